@@ -66,6 +66,7 @@ struct hook {
 };
 
 #define MAX_HOOK_ENTRIES 16
+#define CONN_HASH_SIZE 256
 #define MAX_EXT_ADV_SETS 3
 #define MAX_PENDING_CONN 16
 
@@ -74,6 +75,7 @@ struct btdev_conn {
 	uint8_t  type;
 	struct btdev *dev;
 	struct btdev_conn *link;
+	struct btdev_conn *hash_next;
 	void *data;
 };
 
@@ -136,6 +138,7 @@ struct btdev {
 	uint16_t id;
 
 	struct queue *conns;
+	struct btdev_conn *conn_hash[CONN_HASH_SIZE];
 
 	bool auth_init;
 	uint8_t link_key[16];
@@ -178,6 +181,8 @@ struct btdev {
 	uint8_t  le_features[8];
 	uint8_t  le_states[8];
 	const struct btdev_cmd *cmds;
+	const struct btdev_cmd **cmd_hash;
+	uint8_t  cmd_hash_bits;
 	uint16_t msft_opcode;
 	const struct btdev_cmd *msft_cmds;
 	uint16_t emu_opcode;
@@ -559,6 +564,41 @@ static void conn_unlink(struct btdev_conn *conn1, struct btdev_conn *conn2)
 	conn2->link = NULL;
 }
 
+static struct btdev_conn *conn_find(struct btdev *dev, uint16_t handle)
+{
+	struct btdev_conn *conn;
+
+	conn = dev->conn_hash[handle % CONN_HASH_SIZE];
+	for (; conn; conn = conn->hash_next) {
+		if (conn->handle == handle)
+			return conn;
+	}
+
+	return NULL;
+}
+
+static void conn_hash_add(struct btdev_conn *conn)
+{
+	struct btdev_conn **head;
+
+	head = &conn->dev->conn_hash[conn->handle % CONN_HASH_SIZE];
+	conn->hash_next = *head;
+	*head = conn;
+}
+
+static void conn_hash_del(struct btdev_conn *conn)
+{
+	struct btdev_conn **p;
+
+	p = &conn->dev->conn_hash[conn->handle % CONN_HASH_SIZE];
+	for (; *p; p = &(*p)->hash_next) {
+		if (*p == conn) {
+			*p = conn->hash_next;
+			break;
+		}
+	}
+}
+
 static void conn_remove(void *data)
 {
 	struct btdev_conn *conn = data;
@@ -571,6 +611,7 @@ static void conn_remove(void *data)
 	}
 
 	queue_remove(conn->dev->conns, conn);
+	conn_hash_del(conn);
 
 	free(conn->data);
 	free(conn);
@@ -763,14 +804,6 @@ static void send_event(struct btdev *btdev, uint8_t event,
 		send_packet(btdev, iov, len > 0 ? 3 : 2);
 }
 
-static bool match_handle(const void *data, const void *match_data)
-{
-	const struct btdev_conn *conn = data;
-	uint16_t handle = PTR_TO_UINT(match_data);
-
-	return conn->handle == handle;
-}
-
 static void disconnect_complete(struct btdev *dev, uint16_t handle,
 					uint8_t status, uint8_t reason)
 {
@@ -794,8 +827,7 @@ static int cmd_disconnect_complete(struct btdev *dev, const void *data,
 
 	memset(&rsp, 0, sizeof(rsp));
 
-	conn = queue_remove_if(dev->conns, match_handle,
-				UINT_TO_PTR(cpu_to_le16(cmd->handle)));
+	conn = conn_find(dev, cpu_to_le16(cmd->handle));
 	if (!conn) {
 		disconnect_complete(dev, 0x0000, BT_HCI_ERR_UNKNOWN_CONN_ID,
 								0x00);
@@ -831,8 +863,7 @@ static int cmd_remote_version_complete(struct btdev *dev, const void *data,
 
 	memset(&ev, 0, sizeof(ev));
 
-	conn = queue_find(dev->conns, match_handle,
-				UINT_TO_PTR(cpu_to_le16(cmd->handle)));
+	conn = conn_find(dev, cpu_to_le16(cmd->handle));
 	if (conn) {
 		ev.status = BT_HCI_ERR_SUCCESS;
 		ev.handle = cpu_to_le16(cmd->handle);
@@ -1129,7 +1160,7 @@ static struct btdev_conn *conn_new(struct btdev *dev, uint16_t handle,
 {
 	struct btdev_conn *conn;
 
-	while (queue_find(dev->conns, match_handle, UINT_TO_PTR(handle)))
+	while (conn_find(dev, handle))
 		handle++;
 
 	conn = new0(struct btdev_conn, 1);
@@ -1142,6 +1173,8 @@ static struct btdev_conn *conn_new(struct btdev *dev, uint16_t handle,
 		return NULL;
 	}
 
+	conn_hash_add(conn);
+
 	return conn;
 }
 
@@ -1156,7 +1189,7 @@ static struct btdev_conn *conn_link(struct btdev *dev, struct btdev *remote,
 
 	conn2 = conn_new(remote, handle, type);
 	if (!conn2) {
-		free(conn1);
+		conn_remove(conn1);
 		return NULL;
 	}
 
@@ -1395,8 +1428,7 @@ static int cmd_add_sco_conn(struct btdev *dev, const void *data, uint8_t len)
 
 	memset(&cc, 0, sizeof(cc));
 
-	conn = queue_find(dev->conns, match_handle,
-				UINT_TO_PTR(cpu_to_le16(cmd->handle)));
+	conn = conn_find(dev, cpu_to_le16(cmd->handle));
 	if (!conn) {
 		cc.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
 		goto done;
@@ -1807,8 +1839,7 @@ static int cmd_auth_requested_complete(struct btdev *dev, const void *data,
 	const struct bt_hci_cmd_auth_requested *cmd = data;
 	struct btdev_conn *conn;
 
-	conn = queue_find(dev->conns, match_handle,
-				UINT_TO_PTR(le16_to_cpu(cmd->handle)));
+	conn = conn_find(dev, le16_to_cpu(cmd->handle));
 	if (!conn) {
 		struct bt_hci_evt_auth_complete ev;
 
@@ -1860,8 +1891,7 @@ static int cmd_set_conn_encrypt_complete(struct btdev *dev, const void *data,
 	struct btdev_conn *conn;
 	uint8_t mode;
 
-	conn = queue_find(dev->conns, match_handle,
-				UINT_TO_PTR(le16_to_cpu(cmd->handle)));
+	conn = conn_find(dev, le16_to_cpu(cmd->handle));
 	if (!conn)
 		return 0;
 
@@ -1958,8 +1988,7 @@ static int cmd_read_remote_features_complete(struct btdev *dev,
 	struct bt_hci_evt_remote_features_complete rfc;
 	struct btdev_conn *conn;
 
-	conn = queue_find(dev->conns, match_handle,
-				UINT_TO_PTR(le16_to_cpu(cmd->handle)));
+	conn = conn_find(dev, le16_to_cpu(cmd->handle));
 	if (conn) {
 		rfc.status = BT_HCI_ERR_SUCCESS;
 		rfc.handle = cpu_to_le16(cmd->handle);
@@ -2006,8 +2035,7 @@ static int cmd_read_remote_ext_features_compl(struct btdev *dev,
 
 	memset(&ev, 0, sizeof(ev));
 
-	conn = queue_find(dev->conns, match_handle,
-				UINT_TO_PTR(le16_to_cpu(cmd->handle)));
+	conn = conn_find(dev, le16_to_cpu(cmd->handle));
 	if (conn && cmd->page < 0x02) {
 		ev.handle = cpu_to_le16(cmd->handle);
 		ev.page = cmd->page;
@@ -2058,8 +2086,7 @@ static int cmd_read_clock_offset_complete(struct btdev *dev, const void *data,
 
 	memset(&ev, 0, sizeof(ev));
 
-	conn = queue_find(dev->conns, match_handle,
-				UINT_TO_PTR(le16_to_cpu(cmd->handle)));
+	conn = conn_find(dev, le16_to_cpu(cmd->handle));
 	if (conn) {
 		ev.status = BT_HCI_ERR_SUCCESS;
 		ev.handle = cpu_to_le16(cmd->handle);
@@ -2804,8 +2831,7 @@ static int cmd_enhanced_setup_sync_conn_complete(struct btdev *dev,
 
 	memset(&cc, 0, sizeof(cc));
 
-	conn = queue_find(dev->conns, match_handle,
-				UINT_TO_PTR(le16_to_cpu(cmd->handle)));
+	conn = conn_find(dev, le16_to_cpu(cmd->handle));
 	if (!conn) {
 		cc.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
 		goto done;
@@ -2856,8 +2882,7 @@ static int cmd_setup_sync_conn_complete(struct btdev *dev, const void *data,
 
 	memset(&cc, 0, sizeof(cc));
 
-	conn = queue_find(dev->conns, match_handle,
-				UINT_TO_PTR(le16_to_cpu(cmd->handle)));
+	conn = conn_find(dev, le16_to_cpu(cmd->handle));
 	if (!conn) {
 		cc.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
 		goto done;
@@ -3147,8 +3172,7 @@ static int cmd_read_encrypt_key_size(struct btdev *dev, const void *data,
 
 	rsp.handle = cmd->handle;
 
-	conn = queue_find(dev->conns, match_handle,
-					UINT_TO_PTR(le16_to_cpu(cmd->handle)));
+	conn = conn_find(dev, le16_to_cpu(cmd->handle));
 	if (conn) {
 		rsp.status = BT_HCI_ERR_SUCCESS;
 		rsp.key_size = 16;
@@ -4332,7 +4356,7 @@ static void le_conn_update(struct btdev *btdev, uint16_t handle,
 	ev.latency = cpu_to_le16(latency);
 	ev.supv_timeout = cpu_to_le16(supv_timeout);
 
-	conn = queue_find(btdev->conns, match_handle, UINT_TO_PTR(handle));
+	conn = conn_find(btdev, handle);
 	if (conn)
 		ev.status = BT_HCI_ERR_SUCCESS;
 	else
@@ -4355,7 +4379,7 @@ static void le_conn_param_req(struct btdev *btdev, uint16_t handle,
 	struct bt_hci_evt_le_conn_param_request ev;
 	struct btdev_conn *conn;
 
-	conn = queue_find(btdev->conns, match_handle, UINT_TO_PTR(handle));
+	conn = conn_find(btdev, handle);
 	if (!conn)
 		return;
 
@@ -4404,8 +4428,7 @@ static int cmd_le_read_remote_features(struct btdev *dev, const void *data,
 	struct btdev_conn *conn;
 	uint8_t status = BT_HCI_ERR_SUCCESS;
 
-	conn = queue_find(dev->conns, match_handle,
-				UINT_TO_PTR(le16_to_cpu(cmd->handle)));
+	conn = conn_find(dev, le16_to_cpu(cmd->handle));
 	if (!conn)
 		status = BT_HCI_ERR_UNKNOWN_CONN_ID;
 
@@ -4465,8 +4488,7 @@ static int cmd_start_encrypt(struct btdev *dev, const void *data, uint8_t len)
 	struct bt_hci_evt_le_long_term_key_request ev;
 	struct btdev_conn *conn;
 
-	conn = queue_find(dev->conns, match_handle,
-				UINT_TO_PTR(le16_to_cpu(cmd->handle)));
+	conn = conn_find(dev, le16_to_cpu(cmd->handle));
 	if (!conn) {
 		cmd_status(dev, BT_HCI_ERR_UNKNOWN_CONN_ID,
 				BT_HCI_CMD_LE_START_ENCRYPT);
@@ -4494,8 +4516,7 @@ static int cmd_ltk_reply(struct btdev *dev, const void *data, uint8_t len)
 	struct btdev_conn *conn;
 	uint8_t mode, status;
 
-	conn = queue_find(dev->conns, match_handle,
-				UINT_TO_PTR(le16_to_cpu(cmd->handle)));
+	conn = conn_find(dev, le16_to_cpu(cmd->handle));
 	if (!conn) {
 		rp.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
 		cmd_complete(dev, BT_HCI_CMD_LE_LTK_REQ_REPLY, &rp, sizeof(rp));
@@ -4530,8 +4551,7 @@ static int cmd_ltk_neg_reply(struct btdev *dev, const void *data, uint8_t len)
 	struct bt_hci_rsp_le_ltk_req_neg_reply rp;
 	struct btdev_conn *conn;
 
-	conn = queue_find(dev->conns, match_handle,
-				UINT_TO_PTR(le16_to_cpu(cmd->handle)));
+	conn = conn_find(dev, le16_to_cpu(cmd->handle));
 	if (!conn) {
 		rp.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
 		cmd_complete(dev, BT_HCI_CMD_LE_LTK_REQ_NEG_REPLY, &rp,
@@ -4628,8 +4648,7 @@ static int cmd_conn_param_neg_reply_complete(struct btdev *dev,
 	struct btdev_conn *conn;
 	struct bt_hci_evt_le_conn_update_complete ev;
 
-	conn = queue_find(dev->conns, match_handle,
-				UINT_TO_PTR(le16_to_cpu(cmd->handle)));
+	conn = conn_find(dev, le16_to_cpu(cmd->handle));
 	if (!conn)
 		return 0;
 
@@ -6196,13 +6215,11 @@ static int cmd_create_cis(struct btdev *dev, const void *data, uint8_t len)
 		if (cis_idx >= dev->le_cig[cig_idx].params.num_cis)
 			return -ENOENT;
 
-		acl = queue_find(dev->conns, match_handle,
-				 UINT_TO_PTR(le16_to_cpu(cis->acl_handle)));
+		acl = conn_find(dev, le16_to_cpu(cis->acl_handle));
 		if (!acl)
 			return -ENOENT;
 
-		iso = queue_find(dev->conns, match_handle,
-				 UINT_TO_PTR(le16_to_cpu(cis->cis_handle)));
+		iso = conn_find(dev, le16_to_cpu(cis->cis_handle));
 		if (iso)
 			return -EEXIST;
 	}
@@ -6307,16 +6324,14 @@ static int cmd_create_cis_complete(struct btdev *dev, const void *data,
 		}
 		le_cig = &dev->le_cig[cig_idx];
 
-		acl = queue_find(dev->conns, match_handle,
-				UINT_TO_PTR(le16_to_cpu(cis->acl_handle)));
+		acl = conn_find(dev, le16_to_cpu(cis->acl_handle));
 		if (!acl) {
 			le_cis_estabilished(dev, NULL,
 						BT_HCI_ERR_UNKNOWN_CONN_ID);
 			break;
 		}
 
-		iso = queue_find(dev->conns, match_handle,
-				UINT_TO_PTR(le16_to_cpu(cis->cis_handle)));
+		iso = conn_find(dev, le16_to_cpu(cis->cis_handle));
 		if (!iso) {
 			iso = conn_add_cis(acl, le16_to_cpu(cis->cis_handle));
 			if (!iso) {
@@ -6382,8 +6397,7 @@ static int cmd_accept_cis(struct btdev *dev, const void *data, uint8_t len)
 	const struct bt_hci_cmd_le_accept_cis *cmd = data;
 	struct btdev_conn *conn;
 
-	conn = queue_find(dev->conns, match_handle,
-				UINT_TO_PTR(cpu_to_le16(cmd->handle)));
+	conn = conn_find(dev, cpu_to_le16(cmd->handle));
 	if (!conn) {
 		cmd_status(dev, BT_HCI_ERR_UNKNOWN_CONN_ID,
 					BT_HCI_CMD_LE_ACCEPT_CIS);
@@ -6401,8 +6415,7 @@ static int cmd_reject_cis(struct btdev *dev, const void *data, uint8_t len)
 	const struct bt_hci_cmd_le_reject_cis *cmd = data;
 	struct btdev_conn *conn;
 
-	conn = queue_find(dev->conns, match_handle,
-				UINT_TO_PTR(cpu_to_le16(cmd->handle)));
+	conn = conn_find(dev, cpu_to_le16(cmd->handle));
 	if (!conn) {
 		cmd_status(dev, BT_HCI_ERR_UNKNOWN_CONN_ID,
 					BT_HCI_CMD_LE_REJECT_CIS);
@@ -6692,8 +6705,7 @@ static int cmd_setup_iso_path(struct btdev *dev, const void *data, uint8_t len)
 
 	memset(&rsp, 0, sizeof(rsp));
 
-	conn = queue_find(dev->conns, match_handle,
-				UINT_TO_PTR(cpu_to_le16(cmd->handle)));
+	conn = conn_find(dev, cpu_to_le16(cmd->handle));
 	if (!conn) {
 		rsp.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
 		goto done;
@@ -6734,8 +6746,7 @@ static int cmd_remove_iso_path(struct btdev *dev, const void *data, uint8_t len)
 
 	rsp.handle = cmd->handle;
 
-	conn = queue_find(dev->conns, match_handle,
-				UINT_TO_PTR(cpu_to_le16(cmd->handle)));
+	conn = conn_find(dev, cpu_to_le16(cmd->handle));
 	if (!conn) {
 		rsp.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
 		goto done;
@@ -7293,6 +7304,56 @@ static void set_amp_features(struct btdev *btdev)
 {
 }
 
+static unsigned int cmd_hash(uint16_t opcode, uint8_t bits)
+{
+	return (opcode * 0x9e3779b1U) >> (32 - bits);
+}
+
+static const struct btdev_cmd *find_cmd(struct btdev *btdev, uint16_t opcode)
+{
+	unsigned int mask = (1U << btdev->cmd_hash_bits) - 1;
+	unsigned int i = cmd_hash(opcode, btdev->cmd_hash_bits);
+
+	for (; btdev->cmd_hash[i]; i = (i + 1) & mask) {
+		if (btdev->cmd_hash[i]->opcode == opcode)
+			return btdev->cmd_hash[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Index the command table of the controller by opcode, keeping the first
+ * entry of an opcode listed twice just like a linear scan of it would.
+ */
+static void index_cmds(struct btdev *btdev)
+{
+	const struct btdev_cmd *cmd;
+	unsigned int count = 0, mask;
+
+	for (cmd = btdev->cmds; cmd && cmd->func; cmd++)
+		count++;
+
+	/* Keep the table at most half full */
+	btdev->cmd_hash_bits = 4;
+	while ((1U << btdev->cmd_hash_bits) < count * 2)
+		btdev->cmd_hash_bits++;
+
+	mask = (1U << btdev->cmd_hash_bits) - 1;
+	btdev->cmd_hash = new0(const struct btdev_cmd *, mask + 1);
+
+	for (cmd = btdev->cmds; cmd && cmd->func; cmd++) {
+		unsigned int i = cmd_hash(cmd->opcode, btdev->cmd_hash_bits);
+
+		while (btdev->cmd_hash[i] &&
+				btdev->cmd_hash[i]->opcode != cmd->opcode)
+			i = (i + 1) & mask;
+
+		if (!btdev->cmd_hash[i])
+			btdev->cmd_hash[i] = cmd;
+	}
+}
+
 struct btdev *btdev_create(enum btdev_type type, uint16_t id)
 {
 	struct btdev *btdev;
@@ -7352,6 +7413,8 @@ struct btdev *btdev_create(enum btdev_type type, uint16_t id)
 		break;
 	}
 
+	index_cmds(btdev);
+
 	btdev->page_scan_interval = 0x0800;
 	btdev->page_scan_window = 0x0012;
 	btdev->page_scan_type = 0x00;
@@ -7377,6 +7440,7 @@ struct btdev *btdev_create(enum btdev_type type, uint16_t id)
 	index = add_btdev(btdev);
 	if (index < 0) {
 		bt_crypto_unref(btdev->crypto);
+		free(btdev->cmd_hash);
 		free(btdev);
 		return NULL;
 	}
@@ -7409,6 +7473,7 @@ void btdev_destroy(struct btdev *btdev)
 	queue_destroy(btdev->le_per_adv, free);
 	queue_destroy(btdev->le_big, le_big_free);
 
+	free(btdev->cmd_hash);
 	free(btdev);
 }
 
@@ -7592,12 +7657,9 @@ static const struct btdev_cmd *default_cmd(struct btdev *btdev, uint16_t opcode,
 	if (btdev->msft_opcode == opcode)
 		return vnd_cmd(btdev, opcode, btdev->msft_cmds, data, len);
 
-	for (cmd = btdev->cmds; cmd->func; cmd++) {
-		if (cmd->opcode != opcode)
-			continue;
-
+	cmd = find_cmd(btdev, opcode);
+	if (cmd)
 		return run_cmd(btdev, cmd, data, len);
-	}
 
 	util_debug(btdev->debug_callback, btdev->debug_data,
 			"Unsupported command 0x%4.4x", opcode);
@@ -7714,8 +7776,7 @@ static void send_acl(struct btdev *dev, const void *data, uint16_t len)
 
 	memcpy(&hdr, data, sizeof(hdr));
 
-	conn = queue_find(dev->conns, match_handle,
-					UINT_TO_PTR(acl_handle(hdr.handle)));
+	conn = conn_find(dev, acl_handle(hdr.handle));
 	if (!conn)
 		return;
 
@@ -7750,8 +7811,7 @@ static void send_sco(struct btdev *dev, const void *data, uint16_t len)
 	iov[1].iov_base = hdr = (void *) (data);
 	iov[1].iov_len = len;
 
-	conn = queue_find(dev->conns, match_handle,
-					UINT_TO_PTR(acl_handle(hdr->handle)));
+	conn = conn_find(dev, acl_handle(hdr->handle));
 	if (!conn)
 		return;
 
@@ -7776,8 +7836,7 @@ static void send_iso(struct btdev *dev, const void *data, uint16_t len)
 	iov[1].iov_base = hdr = (void *) (data);
 	iov[1].iov_len = len;
 
-	conn = queue_find(dev->conns, match_handle,
-					UINT_TO_PTR(acl_handle(hdr->handle)));
+	conn = conn_find(dev, acl_handle(hdr->handle));
 	if (!conn)
 		return;
 
@@ -7906,8 +7965,7 @@ static int cmd_msft_monitor_rssi(struct btdev *dev, const void *data,
 	rsp.status = BT_HCI_ERR_SUCCESS;
 	rsp.subcmd = MSFT_SUBCMD_MONITOR_RSSI;
 
-	conn = queue_find(dev->conns, match_handle,
-				UINT_TO_PTR(le16_to_cpu(cmd->handle)));
+	conn = conn_find(dev, le16_to_cpu(cmd->handle));
 	if (!conn)
 		rsp.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
 
@@ -7927,8 +7985,7 @@ static int cmd_msft_cancel_monitor_rssi(struct btdev *dev, const void *data,
 	rsp.status = BT_HCI_ERR_SUCCESS;
 	rsp.subcmd = MSFT_SUBCMD_CANCEL_MONITOR_RSSI;
 
-	conn = queue_find(dev->conns, match_handle,
-				UINT_TO_PTR(le16_to_cpu(cmd->handle)));
+	conn = conn_find(dev, le16_to_cpu(cmd->handle));
 	if (!conn)
 		rsp.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
 
@@ -27,6 +27,7 @@
 #include "btdev.h"
 #include "vhci.h"
 #include "le.h"
+#include "stress.h"
 
 static void signal_callback(int signum, void *user_data)
 {
@@ -54,6 +55,7 @@ static void usage(void)
 		"\t-B                    Create BR/EDR only controller\n"
 		"\t-A                    Create AMP controller\n"
 		"\t-T[num]               Number of test AMP controllers\n"
+		"\t-P[num]               Stress test with num connections\n"
 		"\t-h, --help            Show help options\n");
 }
 
@@ -67,6 +69,7 @@ static const struct option main_options[] = {
 	{ "bredr",   no_argument,       NULL, 'B' },
 	{ "amp",     no_argument,       NULL, 'A' },
 	{ "letest",  optional_argument, NULL, 'U' },
+	{ "stress",  optional_argument, NULL, 'P' },
 	{ "version", no_argument,	NULL, 'v' },
 	{ "help",    no_argument,	NULL, 'h' },
 	{ }
@@ -92,6 +95,7 @@ int main(int argc, char *argv[])
 	bool serial_enabled = false;
 	int letest_count = 0;
 	int vhci_count = 0;
+	int stress_count = 0;
 	enum btdev_type type = BTDEV_TYPE_BREDRLE52;
 	int i;
 
@@ -100,7 +104,7 @@ int main(int argc, char *argv[])
 	for (;;) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "dSst::l::LBAU::T::vh",
+		opt = getopt_long(argc, argv, "dSst::l::LBAU::T::P::vh",
 						main_options, NULL);
 		if (opt < 0)
 			break;
@@ -142,6 +146,12 @@ int main(int argc, char *argv[])
 			else
 				letest_count = 1;
 			break;
+		case 'P':
+			if (optarg)
+				stress_count = atoi(optarg);
+			else
+				stress_count = 256;
+			break;
 		case 'v':
 			printf("%s\n", VERSION);
 			return EXIT_SUCCESS;
@@ -153,6 +163,13 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (stress_count > 0) {
+		if (!stress_run(stress_count, debug_enabled))
+			return EXIT_FAILURE;
+
+		return EXIT_SUCCESS;
+	}
+
 	if (letest_count < 1 && vhci_count < 1 && !server_enabled &&
 						!tcp_port && !serial_enabled) {
 		fprintf(stderr, "No emulator specified\n");
@@ -0,0 +1,261 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#include "lib/bluetooth.h"
+#include "lib/hci.h"
+
+#include "src/shared/util.h"
+#include "monitor/bt.h"
+#include "btdev.h"
+#include "stress.h"
+
+#define STRESS_ROUNDS		100
+#define STRESS_CMDS		100000
+#define STRESS_ACL_LEN		27
+
+/* Spread over the command table rather than hitting its first entries */
+static const uint16_t stress_cmds[] = {
+	BT_HCI_CMD_READ_LOCAL_VERSION,
+	BT_HCI_CMD_READ_BD_ADDR,
+	BT_HCI_CMD_LE_READ_BUFFER_SIZE,
+	BT_HCI_CMD_LE_READ_LOCAL_FEATURES,
+	BT_HCI_CMD_LE_READ_ACCEPT_LIST_SIZE,
+};
+
+struct stress {
+	struct btdev *central;
+	struct btdev *peripheral;
+	uint16_t *handles;
+	unsigned int num_handles;
+	unsigned int max_handles;
+	unsigned int conn_failed;
+	unsigned long cmd_complete;
+	unsigned long acl_completed;
+	unsigned long acl_received;
+};
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) +
+				(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void central_event(struct stress *stress, const uint8_t *data,
+								uint16_t len)
+{
+	const struct bt_hci_evt_hdr *hdr = (const void *) data;
+	const struct bt_hci_evt_le_conn_complete *cc;
+
+	if (len < sizeof(*hdr))
+		return;
+
+	data += sizeof(*hdr);
+	len -= sizeof(*hdr);
+
+	switch (hdr->evt) {
+	case BT_HCI_EVT_CMD_COMPLETE:
+		stress->cmd_complete++;
+		break;
+	case BT_HCI_EVT_NUM_COMPLETED_PACKETS:
+		stress->acl_completed++;
+		break;
+	case BT_HCI_EVT_LE_META_EVENT:
+		if (len < 1 + sizeof(*cc) ||
+				data[0] != BT_HCI_EVT_LE_CONN_COMPLETE)
+			break;
+
+		cc = (const void *) (data + 1);
+		if (cc->status) {
+			stress->conn_failed++;
+			break;
+		}
+
+		/* Ignore connections that were not requested */
+		if (stress->num_handles >= stress->max_handles)
+			break;
+
+		stress->handles[stress->num_handles++] =
+						le16_to_cpu(cc->handle);
+		break;
+	}
+}
+
+static void central_send(const struct iovec *iov, int iovlen,
+							void *user_data)
+{
+	struct stress *stress = user_data;
+	uint8_t pkt[1 + sizeof(struct bt_hci_evt_hdr) + 255];
+	uint16_t len = 0;
+	int i;
+
+	for (i = 0; i < iovlen; i++) {
+		if (len + iov[i].iov_len > sizeof(pkt))
+			return;
+
+		memcpy(pkt + len, iov[i].iov_base, iov[i].iov_len);
+		len += iov[i].iov_len;
+	}
+
+	if (len > 0 && pkt[0] == BT_H4_EVT_PKT)
+		central_event(stress, pkt + 1, len - 1);
+}
+
+static void peripheral_send(const struct iovec *iov, int iovlen,
+							void *user_data)
+{
+	struct stress *stress = user_data;
+
+	if (iovlen > 0 && *(uint8_t *) iov[0].iov_base == BT_H4_ACL_PKT)
+		stress->acl_received++;
+}
+
+static void send_cmd(struct btdev *btdev, uint16_t opcode, const void *data,
+								uint8_t len)
+{
+	uint8_t pkt[1 + sizeof(struct bt_hci_cmd_hdr) + 255];
+	struct bt_hci_cmd_hdr *hdr = (void *) (pkt + 1);
+
+	pkt[0] = BT_H4_CMD_PKT;
+	hdr->opcode = cpu_to_le16(opcode);
+	hdr->plen = len;
+
+	if (len)
+		memcpy(pkt + 1 + sizeof(*hdr), data, len);
+
+	btdev_receive_h4(btdev, pkt, 1 + sizeof(*hdr) + len);
+}
+
+static void send_acl(struct btdev *btdev, uint16_t handle)
+{
+	uint8_t pkt[1 + sizeof(struct bt_hci_acl_hdr) + STRESS_ACL_LEN];
+	struct bt_hci_acl_hdr *hdr = (void *) (pkt + 1);
+
+	memset(pkt, 0, sizeof(pkt));
+	pkt[0] = BT_H4_ACL_PKT;
+	hdr->handle = cpu_to_le16(acl_handle_pack(handle, 0x02));
+	hdr->dlen = cpu_to_le16(STRESS_ACL_LEN);
+
+	btdev_receive_h4(btdev, pkt, sizeof(pkt));
+}
+
+static void connect_all(struct stress *stress, unsigned int num_conns)
+{
+	struct bt_hci_cmd_le_create_conn cc;
+	uint8_t enable = 0x01;
+	unsigned int i;
+
+	memset(&cc, 0, sizeof(cc));
+	cc.scan_interval = cpu_to_le16(0x0060);
+	cc.scan_window = cpu_to_le16(0x0030);
+	cc.peer_addr_type = 0x00;
+	memcpy(cc.peer_addr, btdev_get_bdaddr(stress->peripheral), 6);
+	cc.own_addr_type = 0x00;
+	cc.min_interval = cpu_to_le16(0x0018);
+	cc.max_interval = cpu_to_le16(0x0028);
+	cc.supv_timeout = cpu_to_le16(0x002a);
+
+	/* Advertising stops on every connection so restart it each time */
+	for (i = 0; i < num_conns; i++) {
+		send_cmd(stress->peripheral, BT_HCI_CMD_LE_SET_ADV_ENABLE,
+						&enable, sizeof(enable));
+		send_cmd(stress->central, BT_HCI_CMD_LE_CREATE_CONN,
+							&cc, sizeof(cc));
+	}
+}
+
+bool stress_run(unsigned int num_conns, bool debug)
+{
+	struct stress stress;
+	struct timespec start;
+	unsigned long packets;
+	unsigned int i, j;
+	double secs;
+	bool ret = false;
+
+	memset(&stress, 0, sizeof(stress));
+	stress.handles = new0(uint16_t, num_conns);
+	stress.max_handles = num_conns;
+
+	stress.central = btdev_create(BTDEV_TYPE_BREDRLE52, 0x0001);
+	stress.peripheral = btdev_create(BTDEV_TYPE_BREDRLE52, 0x0002);
+	if (!stress.central || !stress.peripheral) {
+		fprintf(stderr, "Failed to create controllers\n");
+		goto done;
+	}
+
+	btdev_set_send_handler(stress.central, central_send, &stress);
+	btdev_set_send_handler(stress.peripheral, peripheral_send, &stress);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	connect_all(&stress, num_conns);
+	secs = elapsed(&start);
+
+	printf("Connections: %u established, %u failed in %.3f s\n",
+				stress.num_handles, stress.conn_failed, secs);
+
+	if (stress.num_handles < num_conns)
+		goto done;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < STRESS_CMDS; i++)
+		send_cmd(stress.central,
+				stress_cmds[i % ARRAY_SIZE(stress_cmds)],
+				NULL, 0);
+
+	secs = elapsed(&start);
+
+	printf("Commands: %u in %.3f s, %.0f commands/s\n", STRESS_CMDS,
+						secs, STRESS_CMDS / secs);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < STRESS_ROUNDS; i++) {
+		for (j = 0; j < stress.num_handles; j++)
+			send_acl(stress.central, stress.handles[j]);
+	}
+
+	secs = elapsed(&start);
+	packets = (unsigned long) STRESS_ROUNDS * stress.num_handles;
+
+	printf("ACL: %lu packets over %u connections in %.3f s, "
+			"%.0f packets/s\n", packets, stress.num_handles,
+			secs, packets / secs);
+
+	if (debug)
+		printf("Events: %lu command complete, %lu completed packets, "
+				"%lu ACL delivered\n", stress.cmd_complete,
+				stress.acl_completed, stress.acl_received);
+
+	ret = stress.cmd_complete == STRESS_CMDS &&
+				stress.acl_received == packets &&
+				stress.acl_completed == packets;
+
+done:
+	btdev_destroy(stress.central);
+	btdev_destroy(stress.peripheral);
+	free(stress.handles);
+
+	return ret;
+}
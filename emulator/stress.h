@@ -0,0 +1,13 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ */
+
+#include <stdbool.h>
+
+bool stress_run(unsigned int num_conns, bool debug);
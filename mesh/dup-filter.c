@@ -0,0 +1,281 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <ell/ell.h>
+
+#include "src/shared/ad.h"
+
+#include "mesh/dup-filter.h"
+
+/*
+ * Duplicate advertisement filter shared by the mesh-io backends.
+ *
+ * Entries live in a fixed array, chained into a hash table and kept on
+ * a least recently used list. Advertisements are keyed by the sender
+ * address, except PB-ADV packets we sent ourselves, which are keyed by
+ * their leading octets with an all zero address so that the looped
+ * back copy can be recognized whoever relays it. Entries older than
+ * DUP_FILTER_TIME are aged out from the tail of the LRU list and, when
+ * the table is full, the least recently used entry is recycled.
+ */
+
+#define DUP_NONE	0xffff
+
+struct dup_entry {
+	uint64_t data;
+	uint32_t instant;
+	uint16_t hash_next;
+	uint16_t prev;
+	uint16_t next;
+	uint8_t addr[6];
+};
+
+struct dup_filter {
+	struct dup_entry *entries;
+	uint16_t *buckets;
+	uint32_t mask;
+	uint16_t used;
+	uint16_t head;
+	uint16_t tail;
+	uint16_t free;
+	uint32_t checked;
+	uint32_t dropped;
+	uint32_t evicted;
+};
+
+static const uint8_t zero_addr[] = {0, 0, 0, 0, 0, 0};
+
+static uint32_t entry_hash(const struct dup_filter *filter,
+					const uint8_t *addr, uint64_t data)
+{
+	uint32_t hash = 2166136261u;
+	int i;
+
+	for (i = 0; i < 6; i++)
+		hash = (hash ^ addr[i]) * 16777619u;
+
+	if (addr == zero_addr) {
+		for (i = 0; i < 8; i++, data >>= 8)
+			hash = (hash ^ (data & 0xff)) * 16777619u;
+	}
+
+	return hash & filter->mask;
+}
+
+static uint16_t entry_find(struct dup_filter *filter, const uint8_t *addr,
+						uint64_t data, uint32_t hash)
+{
+	uint16_t idx = filter->buckets[hash];
+
+	while (idx != DUP_NONE) {
+		struct dup_entry *entry = &filter->entries[idx];
+
+		if (!memcmp(entry->addr, addr, 6) &&
+				(addr != zero_addr || entry->data == data))
+			return idx;
+
+		idx = entry->hash_next;
+	}
+
+	return DUP_NONE;
+}
+
+static void lru_unlink(struct dup_filter *filter, uint16_t idx)
+{
+	struct dup_entry *entry = &filter->entries[idx];
+
+	if (entry->prev != DUP_NONE)
+		filter->entries[entry->prev].next = entry->next;
+	else
+		filter->head = entry->next;
+
+	if (entry->next != DUP_NONE)
+		filter->entries[entry->next].prev = entry->prev;
+	else
+		filter->tail = entry->prev;
+}
+
+static void lru_push_head(struct dup_filter *filter, uint16_t idx)
+{
+	struct dup_entry *entry = &filter->entries[idx];
+
+	entry->prev = DUP_NONE;
+	entry->next = filter->head;
+
+	if (filter->head != DUP_NONE)
+		filter->entries[filter->head].prev = idx;
+	else
+		filter->tail = idx;
+
+	filter->head = idx;
+}
+
+static void entry_remove(struct dup_filter *filter, uint16_t idx)
+{
+	struct dup_entry *entry = &filter->entries[idx];
+	const uint8_t *addr = entry->addr;
+	uint16_t *link;
+
+	if (!memcmp(addr, zero_addr, 6))
+		addr = zero_addr;
+
+	link = &filter->buckets[entry_hash(filter, addr, entry->data)];
+
+	while (*link != idx)
+		link = &filter->entries[*link].hash_next;
+
+	*link = entry->hash_next;
+
+	lru_unlink(filter, idx);
+
+	entry->hash_next = filter->free;
+	filter->free = idx;
+	filter->used--;
+}
+
+static void filter_expire(struct dup_filter *filter, uint32_t instant)
+{
+	while (filter->tail != DUP_NONE) {
+		struct dup_entry *entry = &filter->entries[filter->tail];
+
+		if (instant - entry->instant < DUP_FILTER_TIME)
+			break;
+
+		entry_remove(filter, filter->tail);
+	}
+}
+
+struct dup_filter *dup_filter_new(unsigned int size)
+{
+	struct dup_filter *filter;
+	unsigned int i, buckets = 1;
+
+	if (!size || size >= DUP_NONE)
+		return NULL;
+
+	while (buckets < size * 2)
+		buckets <<= 1;
+
+	filter = l_new(struct dup_filter, 1);
+	filter->entries = l_new(struct dup_entry, size);
+	filter->buckets = l_new(uint16_t, buckets);
+	filter->mask = buckets - 1;
+	filter->head = DUP_NONE;
+	filter->tail = DUP_NONE;
+
+	for (i = 0; i < buckets; i++)
+		filter->buckets[i] = DUP_NONE;
+
+	for (i = 0; i < size; i++)
+		filter->entries[i].hash_next = i + 1 < size ? i + 1 : DUP_NONE;
+
+	filter->free = 0;
+
+	return filter;
+}
+
+void dup_filter_free(struct dup_filter *filter)
+{
+	if (!filter)
+		return;
+
+	l_debug("Dup filter: %u checked, %u dropped (%u%%), %u evicted, "
+				"%u in use", filter->checked, filter->dropped,
+				filter->checked ? (unsigned int)
+				((uint64_t) filter->dropped * 100 /
+				filter->checked) : 0, filter->evicted,
+				filter->used);
+
+	l_free(filter->buckets);
+	l_free(filter->entries);
+	l_free(filter);
+}
+
+/*
+ * Ignore consecutive duplicate advertisements within DUP_FILTER_TIME.
+ * A NULL addr records an advertisement we are sending.
+ */
+bool dup_filter_check(struct dup_filter *filter, const uint8_t *addr,
+				const uint8_t *adv, uint16_t len,
+				uint32_t instant)
+{
+	struct dup_entry *entry;
+	uint8_t head[8] = { 0 };
+	uint64_t data;
+	uint32_t hash;
+	uint16_t idx;
+
+	if (!filter || len < 2)
+		return false;
+
+	memcpy(head, adv, len < sizeof(head) ? len : sizeof(head));
+	data = l_get_be64(head);
+
+	if (!addr || !memcmp(addr, zero_addr, 6))
+		addr = zero_addr;
+
+	filter_expire(filter, instant);
+	filter->checked++;
+
+	if (adv[1] == BT_AD_MESH_PROV) {
+		hash = entry_hash(filter, zero_addr, data);
+		idx = entry_find(filter, zero_addr, data, hash);
+
+		if (idx == DUP_NONE && addr != zero_addr)
+			return false;
+
+		addr = zero_addr;
+	} else {
+		hash = entry_hash(filter, addr, data);
+		idx = entry_find(filter, addr, data, hash);
+	}
+
+	if (idx == DUP_NONE) {
+		if (filter->free == DUP_NONE) {
+			entry_remove(filter, filter->tail);
+			filter->evicted++;
+		}
+
+		idx = filter->free;
+		entry = &filter->entries[idx];
+		filter->free = entry->hash_next;
+		filter->used++;
+
+		memcpy(entry->addr, addr, 6);
+		entry->data = data;
+		entry->instant = instant;
+		entry->hash_next = filter->buckets[hash];
+		filter->buckets[hash] = idx;
+		lru_push_head(filter, idx);
+
+		return false;
+	}
+
+	entry = &filter->entries[idx];
+	lru_unlink(filter, idx);
+	lru_push_head(filter, idx);
+
+	if (instant - entry->instant >= DUP_FILTER_TIME ||
+							data != entry->data) {
+		entry->instant = instant;
+		entry->data = data;
+		return false;
+	}
+
+	filter->dropped++;
+
+	return true;
+}
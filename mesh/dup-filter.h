@@ -0,0 +1,20 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ */
+
+#define DUP_FILTER_TIME		1000
+#define DUP_FILTER_SIZE		512
+
+struct dup_filter;
+
+struct dup_filter *dup_filter_new(unsigned int size);
+void dup_filter_free(struct dup_filter *filter);
+bool dup_filter_check(struct dup_filter *filter, const uint8_t *addr,
+				const uint8_t *adv, uint16_t len,
+				uint32_t instant);
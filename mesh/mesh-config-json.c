@@ -38,6 +38,9 @@
 #define MIN_SEQ_CACHE_VALUE	(2 * 32)
 #define MIN_SEQ_CACHE_TIME	(5 * 60)
 
+/* Changes made within this many ms of each other are written together */
+#define SAVE_DELAY_MS		50
+
 #define CHECK_KEY_IDX_RANGE(x) ((x) <= 4095)
 
 struct mesh_config {
@@ -46,7 +49,11 @@ struct mesh_config {
 	uint8_t uuid[16];
 	uint32_t write_seq;
 	struct timeval write_time;
-	struct l_queue *idles;
+	struct l_timeout *save_timeout;
+	struct l_queue *save_cbs;
+	unsigned int updates;
+	bool dirty;
+	bool write_failed;
 };
 
 struct write_info {
@@ -86,30 +93,157 @@ static const char *disabled = "disabled";
 static const char *unsupported = "unsupported";
 
 
-static bool save_config(json_object *jnode, const char *fname)
+static bool sync_dir(const char *fname)
 {
-	FILE *outfile;
+	char *dir = l_strdup(fname);
+	bool result = false;
+	int fd;
+
+	fd = open(dirname(dir), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd >= 0) {
+		result = fsync(fd) == 0;
+		close(fd);
+	}
+
+	l_free(dir);
+
+	return result;
+}
+
+static bool write_config(struct mesh_config *cfg)
+{
+	char *fname_tmp, *fname_bak, *fname_cfg;
 	const char *str;
+	size_t len, off = 0;
 	bool result = false;
+	int fd;
 
-	outfile = fopen(fname, "w");
-	if (!outfile) {
-		l_error("Failed to save configuration to %s", fname);
-		return false;
+	fname_cfg = cfg->node_dir_path;
+	fname_tmp = l_strdup_printf("%s%s", fname_cfg, tmp_ext);
+	fname_bak = l_strdup_printf("%s%s", fname_cfg, bak_ext);
+
+	fd = open(fname_tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		l_error("Failed to save configuration to %s", fname_tmp);
+		goto done;
 	}
 
-	str = json_object_to_json_string_ext(jnode, JSON_C_TO_STRING_PRETTY);
+	str = json_object_to_json_string_ext(cfg->jnode,
+						JSON_C_TO_STRING_PLAIN);
+	len = strlen(str);
+
+	while (off < len) {
+		ssize_t written = write(fd, str + off, len - off);
+
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		off += written;
+	}
 
-	if (fwrite(str, sizeof(char), strlen(str), outfile) < strlen(str))
+	if (off < len || fsync(fd) < 0) {
 		l_warn("Incomplete write of mesh configuration");
-	else
-		result = true;
+		close(fd);
+		remove(fname_tmp);
+		goto done;
+	}
+
+	close(fd);
+
+	/*
+	 * Keep the previous version as backup and atomically replace the
+	 * configuration, so that either one of them is always complete.
+	 */
+	remove(fname_bak);
+	if (link(fname_cfg, fname_bak) < 0 && errno != ENOENT)
+		l_warn("Failed to back up mesh configuration");
+
+	if (rename(fname_tmp, fname_cfg) < 0) {
+		l_error("Failed to replace configuration %s", fname_cfg);
+		remove(fname_tmp);
+		goto done;
+	}
 
-	fclose(outfile);
+	/* Make the rename itself survive a crash */
+	if (!sync_dir(fname_cfg)) {
+		l_error("Failed to sync directory of %s", fname_cfg);
+		goto done;
+	}
+
+	l_debug("Saved %s: %zu bytes, %u updates", fname_cfg, len,
+								cfg->updates);
+	result = true;
+
+done:
+	l_free(fname_tmp);
+	l_free(fname_bak);
 
 	return result;
 }
 
+static bool flush_config(struct mesh_config *cfg)
+{
+	struct write_info *info;
+	bool result = true;
+
+	if (cfg->save_timeout) {
+		l_timeout_remove(cfg->save_timeout);
+		cfg->save_timeout = NULL;
+	}
+
+	if (cfg->dirty) {
+		result = write_config(cfg);
+		gettimeofday(&cfg->write_time, NULL);
+
+		/* Retry with the next change if the write failed */
+		cfg->dirty = !result;
+		cfg->write_failed = !result;
+		if (result)
+			cfg->updates = 0;
+	}
+
+	while ((info = l_queue_pop_head(cfg->save_cbs))) {
+		info->cb(info->user_data, result);
+		l_free(info);
+	}
+
+	return result;
+}
+
+static void save_config_timeout(struct l_timeout *timeout, void *user_data)
+{
+	flush_config(user_data);
+}
+
+/*
+ * Mark the configuration as modified. Changes made within SAVE_DELAY_MS
+ * of the first one are written out together from a single timeout, whose
+ * result only reaches mesh_config_save() callbacks. Once a write has
+ * failed, changes are written out right away until storage recovers, so
+ * that callers see the failure.
+ */
+static bool save_config(struct mesh_config *cfg)
+{
+	cfg->dirty = true;
+	cfg->updates++;
+
+	if (cfg->write_failed)
+		return flush_config(cfg);
+
+	if (cfg->save_timeout)
+		return true;
+
+	cfg->save_timeout = l_timeout_create_ms(SAVE_DELAY_MS,
+						save_config_timeout, cfg, NULL);
+	if (!cfg->save_timeout)
+		return flush_config(cfg);
+
+	return true;
+}
+
 static bool get_int(json_object *jobj, const char *keyword, int *value)
 {
 	json_object *jvalue;
@@ -674,7 +808,7 @@ bool mesh_config_net_key_add(struct mesh_config *cfg, uint16_t idx,
 
 	json_object_array_add(jarray, jentry);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return save_config(cfg);
 
 fail:
 	if (jentry)
@@ -716,7 +850,7 @@ bool mesh_config_net_key_update(struct mesh_config *cfg, uint16_t idx,
 	json_object_object_add(jentry, keyRefresh,
 				json_object_new_int(KEY_REFRESH_PHASE_ONE));
 
-	return save_config(jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_net_key_del(struct mesh_config *cfg, uint16_t idx)
@@ -736,7 +870,7 @@ bool mesh_config_net_key_del(struct mesh_config *cfg, uint16_t idx)
 	if (!json_object_array_length(jarray))
 		json_object_object_del(jnode, netKeys);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_write_device_key(struct mesh_config *cfg, const uint8_t *key)
@@ -744,7 +878,7 @@ bool mesh_config_write_device_key(struct mesh_config *cfg, const uint8_t *key)
 	if (!cfg || !add_key_value(cfg->jnode, deviceKey, key))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_write_candidate(struct mesh_config *cfg, const uint8_t *key)
@@ -752,7 +886,7 @@ bool mesh_config_write_candidate(struct mesh_config *cfg, const uint8_t *key)
 	if (!cfg || !add_key_value(cfg->jnode, deviceCan, key))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_read_candidate(struct mesh_config *cfg, uint8_t *key)
@@ -779,7 +913,7 @@ bool mesh_config_finalize_candidate(struct mesh_config *cfg)
 	if (!add_key_value(cfg->jnode, deviceKey, key))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_write_token(struct mesh_config *cfg, const uint8_t *token)
@@ -787,7 +921,7 @@ bool mesh_config_write_token(struct mesh_config *cfg, const uint8_t *token)
 	if (!cfg || !add_u64_value(cfg->jnode, "token", token))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_app_key_add(struct mesh_config *cfg, uint16_t net_idx,
@@ -830,7 +964,7 @@ bool mesh_config_app_key_add(struct mesh_config *cfg, uint16_t net_idx,
 
 	json_object_array_add(jarray, jentry);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return save_config(cfg);
 
 fail:
 
@@ -872,7 +1006,7 @@ bool mesh_config_app_key_update(struct mesh_config *cfg, uint16_t app_idx,
 	if (!add_key_value(jentry, "key", key))
 		return false;
 
-	return save_config(jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_app_key_del(struct mesh_config *cfg, uint16_t net_idx,
@@ -893,7 +1027,7 @@ bool mesh_config_app_key_del(struct mesh_config *cfg, uint16_t net_idx,
 	if (!json_object_array_length(jarray))
 		json_object_object_del(jnode, appKeys);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_model_binding_add(struct mesh_config *cfg, uint16_t ele_addr,
@@ -940,7 +1074,7 @@ bool mesh_config_model_binding_add(struct mesh_config *cfg, uint16_t ele_addr,
 
 	json_object_array_add(jarray, jstring);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_model_binding_del(struct mesh_config *cfg, uint16_t ele_addr,
@@ -976,7 +1110,7 @@ bool mesh_config_model_binding_del(struct mesh_config *cfg, uint16_t ele_addr,
 	if (!json_object_array_length(jarray))
 		json_object_object_del(jmodel, bind);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 static void free_model(void *data)
@@ -1587,7 +1721,7 @@ bool mesh_config_write_mode(struct mesh_config *cfg, const char *keyword,
 	if (!cfg || !write_mode(cfg->jnode, keyword, value))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_write_mode_ex(struct mesh_config *cfg, const char *keyword,
@@ -1635,7 +1769,7 @@ bool mesh_config_write_unicast(struct mesh_config *cfg, uint16_t unicast)
 	if (!cfg || !write_uint16_hex(cfg->jnode, unicastAddress, unicast))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_write_relay_mode(struct mesh_config *cfg, uint8_t mode,
@@ -1645,7 +1779,7 @@ bool mesh_config_write_relay_mode(struct mesh_config *cfg, uint8_t mode,
 	if (!cfg || !write_relay_mode(cfg->jnode, mode, count, interval))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_write_mpb(struct mesh_config *cfg, uint8_t mode,
@@ -1660,7 +1794,7 @@ bool mesh_config_write_mpb(struct mesh_config *cfg, uint8_t mode,
 			return false;
 	}
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_write_net_transmit(struct mesh_config *cfg, uint8_t cnt,
@@ -1686,7 +1820,7 @@ bool mesh_config_write_net_transmit(struct mesh_config *cfg, uint8_t cnt,
 	json_object_object_del(jnode, retransmit);
 	json_object_object_add(jnode, retransmit, jrtx);
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return save_config(cfg);
 
 fail:
 	json_object_put(jrtx);
@@ -1711,7 +1845,7 @@ bool mesh_config_write_iv_index(struct mesh_config *cfg, uint32_t idx,
 	if (!write_int(jnode, "IVupdate", tmp))
 		return false;
 
-	return save_config(jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 static void add_model(void *a, void *b)
@@ -1847,7 +1981,7 @@ static struct mesh_config *create_config(const char *cfg_path,
 	memcpy(cfg->uuid, uuid, 16);
 	cfg->node_dir_path = l_strdup(cfg_path);
 	cfg->write_seq = node->seq_number;
-	cfg->idles = l_queue_new();
+	cfg->save_cbs = l_queue_new();
 	gettimeofday(&cfg->write_time, NULL);
 
 	return cfg;
@@ -2000,7 +2134,7 @@ bool mesh_config_net_key_set_phase(struct mesh_config *cfg, uint16_t idx,
 		finish_key_refresh(jnode, idx);
 	}
 
-	return save_config(jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_model_pub_add(struct mesh_config *cfg, uint16_t ele_addr,
@@ -2063,7 +2197,7 @@ bool mesh_config_model_pub_add(struct mesh_config *cfg, uint16_t ele_addr,
 	json_object_object_add(jpub, retransmit, jrtx);
 	json_object_object_add(jmodel, publish, jpub);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return save_config(cfg);
 
 fail:
 	json_object_put(jpub);
@@ -2096,7 +2230,7 @@ bool mesh_config_model_pub_del(struct mesh_config *cfg, uint16_t addr,
 								publish))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 static bool del_page(json_object *jarray, uint8_t page)
@@ -2142,7 +2276,7 @@ void mesh_config_comp_page_del(struct mesh_config *cfg, uint8_t page)
 	json_object_object_get_ex(jnode, "pages", &jarray);
 
 	if (del_page(jarray, page))
-		save_config(jnode, cfg->node_dir_path);
+		save_config(cfg);
 }
 
 bool mesh_config_comp_page_add(struct mesh_config *cfg, uint8_t page,
@@ -2182,7 +2316,7 @@ bool mesh_config_comp_page_add(struct mesh_config *cfg, uint8_t page,
 	json_object_array_add(jarray, jstring);
 	l_free(buf);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_model_sub_add(struct mesh_config *cfg, uint16_t ele_addr,
@@ -2234,7 +2368,7 @@ bool mesh_config_model_sub_add(struct mesh_config *cfg, uint16_t ele_addr,
 
 	json_object_array_add(jarray, jstring);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_model_sub_del(struct mesh_config *cfg, uint16_t ele_addr,
@@ -2275,7 +2409,7 @@ bool mesh_config_model_sub_del(struct mesh_config *cfg, uint16_t ele_addr,
 	if (!json_object_array_length(jarray))
 		json_object_object_del(jmodel, subscribe);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_model_sub_del_all(struct mesh_config *cfg, uint16_t addr,
@@ -2285,7 +2419,7 @@ bool mesh_config_model_sub_del_all(struct mesh_config *cfg, uint16_t addr,
 								subscribe))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_model_pub_enable(struct mesh_config *cfg, uint16_t ele_addr,
@@ -2314,7 +2448,7 @@ bool mesh_config_model_pub_enable(struct mesh_config *cfg, uint16_t ele_addr,
 	if (!enable)
 		json_object_object_del(jmodel, publish);
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_model_sub_enable(struct mesh_config *cfg, uint16_t ele_addr,
@@ -2343,7 +2477,7 @@ bool mesh_config_model_sub_enable(struct mesh_config *cfg, uint16_t ele_addr,
 	if (!enable)
 		json_object_object_del(jmodel, subscribe);
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_write_seq_number(struct mesh_config *cfg, uint32_t seq,
@@ -2385,9 +2519,8 @@ bool mesh_config_write_seq_number(struct mesh_config *cfg, uint32_t seq,
 		elapsed_ms = elapsed.tv_sec * 1000 + elapsed.tv_usec / 1000;
 
 		/*
-		 * If time since last write is zero, this means that
-		 * idle_save_config is already pending, so we don't need to do
-		 * anything.
+		 * If time since last write is zero, this means that a
+		 * save is already pending, so we don't need to do anything.
 		 */
 		if (!elapsed_ms)
 			return true;
@@ -2427,7 +2560,7 @@ bool mesh_config_write_ttl(struct mesh_config *cfg, uint8_t ttl)
 	if (!cfg || !write_int(cfg->jnode, defaultTTL, ttl))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_update_company_id(struct mesh_config *cfg, uint16_t cid)
@@ -2435,7 +2568,7 @@ bool mesh_config_update_company_id(struct mesh_config *cfg, uint16_t cid)
 	if (!cfg || !write_uint16_hex(cfg->jnode, "cid", cid))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_update_product_id(struct mesh_config *cfg, uint16_t pid)
@@ -2443,7 +2576,7 @@ bool mesh_config_update_product_id(struct mesh_config *cfg, uint16_t pid)
 	if (!cfg || !write_uint16_hex(cfg->jnode, "pid", pid))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_update_version_id(struct mesh_config *cfg, uint16_t vid)
@@ -2451,7 +2584,7 @@ bool mesh_config_update_version_id(struct mesh_config *cfg, uint16_t vid)
 	if (!cfg || !write_uint16_hex(cfg->jnode, "vid", vid))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 bool mesh_config_update_crpl(struct mesh_config *cfg, uint16_t crpl)
@@ -2459,7 +2592,7 @@ bool mesh_config_update_crpl(struct mesh_config *cfg, uint16_t crpl)
 	if (!cfg || !write_uint16_hex(cfg->jnode, "crpl", crpl))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return save_config(cfg);
 }
 
 static bool load_node(const char *fname, const uint8_t uuid[16],
@@ -2521,13 +2654,13 @@ static bool load_node(const char *fname, const uint8_t uuid[16],
 		memcpy(cfg->uuid, uuid, 16);
 		cfg->node_dir_path = l_strdup(fname);
 		cfg->write_seq = node.seq_number;
-		cfg->idles = l_queue_new();
+		cfg->save_cbs = l_queue_new();
 		gettimeofday(&cfg->write_time, NULL);
 
 		result = cb(&node, uuid, cfg, user_data);
 
 		if (!result) {
-			l_free(cfg->idles);
+			l_queue_destroy(cfg->save_cbs, NULL);
 			l_free(cfg->node_dir_path);
 			l_free(cfg);
 		}
@@ -2551,65 +2684,27 @@ done:
 	return result;
 }
 
-static void release_idle(void *data)
-{
-	struct l_idle *idle = data;
-
-	l_idle_remove(idle);
-}
-
 void mesh_config_release(struct mesh_config *cfg)
 {
 	if (!cfg)
 		return;
 
-	l_queue_destroy(cfg->idles, release_idle);
+	l_timeout_remove(cfg->save_timeout);
+
+	/*
+	 * Write out whatever is still pending, but the owner is being torn
+	 * down so completion callbacks are dropped rather than called.
+	 */
+	if (cfg->dirty && !write_config(cfg))
+		l_error("Pending mesh configuration changes lost");
+
+	l_queue_destroy(cfg->save_cbs, l_free);
 
 	l_free(cfg->node_dir_path);
 	json_object_put(cfg->jnode);
 	l_free(cfg);
 }
 
-static void idle_save_config(struct l_idle *idle, void *user_data)
-{
-	struct write_info *info = user_data;
-	char *fname_tmp, *fname_bak, *fname_cfg;
-	bool result = false;
-
-	fname_cfg = info->cfg->node_dir_path;
-	fname_tmp = l_strdup_printf("%s%s", fname_cfg, tmp_ext);
-	fname_bak = l_strdup_printf("%s%s", fname_cfg, bak_ext);
-	remove(fname_tmp);
-
-	result = save_config(info->cfg->jnode, fname_tmp);
-
-	if (result) {
-		remove(fname_bak);
-
-		if (rename(fname_cfg, fname_bak) < 0 ||
-					rename(fname_tmp, fname_cfg) < 0)
-			result = false;
-	}
-
-	remove(fname_tmp);
-
-	l_free(fname_tmp);
-	l_free(fname_bak);
-
-	gettimeofday(&info->cfg->write_time, NULL);
-
-	if (info->cb)
-		info->cb(info->user_data, result);
-
-	if (idle) {
-		l_queue_remove(info->cfg->idles, idle);
-		l_idle_remove(idle);
-	}
-
-	l_free(info);
-
-}
-
 bool mesh_config_save(struct mesh_config *cfg, bool no_wait,
 				mesh_config_status_func_t cb, void *user_data)
 {
@@ -2618,19 +2713,19 @@ bool mesh_config_save(struct mesh_config *cfg, bool no_wait,
 	if (!cfg)
 		return false;
 
-	info = l_new(struct write_info, 1);
-	info->cfg = cfg;
-	info->cb = cb;
-	info->user_data = user_data;
+	if (cb) {
+		info = l_new(struct write_info, 1);
+		info->cfg = cfg;
+		info->cb = cb;
+		info->user_data = user_data;
+		l_queue_push_tail(cfg->save_cbs, info);
+	}
 
-	if (no_wait) {
-		idle_save_config(NULL, info);
-	} else {
-		struct l_idle *idle;
+	if (!save_config(cfg))
+		return false;
 
-		idle = l_idle_create(idle_save_config, info, NULL);
-		l_queue_push_tail(cfg->idles, idle);
-	}
+	if (no_wait)
+		return flush_config(cfg);
 
 	return true;
 }
@@ -2702,6 +2797,15 @@ void mesh_config_destroy_nvm(struct mesh_config *cfg)
 	if (!cfg)
 		return;
 
+	/* Nothing left to write or to report once the node is gone */
+	if (cfg->save_timeout) {
+		l_timeout_remove(cfg->save_timeout);
+		cfg->save_timeout = NULL;
+	}
+
+	cfg->dirty = false;
+	l_queue_clear(cfg->save_cbs, l_free);
+
 	node_dir = dirname(cfg->node_dir_path);
 	l_debug("Delete node config %s", node_dir);
 
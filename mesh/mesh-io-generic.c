@@ -30,10 +30,12 @@
 #include "mesh/mesh-io.h"
 #include "mesh/mesh-io-api.h"
 #include "mesh/mesh-io-generic.h"
+#include "mesh/dup-filter.h"
 
 struct mesh_io_private {
 	struct mesh_io *io;
 	struct bt_hci *hci;
+	struct dup_filter *dup_filter;
 	struct l_timeout *tx_timeout;
 	struct l_queue *tx_pkts;
 	struct tx_pkt *tx;
@@ -126,6 +128,9 @@ static void event_adv_report(struct mesh_io *io, const void *buf, uint8_t size)
 	/* rssi is just beyond last byte of data */
 	rssi = (int8_t) adv[adv_len];
 
+	if (dup_filter_check(io->pvt->dup_filter, addr, adv, adv_len, instant))
+		return;
+
 	while (len < adv_len - 1) {
 		uint8_t field_len = adv[0];
 
@@ -415,6 +420,7 @@ static bool dev_init(struct mesh_io *io, void *opts, void *user_data)
 	io->pvt = l_new(struct mesh_io_private, 1);
 
 	io->pvt->tx_pkts = l_queue_new();
+	io->pvt->dup_filter = dup_filter_new(DUP_FILTER_SIZE);
 
 	io->pvt->io = io;
 
@@ -431,6 +437,7 @@ static bool dev_destroy(struct mesh_io *io)
 		return true;
 
 	bt_hci_unref(pvt->hci);
+	dup_filter_free(pvt->dup_filter);
 	l_timeout_remove(pvt->tx_timeout);
 	l_queue_remove_if(pvt->tx_pkts, simple_match, pvt->tx);
 	l_queue_destroy(pvt->tx_pkts, l_free);
@@ -32,21 +32,57 @@
 #include "mesh/mesh-io.h"
 #include "mesh/mesh-io-api.h"
 #include "mesh/mesh-io-mgmt.h"
+#include "mesh/dup-filter.h"
+
+/* Upper bound of packets handed to the kernel at the same time */
+#define TX_SLOTS_MAX		8
+
+/* Reclaim a slot if the kernel never reports its completion */
+#define TX_SLOT_TIMEOUT		500
+
+/* Interval between two TX statistics reports, in ms */
+#define TX_STATS_INTERVAL	60000
+
+/* Transmission currently owned by the kernel */
+struct tx_slot {
+	struct tx_pkt *tx;
+	uint32_t sent;
+	unsigned int seq;
+	uint8_t handle;
+	bool busy;
+	bool cancel;
+};
+
+struct tx_stats {
+	uint64_t latency;
+	uint32_t latency_max;
+	uint32_t queued;
+	uint32_t sent;
+	uint32_t merged;
+	uint32_t reclaimed;
+	uint32_t max_depth;
+	uint8_t max_busy;
+};
 
 struct mesh_io_private {
 	struct mesh_io *io;
 	void *user_data;
 	struct l_timeout *tx_timeout;
-	struct l_timeout *dup_timeout;
-	struct l_queue *dup_filters;
+	struct dup_filter *dup_filter;
 	struct l_queue *tx_pkts;
-	struct tx_pkt *tx;
+	struct tx_slot slots[TX_SLOTS_MAX];
+	unsigned int reclaimed_seqs[TX_SLOTS_MAX];
+	struct tx_stats stats;
+	uint32_t stats_time;
 	unsigned int tx_id;
 	unsigned int rx_id;
+	unsigned int tx_seq;
 	uint16_t send_idx;
 	uint16_t interval;
-	uint8_t handle;
-	bool sending;
+	uint8_t num_slots;
+	uint8_t busy;
+	uint8_t reclaimed_idx;
+	bool tx_pending;
 	bool active;
 };
 
@@ -59,7 +95,11 @@ struct process_data {
 
 struct tx_pkt {
 	struct mesh_io_send_info	info;
+	struct tx_slot			*slot;
+	uint32_t			queued;
+	uint32_t			due;
 	bool				delete;
+	bool				sent;
 	uint8_t				len;
 	uint8_t				pkt[MESH_AD_MAX_LEN];
 };
@@ -69,16 +109,6 @@ struct tx_pattern {
 	uint8_t				len;
 };
 
-#define DUP_FILTER_TIME        1000
-/* Accept one instance of unique message a second */
-struct dup_filter {
-	uint64_t data;
-	uint32_t instant;
-	uint8_t addr[6];
-} __packed;
-
-static const uint8_t zero_addr[] = {0, 0, 0, 0, 0, 0};
-
 static struct mesh_io_private *pvt;
 
 static uint32_t get_instant(void)
@@ -100,132 +130,439 @@ static uint32_t instant_remaining_ms(uint32_t instant)
 	return instant;
 }
 
-static bool find_by_addr(const void *a, const void *b)
+static void process_rx_callbacks(void *v_reg, void *v_rx)
 {
-	const struct dup_filter *filter = a;
+	struct mesh_io_reg *rx_reg = v_reg;
+	struct process_data *rx = v_rx;
 
-	return !memcmp(filter->addr, b, 6);
+	if (!memcmp(rx->data, rx_reg->filter, rx_reg->len))
+		rx_reg->cb(rx_reg->user_data, &rx->info, rx->data, rx->len);
 }
 
-static bool find_by_adv(const void *a, const void *b)
+static void process_rx(uint16_t index, struct mesh_io_private *pvt, int8_t rssi,
+					uint32_t instant, const uint8_t *addr,
+					const uint8_t *data, uint8_t len)
 {
-	const struct dup_filter *filter = a;
-	uint64_t data = l_get_be64(b);
+	struct process_data rx = {
+		.pvt = pvt,
+		.data = data,
+		.len = len,
+		.info.instant = instant,
+		.info.addr = addr,
+		.info.chan = 7,
+		.info.rssi = rssi,
+	};
+
+	/* Accept all traffic except beacons from any controller */
+	if (index != pvt->send_idx && data[0] == BT_AD_MESH_BEACON)
+		return;
 
-	return !memcmp(filter->addr, zero_addr, 6) && filter->data == data;
+	print_packet("RX", data, len);
+	l_queue_foreach(pvt->io->rx_regs, process_rx_callbacks, &rx);
 }
 
-static void filter_timeout(struct l_timeout *timeout, void *user_data)
+static bool instant_passed(uint32_t now, uint32_t instant)
 {
-	struct dup_filter *filter;
-	uint32_t instant, delta;
+	return (int32_t) (now - instant) >= 0;
+}
 
-	if (!pvt)
-		goto done;
+/* Poll responses have to make the Friend's receive window */
+static int compare_tx_due(const void *a, const void *b, void *user_data)
+{
+	const struct tx_pkt *tx_a = a;
+	const struct tx_pkt *tx_b = b;
+	bool rsp_a = tx_a->info.type == MESH_IO_TIMING_TYPE_POLL_RSP;
+	bool rsp_b = tx_b->info.type == MESH_IO_TIMING_TYPE_POLL_RSP;
 
-	instant = get_instant();
+	if (rsp_a != rsp_b)
+		return rsp_a ? -1 : 1;
 
-	filter = l_queue_peek_tail(pvt->dup_filters);
-	while (filter) {
-		delta = instant - filter->instant;
-		if (delta >= DUP_FILTER_TIME) {
-			l_queue_remove(pvt->dup_filters, filter);
-			l_free(filter);
-		} else {
-			l_timeout_modify(timeout, 1);
-			return;
-		}
+	if (tx_a->due == tx_b->due)
+		return 0;
 
-		filter = l_queue_peek_tail(pvt->dup_filters);
+	return instant_passed(tx_a->due, tx_b->due) ? 1 : -1;
+}
+
+static struct tx_slot *find_slot_by_seq(struct mesh_io_private *pvt,
+							unsigned int seq)
+{
+	int i;
+
+	for (i = 0; i < TX_SLOTS_MAX; i++) {
+		if (pvt->slots[i].busy && pvt->slots[i].seq == seq)
+			return &pvt->slots[i];
 	}
 
-	pvt->dup_timeout = NULL;
+	return NULL;
+}
+
+static struct tx_slot *find_slot_by_handle(struct mesh_io_private *pvt,
+								uint8_t handle)
+{
+	int i;
+
+	for (i = 0; i < TX_SLOTS_MAX; i++) {
+		if (pvt->slots[i].busy && pvt->slots[i].handle == handle)
+			return &pvt->slots[i];
+	}
 
-done:
-	l_timeout_remove(timeout);
+	return NULL;
 }
 
-/* Ignore consecutive duplicate advertisements within timeout period */
-static bool filter_dups(const uint8_t *addr, const uint8_t *adv,
-							uint32_t instant)
+static void slot_release(struct mesh_io_private *pvt, struct tx_slot *slot)
 {
-	struct dup_filter *filter;
-	uint32_t instant_delta;
-	uint64_t data = l_get_be64(adv);
+	if (slot->tx) {
+		slot->tx->slot = NULL;
 
-	if (!addr)
-		addr = zero_addr;
+		/* Last transmission, the packet is no longer queued */
+		if (slot->tx->delete)
+			l_free(slot->tx);
+	}
+
+	memset(slot, 0, sizeof(*slot));
+	pvt->busy--;
+}
+
+static void send_cancel(struct mesh_io_private *pvt, uint8_t handle)
+{
+	struct mgmt_cp_mesh_send_cancel remove;
 
-	if (adv[1] == BT_AD_MESH_PROV) {
-		filter = l_queue_find(pvt->dup_filters, find_by_adv, adv);
+	remove.handle = handle;
+	mesh_mgmt_send(MGMT_OP_MESH_SEND_CANCEL, pvt->send_idx,
+				sizeof(remove), &remove, NULL, NULL, NULL);
+}
 
-		if (!filter && addr != zero_addr)
-			return false;
+static void slot_cancel(struct mesh_io_private *pvt, struct tx_slot *slot)
+{
+	struct tx_pkt *tx = slot->tx;
 
-		l_queue_remove(pvt->dup_filters, filter);
+	if (tx) {
+		tx->slot = NULL;
+		slot->tx = NULL;
 
-	} else {
-		filter = l_queue_remove_if(pvt->dup_filters, find_by_addr,
-									addr);
+		if (tx->delete)
+			l_free(tx);
 	}
 
-	if (!filter) {
-		filter = l_new(struct dup_filter, 1);
-		memcpy(filter->addr, addr, 6);
+	/* Cancel once the kernel has told us the handle */
+	if (!slot->handle) {
+		slot->cancel = true;
+		return;
 	}
 
-	/* Start filter expiration timer */
-	if (!l_queue_length(pvt->dup_filters))
-		pvt->dup_timeout = l_timeout_create(1, filter_timeout, NULL,
-									NULL);
+	send_cancel(pvt, slot->handle);
+	slot_release(pvt, slot);
+}
 
-	l_queue_push_head(pvt->dup_filters, filter);
-	instant_delta = instant - filter->instant;
+static void tx_cancel_all(struct mesh_io_private *pvt)
+{
+	int i;
 
-	if (instant_delta >= DUP_FILTER_TIME || data != filter->data) {
-		filter->instant = instant;
-		filter->data = data;
-		return false;
+	for (i = 0; i < TX_SLOTS_MAX; i++) {
+		if (pvt->slots[i].busy)
+			slot_cancel(pvt, &pvt->slots[i]);
 	}
+}
 
-	return true;
+static void print_tx_stats(struct mesh_io_private *pvt)
+{
+	struct tx_stats *stats = &pvt->stats;
+
+	l_debug("TX: %u queued, %u merged, %u sent, %u reclaimed, "
+			"depth %u (max %u), in flight max %u/%u, "
+			"latency avg %u max %u ms", stats->queued,
+			stats->merged, stats->sent, stats->reclaimed,
+			l_queue_length(pvt->tx_pkts), stats->max_depth,
+			stats->max_busy, pvt->num_slots,
+			stats->queued ? (uint32_t) (stats->latency /
+			stats->queued) : 0, stats->latency_max);
 }
 
-static void process_rx_callbacks(void *v_reg, void *v_rx)
+static void tx_schedule(struct mesh_io_private *pvt);
+
+/*
+ * A slot reclaimed before the kernel told us its handle may still get a
+ * handle later on, remember it so that the handle can be cancelled then.
+ */
+static void slot_reclaim(struct mesh_io_private *pvt, struct tx_slot *slot)
 {
-	struct mesh_io_reg *rx_reg = v_reg;
-	struct process_data *rx = v_rx;
+	unsigned int seq = slot->seq;
+	bool pending = !slot->handle;
 
-	if (!memcmp(rx->data, rx_reg->filter, rx_reg->len))
-		rx_reg->cb(rx_reg->user_data, &rx->info, rx->data, rx->len);
+	pvt->stats.reclaimed++;
+	slot_cancel(pvt, slot);
+
+	if (!pending)
+		return;
+
+	slot_release(pvt, slot);
+
+	pvt->reclaimed_seqs[pvt->reclaimed_idx] = seq;
+	pvt->reclaimed_idx = (pvt->reclaimed_idx + 1) % TX_SLOTS_MAX;
 }
 
-static void process_rx(uint16_t index, struct mesh_io_private *pvt, int8_t rssi,
-					uint32_t instant, const uint8_t *addr,
-					const uint8_t *data, uint8_t len)
+static bool forget_reclaimed(struct mesh_io_private *pvt, unsigned int seq)
 {
-	struct process_data rx = {
-		.pvt = pvt,
-		.data = data,
-		.len = len,
-		.info.instant = instant,
-		.info.addr = addr,
-		.info.chan = 7,
-		.info.rssi = rssi,
-	};
+	int i;
 
-	/* Accept all traffic except beacons from any controller */
-	if (index != pvt->send_idx && data[0] == BT_AD_MESH_BEACON)
+	for (i = 0; i < TX_SLOTS_MAX; i++) {
+		if (seq && pvt->reclaimed_seqs[i] == seq) {
+			pvt->reclaimed_seqs[i] = 0;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void send_queued(uint8_t status, uint16_t length,
+					const void *param, void *user_data)
+{
+	struct tx_slot *slot;
+
+	if (!pvt)
 		return;
 
-	print_packet("RX", data, len);
-	l_queue_foreach(pvt->io->rx_regs, process_rx_callbacks, &rx);
+	slot = find_slot_by_seq(pvt, L_PTR_TO_UINT(user_data));
+	if (!slot) {
+		if (forget_reclaimed(pvt, L_PTR_TO_UINT(user_data)) &&
+					!status && param && length >= 1)
+			send_cancel(pvt, *(uint8_t *) param);
+		return;
+	}
+
+	if (status) {
+		l_debug("Mesh Send Failed: %d", status);
+		slot_release(pvt, slot);
+		tx_schedule(pvt);
+		return;
+	}
+
+	if (param && length >= 1)
+		slot->handle = *(uint8_t *) param;
+
+	if (slot->cancel) {
+		slot_cancel(pvt, slot);
+		tx_schedule(pvt);
+	}
 }
 
 static void send_cmplt(uint16_t index, uint16_t length,
 					const void *param, void *user_data)
 {
-	/* print_packet("Mesh Send Complete", param, length); */
+	const struct mgmt_ev_mesh_pkt_cmplt *ev = param;
+	struct tx_slot *slot;
+
+	if (!pvt || length < sizeof(*ev) || !ev->handle)
+		return;
+
+	slot = find_slot_by_handle(pvt, ev->handle);
+	if (!slot)
+		return;
+
+	slot_release(pvt, slot);
+	tx_schedule(pvt);
+}
+
+static void send_pkt(struct mesh_io_private *pvt, struct tx_slot *slot,
+					struct tx_pkt *tx, uint32_t now)
+{
+	uint8_t buffer[sizeof(struct mgmt_cp_mesh_send) + tx->len + 1];
+	struct mgmt_cp_mesh_send *send = (void *) buffer;
+	size_t len;
+
+	len = sizeof(buffer);
+	memset(send, 0, len);
+	send->addr.type = BDADDR_LE_RANDOM;
+	send->instant = 0;
+	send->delay = 0;
+	send->cnt = 1;
+	send->adv_data_len = tx->len + 1;
+	send->adv_data[0] = tx->len;
+	memcpy(send->adv_data + 1, tx->pkt, tx->len);
+
+	/* Filter looped back Provision packets */
+	if (tx->pkt[0] == BT_AD_MESH_PROV)
+		dup_filter_check(pvt->dup_filter, NULL, send->adv_data,
+					send->adv_data_len, now);
+
+	slot->tx = tx;
+	slot->sent = now;
+	slot->seq = ++pvt->tx_seq;
+	slot->busy = true;
+	tx->slot = slot;
+	pvt->busy++;
+
+	if (pvt->busy > pvt->stats.max_busy)
+		pvt->stats.max_busy = pvt->busy;
+
+	mesh_mgmt_send(MGMT_OP_MESH_SEND, pvt->send_idx, len, send,
+				send_queued, L_UINT_TO_PTR(slot->seq), NULL);
+	/* print_packet("Mesh Send Start", tx->pkt, tx->len); */
+}
+
+static void tx_send(struct mesh_io_private *pvt, struct tx_pkt *tx,
+								uint32_t now)
+{
+	struct tx_slot *slot = pvt->slots;
+	uint32_t latency;
+	uint16_t ms;
+	uint8_t count;
+
+	while (slot->busy)
+		slot++;
+
+	if (!tx->sent) {
+		tx->sent = true;
+		latency = now - tx->queued;
+		pvt->stats.latency += latency;
+
+		if (latency > pvt->stats.latency_max)
+			pvt->stats.latency_max = latency;
+	}
+
+	if (tx->info.type == MESH_IO_TIMING_TYPE_GENERAL) {
+		ms = tx->info.u.gen.interval;
+		count = tx->info.u.gen.cnt;
+		if (count != MESH_IO_TX_COUNT_UNLIMITED)
+			tx->info.u.gen.cnt--;
+	} else {
+		ms = 25;
+		count = 1;
+	}
+
+	tx->delete = (count == 1);
+
+	l_queue_remove(pvt->tx_pkts, tx);
+
+	if (!tx->delete) {
+		tx->due = now + ms;
+		l_queue_insert(pvt->tx_pkts, tx, compare_tx_due, NULL);
+	}
+
+	pvt->stats.sent++;
+	send_pkt(pvt, slot, tx, now);
+}
+
+static void tx_to(struct l_timeout *timeout, void *user_data)
+{
+	if (!pvt) {
+		l_timeout_remove(timeout);
+		return;
+	}
+
+	tx_schedule(pvt);
+}
+
+/* General packets leave the last slot to a pending Poll response */
+static bool tx_slot_free(struct mesh_io_private *pvt, bool rsp_pending)
+{
+	return pvt->busy + (rsp_pending ? 1 : 0) < pvt->num_slots;
+}
+
+/*
+ * Hand every due packet to the kernel while it has advertising handles
+ * to spare, earliest deadline first, and sleep until the next deadline
+ * or slot timeout.
+ */
+static void tx_schedule(struct mesh_io_private *pvt)
+{
+	const struct l_queue_entry *entry;
+	uint32_t now = get_instant();
+	uint32_t wake = 0;
+	bool wake_set = false;
+	bool rsp_pending = false;
+	int i;
+
+	for (i = 0; i < TX_SLOTS_MAX; i++) {
+		struct tx_slot *slot = &pvt->slots[i];
+
+		if (!slot->busy || now - slot->sent < TX_SLOT_TIMEOUT)
+			continue;
+
+		slot_reclaim(pvt, slot);
+	}
+
+	if (now - pvt->stats_time >= TX_STATS_INTERVAL) {
+		pvt->stats_time = now;
+		print_tx_stats(pvt);
+	}
+
+	entry = l_queue_get_entries(pvt->tx_pkts);
+
+	/* Poll responses come first, so the general packets know about them */
+	while (entry && pvt->busy < pvt->num_slots) {
+		struct tx_pkt *tx = entry->data;
+
+		entry = entry->next;
+
+		if (tx->slot)
+			continue;
+
+		if (tx->info.type == MESH_IO_TIMING_TYPE_POLL_RSP) {
+			if (instant_passed(now, tx->due))
+				tx_send(pvt, tx, now);
+			else
+				rsp_pending = true;
+
+			continue;
+		}
+
+		if (!tx_slot_free(pvt, rsp_pending) ||
+						!instant_passed(now, tx->due))
+			break;
+
+		tx_send(pvt, tx, now);
+	}
+
+	if (pvt->busy < pvt->num_slots) {
+		for (entry = l_queue_get_entries(pvt->tx_pkts); entry;
+							entry = entry->next) {
+			struct tx_pkt *tx = entry->data;
+
+			if (tx->slot)
+				continue;
+
+			/* Wait for a slot to complete instead of spinning */
+			if (tx->info.type != MESH_IO_TIMING_TYPE_POLL_RSP &&
+					!tx_slot_free(pvt, rsp_pending))
+				break;
+
+			if (!wake_set || instant_passed(wake, tx->due)) {
+				wake = tx->due;
+				wake_set = true;
+			}
+
+			if (tx->info.type != MESH_IO_TIMING_TYPE_POLL_RSP)
+				break;
+		}
+	}
+
+	for (i = 0; i < TX_SLOTS_MAX; i++) {
+		struct tx_slot *slot = &pvt->slots[i];
+		uint32_t timeout = slot->sent + TX_SLOT_TIMEOUT;
+
+		if (!slot->busy)
+			continue;
+
+		if (!wake_set || instant_passed(wake, timeout)) {
+			wake = timeout;
+			wake_set = true;
+		}
+	}
+
+	if (!wake_set) {
+		l_timeout_remove(pvt->tx_timeout);
+		pvt->tx_timeout = NULL;
+		return;
+	}
+
+	wake = instant_passed(now, wake) ? 1 : wake - now;
+
+	if (pvt->tx_timeout)
+		l_timeout_modify_ms(pvt->tx_timeout, wake);
+	else
+		pvt->tx_timeout = l_timeout_create_ms(wake, tx_to, NULL, NULL);
 }
 
 static void event_device_found(uint16_t index, uint16_t length,
@@ -247,7 +584,7 @@ static void event_device_found(uint16_t index, uint16_t length,
 	adv_len = ev->eir_len;
 	addr = ev->addr.bdaddr.b;
 
-	if (filter_dups(addr, adv, instant))
+	if (dup_filter_check(pvt->dup_filter, addr, adv, adv_len, instant))
 		return;
 
 	while (len < adv_len - 1) {
@@ -271,11 +608,6 @@ static void event_device_found(uint16_t index, uint16_t length,
 	}
 }
 
-static bool simple_match(const void *a, const void *b)
-{
-	return a == b;
-}
-
 static bool find_by_ad_type(const void *a, const void *b)
 {
 	const struct tx_pkt *tx = a;
@@ -325,6 +657,29 @@ static void le_up(uint8_t status, uint16_t length,
 	l_debug("HCI%d LE up status: %d", index, status);
 }
 
+static void features_cb(uint8_t status, uint16_t length,
+					const void *param, void *user_data)
+{
+	const struct mgmt_rp_mesh_read_features *rp = param;
+
+	if (!pvt || status != MGMT_STATUS_SUCCESS || length < sizeof(*rp))
+		return;
+
+	/* One slot per handle the kernel can still track for us */
+	if (rp->max_handles > rp->used_handles)
+		pvt->num_slots = rp->max_handles - rp->used_handles;
+	else
+		pvt->num_slots = 0;
+
+	if (pvt->num_slots > TX_SLOTS_MAX)
+		pvt->num_slots = TX_SLOTS_MAX;
+	else if (!pvt->num_slots)
+		pvt->num_slots = 1;
+
+	l_debug("HCI%d mesh TX slots: %u", L_PTR_TO_UINT(user_data),
+							pvt->num_slots);
+}
+
 static void ctl_up(uint8_t status, uint16_t length,
 					const void *param, void *user_data)
 {
@@ -351,7 +706,7 @@ static void ctl_up(uint8_t status, uint16_t length,
 				MGMT_INDEX_NONE, event_device_found, pvt,
 				NULL);
 	pvt->tx_id = mesh_mgmt_register(MGMT_EV_MESH_PACKET_CMPLT,
-					index, send_cmplt, pvt, NULL);
+					index, send_cmplt, NULL, NULL);
 
 	mesh_mgmt_send(MGMT_OP_SET_MESH_RECEIVER, index, len, mesh,
 			mesh_up, L_UINT_TO_PTR(index), NULL);
@@ -361,6 +716,8 @@ static void ctl_up(uint8_t status, uint16_t length,
 
 	if (pvt->send_idx == MGMT_INDEX_NONE) {
 		pvt->send_idx = index;
+		mesh_mgmt_send(MGMT_OP_MESH_READ_FEATURES, index, 0, NULL,
+				features_cb, L_UINT_TO_PTR(index), NULL);
 		if (pvt && pvt->io && pvt->io->ready) {
 			pvt->io->ready(pvt->io->user_data, true);
 			pvt->io->ready = NULL;
@@ -436,11 +793,13 @@ static bool dev_init(struct mesh_io *io, void *opts, void *user_data)
 	pvt = l_new(struct mesh_io_private, 1);
 
 	pvt->send_idx = MGMT_INDEX_NONE;
+	pvt->num_slots = 1;
+	pvt->stats_time = get_instant();
 
 	mesh_mgmt_send(MGMT_OP_READ_INFO, index, 0, NULL,
 				read_info_cb, L_UINT_TO_PTR(index), NULL);
 
-	pvt->dup_filters = l_queue_new();
+	pvt->dup_filter = dup_filter_new(DUP_FILTER_SIZE);
 	pvt->tx_pkts = l_queue_new();
 
 	pvt->io = io;
@@ -462,8 +821,9 @@ static bool dev_destroy(struct mesh_io *io)
 	mesh_mgmt_unregister(pvt->rx_id);
 	mesh_mgmt_unregister(pvt->tx_id);
 	l_timeout_remove(pvt->tx_timeout);
-	l_timeout_remove(pvt->dup_timeout);
-	l_queue_destroy(pvt->dup_filters, l_free);
+	dup_filter_free(pvt->dup_filter);
+	print_tx_stats(pvt);
+	tx_cancel_all(pvt);
 	l_queue_destroy(pvt->tx_pkts, l_free);
 	io->pvt = NULL;
 	l_free(pvt);
@@ -485,252 +845,161 @@ static bool dev_caps(struct mesh_io *io, struct mesh_io_caps *caps)
 	return true;
 }
 
-static void send_cancel(struct mesh_io_private *pvt)
+static void tx_worker(void *user_data)
 {
-	struct mgmt_cp_mesh_send_cancel remove;
-
 	if (!pvt)
 		return;
 
-	if (pvt->handle) {
-		remove.handle = pvt->handle;
-		/* l_debug("Cancel TX"); */
-		mesh_mgmt_send(MGMT_OP_MESH_SEND_CANCEL, pvt->send_idx,
-						sizeof(remove), &remove,
-						NULL, NULL, NULL);
-	}
+	pvt->tx_pending = false;
+	tx_schedule(pvt);
 }
 
-static void tx_to(struct l_timeout *timeout, void *user_data);
-static void send_queued(uint8_t status, uint16_t length,
-					const void *param, void *user_data)
+static uint32_t random_delay(uint8_t min_delay, uint8_t max_delay)
 {
-	struct tx_pkt *tx = user_data;
+	uint32_t delay;
 
-	if (status)
-		l_debug("Mesh Send Failed: %d", status);
-	else if (param && length >= 1)
-		pvt->handle = *(uint8_t *) param;
+	if (min_delay == max_delay)
+		return min_delay;
 
-	if (tx->delete) {
-		l_queue_remove_if(pvt->tx_pkts, simple_match, tx);
-		l_free(tx);
-		pvt->tx = NULL;
-	}
+	l_getrandom(&delay, sizeof(delay));
+	delay %= max_delay - min_delay;
+
+	return delay + min_delay;
 }
 
-static void send_pkt(struct mesh_io_private *pvt, struct tx_pkt *tx,
-							uint16_t interval)
+static bool find_by_general_pkt(const void *a, const void *b)
 {
-	uint8_t buffer[sizeof(struct mgmt_cp_mesh_send) + tx->len + 1];
-	struct mgmt_cp_mesh_send *send = (void *) buffer;
-	uint16_t index;
-	size_t len;
-
-	if (!pvt)
-		return;
-
-	index = pvt->send_idx;
-
-	len = sizeof(buffer);
-	memset(send, 0, len);
-	send->addr.type = BDADDR_LE_RANDOM;
-	send->instant = 0;
-	send->delay = 0;
-	send->cnt = 1;
-	send->adv_data_len = tx->len + 1;
-	send->adv_data[0] = tx->len;
-	memcpy(send->adv_data + 1, tx->pkt, tx->len);
-
-	/* Filter looped back Provision packets */
-	if (tx->pkt[0] == BT_AD_MESH_PROV)
-		filter_dups(NULL, send->adv_data, get_instant());
+	const struct tx_pkt *tx = a;
+	const struct tx_pkt *new_tx = b;
 
-	mesh_mgmt_send(MGMT_OP_MESH_SEND, index,
-			len, send, send_queued, tx, NULL);
-	/* print_packet("Mesh Send Start", tx->pkt, tx->len); */
-	pvt->tx = tx;
+	return tx->info.type == MESH_IO_TIMING_TYPE_GENERAL &&
+					tx->len == new_tx->len &&
+					!memcmp(tx->pkt, new_tx->pkt, tx->len);
 }
 
-static void tx_to(struct l_timeout *timeout, void *user_data)
+/* Fold a retransmission of a packet that is still queued into it */
+static bool merge_tx(struct mesh_io_private *pvt, struct tx_pkt *tx)
 {
-	struct mesh_io_private *pvt = user_data;
-	struct tx_pkt *tx;
-	uint16_t ms;
-	uint8_t count;
-
-	if (!pvt)
-		return;
+	struct tx_pkt *queued;
 
-	tx = l_queue_pop_head(pvt->tx_pkts);
-	if (!tx) {
-		l_timeout_remove(timeout);
-		pvt->tx_timeout = NULL;
-		send_cancel(pvt);
-		pvt->tx = NULL;
-		return;
-	}
-
-	if (tx->info.type == MESH_IO_TIMING_TYPE_GENERAL) {
-		ms = tx->info.u.gen.interval;
-		count = tx->info.u.gen.cnt;
-		if (count != MESH_IO_TX_COUNT_UNLIMITED)
-			tx->info.u.gen.cnt--;
-	} else {
-		ms = 25;
-		count = 1;
-	}
+	if (tx->info.type != MESH_IO_TIMING_TYPE_GENERAL)
+		return false;
 
-	tx->delete = (count == 1);
+	queued = l_queue_find(pvt->tx_pkts, find_by_general_pkt, tx);
+	if (!queued)
+		return false;
 
-	send_pkt(pvt, tx, ms);
+	if (queued->info.u.gen.cnt != MESH_IO_TX_COUNT_UNLIMITED &&
+			(tx->info.u.gen.cnt == MESH_IO_TX_COUNT_UNLIMITED ||
+			tx->info.u.gen.cnt > queued->info.u.gen.cnt))
+		queued->info.u.gen.cnt = tx->info.u.gen.cnt;
 
-	if (count == 1) {
-		/* Recalculate wakeup if we are responding to POLL */
-		tx = l_queue_peek_head(pvt->tx_pkts);
+	if (tx->info.u.gen.interval < queued->info.u.gen.interval)
+		queued->info.u.gen.interval = tx->info.u.gen.interval;
 
-		if (tx && tx->info.type == MESH_IO_TIMING_TYPE_POLL_RSP) {
-			ms = instant_remaining_ms(tx->info.u.poll_rsp.instant +
-						tx->info.u.poll_rsp.delay);
-		}
-	} else
-		l_queue_push_tail(pvt->tx_pkts, tx);
+	pvt->stats.merged++;
 
-	if (timeout) {
-		pvt->tx_timeout = timeout;
-		l_timeout_modify_ms(timeout, ms);
-	} else
-		pvt->tx_timeout = l_timeout_create_ms(ms, tx_to, pvt, NULL);
+	return true;
 }
 
-static void tx_worker(void *user_data)
+static bool send_tx(struct mesh_io *io, struct mesh_io_send_info *info,
+					const uint8_t *data, uint16_t len)
 {
-	struct mesh_io_private *pvt = user_data;
 	struct tx_pkt *tx;
-	uint32_t delay;
+	uint32_t now;
 
-	tx = l_queue_peek_head(pvt->tx_pkts);
-	if (!tx)
-		return;
+	if (!info || !data || !len || len > sizeof(tx->pkt))
+		return false;
 
-	switch (tx->info.type) {
+	tx = l_new(struct tx_pkt, 1);
+
+	memcpy(&tx->info, info, sizeof(tx->info));
+	memcpy(&tx->pkt, data, len);
+	tx->len = len;
+
+	if (merge_tx(pvt, tx)) {
+		l_free(tx);
+		return true;
+	}
+
+	now = get_instant();
+	tx->queued = now;
+
+	switch (info->type) {
 	case MESH_IO_TIMING_TYPE_GENERAL:
-		if (tx->info.u.gen.min_delay == tx->info.u.gen.max_delay)
-			delay = tx->info.u.gen.min_delay;
-		else {
-			l_getrandom(&delay, sizeof(delay));
-			delay %= tx->info.u.gen.max_delay -
-						tx->info.u.gen.min_delay;
-			delay += tx->info.u.gen.min_delay;
-		}
+		tx->due = now + random_delay(info->u.gen.min_delay,
+						info->u.gen.max_delay);
 		break;
 
 	case MESH_IO_TIMING_TYPE_POLL:
-		if (tx->info.u.poll.min_delay == tx->info.u.poll.max_delay)
-			delay = tx->info.u.poll.min_delay;
-		else {
-			l_getrandom(&delay, sizeof(delay));
-			delay %= tx->info.u.poll.max_delay -
-						tx->info.u.poll.min_delay;
-			delay += tx->info.u.poll.min_delay;
-		}
+		tx->due = now + random_delay(info->u.poll.min_delay,
+						info->u.poll.max_delay);
 		break;
 
 	case MESH_IO_TIMING_TYPE_POLL_RSP:
 		/* Delay until Instant + Delay */
-		delay = instant_remaining_ms(tx->info.u.poll_rsp.instant +
-						tx->info.u.poll_rsp.delay);
-		if (delay > 255)
-			delay = 0;
+		tx->due = info->u.poll_rsp.instant + info->u.poll_rsp.delay;
+		if (instant_remaining_ms(tx->due) > 255)
+			tx->due = now;
 		break;
 
 	default:
-		return;
+		l_free(tx);
+		return false;
 	}
 
-	if (!delay)
-		tx_to(pvt->tx_timeout, pvt);
-	else if (pvt->tx_timeout)
-		l_timeout_modify_ms(pvt->tx_timeout, delay);
-	else
-		pvt->tx_timeout = l_timeout_create_ms(delay, tx_to, pvt, NULL);
-}
-
-static bool send_tx(struct mesh_io *io, struct mesh_io_send_info *info,
-					const uint8_t *data, uint16_t len)
-{
-	struct tx_pkt *tx;
-	bool sending = false;
+	l_queue_insert(pvt->tx_pkts, tx, compare_tx_due, NULL);
+	pvt->stats.queued++;
 
-	if (!info || !data || !len || len > sizeof(tx->pkt))
-		return false;
+	if (l_queue_length(pvt->tx_pkts) > pvt->stats.max_depth)
+		pvt->stats.max_depth = l_queue_length(pvt->tx_pkts);
 
-	tx = l_new(struct tx_pkt, 1);
+	if (!pvt->tx_pending) {
+		pvt->tx_pending = true;
+		l_idle_oneshot(tx_worker, NULL, NULL);
+	}
 
-	memcpy(&tx->info, info, sizeof(tx->info));
-	memcpy(&tx->pkt, data, len);
-	tx->len = len;
+	return true;
+}
 
-	if (info->type == MESH_IO_TIMING_TYPE_POLL_RSP)
-		l_queue_push_head(pvt->tx_pkts, tx);
-	else {
-		if (pvt->tx)
-			sending = true;
-		else
-			sending = !l_queue_isempty(pvt->tx_pkts);
+static void cancel_matching(struct mesh_io_private *pvt,
+				l_queue_match_func_t match,
+				const void *match_data)
+{
+	struct tx_pkt *tx;
+	int i;
 
-		l_queue_push_tail(pvt->tx_pkts, tx);
-	}
+	/* Last transmissions are only referenced from their slot */
+	for (i = 0; i < TX_SLOTS_MAX; i++) {
+		struct tx_slot *slot = &pvt->slots[i];
 
-	if (!sending) {
-		l_timeout_remove(pvt->tx_timeout);
-		pvt->tx_timeout = NULL;
-		l_idle_oneshot(tx_worker, pvt, NULL);
+		if (slot->busy && slot->tx && match(slot->tx, match_data))
+			slot_cancel(pvt, slot);
 	}
 
-	return true;
+	while ((tx = l_queue_remove_if(pvt->tx_pkts, match, match_data)))
+		l_free(tx);
 }
 
 static bool tx_cancel(struct mesh_io *io, const uint8_t *data, uint8_t len)
 {
 	struct mesh_io_private *pvt = io->pvt;
-	struct tx_pkt *tx;
 
 	if (!data)
 		return false;
 
-	if (len == 1) {
-		do {
-			tx = l_queue_remove_if(pvt->tx_pkts, find_by_ad_type,
-							L_UINT_TO_PTR(data[0]));
-			l_free(tx);
-
-			if (tx == pvt->tx)
-				pvt->tx = NULL;
-
-		} while (tx);
-	} else {
+	if (len == 1)
+		cancel_matching(pvt, find_by_ad_type, L_UINT_TO_PTR(data[0]));
+	else {
 		struct tx_pattern pattern = {
 			.data = data,
 			.len = len
 		};
 
-		do {
-			tx = l_queue_remove_if(pvt->tx_pkts, find_by_pattern,
-								&pattern);
-			l_free(tx);
-
-			if (tx == pvt->tx)
-				pvt->tx = NULL;
-
-		} while (tx);
+		cancel_matching(pvt, find_by_pattern, &pattern);
 	}
 
-	if (l_queue_isempty(pvt->tx_pkts)) {
-		send_cancel(pvt);
-		l_timeout_remove(pvt->tx_timeout);
-		pvt->tx_timeout = NULL;
-	}
+	tx_schedule(pvt);
 
 	return true;
 }
@@ -73,6 +73,27 @@ struct mod_forward {
 	bool done;
 };
 
+/* Model subscribed to a group or virtual address */
+struct sub_target {
+	struct mesh_model *mod;
+	uint8_t ele_idx;
+};
+
+/*
+ * Per node map of subscription addresses to the models subscribed to them.
+ * It is rebuilt on first use after any subscription of the node has changed.
+ */
+struct mesh_model_index {
+	struct l_hashmap *groups;
+	struct l_hashmap *virtuals;
+	uint32_t generation;
+	uint32_t built;
+	uint32_t rebuilds;
+	uint32_t messages;
+	uint32_t deliveries;
+	uint32_t max_fanout;
+};
+
 static struct l_queue *mesh_virtuals;
 
 static bool is_internal(uint32_t id)
@@ -349,50 +370,140 @@ static void cfg_update_model_subs(struct mesh_node *node, uint16_t ele_idx,
 	l_dbus_send(dbus, msg);
 }
 
+static void deliver_model(struct mesh_model *mod, struct mod_forward *fwd,
+								uint16_t dst)
+{
+	bool result = false;
+
+	fwd->has_dst = true;
+
+	/* Return, if this is not a internal model */
+	if (!mod->cbs)
+		return;
+
+	if (mod->cbs->recv)
+		result = mod->cbs->recv(fwd->src, dst, fwd->app_idx,
+				fwd->net_idx,
+				fwd->data, fwd->size, mod->user_data);
+
+	if (dst == fwd->unicast && result)
+		fwd->done = true;
+}
+
+static bool model_accepts(struct mesh_model *mod, uint16_t app_idx)
+{
+	if (app_idx == APP_IDX_DEV_LOCAL || app_idx == APP_IDX_DEV_REMOTE)
+		return true;
+
+	return has_binding(mod->bindings, app_idx);
+}
+
+/* Unicast and fixed group addresses reach every model of the element */
 static void forward_model(void *a, void *b)
 {
 	struct mesh_model *mod = a;
 	struct mod_forward *fwd = b;
-	struct mesh_virtual *virt;
-	uint16_t dst;
-	bool result;
 
-	if (fwd->app_idx != APP_IDX_DEV_LOCAL &&
-				fwd->app_idx != APP_IDX_DEV_REMOTE &&
-				!has_binding(mod->bindings, fwd->app_idx))
+	if (!model_accepts(mod, fwd->app_idx))
 		return;
 
-	dst = fwd->dst;
+	deliver_model(mod, fwd, fwd->dst);
+}
+
+static void free_targets(void *data)
+{
+	l_queue_destroy(data, l_free);
+}
+
+static void index_add(struct l_hashmap *map, const void *key,
+					struct mesh_model *mod, uint8_t ele_idx)
+{
+	struct l_queue *targets = l_hashmap_lookup(map, key);
+	struct sub_target *target;
+
+	if (!targets) {
+		targets = l_queue_new();
+		l_hashmap_insert(map, key, targets);
+	}
+
+	target = l_new(struct sub_target, 1);
+	target->mod = mod;
+	target->ele_idx = ele_idx;
+	l_queue_push_tail(targets, target);
+}
+
+static void index_rebuild(struct mesh_node *node,
+					struct mesh_model_index *index)
+{
+	uint8_t i, num_ele = node_get_num_elements(node);
+
+	l_hashmap_destroy(index->groups, free_targets);
+	l_hashmap_destroy(index->virtuals, free_targets);
+	index->groups = l_hashmap_new();
+	index->virtuals = l_hashmap_new();
 
-	if (dst == fwd->unicast || IS_FIXED_GROUP_ADDRESS(dst)) {
-		fwd->has_dst = true;
-	} else if (fwd->virt) {
-		virt = l_queue_find(mod->virtuals, simple_match, fwd->virt);
-		if (virt) {
-			fwd->has_dst = true;
-			dst = virt->addr;
+	/* Keep element and model order so delivery order is unchanged */
+	for (i = 0; i < num_ele; i++) {
+		const struct l_queue_entry *mod_entry, *entry;
+
+		mod_entry = l_queue_get_entries(node_get_element_models(node,
+									i));
+
+		for (; mod_entry; mod_entry = mod_entry->next) {
+			struct mesh_model *mod = mod_entry->data;
+
+			entry = l_queue_get_entries(mod->subs);
+			for (; entry; entry = entry->next)
+				index_add(index->groups, entry->data, mod, i);
+
+			entry = l_queue_get_entries(mod->virtuals);
+			for (; entry; entry = entry->next)
+				index_add(index->virtuals, entry->data, mod, i);
 		}
-	} else {
-		if (l_queue_find(mod->subs, simple_match, L_UINT_TO_PTR(dst)))
-			fwd->has_dst = true;
 	}
 
-	if (!fwd->has_dst)
-		return;
+	index->built = index->generation;
+	index->rebuilds++;
+}
 
-	/* Return, if this is not a internal model */
-	if (!mod->cbs)
-		return;
+static struct mesh_model_index *get_index(struct mesh_node *node)
+{
+	struct mesh_model_index *index = node_get_model_index(node);
 
-	result = false;
+	if (!index) {
+		index = l_new(struct mesh_model_index, 1);
+		index->generation = 1;
+		node_set_model_index(node, index);
+	}
 
-	if (mod->cbs->recv)
-		result = mod->cbs->recv(fwd->src, dst, fwd->app_idx,
-				fwd->net_idx,
-				fwd->data, fwd->size, mod->user_data);
+	if (index->built != index->generation)
+		index_rebuild(node, index);
 
-	if (dst == fwd->unicast && result)
-		fwd->done = true;
+	return index;
+}
+
+/* Called on every subscription change of the node */
+static void subs_changed(struct mesh_node *node)
+{
+	struct mesh_model_index *index = node_get_model_index(node);
+
+	if (index)
+		index->generation++;
+}
+
+void mesh_model_index_free(struct mesh_model_index *index)
+{
+	if (!index)
+		return;
+
+	l_debug("Model dispatch: %u msgs, %u deliveries, max fan-out %u, "
+				"%u rebuilds", index->messages,
+				index->deliveries, index->max_fanout,
+				index->rebuilds);
+
+	l_hashmap_destroy(index->groups, free_targets);
+	l_hashmap_destroy(index->virtuals, free_targets);
+	l_free(index);
 }
 
 static int app_packet_decrypt(struct mesh_net *net, const uint8_t *data,
@@ -752,7 +863,7 @@ static int set_virt_pub(struct mesh_model *mod, const uint8_t *label,
 								interval);
 }
 
-static int add_virt_sub(struct mesh_net *net, struct mesh_model *mod,
+static int add_virt_sub(struct mesh_node *node, struct mesh_model *mod,
 				const uint8_t *label, uint16_t *addr)
 {
 	struct mesh_virtual *virt = l_queue_find(mod->virtuals,
@@ -764,7 +875,8 @@ static int add_virt_sub(struct mesh_net *net, struct mesh_model *mod,
 			return MESH_STATUS_INSUFF_RESOURCES;
 
 		l_queue_push_head(mod->virtuals, virt);
-		mesh_net_dst_reg(net, virt->addr);
+		subs_changed(node);
+		mesh_net_dst_reg(node_get_net(node), virt->addr);
 		l_debug("Added virtual sub addr %4.4x", virt->addr);
 	}
 
@@ -774,7 +886,7 @@ static int add_virt_sub(struct mesh_net *net, struct mesh_model *mod,
 	return MESH_STATUS_SUCCESS;
 }
 
-static int add_sub(struct mesh_net *net, struct mesh_model *mod,
+static int add_sub(struct mesh_node *node, struct mesh_model *mod,
 							uint16_t addr)
 {
 	if (!mod->subs)
@@ -788,7 +900,8 @@ static int add_sub(struct mesh_net *net, struct mesh_model *mod,
 		return MESH_STATUS_INSUFF_RESOURCES;
 
 	l_queue_push_tail(mod->subs, L_UINT_TO_PTR(addr));
-	mesh_net_dst_reg(net, addr);
+	subs_changed(node);
+	mesh_net_dst_reg(node_get_net(node), addr);
 	l_debug("Added group subscription %4.4x", addr);
 
 	return MESH_STATUS_SUCCESS;
@@ -875,6 +988,85 @@ static void send_msg_rcvd(struct mesh_node *node, uint8_t ele_idx,
 	l_dbus_send(dbus, msg);
 }
 
+/*
+ * Cycle through external models if the message has not been handled by
+ * internal models
+ */
+static void forward_external(struct mesh_node *node, uint8_t ele_idx,
+				struct mod_forward *fwd, int decrypt_idx)
+{
+	if (!fwd->has_dst || fwd->done)
+		return;
+
+	if ((decrypt_idx & APP_IDX_MASK) == decrypt_idx)
+		send_msg_rcvd(node, ele_idx, fwd->src, fwd->dst, fwd->virt,
+					fwd->app_idx, fwd->size, fwd->data);
+	else if (decrypt_idx == APP_IDX_DEV_REMOTE ||
+					decrypt_idx == APP_IDX_DEV_LOCAL)
+		send_dev_key_msg_rcvd(node, ele_idx, fwd->src, decrypt_idx,
+					fwd->net_idx, fwd->size, fwd->data);
+}
+
+/*
+ * Deliver a group or virtual addressed message only to the models that
+ * are subscribed to it, element by element.
+ */
+static bool forward_subscribers(struct mesh_node *node,
+				struct mod_forward *fwd, int decrypt_idx)
+{
+	struct mesh_model_index *index = get_index(node);
+	const struct l_queue_entry *entry;
+	struct l_queue *targets;
+	uint16_t primary = node_get_primary(node);
+	uint32_t fanout = 0;
+	int ele_idx = -1;
+	bool result = false;
+
+	if (fwd->virt)
+		targets = l_hashmap_lookup(index->virtuals, fwd->virt);
+	else
+		targets = l_hashmap_lookup(index->groups,
+						L_UINT_TO_PTR(fwd->dst));
+
+	index->messages++;
+
+	for (entry = l_queue_get_entries(targets); entry;
+							entry = entry->next) {
+		struct sub_target *target = entry->data;
+
+		if (target->ele_idx != ele_idx) {
+			if (ele_idx >= 0) {
+				forward_external(node, ele_idx, fwd,
+								decrypt_idx);
+				result |= fwd->has_dst | fwd->done;
+			}
+
+			ele_idx = target->ele_idx;
+			fwd->unicast = primary + ele_idx;
+			fwd->has_dst = false;
+		}
+
+		if (!model_accepts(target->mod, fwd->app_idx))
+			continue;
+
+		deliver_model(target->mod, fwd,
+					fwd->virt ? fwd->virt->addr : fwd->dst);
+		fanout++;
+	}
+
+	if (ele_idx >= 0) {
+		forward_external(node, ele_idx, fwd, decrypt_idx);
+		result |= fwd->has_dst | fwd->done;
+	}
+
+	index->deliveries += fanout;
+
+	if (fanout > index->max_fanout)
+		index->max_fanout = fanout;
+
+	return result;
+}
+
 bool mesh_model_rx(struct mesh_node *node, bool szmict, uint32_t seq0,
 			uint32_t iv_index, uint16_t net_idx, uint16_t src,
 			uint16_t dst, uint8_t key_aid, const uint8_t *data,
@@ -894,7 +1086,6 @@ bool mesh_model_rx(struct mesh_node *node, bool szmict, uint32_t seq0,
 	uint16_t addr;
 	struct mesh_virtual *decrypt_virt = NULL;
 	bool result = false;
-	bool is_subscription;
 
 	l_debug("iv_index %8.8x key_aid = %2.2x", iv_index, key_aid);
 	if (!dst)
@@ -945,56 +1136,32 @@ bool mesh_model_rx(struct mesh_node *node, bool szmict, uint32_t seq0,
 	if (!num_ele || IS_UNASSIGNED(addr))
 		goto done;
 
-	is_subscription = !(IS_UNICAST(dst));
-
-	for (i = 0; i < num_ele; i++) {
-		struct l_queue *models;
+	if (!IS_UNICAST(dst) && !IS_FIXED_GROUP_ADDRESS(dst)) {
+		result = forward_subscribers(node, &forward, decrypt_idx);
+		goto done;
+	}
 
-		if (!is_subscription && ele_idx != i)
-			continue;
+	/*
+	 * Unicast messages go to the addressed element, while the fixed
+	 * group addresses, i.e., all-proxies, all-friends, all-relays,
+	 * all-nodes, are delivered to the primary element only.
+	 */
+	i = IS_UNICAST(dst) ? ele_idx : 0;
 
-		forward.unicast = addr + i;
-		forward.has_dst = false;
+	forward.unicast = addr + i;
+	forward.has_dst = false;
 
-		models = node_get_element_models(node, i);
+	/* Internal models */
+	l_queue_foreach(node_get_element_models(node, i), forward_model,
+								&forward);
 
-		/* Internal models */
-		l_queue_foreach(models, forward_model, &forward);
-
-		/*
-		 * Cycle through external models if the message has not been
-		 * handled by internal models
-		 */
-		if (forward.has_dst && !forward.done) {
-			if ((decrypt_idx & APP_IDX_MASK) == decrypt_idx)
-				send_msg_rcvd(node, i, src, dst, decrypt_virt,
-						forward.app_idx, forward.size,
-						forward.data);
-			else if (decrypt_idx == APP_IDX_DEV_REMOTE ||
-				 decrypt_idx == APP_IDX_DEV_LOCAL)
-				send_dev_key_msg_rcvd(node, i, src, decrypt_idx,
-							net_idx, forward.size,
-								forward.data);
-		}
+	forward_external(node, i, &forward, decrypt_idx);
 
-		/*
-		 * Either the message has been processed internally or
-		 * has been passed on to an external model.
-		 */
-		result |= forward.has_dst | forward.done;
-
-		/* If the message was to unicast address, we are done */
-		if (!is_subscription && ele_idx == i)
-			break;
-
-		/*
-		 * For the fixed group addresses, i.e., all-proxies,
-		 * all-friends, all-relays, all-nodes, the message is delivered
-		 * to a primary element only.
-		 */
-		if (IS_FIXED_GROUP_ADDRESS(dst))
-			break;
-	}
+	/*
+	 * Either the message has been processed internally or
+	 * has been passed on to an external model.
+	 */
+	result = forward.has_dst | forward.done;
 
 done:
 	l_free(clear_text);
@@ -1183,6 +1350,7 @@ static void remove_subs(struct mesh_node *node, struct mesh_model *mod)
 
 	l_queue_clear(mod->subs, NULL);
 	l_queue_clear(mod->virtuals, unref_virt);
+	subs_changed(node);
 }
 
 static struct mesh_model *model_new(uint32_t id)
@@ -1458,7 +1626,7 @@ int mesh_model_sub_add(struct mesh_node *node, uint16_t ele_addr, uint32_t id,
 	if (!mod->sub_enabled || (mod->cbs && !(mod->cbs->sub)))
 		return MESH_STATUS_NOT_SUB_MOD;
 
-	status = add_sub(node_get_net(node), mod, addr);
+	status = add_sub(node, mod, addr);
 	if (status != MESH_STATUS_SUCCESS)
 		return status;
 
@@ -1486,7 +1654,7 @@ int mesh_model_virt_sub_add(struct mesh_node *node, uint16_t ele_addr,
 	if (!mod->sub_enabled || (mod->cbs && !(mod->cbs->sub)))
 		return MESH_STATUS_NOT_SUB_MOD;
 
-	status = add_virt_sub(node_get_net(node), mod, label, pub_addr);
+	status = add_virt_sub(node, mod, label, pub_addr);
 
 	if (status != MESH_STATUS_SUCCESS)
 		return status;
@@ -1516,8 +1684,9 @@ int mesh_model_sub_ovrt(struct mesh_node *node, uint16_t ele_addr, uint32_t id,
 
 	l_queue_clear(mod->subs, NULL);
 	l_queue_clear(mod->virtuals, unref_virt);
+	subs_changed(node);
 
-	add_sub(node_get_net(node), mod, addr);
+	add_sub(node, mod, addr);
 
 	if (!mod->cbs)
 		/* External models */
@@ -1545,8 +1714,9 @@ int mesh_model_virt_sub_ovrt(struct mesh_node *node, uint16_t ele_addr,
 
 	l_queue_clear(mod->subs, NULL);
 	l_queue_clear(mod->virtuals, unref_virt);
+	subs_changed(node);
 
-	status = add_virt_sub(node_get_net(node), mod, label, addr);
+	status = add_virt_sub(node, mod, label, addr);
 
 	if (!mod->cbs)
 		/* External models */
@@ -1572,6 +1742,7 @@ int mesh_model_sub_del(struct mesh_node *node, uint16_t ele_addr, uint32_t id,
 		return MESH_STATUS_NOT_SUB_MOD;
 
 	if (l_queue_remove(mod->subs, L_UINT_TO_PTR(addr))) {
+		subs_changed(node);
 		mesh_net_dst_unreg(node_get_net(node), addr);
 
 		if (!mod->cbs)
@@ -1603,6 +1774,7 @@ int mesh_model_virt_sub_del(struct mesh_node *node, uint16_t ele_addr,
 	virt = l_queue_remove_if(mod->virtuals, find_virt_by_label, label);
 
 	if (virt) {
+		subs_changed(node);
 		*addr = virt->addr;
 		unref_virt(virt);
 	} else {
@@ -1646,7 +1818,8 @@ int mesh_model_sub_del_all(struct mesh_node *node, uint16_t ele_addr,
 	return MESH_STATUS_SUCCESS;
 }
 
-static struct mesh_model *model_setup(struct mesh_net *net, uint8_t ele_idx,
+static struct mesh_model *model_setup(struct mesh_node *node,
+					uint8_t ele_idx,
 					struct mesh_config_model *db_mod)
 {
 	struct mesh_model *mod;
@@ -1713,9 +1886,9 @@ static struct mesh_model *model_setup(struct mesh_net *net, uint8_t ele_idx,
 		struct mesh_config_sub *sub = &db_mod->subs[i];
 
 		if (!sub->virt)
-			add_sub(net, mod, sub->addr.grp);
+			add_sub(node, mod, sub->addr.grp);
 		else
-			add_virt_sub(net, mod, sub->addr.label, NULL);
+			add_virt_sub(node, mod, sub->addr.label, NULL);
 	}
 
 	return mod;
@@ -1724,7 +1897,6 @@ static struct mesh_model *model_setup(struct mesh_net *net, uint8_t ele_idx,
 bool mesh_model_add_from_storage(struct mesh_node *node, uint8_t ele_idx,
 				struct l_queue *mods, struct l_queue *db_mods)
 {
-	struct mesh_net *net = node_get_net(node);
 	const struct l_queue_entry *entry;
 
 	/* Allow empty elements */
@@ -1746,7 +1918,7 @@ bool mesh_model_add_from_storage(struct mesh_node *node, uint8_t ele_idx,
 		if (l_queue_find(mods, match_model_id, L_UINT_TO_PTR(id)))
 			return false;
 
-		mod = model_setup(net, ele_idx, db_mod);
+		mod = model_setup(node, ele_idx, db_mod);
 		if (!mod)
 			return false;
 
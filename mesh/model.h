@@ -26,6 +26,7 @@ struct mesh_model;
 #define VENDOR_ID(x)	((x) >> 16)
 
 struct mesh_virtual;
+struct mesh_model_index;
 
 struct mesh_model_pub {
 	struct mesh_virtual *virt;
@@ -122,3 +123,4 @@ uint16_t mesh_model_generate_composition(struct l_queue *mods, uint16_t buf_sz,
 								uint8_t *buf);
 void mesh_model_init(void);
 void mesh_model_cleanup(void);
+void mesh_model_index_free(struct mesh_model_index *index);
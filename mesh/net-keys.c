@@ -31,6 +31,8 @@
 /* This allows daemon to skip decryption on recently seen beacons */
 #define BEACON_CACHE_MAX	10
 
+#define NID_MASK		0x7f
+
 struct beacon_rx {
 	uint8_t data[BEACON_LEN_MAX];
 	uint32_t id;
@@ -75,6 +77,10 @@ static struct l_queue *beacons;
 static struct l_queue *keys;
 static uint32_t last_flooding_id;
 
+/* Decryption candidates, bucketed by NID (in the same order as keys) */
+static struct l_queue *nid_keys[NID_MASK + 1];
+static struct net_key_stats stats;
+
 /* To avoid re-decrypting same packet for multiple nodes, cache and check */
 static uint8_t cache_pkt[MESH_NET_MAX_PDU_LEN];
 static uint8_t cache_plain[MESH_NET_MAX_PDU_LEN];
@@ -106,6 +112,31 @@ static bool match_network(const void *a, const void *b)
 	return memcmp(key->net_id, net_id, sizeof(key->net_id)) == 0;
 }
 
+static void nid_key_add(struct net_key *key, bool head)
+{
+	uint8_t nid = key->nid & NID_MASK;
+
+	if (!nid_keys[nid])
+		nid_keys[nid] = l_queue_new();
+
+	if (head)
+		l_queue_push_head(nid_keys[nid], key);
+	else
+		l_queue_push_tail(nid_keys[nid], key);
+}
+
+static void nid_key_remove(struct net_key *key)
+{
+	uint8_t nid = key->nid & NID_MASK;
+
+	l_queue_remove(nid_keys[nid], key);
+
+	if (l_queue_isempty(nid_keys[nid])) {
+		l_queue_destroy(nid_keys[nid], NULL);
+		nid_keys[nid] = NULL;
+	}
+}
+
 /* Key added from Provisioning, NetKey Add or NetKey update */
 uint32_t net_key_add(const uint8_t flooding[16])
 {
@@ -147,6 +178,7 @@ uint32_t net_key_add(const uint8_t flooding[16])
 
 	key->id = ++last_flooding_id;
 	l_queue_push_tail(keys, key);
+	nid_key_add(key, false);
 	return key->id;
 
 fail:
@@ -185,6 +217,7 @@ uint32_t net_key_frnd_add(uint32_t flooding_id, uint16_t lpn, uint16_t frnd,
 	frnd_key->ref_cnt++;
 	frnd_key->id = ++last_flooding_id;
 	l_queue_push_head(keys, frnd_key);
+	nid_key_add(frnd_key, true);
 
 	return frnd_key->id;
 }
@@ -197,6 +230,7 @@ void net_key_unref(uint32_t id)
 		if (--key->ref_cnt == 0) {
 			l_timeout_remove(key->observe.timeout);
 			l_queue_remove(keys, key);
+			nid_key_remove(key);
 			l_free(key);
 		}
 	}
@@ -229,9 +263,11 @@ static void decrypt_net_pkt(void *a, void *b)
 	const struct net_key *key = a;
 	bool result;
 
-	if (cache_id || !key->ref_cnt || (cache_pkt[0] & 0x7f) != key->nid)
+	if (cache_id || !key->ref_cnt ||
+				(cache_pkt[0] & NID_MASK) != key->nid)
 		return;
 
+	stats.attempts++;
 	result = mesh_crypto_packet_decode(cache_pkt, cache_len, false,
 						cache_plain, cache_iv_index,
 						key->enc_key, key->prv_key);
@@ -239,18 +275,22 @@ static void decrypt_net_pkt(void *a, void *b)
 	if (result) {
 		cache_id = key->id;
 		cache_plainlen = cache_len;
+		stats.decrypted++;
 	}
 }
 
 uint32_t net_key_decrypt(uint32_t iv_index, const uint8_t *pkt, size_t len,
 					uint8_t **plain, size_t *plain_len)
 {
+	stats.lookups++;
+
 	/* If we already successfully decrypted this packet, use cached data */
 	if (cache_id && cache_len == len && !memcmp(pkt, cache_pkt, len)) {
 		/* IV Index must match what was used to decrypt */
 		if (cache_iv_index != iv_index)
 			return 0;
 
+		stats.cache_hits++;
 		goto done;
 	}
 
@@ -259,8 +299,8 @@ uint32_t net_key_decrypt(uint32_t iv_index, const uint8_t *pkt, size_t len,
 	cache_len = len;
 	cache_iv_index = iv_index;
 
-	/* Try all network keys known to us */
-	l_queue_foreach(keys, decrypt_net_pkt, NULL);
+	/* Try the network keys known to us with a matching NID */
+	l_queue_foreach(nid_keys[pkt[0] & NID_MASK], decrypt_net_pkt, NULL);
 
 done:
 	if (cache_id) {
@@ -790,8 +830,20 @@ static void free_key(void *data)
 	l_free(key);
 }
 
+void net_key_get_stats(struct net_key_stats *out)
+{
+	*out = stats;
+}
+
 void net_key_cleanup(void)
 {
+	int i;
+
+	for (i = 0; i <= NID_MASK; i++) {
+		l_queue_destroy(nid_keys[i], NULL);
+		nid_keys[i] = NULL;
+	}
+
 	l_queue_destroy(keys, free_key);
 	keys = NULL;
 	l_queue_destroy(beacons, l_free);
@@ -17,7 +17,15 @@
 #define IV_INDEX_UPDATE		0x02
 #define NET_MPB_REFRESH_DEFAULT	60
 
+struct net_key_stats {
+	uint32_t lookups;	/* Calls to net_key_decrypt() */
+	uint32_t cache_hits;	/* Served from the last decrypted packet */
+	uint32_t attempts;	/* Decryptions tried with a NID matching key */
+	uint32_t decrypted;	/* Successful decryptions */
+};
+
 void net_key_cleanup(void);
+void net_key_get_stats(struct net_key_stats *stats);
 bool net_key_confirm(uint32_t id, const uint8_t flooding[16]);
 bool net_key_retrieve(uint32_t id, uint8_t *flooding);
 uint32_t net_key_add(const uint8_t flooding[16]);
@@ -58,6 +58,14 @@
 
 #define FAST_CACHE_SIZE 8
 
+/* Incoming segmented messages tracked at once, one bit each in sar_pool */
+#define SAR_POOL_SIZE	32
+#define SAR_POOL_HASH	64
+#define SAR_POOL_BUF	MAX_SEG_TO_LEN(SEG_MASK)
+
+/* Finished Friend reassembly buffers kept for reuse */
+#define FRND_SAR_POOL_SIZE	8
+
 enum _relay_advice {
 	RELAY_NONE,		/* Relay not enabled in node */
 	RELAY_ALLOWED,		/* Relay enabled, msg not to node's unicast */
@@ -86,6 +94,44 @@ struct mesh_subnet {
 	uint8_t kr_phase;
 };
 
+/*
+ * Fixed size cache of recently seen messages. Entries are kept in a ring
+ * so that the oldest one is evicted first, and indexed by an open
+ * addressing (linear probing) table holding ring slot + 1.
+ */
+struct net_cache_entry {
+	uint64_t key;
+	uint32_t ext;
+	uint32_t hash;
+};
+
+struct net_cache {
+	struct net_cache_entry *ring;
+	uint16_t *index;
+	unsigned int size;
+	unsigned int mask;
+	unsigned int head;
+	unsigned int count;
+	uint32_t hits;
+	uint32_t misses;
+};
+
+/*
+ * Incoming SAR contexts are taken from a fixed set of slots, each with a
+ * buffer for the largest segmented message, and found by source address
+ * through a small chained hash. Only one message per source is
+ * reassembled at a time, newer SeqAuth replacing older.
+ */
+struct sar_pool {
+	struct mesh_sar *slots[SAR_POOL_SIZE];
+	uint8_t index[SAR_POOL_HASH];
+	uint32_t busy;
+	uint32_t msgs;
+	uint32_t evicted;
+	uint32_t dropped;
+	uint8_t max_busy;
+};
+
 struct mesh_net {
 	struct mesh_io *io;
 	struct mesh_node *node;
@@ -129,25 +175,21 @@ struct mesh_net {
 	uint16_t features;
 
 	struct l_queue *subnets;
-	struct l_queue *msg_cache;
-	struct l_queue *replay_cache;
-	struct l_queue *sar_in;
+	struct net_cache msg_cache;
+	struct l_hashmap *replay_cache;
+	struct sar_pool sar_in;
 	struct l_queue *sar_out;
 	struct l_queue *sar_queue;
 	struct l_queue *frnd_msgs;
+	struct l_queue *frnd_msg_pool;
 	struct l_queue *friends;
 	struct l_queue *negotiations;
 	struct l_queue *destinations;
 };
 
-struct mesh_msg {
-	uint16_t src;
-	uint32_t seq;
-	uint32_t mic;
-};
-
 struct mesh_sar {
 	unsigned int id;
+	struct mesh_net *net;
 	struct l_timeout *seg_timeout;
 	struct l_timeout *msg_timeout;
 	uint32_t flags;
@@ -168,6 +210,8 @@ struct mesh_sar {
 	uint8_t ttl;
 	uint8_t last_seg;
 	uint8_t key_aid;
+	uint8_t slot;
+	uint8_t hash_next;
 	uint8_t buf[4]; /* Large enough for ACK-Flags and MIC */
 };
 
@@ -206,11 +250,115 @@ struct net_beacon_data {
 	bool local;
 };
 
-static struct l_queue *fast_cache;
+static struct net_cache fast_cache;
 static struct l_queue *nets;
 
 static void net_rx(void *net_ptr, void *user_data);
 
+static void net_cache_init(struct net_cache *cache, unsigned int size)
+{
+	unsigned int slots = 1;
+
+	/* Keep the index at most half full */
+	while (slots < size * 2)
+		slots <<= 1;
+
+	cache->ring = l_new(struct net_cache_entry, size);
+	cache->index = l_new(uint16_t, slots);
+	cache->size = size;
+	cache->mask = slots - 1;
+	cache->head = 0;
+	cache->count = 0;
+	cache->hits = 0;
+	cache->misses = 0;
+}
+
+static void net_cache_free(struct net_cache *cache)
+{
+	l_free(cache->ring);
+	l_free(cache->index);
+	memset(cache, 0, sizeof(*cache));
+}
+
+static void net_cache_clear(struct net_cache *cache)
+{
+	memset(cache->index, 0, (cache->mask + 1) * sizeof(uint16_t));
+	cache->head = 0;
+	cache->count = 0;
+}
+
+static uint32_t net_cache_hash(uint64_t key, uint32_t ext)
+{
+	key ^= (uint64_t) ext << 24;
+	key *= 0x9e3779b97f4a7c15ULL;
+
+	return key >> 32;
+}
+
+static void net_cache_unindex(struct net_cache *cache, unsigned int slot)
+{
+	unsigned int i, j, home;
+
+	i = cache->ring[slot].hash & cache->mask;
+	while (cache->index[i] != slot + 1)
+		i = (i + 1) & cache->mask;
+
+	/* Shift back any entry that probed past the freed position */
+	for (j = (i + 1) & cache->mask; cache->index[j];
+						j = (j + 1) & cache->mask) {
+		home = cache->ring[cache->index[j] - 1].hash & cache->mask;
+
+		if (((j - home) & cache->mask) >= ((j - i) & cache->mask)) {
+			cache->index[i] = cache->index[j];
+			i = j;
+		}
+	}
+
+	cache->index[i] = 0;
+}
+
+/* Returns true if already cached, otherwise adds the entry */
+static bool net_cache_check(struct net_cache *cache, uint64_t key,
+								uint32_t ext)
+{
+	struct net_cache_entry *entry;
+	uint32_t hash = net_cache_hash(key, ext);
+	unsigned int i, slot;
+
+	for (i = hash & cache->mask; cache->index[i];
+						i = (i + 1) & cache->mask) {
+		entry = &cache->ring[cache->index[i] - 1];
+
+		if (entry->key == key && entry->ext == ext) {
+			cache->hits++;
+			return true;
+		}
+	}
+
+	cache->misses++;
+
+	/* Evict the oldest entry once full */
+	slot = cache->head;
+	if (cache->count == cache->size) {
+		net_cache_unindex(cache, slot);
+
+		/* Removal may have moved entries around the free position */
+		for (i = hash & cache->mask; cache->index[i];
+						i = (i + 1) & cache->mask)
+			;
+	} else
+		cache->count++;
+
+	entry = &cache->ring[slot];
+	entry->key = key;
+	entry->ext = ext;
+	entry->hash = hash;
+	cache->index[i] = slot + 1;
+	cache->head = (slot + 1) % cache->size;
+
+	return false;
+}
+
 static inline struct mesh_subnet *get_primary_subnet(struct mesh_net *net)
 {
 	return l_queue_peek_head(net->subnets);
@@ -510,6 +658,110 @@ static void mesh_sar_free(void *data)
 	l_free(sar);
 }
 
+static void sar_pool_init(struct sar_pool *pool)
+{
+	memset(pool, 0, sizeof(*pool));
+	memset(pool->index, 0xff, sizeof(pool->index));
+}
+
+static void sar_pool_free(struct sar_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < SAR_POOL_SIZE; i++)
+		mesh_sar_free(pool->slots[i]);
+
+	memset(pool, 0, sizeof(*pool));
+}
+
+static uint8_t *sar_pool_link(struct sar_pool *pool, uint16_t remote)
+{
+	return &pool->index[(remote * 0x9e37u >> 8) & (SAR_POOL_HASH - 1)];
+}
+
+static struct mesh_sar *sar_pool_find(struct sar_pool *pool, uint16_t remote)
+{
+	uint8_t slot = *sar_pool_link(pool, remote);
+
+	while (slot != 0xff) {
+		struct mesh_sar *sar = pool->slots[slot];
+
+		if (sar->remote == remote)
+			return sar;
+
+		slot = sar->hash_next;
+	}
+
+	return NULL;
+}
+
+static void sar_pool_put(struct sar_pool *pool, struct mesh_sar *sar)
+{
+	uint8_t *link = sar_pool_link(pool, sar->remote);
+
+	while (*link != sar->slot)
+		link = &pool->slots[*link]->hash_next;
+
+	*link = sar->hash_next;
+
+	l_timeout_remove(sar->seg_timeout);
+	l_timeout_remove(sar->msg_timeout);
+	sar->seg_timeout = NULL;
+	sar->msg_timeout = NULL;
+
+	pool->busy &= ~(1u << sar->slot);
+}
+
+/* Returns a cleared context, recycling a finished one if all are busy */
+static struct mesh_sar *sar_pool_get(struct mesh_net *net, uint16_t remote)
+{
+	struct sar_pool *pool = &net->sar_in;
+	struct mesh_sar *sar;
+	uint8_t *link;
+	int slot;
+
+	if (pool->busy == 0xffffffff) {
+		for (slot = 0; slot < SAR_POOL_SIZE; slot++) {
+			if (pool->slots[slot]->delete)
+				break;
+		}
+
+		if (slot == SAR_POOL_SIZE) {
+			l_error("All %u SAR contexts busy, dropping segment "
+					"from %4.4x", SAR_POOL_SIZE, remote);
+			pool->dropped++;
+			return NULL;
+		}
+
+		sar_pool_put(pool, pool->slots[slot]);
+		pool->evicted++;
+	}
+
+	slot = __builtin_ctz(~pool->busy);
+	sar = pool->slots[slot];
+
+	if (!sar) {
+		sar = mesh_sar_new(SAR_POOL_BUF);
+		pool->slots[slot] = sar;
+	} else
+		memset(sar, 0, sizeof(*sar));
+
+	link = sar_pool_link(pool, remote);
+	sar->net = net;
+	sar->slot = slot;
+	sar->remote = remote;
+	sar->hash_next = *link;
+	*link = slot;
+
+	pool->busy |= 1u << slot;
+	pool->msgs++;
+
+	if (__builtin_popcount(pool->busy) > pool->max_busy)
+		pool->max_busy = __builtin_popcount(pool->busy);
+
+	return sar;
+}
+
 static void subnet_free(void *data)
 {
 	struct mesh_subnet *subnet = data;
@@ -626,20 +878,21 @@ struct mesh_net *mesh_net_new(struct mesh_node *node)
 	net->tx_interval = DEFAULT_TRANSMIT_INTERVAL;
 
 	net->subnets = l_queue_new();
-	net->msg_cache = l_queue_new();
-	net->sar_in = l_queue_new();
+	net_cache_init(&net->msg_cache, MSG_CACHE_SIZE);
+	sar_pool_init(&net->sar_in);
 	net->sar_out = l_queue_new();
 	net->sar_queue = l_queue_new();
 	net->frnd_msgs = l_queue_new();
+	net->frnd_msg_pool = l_queue_new();
 	net->destinations = l_queue_new();
 	net->app_keys = l_queue_new();
-	net->replay_cache = l_queue_new();
+	net->replay_cache = l_hashmap_new();
 
 	if (!nets)
 		nets = l_queue_new();
 
-	if (!fast_cache)
-		fast_cache = l_queue_new();
+	if (!fast_cache.size)
+		net_cache_init(&fast_cache, FAST_CACHE_SIZE);
 
 	return net;
 }
@@ -647,17 +900,31 @@ struct mesh_net *mesh_net_new(struct mesh_node *node)
 void mesh_net_free(void *user_data)
 {
 	struct mesh_net *net = user_data;
+	struct mesh_net_cache_stats stats;
+	struct net_key_stats key_stats;
 
 	if (!net)
 		return;
 
+	mesh_net_get_cache_stats(net, &stats);
+	net_key_get_stats(&key_stats);
+
+	l_debug("Cache hits: fast %u/%u msg %u/%u decrypt %u/%u",
+			stats.fast_hits, stats.fast_hits + stats.fast_misses,
+			stats.msg_hits, stats.msg_hits + stats.msg_misses,
+			key_stats.cache_hits, key_stats.lookups);
+	l_debug("SAR in: %u msgs, max %u/%u busy, %u recycled, %u dropped",
+			net->sar_in.msgs, net->sar_in.max_busy, SAR_POOL_SIZE,
+			net->sar_in.evicted, net->sar_in.dropped);
+
 	l_queue_destroy(net->subnets, subnet_free);
-	l_queue_destroy(net->msg_cache, l_free);
-	l_queue_destroy(net->replay_cache, l_free);
-	l_queue_destroy(net->sar_in, mesh_sar_free);
+	net_cache_free(&net->msg_cache);
+	l_hashmap_destroy(net->replay_cache, l_free);
+	sar_pool_free(&net->sar_in);
 	l_queue_destroy(net->sar_out, mesh_sar_free);
 	l_queue_destroy(net->sar_queue, mesh_sar_free);
 	l_queue_destroy(net->frnd_msgs, l_free);
+	l_queue_destroy(net->frnd_msg_pool, l_free);
 	l_queue_destroy(net->friends, mesh_friend_free);
 	l_queue_destroy(net->negotiations, mesh_friend_free);
 	l_queue_destroy(net->destinations, l_free);
@@ -668,8 +935,7 @@ void mesh_net_free(void *user_data)
 
 void mesh_net_cleanup(void)
 {
-	l_queue_destroy(fast_cache, l_free);
-	fast_cache = NULL;
+	net_cache_free(&fast_cache);
 	l_queue_destroy(nets, mesh_net_free);
 	nets = NULL;
 }
@@ -1017,50 +1283,19 @@ void mesh_net_set_frnd_seq(struct mesh_net *net, bool seq)
 	net->friend_seq = seq;
 }
 
-static bool match_cache(const void *a, const void *b)
-{
-	const struct mesh_msg *msg = a;
-	const struct mesh_msg *tst = b;
-
-	if (msg->seq != tst->seq || msg->mic != tst->mic ||
-					msg->src != tst->src)
-		return false;
-
-	return true;
-}
-
 static bool msg_in_cache(struct mesh_net *net, uint16_t src, uint32_t seq,
 								uint32_t mic)
 {
-	struct mesh_msg *msg;
-	struct mesh_msg tst = {
-		.src = src,
-		.seq = seq,
-		.mic = mic,
-	};
-
-	msg = l_queue_find(net->msg_cache, match_cache, &tst);
+	uint64_t key = ((uint64_t) seq << 32) | mic;
 
-	if (msg) {
+	if (net_cache_check(&net->msg_cache, key, src)) {
 		l_debug("Suppressing duplicate %4.4x + %6.6x + %8.8x",
 							src, seq, mic);
 		return true;
 	}
 
-	msg = l_new(struct mesh_msg, 1);
-	*msg = tst;
-	l_queue_push_head(net->msg_cache, msg);
 	l_debug("Add %4.4x + %6.6x + %8.8x", src, seq, mic);
 
-	if (l_queue_length(net->msg_cache) > MSG_CACHE_SIZE) {
-		msg = l_queue_peek_tail(net->msg_cache);
-		/* Remove Tail (oldest msg in cache) */
-		l_debug("Remove %4.4x + %6.6x + %8.8x",
-						msg->src, msg->seq, msg->mic);
-		if (l_queue_remove(net->msg_cache, msg))
-			l_free(msg);
-	}
-
 	return false;
 }
 
@@ -1487,31 +1722,18 @@ static void send_net_ack(struct mesh_net *net, struct mesh_sar *sar,
 
 static void inseg_to(struct l_timeout *seg_timeout, void *user_data)
 {
-	struct mesh_net *net = user_data;
-	struct mesh_sar *sar = l_queue_find(net->sar_in,
-					match_seg_timeout, seg_timeout);
-
-	l_timeout_remove(seg_timeout);
-	if (!sar)
-		return;
+	struct mesh_sar *sar = user_data;
 
 	/* Send NAK */
 	l_debug("Timeout %p %3.3x", sar, sar->app_idx);
-	send_net_ack(net, sar, sar->flags);
+	send_net_ack(sar->net, sar, sar->flags);
 
-	sar->seg_timeout = l_timeout_create(SEG_TO, inseg_to, net, NULL);
+	l_timeout_modify(seg_timeout, SEG_TO);
 }
 
 static void inmsg_to(struct l_timeout *msg_timeout, void *user_data)
 {
-	struct mesh_net *net = user_data;
-	struct mesh_sar *sar = l_queue_find(net->sar_in,
-			match_msg_timeout, msg_timeout);
-
-	if (!sar) {
-		l_timeout_remove(msg_timeout);
-		return;
-	}
+	struct mesh_sar *sar = user_data;
 
 	if (!sar->delete) {
 		/*
@@ -1525,8 +1747,7 @@ static void inmsg_to(struct l_timeout *msg_timeout, void *user_data)
 		return;
 	}
 
-	l_queue_remove(net->sar_in, sar);
-	mesh_sar_free(sar);
+	sar_pool_put(&sar->net->sar_in, sar);
 }
 
 static void outmsg_to(struct l_timeout *msg_timeout, void *user_data)
@@ -1637,18 +1858,10 @@ static void outseg_to(struct l_timeout *seg_timeout, void *user_data)
 					sar->seqZero, sar->last_nak);
 }
 
-static bool match_replay_cache(const void *a, const void *b)
-{
-	const struct mesh_rpl *rpe = a;
-	uint16_t src = L_PTR_TO_UINT(b);
-
-	return src == rpe->src;
-}
-
-static bool clean_old_iv_index(void *a, void *b)
+static bool clean_old_iv_index(const void *key, void *value, void *user_data)
 {
-	struct mesh_rpl *rpe = a;
-	uint32_t iv_index = L_PTR_TO_UINT(b);
+	struct mesh_rpl *rpe = value;
+	uint32_t iv_index = L_PTR_TO_UINT(user_data);
 
 	if (iv_index < 2)
 		return false;
@@ -1670,8 +1883,7 @@ static bool msg_check_replay_cache(struct mesh_net *net, uint16_t src,
 	if (!net || !net->node)
 		return true;
 
-	rpe = l_queue_find(net->replay_cache, match_replay_cache,
-						L_UINT_TO_PTR(src));
+	rpe = l_hashmap_lookup(net->replay_cache, L_UINT_TO_PTR(src));
 
 	if (rpe) {
 		if (iv_index > rpe->iv_index)
@@ -1682,10 +1894,10 @@ static bool msg_check_replay_cache(struct mesh_net *net, uint16_t src,
 			l_debug("Ignoring replayed packet");
 			return true;
 		}
-	} else if (l_queue_length(net->replay_cache) >= crpl) {
+	} else if (l_hashmap_size(net->replay_cache) >= crpl) {
 		/* SRC not in Replay Cache... see if there is space for it */
 
-		int ret = l_queue_foreach_remove(net->replay_cache,
+		int ret = l_hashmap_foreach_remove(net->replay_cache,
 				clean_old_iv_index, L_UINT_TO_PTR(iv_index));
 
 		/* Return true if no space could be freed */
@@ -1706,20 +1918,17 @@ static void msg_add_replay_cache(struct mesh_net *net, uint16_t src,
 	if (!net || !net->replay_cache)
 		return;
 
-	rpe = l_queue_remove_if(net->replay_cache, match_replay_cache,
-						L_UINT_TO_PTR(src));
+	rpe = l_hashmap_lookup(net->replay_cache, L_UINT_TO_PTR(src));
 
 	if (!rpe) {
 		rpe = l_new(struct mesh_rpl, 1);
 		rpe->src = src;
+		l_hashmap_insert(net->replay_cache, L_UINT_TO_PTR(src), rpe);
 	}
 
 	rpe->seq = seq;
 	rpe->iv_index = iv_index;
 	rpl_put_entry(net->node, src, iv_index, seq);
-
-	/* Optimize so that most recent conversations stay earliest in cache */
-	l_queue_push_head(net->replay_cache, rpe);
 }
 
 static bool msg_rxed(struct mesh_net *net, bool frnd, uint32_t iv_index,
@@ -1833,6 +2042,39 @@ static bool match_frnd_sar_dst(const void *a, const void *b)
 	return frnd_msg->dst == dst;
 }
 
+/*
+ * Friend reassembly buffers are sized for the largest segmented message
+ * so that they can be reused for any message once it has been handed to
+ * the Friend queues.
+ */
+static struct mesh_friend_msg *frnd_sar_get(struct mesh_net *net)
+{
+	struct mesh_friend_msg *frnd_msg;
+	size_t size;
+
+	frnd_msg = l_queue_pop_head(net->frnd_msg_pool);
+	if (!frnd_msg)
+		return mesh_friend_msg_new(SEG_MASK);
+
+	size = sizeof(struct mesh_friend_msg) -
+				sizeof(struct mesh_friend_seg_one);
+	size += (SEG_MASK + 1) * sizeof(struct mesh_friend_seg_12);
+	memset(frnd_msg, 0, size);
+
+	return frnd_msg;
+}
+
+static void frnd_sar_put(struct mesh_net *net,
+					struct mesh_friend_msg *frnd_msg)
+{
+	l_queue_remove(net->frnd_msgs, frnd_msg);
+
+	if (l_queue_length(net->frnd_msg_pool) < FRND_SAR_POOL_SIZE)
+		l_queue_push_head(net->frnd_msg_pool, frnd_msg);
+	else
+		l_free(frnd_msg);
+}
+
 static void friend_seg_rxed(struct mesh_net *net,
 				uint32_t iv_index,
 				uint8_t ttl, uint32_t seq,
@@ -1872,14 +2114,13 @@ static void friend_seg_rxed(struct mesh_net *net,
 
 		/* Flush incomplete old SAR message if it doesn't match */
 		if ((frnd_msg->u.s12[0].hdr & HDR_KEY_MASK) != hdr_key) {
-			l_queue_remove(net->frnd_msgs, frnd_msg);
-			l_free(frnd_msg);
+			frnd_sar_put(net, frnd_msg);
 			frnd_msg = NULL;
 		}
 	}
 
 	if (!frnd_msg) {
-		frnd_msg = mesh_friend_msg_new(segN);
+		frnd_msg = frnd_sar_get(net);
 		frnd_msg->iv_index = iv_index;
 		frnd_msg->src = src;
 		frnd_msg->dst = dst;
@@ -1914,11 +2155,8 @@ static void friend_seg_rxed(struct mesh_net *net,
 					enqueue_friend_pkt, frnd_msg);
 		}
 
-		/* Remove from "in progress" queue */
-		l_queue_remove(net->frnd_msgs, frnd_msg);
-
-		/* TODO Optimization(?): Unicast messages keep this buffer */
-		l_free(frnd_msg);
+		/* Friend queues hold copies, recycle the buffer */
+		frnd_sar_put(net, frnd_msg);
 		return;
 	}
 
@@ -1949,8 +2187,7 @@ static bool seg_rxed(struct mesh_net *net, bool frnd, uint32_t iv_index,
 	 * DST could receive additional Segments after
 	 * completing due to a lost ACK, so re-ACK and discard
 	 */
-	sar_in = l_queue_find(net->sar_in, match_sar_remote,
-						L_UINT_TO_PTR(src));
+	sar_in = sar_pool_find(&net->sar_in, src);
 
 	/* Discard *old* incoming-SAR-in-progress if this segment newer */
 	seqAuth = seq_auth(seq, seqZero);
@@ -1967,8 +2204,7 @@ static bool seg_rxed(struct mesh_net *net, bool frnd, uint32_t iv_index,
 
 		if (newer) {
 			/* Cancel Old, start New */
-			l_queue_remove(net->sar_in, sar_in);
-			mesh_sar_free(sar_in);
+			sar_pool_put(&net->sar_in, sar_in);
 			sar_in = NULL;
 		} else
 			/* Ignore Old */
@@ -1997,22 +2233,24 @@ static bool seg_rxed(struct mesh_net *net, bool frnd, uint32_t iv_index,
 
 		l_debug("RXed (new: %04x %06x size: %d len: %d) %d of %d",
 				seqZero, seq, size, len, segO, segN);
-		l_debug("Queue Size: %d", l_queue_length(net->sar_in));
-		sar_in = mesh_sar_new(len);
+		sar_in = sar_pool_get(net, src);
+		if (!sar_in) {
+			l_debug("No free SAR context");
+			return false;
+		}
+
 		sar_in->seqAuth = seqAuth;
 		sar_in->iv_index = iv_index;
 		sar_in->src = dst;
-		sar_in->remote = src;
 		sar_in->seqZero = seqZero;
 		sar_in->key_aid = key_aid;
 		sar_in->len = len;
 		sar_in->last_seg = 0xff;
 		sar_in->net_idx = net_idx;
 		sar_in->msg_timeout = l_timeout_create(MSG_TO,
-					inmsg_to, net, NULL);
+					inmsg_to, sar_in, NULL);
 
 		l_debug("First Seg %4.4x", sar_in->flags);
-		l_queue_push_head(net->sar_in, sar_in);
 	}
 
 	seg_off = segO * MAX_SEG_LEN;
@@ -2049,16 +2287,17 @@ static bool seg_rxed(struct mesh_net *net, bool frnd, uint32_t iv_index,
 	}
 
 	if (reset_seg_to) {
-		/* Restart Inter-Seg Timeout */
-		l_timeout_remove(sar_in->seg_timeout);
-
 		/* if this is the largest outstanding segment, send NAK now */
 		largest = (0xffffffff << segO) & expected;
 		if ((largest & sar_in->flags) == largest)
 			send_net_ack(net, sar_in, sar_in->flags);
 
-		sar_in->seg_timeout = l_timeout_create(SEG_TO,
-				inseg_to, net, NULL);
+		/* Restart Inter-Seg Timeout */
+		if (sar_in->seg_timeout)
+			l_timeout_modify(sar_in->seg_timeout, SEG_TO);
+		else
+			sar_in->seg_timeout = l_timeout_create(SEG_TO,
+						inseg_to, sar_in, NULL);
 	} else
 		largest = 0;
 
@@ -2200,31 +2439,9 @@ static bool ctl_received(struct mesh_net *net, uint32_t net_key_id,
 	return true;
 }
 
-static bool find_fast_hash(const void *a, const void *b)
-{
-	const uint64_t *entry = a;
-	const uint64_t *test = b;
-
-	return *entry == *test;
-}
-
 static bool check_fast_cache(uint64_t hash)
 {
-	void *found = l_queue_find(fast_cache, find_fast_hash, &hash);
-	uint64_t *new_hash;
-
-	if (found)
-		return false;
-
-	if (l_queue_length(fast_cache) >= FAST_CACHE_SIZE)
-		new_hash = l_queue_pop_head(fast_cache);
-	else
-		new_hash = l_malloc(sizeof(hash));
-
-	*new_hash = hash;
-	l_queue_push_tail(fast_cache, new_hash);
-
-	return true;
+	return !net_cache_check(&fast_cache, hash, 0);
 }
 
 static bool match_by_dst(const void *a, const void *b)
@@ -2563,7 +2780,7 @@ static void iv_upd_to(struct l_timeout *upd_timeout, void *user_data)
 							net->iv_index, false);
 		l_queue_foreach(net->subnets, refresh_beacon, net);
 		queue_friend_update(net);
-		l_queue_clear(net->msg_cache, l_free);
+		net_cache_clear(&net->msg_cache);
 		break;
 
 	case IV_UPD_INIT:
@@ -2998,8 +3215,8 @@ bool mesh_net_attach(struct mesh_net *net, struct mesh_io *io)
 		if (!nets)
 			nets = l_queue_new();
 
-		if (!fast_cache)
-			fast_cache = l_queue_new();
+		if (!fast_cache.size)
+			net_cache_init(&fast_cache, FAST_CACHE_SIZE);
 
 		mesh_io_register_recv_cb(io, snb, sizeof(snb),
 							beacon_recv, NULL);
@@ -3053,7 +3270,7 @@ bool mesh_net_iv_index_update(struct mesh_net *net)
 		return false;
 
 	l_debug("iv_upd_state = IV_UPD_UPDATING");
-	l_queue_clear(net->msg_cache, l_free);
+	net_cache_clear(&net->msg_cache);
 
 	if (!mesh_config_write_iv_index(node_config_get(net->node),
 						net->iv_index + 1, true))
@@ -3852,6 +4069,15 @@ int mesh_net_set_heartbeat_pub(struct mesh_net *net, uint16_t dst,
 	return MESH_STATUS_SUCCESS;
 }
 
+void mesh_net_get_cache_stats(struct mesh_net *net,
+					struct mesh_net_cache_stats *stats)
+{
+	stats->fast_hits = fast_cache.hits;
+	stats->fast_misses = fast_cache.misses;
+	stats->msg_hits = net ? net->msg_cache.hits : 0;
+	stats->msg_misses = net ? net->msg_cache.misses : 0;
+}
+
 bool mesh_net_load_rpl(struct mesh_net *net)
 {
 	return rpl_get_list(net->node, net->replay_cache);
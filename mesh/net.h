@@ -212,6 +212,13 @@ struct mesh_friend_msg {
 	} u;
 };
 
+struct mesh_net_cache_stats {
+	uint32_t fast_hits;	/* Same PDU already received */
+	uint32_t fast_misses;
+	uint32_t msg_hits;	/* Same SRC + SEQ + MIC already processed */
+	uint32_t msg_misses;
+};
+
 struct mesh_net *mesh_net_new(struct mesh_node *node);
 void mesh_net_free(void *net);
 void mesh_net_cleanup(void);
@@ -301,6 +308,8 @@ uint16_t mesh_net_get_primary_idx(struct mesh_net *net);
 uint32_t mesh_net_friend_timeout(struct mesh_net *net, uint16_t addr);
 struct mesh_io *mesh_net_get_io(struct mesh_net *net);
 struct mesh_node *mesh_net_node_get(struct mesh_net *net);
+void mesh_net_get_cache_stats(struct mesh_net *net,
+					struct mesh_net_cache_stats *stats);
 bool mesh_net_have_key(struct mesh_net *net, uint16_t net_idx);
 bool mesh_net_is_local_address(struct mesh_net *net, uint16_t src,
 							uint16_t count);
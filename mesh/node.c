@@ -81,6 +81,7 @@ struct mesh_node {
 	char *obj_path;
 	struct mesh_agent *agent;
 	struct mesh_config *cfg;
+	struct mesh_model_index *model_index;
 	char *storage_dir;
 	uint32_t disc_watch;
 	uint32_t seq_number;
@@ -298,11 +299,13 @@ static void free_node_resources(void *data)
 
 	/* Free dynamic resources */
 	free_node_dbus_resources(node);
+	mesh_model_index_free(node->model_index);
 	l_queue_destroy(node->elements, element_free);
 	l_queue_destroy(node->pages, l_free);
 	mesh_agent_remove(node->agent);
 	mesh_config_release(node->cfg);
 	mesh_net_free(node->net);
+	rpl_cleanup(node);
 	l_free(node->storage_dir);
 	l_free(node);
 }
@@ -761,6 +764,17 @@ uint16_t node_get_crpl(struct mesh_node *node)
 	return node->comp.crpl;
 }
 
+struct mesh_model_index *node_get_model_index(struct mesh_node *node)
+{
+	return node->model_index;
+}
+
+void node_set_model_index(struct mesh_node *node,
+					struct mesh_model_index *index)
+{
+	node->model_index = index;
+}
+
 uint8_t node_relay_mode_get(struct mesh_node *node, uint8_t *count,
 							uint16_t *interval)
 {
@@ -1590,6 +1604,10 @@ static bool attach_req_node(struct mesh_node *attach, struct mesh_node *node)
 		new_ele = l_queue_remove_if(node->elements, is_zero, NULL);
 		element_free(new_ele);
 
+		/* The subscription index points at the models freed here */
+		mesh_model_index_free(attach->model_index);
+		attach->model_index = NULL;
+
 		l_queue_destroy(attach->elements, element_free);
 		attach->elements = node->elements;
 		attach->num_ele = node->num_ele;
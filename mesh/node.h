@@ -15,6 +15,7 @@ struct mesh_agent;
 struct mesh_config;
 struct mesh_config_node;
 struct mesh_prov_node_info;
+struct mesh_model_index;
 
 typedef void (*node_ready_func_t) (void *user_data, int status,
 							struct mesh_node *node);
@@ -51,6 +52,9 @@ int node_get_element_idx(struct mesh_node *node, uint16_t ele_addr);
 struct l_queue *node_get_element_models(struct mesh_node *node,
 							uint8_t ele_idx);
 uint16_t node_get_crpl(struct mesh_node *node);
+struct mesh_model_index *node_get_model_index(struct mesh_node *node);
+void node_set_model_index(struct mesh_node *node,
+					struct mesh_model_index *index);
 const uint8_t *node_get_comp(struct mesh_node *node, uint8_t page_num,
 								uint16_t *len);
 bool node_replace_comp(struct mesh_node *node, uint8_t retire, uint8_t with);
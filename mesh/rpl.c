@@ -32,105 +32,478 @@
 #include "mesh/util.h"
 #include "mesh/rpl.h"
 
+/*
+ * The Replay Protection List is kept in an append-only journal under
+ * <node>/rpl/journal. The file starts with an 8 octet header (magic and
+ * version) followed by fixed size records:
+ *
+ *	0	type (RPL_RECORD_PUT or RPL_RECORD_DEL)
+ *	1	reserved
+ *	2-3	src (LE)
+ *	4-7	iv_index (LE)
+ *	8-11	seq (LE)
+ *	12-15	CRC-32 of octets 0-11 (LE)
+ *
+ * When replayed, the last record for a given src wins. A record that fails
+ * its checksum marks a torn write, and the journal is truncated there.
+ * Writes are flushed to storage at most every RPL_SYNC_INTERVAL seconds and
+ * the journal is rewritten with only the live entries once it grows past
+ * its compaction threshold.
+ *
+ * Older versions stored one file per src under <node>/rpl/<iv_index>/,
+ * those trees are imported and removed the first time the list is loaded.
+ */
+
+#define RPL_JOURNAL_MAGIC	"MRPL"
+#define RPL_JOURNAL_VERSION	1
+#define RPL_HEADER_SIZE		8
+#define RPL_RECORD_SIZE		16
+
+#define RPL_RECORD_PUT		0x01
+#define RPL_RECORD_DEL		0x02
+
+#define RPL_SYNC_INTERVAL	2
+#define RPL_COMPACT_MIN		4096
+
+struct rpl_journal {
+	struct mesh_node *node;
+	char *path;
+	int fd;
+	uint32_t records;
+	uint32_t compact_at;
+	uint32_t iv_index;
+	struct l_timeout *sync_to;
+	bool dirty;
+};
+
 static const char *rpl_dir = "/rpl";
+static const char *rpl_journal = "/journal";
 
-bool rpl_put_entry(struct mesh_node *node, uint16_t src, uint32_t iv_index,
-								uint32_t seq)
+static struct l_queue *journals;
+
+static uint32_t rpl_crc32(const uint8_t *data, size_t len)
 {
-	const char *node_path;
-	char src_file[PATH_MAX];
-	char seq_txt[7];
-	bool result = false;
-	DIR *dir;
-	int fd;
+	uint32_t crc = 0xffffffff;
+	int i;
 
-	if (!IS_UNICAST(src))
-		return false;
+	while (len--) {
+		crc ^= *data++;
+
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+
+	return ~crc;
+}
+
+static void record_encode(uint8_t *buf, uint8_t type, uint16_t src,
+						uint32_t iv_index, uint32_t seq)
+{
+	buf[0] = type;
+	buf[1] = 0;
+	l_put_le16(src, buf + 2);
+	l_put_le32(iv_index, buf + 4);
+	l_put_le32(seq, buf + 8);
+	l_put_le32(rpl_crc32(buf, 12), buf + 12);
+}
+
+static void apply_record(struct l_hashmap *rpl_list, uint8_t type,
+				uint16_t src, uint32_t iv_index, uint32_t seq)
+{
+	struct mesh_rpl *rpl;
+
+	if (!rpl_list || !IS_UNICAST(src))
+		return;
+
+	if (type == RPL_RECORD_DEL) {
+		l_free(l_hashmap_remove(rpl_list, L_UINT_TO_PTR(src)));
+		return;
+	}
+
+	if (type != RPL_RECORD_PUT || seq > SEQ_MASK)
+		return;
+
+	rpl = l_hashmap_lookup(rpl_list, L_UINT_TO_PTR(src));
+	if (!rpl) {
+		rpl = l_new(struct mesh_rpl, 1);
+		rpl->src = src;
+		l_hashmap_insert(rpl_list, L_UINT_TO_PTR(src), rpl);
+	}
+
+	rpl->iv_index = iv_index;
+	rpl->seq = seq;
+}
+
+/*
+ * Replays the journal into rpl_list (if not NULL). Returns the number of
+ * valid records and sets len to the length of the valid part of the file,
+ * or returns -1 if the file is not a journal at all.
+ */
+static int journal_read(int fd, struct l_hashmap *rpl_list, off_t *len)
+{
+	struct stat st;
+	uint8_t *buf;
+	off_t pos;
+	ssize_t n;
+	int records = 0;
+
+	*len = 0;
+
+	if (fstat(fd, &st) < 0)
+		return -1;
+
+	if (st.st_size == 0)
+		return 0;
+
+	if (st.st_size < RPL_HEADER_SIZE)
+		return -1;
+
+	buf = l_malloc(st.st_size);
+
+	for (pos = 0; pos < st.st_size; pos += n) {
+		n = pread(fd, buf + pos, st.st_size - pos, pos);
+		if (n <= 0)
+			break;
+	}
+
+	if (pos < RPL_HEADER_SIZE || memcmp(buf, RPL_JOURNAL_MAGIC, 4) ||
+			l_get_le32(buf + 4) != RPL_JOURNAL_VERSION) {
+		l_free(buf);
+		return -1;
+	}
+
+	*len = RPL_HEADER_SIZE;
+
+	while (*len + RPL_RECORD_SIZE <= pos) {
+		const uint8_t *rec = buf + *len;
+
+		if (l_get_le32(rec + 12) != rpl_crc32(rec, 12))
+			break;
+
+		apply_record(rpl_list, rec[0], l_get_le16(rec + 2),
+				l_get_le32(rec + 4), l_get_le32(rec + 8));
+
+		*len += RPL_RECORD_SIZE;
+		records++;
+	}
+
+	l_free(buf);
+
+	return records;
+}
+
+static bool journal_write_header(int fd)
+{
+	uint8_t hdr[RPL_HEADER_SIZE];
+
+	memcpy(hdr, RPL_JOURNAL_MAGIC, 4);
+	l_put_le32(RPL_JOURNAL_VERSION, hdr + 4);
+
+	return write(fd, hdr, sizeof(hdr)) == sizeof(hdr);
+}
+
+static bool match_node(const void *a, const void *b)
+{
+	const struct rpl_journal *journal = a;
+
+	return journal->node == b;
+}
+
+static void journal_free(void *data)
+{
+	struct rpl_journal *journal = data;
+
+	l_timeout_remove(journal->sync_to);
+
+	if (journal->dirty)
+		fdatasync(journal->fd);
+
+	close(journal->fd);
+	l_free(journal->path);
+	l_free(journal);
+}
+
+static void update_compact_at(struct rpl_journal *journal, uint32_t live)
+{
+	journal->compact_at = live * 2;
+
+	if (journal->compact_at < RPL_COMPACT_MIN)
+		journal->compact_at = RPL_COMPACT_MIN;
+}
+
+/*
+ * Opens (creating if needed) the journal of a node and replays it into
+ * rpl_list. A torn tail is cut off and a corrupted journal is reset.
+ */
+static struct rpl_journal *journal_open(struct mesh_node *node,
+						struct l_hashmap *rpl_list)
+{
+	struct rpl_journal *journal;
+	const char *node_path;
+	off_t len;
+	int fd, records;
 
 	node_path = node_get_storage_dir(node);
+	if (!node_path)
+		return NULL;
+
+	if (strlen(node_path) + strlen(rpl_dir) + strlen(rpl_journal) + 5 >=
+								PATH_MAX)
+		return NULL;
+
+	journal = l_new(struct rpl_journal, 1);
+	journal->node = node;
+	journal->path = l_strdup_printf("%s%s%s", node_path, rpl_dir,
+								rpl_journal);
+
+	fd = open(journal->path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC,
+									0600);
+	if (fd < 0) {
+		l_error("Failed to open RPL journal(%d): %s", errno,
+								journal->path);
+		l_free(journal->path);
+		l_free(journal);
+		return NULL;
+	}
 
-	if (strlen(node_path) + strlen(rpl_dir) + 15 >= PATH_MAX)
-		return false;
+	journal->fd = fd;
 
-	snprintf(src_file, PATH_MAX, "%s%s/%8.8x", node_path, rpl_dir,
-								iv_index);
-	dir = opendir(src_file);
+	records = journal_read(fd, rpl_list, &len);
+	if (records < 0) {
+		l_error("Discarding invalid RPL journal: %s", journal->path);
+		records = 0;
+		len = 0;
+	}
 
-	if (!dir) {
-		if (mkdir(src_file, 0755) != 0)
-			l_error("Failed to create dir: %s", src_file);
-	} else
-		closedir(dir);
+	if (ftruncate(fd, len) < 0)
+		l_error("Failed to truncate(%d): %s", errno, journal->path);
 
-	snprintf(src_file, PATH_MAX, "%s%s/%8.8x/%4.4x", node_path, rpl_dir,
-								iv_index, src);
+	if (!len && !journal_write_header(fd))
+		l_error("Failed to write RPL journal: %s", journal->path);
 
-	fd = open(src_file, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	journal->records = records;
+	update_compact_at(journal, 0);
+
+	if (!journals)
+		journals = l_queue_new();
+
+	l_queue_push_tail(journals, journal);
+
+	return journal;
+}
+
+static struct rpl_journal *journal_get(struct mesh_node *node)
+{
+	struct rpl_journal *journal;
+
+	journal = l_queue_find(journals, match_node, node);
+	if (journal)
+		return journal;
+
+	return journal_open(node, NULL);
+}
+
+struct compact_data {
+	uint8_t *buf;
+	uint32_t count;
+	uint32_t iv_index;
+};
+
+static void compact_entry(const void *key, void *value, void *user_data)
+{
+	struct mesh_rpl *rpl = value;
+	struct compact_data *data = user_data;
+
+	/* Entries from before the previous IV Index are of no use */
+	if (data->iv_index > 1 && rpl->iv_index < data->iv_index - 1)
+		return;
+
+	record_encode(data->buf + RPL_HEADER_SIZE +
+					data->count * RPL_RECORD_SIZE,
+			RPL_RECORD_PUT, rpl->src, rpl->iv_index, rpl->seq);
+	data->count++;
+}
+
+static void sync_dir(const char *path)
+{
+	char *dir_path = l_strdup(path);
+	char *sep = strrchr(dir_path, '/');
+	int fd;
+
+	if (sep)
+		*sep = '\0';
+
+	fd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
 	if (fd >= 0) {
-		snprintf(seq_txt, 7, "%6.6x", seq);
-		if (write(fd, seq_txt, 6) == 6)
-			result = true;
+		fsync(fd);
+		close(fd);
+	}
+
+	l_free(dir_path);
+}
+
+/*
+ * Atomically replaces the journal with one record per live entry. If
+ * rpl_list is NULL, the live entries are recovered from the journal.
+ */
+static bool journal_compact(struct rpl_journal *journal,
+						struct l_hashmap *rpl_list)
+{
+	struct l_hashmap *live = rpl_list;
+	struct compact_data data;
+	char *tmp_path;
+	size_t len;
+	off_t valid;
+	int fd;
+	bool result = false;
+
+	l_timeout_remove(journal->sync_to);
+	journal->sync_to = NULL;
+
+	if (!live) {
+		live = l_hashmap_new();
+		journal_read(journal->fd, live, &valid);
+	}
+
+	data.buf = l_malloc(RPL_HEADER_SIZE +
+				l_hashmap_size(live) * RPL_RECORD_SIZE);
+	data.count = 0;
+	data.iv_index = journal->iv_index;
+
+	memcpy(data.buf, RPL_JOURNAL_MAGIC, 4);
+	l_put_le32(RPL_JOURNAL_VERSION, data.buf + 4);
+	l_hashmap_foreach(live, compact_entry, &data);
+
+	len = RPL_HEADER_SIZE + data.count * RPL_RECORD_SIZE;
+	tmp_path = l_strdup_printf("%s.tmp", journal->path);
+
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		l_error("Failed to create(%d): %s", errno, tmp_path);
+		goto done;
+	}
 
+	if (write(fd, data.buf, len) != (ssize_t) len || fdatasync(fd) < 0) {
+		l_error("Failed to write(%d): %s", errno, tmp_path);
 		close(fd);
+		remove(tmp_path);
+		goto done;
 	}
 
-	if (!result)
-		return false;
+	close(fd);
+
+	if (rename(tmp_path, journal->path) < 0) {
+		l_error("Failed to rename(%d): %s", errno, tmp_path);
+		remove(tmp_path);
+		goto done;
+	}
+
+	sync_dir(journal->path);
+
+	fd = open(journal->path, O_RDWR | O_APPEND | O_CLOEXEC);
+	if (fd < 0) {
+		l_error("Failed to open RPL journal(%d): %s", errno,
+								journal->path);
+		goto done;
+	}
+
+	close(journal->fd);
+	journal->fd = fd;
+	journal->records = data.count;
+	journal->dirty = false;
+	update_compact_at(journal, data.count);
+	result = true;
 
-	/* Delete RPL entry from old iv_index (if it exists) */
-	iv_index--;
-	snprintf(src_file, PATH_MAX, "%s%s/%8.8x/%4.4x", node_path, rpl_dir,
-								iv_index, src);
-	if (remove(src_file) < 0 && errno != ENOENT)
-		l_error("Failed to remove(%d): %s", errno, src_file);
+done:
+	l_free(tmp_path);
+	l_free(data.buf);
+
+	if (live != rpl_list)
+		l_hashmap_destroy(live, l_free);
 
 	return result;
 }
 
-void rpl_del_entry(struct mesh_node *node, uint16_t src)
+static void journal_sync(struct rpl_journal *journal)
 {
-	const char *node_path;
-	char rpl_path[PATH_MAX];
-	struct dirent *entry;
-	DIR *dir;
-
-	if (!IS_UNICAST(src))
+	if (journal->records >= journal->compact_at &&
+					journal_compact(journal, NULL))
 		return;
 
-	node_path = node_get_storage_dir(node);
+	if (journal->dirty && fdatasync(journal->fd) < 0)
+		l_error("Failed to sync(%d): %s", errno, journal->path);
 
-	if (strlen(node_path) + strlen(rpl_dir) + 15 >= PATH_MAX)
-		return;
+	journal->dirty = false;
+}
 
-	snprintf(rpl_path, PATH_MAX, "%s%s", node_path, rpl_dir);
-	dir = opendir(rpl_path);
+static void sync_timeout(struct l_timeout *timeout, void *user_data)
+{
+	struct rpl_journal *journal = user_data;
 
-	if (!dir)
-		return;
+	l_timeout_remove(timeout);
+	journal->sync_to = NULL;
 
-	/* Remove all instances of src address */
-	while ((entry = readdir(dir)) != NULL) {
-		if (entry->d_type == DT_DIR && entry->d_name[0] != '.') {
-			snprintf(rpl_path, PATH_MAX, "%s%s/%s/%4.4x",
-					node_path, rpl_dir, entry->d_name, src);
-			if (remove(rpl_path) < 0)
-				l_error("Failed to remove(%d): %s", errno,
-								rpl_path);
-		}
+	journal_sync(journal);
+}
+
+static bool journal_append(struct rpl_journal *journal, uint8_t type,
+				uint16_t src, uint32_t iv_index, uint32_t seq)
+{
+	uint8_t rec[RPL_RECORD_SIZE];
+
+	record_encode(rec, type, src, iv_index, seq);
+
+	if (write(journal->fd, rec, sizeof(rec)) != sizeof(rec)) {
+		l_error("Failed to write(%d): %s", errno, journal->path);
+
+		/* Don't leave a partial record in front of the next one */
+		if (ftruncate(journal->fd, RPL_HEADER_SIZE +
+				journal->records * RPL_RECORD_SIZE) < 0)
+			l_error("Failed to truncate(%d): %s", errno,
+								journal->path);
+		return false;
 	}
 
-	closedir(dir);
+	journal->records++;
+	journal->dirty = true;
+
+	if (!journal->sync_to)
+		journal->sync_to = l_timeout_create(RPL_SYNC_INTERVAL,
+						sync_timeout, journal, NULL);
+
+	return true;
 }
 
-static bool match_src(const void *a, const void *b)
+bool rpl_put_entry(struct mesh_node *node, uint16_t src, uint32_t iv_index,
+								uint32_t seq)
 {
-	const struct mesh_rpl *rpl = a;
-	uint16_t src = L_PTR_TO_UINT(b);
+	struct rpl_journal *journal;
 
-	return rpl->src == src;
+	if (!IS_UNICAST(src))
+		return false;
+
+	journal = journal_get(node);
+	if (!journal)
+		return false;
+
+	return journal_append(journal, RPL_RECORD_PUT, src, iv_index, seq);
 }
 
-static void get_entries(const char *iv_path, struct l_queue *rpl_list)
+void rpl_del_entry(struct mesh_node *node, uint16_t src)
+{
+	struct rpl_journal *journal;
+
+	if (!IS_UNICAST(src))
+		return;
+
+	journal = journal_get(node);
+	if (!journal)
+		return;
+
+	journal_append(journal, RPL_RECORD_DEL, src, 0, 0);
+}
+
+static void get_entries(const char *iv_path, struct l_hashmap *rpl_list)
 {
 	struct mesh_rpl *rpl;
 	struct dirent *entry;
@@ -170,8 +543,8 @@ static void get_entries(const char *iv_path, struct l_queue *rpl_list)
 			if (read(fd, seq_txt, 6) == 6 &&
 					sscanf(seq_txt, "%06x", &seq) == 1) {
 
-				rpl = l_queue_find(rpl_list, match_src,
-						L_UINT_TO_PTR(src));
+				rpl = l_hashmap_lookup(rpl_list,
+							L_UINT_TO_PTR(src));
 
 				if (rpl) {
 					/* Replace older entries */
@@ -185,7 +558,8 @@ static void get_entries(const char *iv_path, struct l_queue *rpl_list)
 					rpl->iv_index = iv_index;
 					rpl->seq = seq;
 
-					l_queue_push_head(rpl_list, rpl);
+					l_hashmap_insert(rpl_list,
+						L_UINT_TO_PTR(src), rpl);
 				}
 			}
 			close(fd);
@@ -195,57 +569,87 @@ static void get_entries(const char *iv_path, struct l_queue *rpl_list)
 	closedir(dir);
 }
 
-bool rpl_get_list(struct mesh_node *node, struct l_queue *rpl_list)
+/*
+ * Imports (if rpl_list is not NULL) or deletes the per iv_index trees used
+ * by older versions. Returns true if any were found.
+ */
+static bool legacy_entries(const char *node_path, struct l_hashmap *rpl_list)
 {
-	const char *node_path;
 	struct dirent *entry;
-	char *rpl_path;
-	size_t len;
+	char path[PATH_MAX];
+	bool found = false;
 	DIR *dir;
 
-	if (!rpl_list)
-		return false;
-
-	node_path = node_get_storage_dir(node);
-
-	len = strlen(node_path) + strlen(rpl_dir) + 15;
-
-	if (len > PATH_MAX)
-		return false;
-
-	rpl_path = l_malloc(len);
-	snprintf(rpl_path, len, "%s%s", node_path, rpl_dir);
-
-	dir = opendir(rpl_path);
+	snprintf(path, PATH_MAX, "%s%s", node_path, rpl_dir);
 
+	dir = opendir(path);
 	if (!dir) {
-		l_error("Failed to read RPL dir: %s", rpl_path);
-		l_free(rpl_path);
+		l_error("Failed to read RPL dir: %s", path);
 		return false;
 	}
 
 	while ((entry = readdir(dir)) != NULL) {
 		/* RPL sequences are stored in files under iv_indexs */
 		if (entry->d_type == DT_DIR && entry->d_name[0] != '.') {
-			snprintf(rpl_path, len, "%s%s/%s",
+			snprintf(path, PATH_MAX, "%s%s/%s",
 					node_path, rpl_dir, entry->d_name);
-			get_entries(rpl_path, rpl_list);
+
+			if (rpl_list)
+				get_entries(path, rpl_list);
+			else
+				del_path(path);
+
+			found = true;
 		}
 	}
 
-	l_free(rpl_path);
 	closedir(dir);
 
+	return found;
+}
+
+bool rpl_get_list(struct mesh_node *node, struct l_hashmap *rpl_list)
+{
+	struct rpl_journal *journal;
+	const char *node_path;
+	bool migrate;
+	off_t len;
+
+	if (!rpl_list)
+		return false;
+
+	node_path = node_get_storage_dir(node);
+	if (!node_path)
+		return false;
+
+	if (strlen(node_path) + strlen(rpl_dir) + 15 >= PATH_MAX)
+		return false;
+
+	/* Older entries first, so that the journal takes precedence */
+	migrate = legacy_entries(node_path, rpl_list);
+
+	journal = l_queue_find(journals, match_node, node);
+	if (journal)
+		journal_read(journal->fd, rpl_list, &len);
+	else
+		journal = journal_open(node, rpl_list);
+
+	if (!journal)
+		return false;
+
+	if (!migrate && journal->records < journal->compact_at)
+		return true;
+
+	if (journal_compact(journal, rpl_list) && migrate)
+		legacy_entries(node_path, NULL);
+
 	return true;
 }
 
 void rpl_update(struct mesh_node *node, uint32_t cur)
 {
-	uint32_t old = cur - 1;
+	struct rpl_journal *journal;
 	const char *node_path;
-	struct dirent *entry;
-	char path[PATH_MAX];
-	DIR *dir;
 
 	node_path = node_get_storage_dir(node);
 	if (!node_path)
@@ -254,36 +658,16 @@ void rpl_update(struct mesh_node *node, uint32_t cur)
 	if (strlen(node_path) + strlen(rpl_dir) + 15 >= PATH_MAX)
 		return;
 
-	/* Make sure path exists */
-	snprintf(path, PATH_MAX, "%s%s", node_path, rpl_dir);
-	if (mkdir(path, 0755) != 0 && errno != EEXIST)
-		l_error("Failed to create dir(%d): %s", errno, path);
+	/* Cleanup any stale or legacy trees */
+	legacy_entries(node_path, NULL);
 
-	dir = opendir(path);
-	if (!dir)
+	journal = journal_get(node);
+	if (!journal)
 		return;
 
-	/* Cleanup any stale or malformed trees */
-	while ((entry = readdir(dir)) != NULL) {
-		if (entry->d_type == DT_DIR && entry->d_name[0] != '.') {
-			uint32_t val;
-			bool del = false;
-
-			if (strlen(entry->d_name) != 8)
-				del = true;
-			else if (sscanf(entry->d_name, "%08x", &val) != 1)
-				del = true;
-
-			/* Delete all invalid iv_index trees */
-			if (del || (val != cur && val != old)) {
-				snprintf(path, PATH_MAX, "%s%s/%s",
-					node_path, rpl_dir, entry->d_name);
-				del_path(path);
-			}
-		}
-	}
-
-	closedir(dir);
+	/* Drop entries from before the previous IV Index */
+	journal->iv_index = cur;
+	journal_compact(journal, NULL);
 }
 
 bool rpl_init(const char *node_path)
@@ -298,3 +682,17 @@ bool rpl_init(const char *node_path)
 		l_error("Failed to create dir(%d): %s", errno, path);
 	return true;
 }
+
+void rpl_cleanup(struct mesh_node *node)
+{
+	struct rpl_journal *journal;
+
+	journal = l_queue_remove_if(journals, match_node, node);
+	if (journal)
+		journal_free(journal);
+
+	if (l_queue_isempty(journals)) {
+		l_queue_destroy(journals, NULL);
+		journals = NULL;
+	}
+}
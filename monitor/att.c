@@ -123,7 +123,7 @@ static struct att_read *att_get_read(const struct l2cap_frame *frame)
 	struct packet_conn_data *conn;
 	struct att_conn_data *data;
 
-	conn = packet_get_conn_data(frame->handle);
+	conn = packet_get_conn_data(frame->index, frame->handle);
 	if (!conn)
 		return NULL;
 
@@ -529,7 +529,7 @@ static struct gatt_db *get_db(const struct l2cap_frame *frame, bool rsp)
 	struct att_conn_data *data;
 	struct gatt_db *db;
 
-	conn = packet_get_conn_data(frame->handle);
+	conn = packet_get_conn_data(frame->index, frame->handle);
 	if (!conn)
 		return NULL;
 
@@ -4189,7 +4189,7 @@ static void att_exchange_mtu_rsp(const struct l2cap_frame *frame)
 
 	print_field("Server RX MTU: %d", mtu);
 
-	conn = packet_get_conn_data(frame->handle);
+	conn = packet_get_conn_data(frame->index, frame->handle);
 	data = att_get_conn_data(conn);
 	if (!data)
 		return;
@@ -4359,7 +4359,7 @@ static void queue_read(const struct l2cap_frame *frame, bt_uuid_t *uuid,
 
 	handler = attr ? get_handler(attr) : get_handler_uuid(uuid);
 
-	conn = packet_get_conn_data(frame->handle);
+	conn = packet_get_conn_data(frame->index, frame->handle);
 	data = att_get_conn_data(conn);
 	if (!data)
 		return;
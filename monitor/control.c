@@ -21,11 +21,13 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <termios.h>
 #include <fcntl.h>
 #include <linux/filter.h>
@@ -40,16 +42,48 @@
 
 #include "display.h"
 #include "packet.h"
+#include "filter.h"
 #include "hcidump.h"
 #include "ellisys.h"
 #include "tty.h"
 #include "control.h"
 #include "jlink.h"
 
+/* Upper bound for how long captured packets stay in the write buffer */
+#define WRITER_FLUSH_INTERVAL	500
+
+/* Smallest number of records worth handing to a parallel reader job */
+#define READER_MIN_RECORDS	4096
+
 static struct btsnoop *btsnoop_file = NULL;
+static struct btsnoop *reader_file = NULL;
+static int writer_flush_id = 0;
 static bool hcidump_fallback = false;
 static bool decode_control = true;
 static uint16_t filter_index = HCI_DEV_NONE;
+static unsigned int reader_jobs = 1;
+
+static void writer_flush(int id, void *user_data)
+{
+	mainloop_remove_timeout(id);
+	writer_flush_id = 0;
+
+	btsnoop_flush(btsnoop_file);
+}
+
+static void writer_write_hci(struct timeval *tv, uint16_t index,
+				uint16_t opcode, uint32_t drops,
+				const void *data, uint16_t size)
+{
+	if (!btsnoop_file)
+		return;
+
+	btsnoop_write_hci(btsnoop_file, tv, index, opcode, drops, data, size);
+
+	if (!writer_flush_id)
+		writer_flush_id = mainloop_add_timeout(WRITER_FLUSH_INTERVAL,
+						writer_flush, NULL, NULL);
+}
 
 struct control_data {
 	uint16_t channel;
@@ -966,7 +1000,10 @@ static void data_callback(int fd, uint32_t events, void *user_data)
 							data->buf, pktlen);
 			break;
 		case HCI_CHANNEL_MONITOR:
-			btsnoop_write_hci(btsnoop_file, tv, index, opcode, 0,
+			if (!filter_match(index, opcode, data->buf, pktlen))
+				break;
+
+			writer_write_hci(tv, index, opcode, 0,
 							data->buf, pktlen);
 			ellisys_inject_hci(tv, index, opcode,
 							data->buf, pktlen);
@@ -1109,7 +1146,9 @@ static void client_callback(int fd, uint32_t events, void *user_data)
 		opcode = le16_to_cpu(hdr->opcode);
 		index = le16_to_cpu(hdr->index);
 
-		packet_monitor(NULL, NULL, index, opcode,
+		if (filter_match(index, opcode, data->buf + MGMT_HDR_SIZE,
+								pktlen))
+			packet_monitor(NULL, NULL, index, opcode,
 					data->buf + MGMT_HDR_SIZE, pktlen);
 
 		data->offset -= pktlen + MGMT_HDR_SIZE;
@@ -1323,13 +1362,18 @@ static void process_data(struct control_data *data)
 		opcode = le16_to_cpu(hdr->opcode);
 		pktlen = data_len - 4 - hdr->hdr_len;
 
-		btsnoop_write_hci(btsnoop_file, tv, 0, opcode, drops,
+		if (!filter_match(0, opcode, hdr->ext_hdr + hdr->hdr_len,
+								pktlen))
+			goto next;
+
+		writer_write_hci(tv, 0, opcode, drops,
 					hdr->ext_hdr + hdr->hdr_len, pktlen);
 		ellisys_inject_hci(tv, 0, opcode, hdr->ext_hdr + hdr->hdr_len,
 					pktlen);
 		packet_monitor(tv, NULL, 0, opcode,
 					hdr->ext_hdr + hdr->hdr_len, pktlen);
 
+next:
 		data->offset -= 2 + data_len;
 
 		if (data->offset > 0)
@@ -1472,18 +1516,271 @@ bool control_writer(const char *path)
 	return !!btsnoop_file;
 }
 
-void control_reader(const char *path, bool pager)
+void control_cleanup(void)
+{
+	if (writer_flush_id) {
+		mainloop_remove_timeout(writer_flush_id);
+		writer_flush_id = 0;
+	}
+
+	btsnoop_unref(btsnoop_file);
+	btsnoop_file = NULL;
+}
+
+static bool reader_hci(unsigned long count, bool decode, bool forward)
+{
+	unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
+	uint16_t pktlen;
+	struct timeval tv;
+
+	for (; count; count--) {
+		uint16_t index, opcode;
+
+		if (!btsnoop_read_hci(reader_file, &tv, &index, &opcode,
+								buf, &pktlen))
+			return false;
+
+		if (opcode == 0xffff)
+			continue;
+
+		if (!filter_match(index, opcode, buf, pktlen))
+			continue;
+
+		if (decode)
+			packet_monitor(&tv, NULL, index, opcode, buf, pktlen);
+
+		if (!forward)
+			continue;
+
+		writer_write_hci(&tv, index, opcode, 0, buf, pktlen);
+		ellisys_inject_hci(&tv, index, opcode, buf, pktlen);
+	}
+
+	return true;
+}
+
+struct reader_job {
+	pid_t pid;
+	FILE *out;
+	bool failed;
+};
+
+static bool reader_job_run(struct reader_job *job, unsigned long count)
+{
+	bool more;
+
+	fflush(stdout);
+	dup2(fileno(job->out), STDOUT_FILENO);
+
+	display_quiet = false;
+	more = reader_hci(count, true, false);
+	display_quiet = true;
+
+	fflush(stdout);
+
+	return more;
+}
+
+static bool reader_job_output(struct reader_job *job, int fd)
+{
+	char buf[65536];
+	off_t offset = 0;
+	ssize_t len;
+
+	while ((len = pread(fileno(job->out), buf, sizeof(buf), offset)) > 0) {
+		ssize_t written = 0;
+
+		offset += len;
+
+		while (written < len) {
+			ssize_t n = write(fd, buf + written, len - written);
+
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				return false;
+			}
+
+			written += n;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Emit the output of the finished jobs in file order, blocking until the
+ * next one is done if wait is set. Returns the number of jobs emitted.
+ */
+static unsigned int reader_jobs_output(struct reader_job *jobs,
+					unsigned int start, unsigned int num,
+					int fd, bool wait)
+{
+	unsigned int i;
+
+	for (i = start; i < num && jobs[i].out; i++) {
+		if (jobs[i].pid > 0) {
+			int status;
+			pid_t pid;
+
+			do {
+				pid = waitpid(jobs[i].pid, &status,
+							wait ? 0 : WNOHANG);
+			} while (pid < 0 && errno == EINTR);
+
+			if (!pid)
+				break;
+
+			if (pid < 0 || !WIFEXITED(status) ||
+						WEXITSTATUS(status)) {
+				fprintf(stderr, "Reader job %u failed\n", i);
+				jobs[i].failed = true;
+			}
+		}
+
+		if (!reader_job_output(&jobs[i], fd))
+			jobs[i].failed = true;
+
+		fclose(jobs[i].out);
+		jobs[i].out = NULL;
+	}
+
+	return i - start;
+}
+
+/*
+ * Decode a capture with several worker processes. The file is split into
+ * chunks at record boundaries and the main process runs through it with
+ * all output suppressed, forking a worker at the start of each chunk. So
+ * every worker starts with exactly the decoder state the sequential read
+ * would have at that point and its output is identical. The workers write
+ * into temporary files that get copied out in order.
+ *
+ * Returns -ENOTSUP if the file is not worth splitting, -EIO if a worker
+ * failed and 0 otherwise.
+ */
+static int reader_parallel(void)
+{
+	struct reader_job *jobs;
+	unsigned long count, chunk;
+	unsigned int i, num, done = 0;
+	int out_fd, null_fd, err = 0;
+	bool more = true;
+
+	count = btsnoop_get_count(reader_file);
+
+	num = count / READER_MIN_RECORDS;
+	if (num > reader_jobs)
+		num = reader_jobs;
+
+	if (num < 2)
+		return -ENOTSUP;
+
+	chunk = count / num;
+
+	jobs = new0(struct reader_job, num);
+
+	for (i = 0; i < num; i++) {
+		jobs[i].out = tmpfile();
+		if (!jobs[i].out) {
+			perror("Failed to create reader output");
+			goto failed;
+		}
+	}
+
+	null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	if (null_fd < 0) {
+		perror("Failed to open /dev/null");
+		goto failed;
+	}
+
+	/* Settle color and width while stdout still is the real output */
+	use_color();
+	num_columns();
+
+	fflush(stdout);
+	out_fd = dup(STDOUT_FILENO);
+	dup2(null_fd, STDOUT_FILENO);
+
+	display_quiet = true;
+
+	for (i = 0; i < num; i++) {
+		unsigned long len = i < num - 1 ? chunk : ULONG_MAX;
+
+		if (!more) {
+			fclose(jobs[i].out);
+			jobs[i].out = NULL;
+			continue;
+		}
+
+		fflush(stdout);
+
+		jobs[i].pid = fork();
+		if (jobs[i].pid < 0) {
+			/* Decode the chunk right here instead */
+			perror("Failed to fork reader");
+			more = reader_job_run(&jobs[i], len);
+			dup2(null_fd, STDOUT_FILENO);
+			continue;
+		}
+
+		if (jobs[i].pid == 0) {
+			close(out_fd);
+			close(null_fd);
+			reader_job_run(&jobs[i], len);
+			_exit(ferror(stdout) ? EXIT_FAILURE : EXIT_SUCCESS);
+		}
+
+		/* The last chunk is only read for the writer and injection */
+		more = reader_hci(len, i < num - 1, true);
+
+		done += reader_jobs_output(jobs, done, num, out_fd, false);
+	}
+
+	fflush(stdout);
+	dup2(out_fd, STDOUT_FILENO);
+	close(out_fd);
+	close(null_fd);
+
+	display_quiet = false;
+
+	while (done < num && jobs[done].out)
+		done += reader_jobs_output(jobs, done, num, STDOUT_FILENO,
+									true);
+
+	for (i = 0; i < num; i++) {
+		if (jobs[i].failed)
+			err = -EIO;
+	}
+
+	free(jobs);
+
+	return err;
+
+failed:
+	for (i = 0; i < num; i++) {
+		if (jobs[i].out)
+			fclose(jobs[i].out);
+	}
+
+	free(jobs);
+
+	return -ENOTSUP;
+}
+
+int control_reader(const char *path, bool pager)
 {
 	unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
 	uint16_t pktlen;
 	uint32_t format;
 	struct timeval tv;
+	int err = 0;
 
-	btsnoop_file = btsnoop_open(path, BTSNOOP_FLAG_PKLG_SUPPORT);
-	if (!btsnoop_file)
-		return;
+	reader_file = btsnoop_open(path, BTSNOOP_FLAG_PKLG_SUPPORT);
+	if (!reader_file)
+		return 0;
 
-	format = btsnoop_get_format(btsnoop_file);
+	format = btsnoop_get_format(reader_file);
 
 	switch (format) {
 	case BTSNOOP_FORMAT_HCI:
@@ -1504,26 +1801,22 @@ void control_reader(const char *path, bool pager)
 	case BTSNOOP_FORMAT_HCI:
 	case BTSNOOP_FORMAT_UART:
 	case BTSNOOP_FORMAT_MONITOR:
-		while (1) {
-			uint16_t index, opcode;
-
-			if (!btsnoop_read_hci(btsnoop_file, &tv, &index,
-							&opcode, buf, &pktlen))
+		if (reader_jobs > 1) {
+			err = reader_parallel();
+			if (err != -ENOTSUP)
 				break;
 
-			if (opcode == 0xffff)
-				continue;
-
-			packet_monitor(&tv, NULL, index, opcode, buf, pktlen);
-			ellisys_inject_hci(&tv, index, opcode, buf, pktlen);
+			err = 0;
 		}
+
+		reader_hci(ULONG_MAX, true, true);
 		break;
 
 	case BTSNOOP_FORMAT_SIMULATOR:
 		while (1) {
 			uint16_t frequency;
 
-			if (!btsnoop_read_phy(btsnoop_file, &tv, &frequency,
+			if (!btsnoop_read_phy(reader_file, &tv, &frequency,
 								buf, &pktlen))
 				break;
 
@@ -1535,7 +1828,15 @@ void control_reader(const char *path, bool pager)
 	if (pager)
 		close_pager();
 
-	btsnoop_unref(btsnoop_file);
+	btsnoop_unref(reader_file);
+	reader_file = NULL;
+
+	return err;
+}
+
+void control_reader_jobs(unsigned int jobs)
+{
+	reader_jobs = jobs;
 }
 
 int control_tracing(void)
@@ -30,6 +30,7 @@
 static pid_t pager_pid = 0;
 int default_pager_num_columns = FALLBACK_TERMINAL_WIDTH;
 enum monitor_color setting_monitor_color = COLOR_AUTO;
+bool display_quiet = false;
 
 void set_monitor_color(enum monitor_color color)
 {
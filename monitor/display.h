@@ -41,8 +41,13 @@ void set_monitor_color(enum monitor_color);
 
 #define FALLBACK_TERMINAL_WIDTH 80
 
+/* Decode without formatting any output, only tracking state */
+extern bool display_quiet;
+
 #define print_indent(indent, color1, prefix, title, color2, fmt, args...) \
 do { \
+	if (display_quiet) \
+		break; \
 	printf("%*c%s%s%s%s" fmt "%s\n", (indent), ' ', \
 		use_color() ? (color1) : "", prefix, title, \
 		use_color() ? (color2) : "", ## args, \
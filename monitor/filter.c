@@ -0,0 +1,961 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "lib/bluetooth.h"
+
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/btsnoop.h"
+
+#include "bt.h"
+#include "filter.h"
+
+/*
+ * Filter expressions select which packets get written and decoded. They
+ * are compiled into a tree that is evaluated on the raw monitor records,
+ * before anything gets decoded:
+ *
+ *   expr      := term { ("or" | "||") term }
+ *   term      := factor { ["and" | "&&"] factor }
+ *   factor    := ("not" | "!") factor | "(" expr ")" | primitive
+ *   primitive := "index" <num> | "type" <name> | "handle" <num> |
+ *                "opcode" <num> | "event" <num> | "cid" <num> |
+ *                "psm" <num> | "att" <num> | "addr" <bdaddr>
+ *
+ * Only the headers are looked at, plus just enough connection state to
+ * map handles to addresses, L2CAP continuation fragments to their channel
+ * and dynamic channels to their PSM. Each side of a connection allocates
+ * its own channel identifiers, so fragments and channels are tracked per
+ * direction.
+ */
+
+enum filter_op {
+	FILTER_OR,
+	FILTER_AND,
+	FILTER_NOT,
+	FILTER_INDEX,
+	FILTER_TYPE,
+	FILTER_HANDLE,
+	FILTER_OPCODE,
+	FILTER_EVENT,
+	FILTER_CID,
+	FILTER_PSM,
+	FILTER_ATT,
+	FILTER_ADDR,
+};
+
+struct filter_node {
+	enum filter_op op;
+	uint32_t value;
+	uint8_t addr[6];
+	struct filter_node *left;
+	struct filter_node *right;
+};
+
+/* Values a packet has for each primitive, -1 where it has none */
+struct filter_fields {
+	uint16_t index;
+	uint32_t type;
+	int handle;
+	int opcode;
+	int event;
+	int cid;
+	int psm;
+	int att;
+	const uint8_t *addr;
+	struct filter_conn *release;
+};
+
+/* A channel identifier as seen on packets going in one direction */
+struct filter_chan {
+	uint16_t cid;
+	bool in;
+	uint16_t psm;
+	uint8_t ident;
+};
+
+struct filter_conn {
+	uint16_t index;
+	uint16_t handle;
+	uint8_t addr[6];
+	bool has_addr;
+	uint16_t cid[2];
+	struct queue *chans;
+};
+
+struct filter_parser {
+	const char *pos;
+	char token[32];
+	const char *error;
+};
+
+#define TYPE(opcode)	(1u << BTSNOOP_OPCODE_##opcode)
+
+static const struct {
+	const char *str;
+	uint32_t mask;
+} type_table[] = {
+	{ "command",	TYPE(COMMAND_PKT) },
+	{ "event",	TYPE(EVENT_PKT) },
+	{ "acl",	TYPE(ACL_TX_PKT) | TYPE(ACL_RX_PKT) },
+	{ "sco",	TYPE(SCO_TX_PKT) | TYPE(SCO_RX_PKT) },
+	{ "iso",	TYPE(ISO_TX_PKT) | TYPE(ISO_RX_PKT) },
+	{ "index",	TYPE(NEW_INDEX) | TYPE(DEL_INDEX) |
+			TYPE(OPEN_INDEX) | TYPE(CLOSE_INDEX) |
+			TYPE(INDEX_INFO) },
+	{ "vendor",	TYPE(VENDOR_DIAG) },
+	{ "note",	TYPE(SYSTEM_NOTE) },
+	{ "log",	TYPE(USER_LOGGING) },
+	{ "mgmt",	TYPE(CTRL_OPEN) | TYPE(CTRL_CLOSE) |
+			TYPE(CTRL_COMMAND) | TYPE(CTRL_EVENT) },
+	{ }
+};
+
+static const struct {
+	const char *str;
+	enum filter_op op;
+} primitive_table[] = {
+	{ "index",	FILTER_INDEX	},
+	{ "type",	FILTER_TYPE	},
+	{ "handle",	FILTER_HANDLE	},
+	{ "opcode",	FILTER_OPCODE	},
+	{ "event",	FILTER_EVENT	},
+	{ "cid",	FILTER_CID	},
+	{ "psm",	FILTER_PSM	},
+	{ "att",	FILTER_ATT	},
+	{ "addr",	FILTER_ADDR	},
+	{ }
+};
+
+static struct filter_node *filter_root;
+static struct queue *conn_list;
+
+static void node_free(struct filter_node *node)
+{
+	if (!node)
+		return;
+
+	node_free(node->left);
+	node_free(node->right);
+	free(node);
+}
+
+static struct filter_node *node_new(enum filter_op op,
+					struct filter_node *left,
+					struct filter_node *right)
+{
+	struct filter_node *node;
+
+	node = new0(struct filter_node, 1);
+	node->op = op;
+	node->left = left;
+	node->right = right;
+
+	return node;
+}
+
+static const char *next_token(struct filter_parser *parser)
+{
+	const char *start;
+	size_t len;
+
+	while (isspace(*parser->pos))
+		parser->pos++;
+
+	start = parser->pos;
+
+	if (!*start) {
+		len = 0;
+	} else if (strchr("()!", *start)) {
+		len = 1;
+	} else if (!strncmp(start, "&&", 2) || !strncmp(start, "||", 2)) {
+		len = 2;
+	} else {
+		len = 0;
+		while (start[len] && !isspace(start[len]) &&
+					!strchr("()!&|", start[len]))
+			len++;
+	}
+
+	if (!len && *start) {
+		parser->error = "unexpected character";
+		len = 1;
+	}
+
+	if (len >= sizeof(parser->token)) {
+		parser->error = "token too long";
+		len = sizeof(parser->token) - 1;
+	}
+
+	memcpy(parser->token, start, len);
+	parser->token[len] = '\0';
+
+	parser->pos = start + len;
+
+	return parser->token;
+}
+
+static const char *peek_token(struct filter_parser *parser)
+{
+	const char *pos = parser->pos;
+
+	next_token(parser);
+	parser->pos = pos;
+
+	return parser->token;
+}
+
+/* Numbers are decimal, or hexadecimal with a 0x prefix, never octal */
+static bool parse_number(const char *str, uint32_t max, uint32_t *value)
+{
+	unsigned long val;
+	char *end;
+	int base = 10;
+
+	if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+		str += 2;
+		base = 16;
+	}
+
+	if (!isxdigit(*str) || (base == 10 && !isdigit(*str)))
+		return false;
+
+	val = strtoul(str, &end, base);
+	if (*end || val > max)
+		return false;
+
+	*value = val;
+
+	return true;
+}
+
+static struct filter_node *parse_expr(struct filter_parser *parser);
+
+static struct filter_node *parse_primitive(struct filter_parser *parser)
+{
+	struct filter_node *node;
+	const char *token;
+	bdaddr_t bdaddr;
+	int i;
+
+	token = next_token(parser);
+
+	for (i = 0; primitive_table[i].str; i++) {
+		if (!strcmp(primitive_table[i].str, token))
+			break;
+	}
+
+	if (!primitive_table[i].str) {
+		if (!parser->error)
+			parser->error = *token ? "unknown primitive" :
+							"missing primitive";
+		return NULL;
+	}
+
+	node = node_new(primitive_table[i].op, NULL, NULL);
+
+	token = next_token(parser);
+
+	switch (node->op) {
+	case FILTER_TYPE:
+		for (i = 0; type_table[i].str; i++) {
+			if (!strcmp(type_table[i].str, token))
+				break;
+		}
+
+		if (!type_table[i].str) {
+			parser->error = "unknown packet type";
+			break;
+		}
+
+		node->value = type_table[i].mask;
+		break;
+
+	case FILTER_ADDR:
+		if (bachk(token) < 0) {
+			parser->error = "invalid address";
+			break;
+		}
+
+		str2ba(token, &bdaddr);
+		memcpy(node->addr, bdaddr.b, 6);
+		break;
+
+	case FILTER_INDEX:
+	case FILTER_HANDLE:
+	case FILTER_OPCODE:
+	case FILTER_CID:
+	case FILTER_PSM:
+		if (!parse_number(token, 0xffff, &node->value))
+			parser->error = "invalid number";
+		break;
+
+	case FILTER_EVENT:
+	case FILTER_ATT:
+		if (!parse_number(token, 0xff, &node->value))
+			parser->error = "invalid number";
+		break;
+
+	case FILTER_OR:
+	case FILTER_AND:
+	case FILTER_NOT:
+		break;
+	}
+
+	if (parser->error) {
+		node_free(node);
+		return NULL;
+	}
+
+	return node;
+}
+
+static struct filter_node *parse_factor(struct filter_parser *parser)
+{
+	struct filter_node *node;
+	const char *token;
+
+	token = peek_token(parser);
+
+	if (!strcmp(token, "not") || !strcmp(token, "!")) {
+		next_token(parser);
+
+		node = parse_factor(parser);
+		if (!node)
+			return NULL;
+
+		return node_new(FILTER_NOT, node, NULL);
+	}
+
+	if (!strcmp(token, "(")) {
+		next_token(parser);
+
+		node = parse_expr(parser);
+		if (!node)
+			return NULL;
+
+		if (strcmp(next_token(parser), ")")) {
+			parser->error = "missing )";
+			node_free(node);
+			return NULL;
+		}
+
+		return node;
+	}
+
+	return parse_primitive(parser);
+}
+
+static struct filter_node *parse_term(struct filter_parser *parser)
+{
+	struct filter_node *node;
+
+	node = parse_factor(parser);
+
+	while (node) {
+		struct filter_node *right;
+		const char *token;
+
+		token = peek_token(parser);
+
+		if (!*token || !strcmp(token, ")") || !strcmp(token, "or") ||
+							!strcmp(token, "||"))
+			break;
+
+		/* Adjacent factors are combined with an implicit and */
+		if (!strcmp(token, "and") || !strcmp(token, "&&"))
+			next_token(parser);
+
+		right = parse_factor(parser);
+		if (!right) {
+			node_free(node);
+			return NULL;
+		}
+
+		node = node_new(FILTER_AND, node, right);
+	}
+
+	return node;
+}
+
+static struct filter_node *parse_expr(struct filter_parser *parser)
+{
+	struct filter_node *node;
+
+	node = parse_term(parser);
+
+	while (node) {
+		struct filter_node *right;
+		const char *token;
+
+		token = peek_token(parser);
+		if (strcmp(token, "or") && strcmp(token, "||"))
+			break;
+
+		next_token(parser);
+
+		right = parse_term(parser);
+		if (!right) {
+			node_free(node);
+			return NULL;
+		}
+
+		node = node_new(FILTER_OR, node, right);
+	}
+
+	return node;
+}
+
+bool filter_compile(const char *expr)
+{
+	struct filter_parser parser;
+	struct filter_node *root;
+
+	memset(&parser, 0, sizeof(parser));
+	parser.pos = expr;
+
+	root = parse_expr(&parser);
+
+	if (root && *next_token(&parser)) {
+		parser.error = "unexpected token";
+		node_free(root);
+		root = NULL;
+	}
+
+	if (!root) {
+		fprintf(stderr, "Invalid filter at '%s': %s\n",
+					parser.token, parser.error ?
+					parser.error : "syntax error");
+		return false;
+	}
+
+	node_free(filter_root);
+	filter_root = root;
+
+	if (!conn_list)
+		conn_list = queue_new();
+
+	return true;
+}
+
+static void conn_free(void *data)
+{
+	struct filter_conn *conn = data;
+
+	queue_destroy(conn->chans, free);
+	free(conn);
+}
+
+void filter_cleanup(void)
+{
+	node_free(filter_root);
+	filter_root = NULL;
+
+	queue_destroy(conn_list, conn_free);
+	conn_list = NULL;
+}
+
+static bool match_conn(const void *data, const void *match_data)
+{
+	const struct filter_conn *conn = data;
+	const uint32_t *id = match_data;
+
+	return conn->index == (*id >> 16) && conn->handle == (*id & 0xffff);
+}
+
+static struct filter_conn *conn_lookup(uint16_t index, uint16_t handle,
+								bool create)
+{
+	struct filter_conn *conn;
+	uint32_t id = index << 16 | handle;
+
+	conn = queue_find(conn_list, match_conn, &id);
+	if (conn || !create)
+		return conn;
+
+	conn = new0(struct filter_conn, 1);
+	conn->index = index;
+	conn->handle = handle;
+	conn->chans = queue_new();
+
+	queue_push_tail(conn_list, conn);
+
+	return conn;
+}
+
+static bool match_index(const void *data, const void *match_data)
+{
+	const struct filter_conn *conn = data;
+
+	return conn->index == PTR_TO_UINT(match_data);
+}
+
+static bool match_cid(const void *data, const void *match_data)
+{
+	const struct filter_chan *chan = data;
+	const struct filter_chan *match = match_data;
+
+	return chan->cid == match->cid && chan->in == match->in;
+}
+
+static bool match_ident(const void *data, const void *match_data)
+{
+	const struct filter_chan *chan = data;
+	const struct filter_chan *match = match_data;
+
+	return chan->ident == match->ident && chan->in == match->in;
+}
+
+static struct filter_chan *chan_lookup(struct filter_conn *conn, bool in,
+								uint16_t cid)
+{
+	struct filter_chan match = { .cid = cid, .in = in };
+
+	return queue_find(conn->chans, match_cid, &match);
+}
+
+static void chan_add(struct filter_conn *conn, bool in, uint16_t cid,
+						uint16_t psm, uint8_t ident)
+{
+	struct filter_chan match = { .cid = cid, .in = in };
+	struct filter_chan *chan;
+
+	free(queue_remove_if(conn->chans, match_cid, &match));
+
+	chan = new0(struct filter_chan, 1);
+	chan->cid = cid;
+	chan->in = in;
+	chan->psm = psm;
+	chan->ident = ident;
+
+	queue_push_head(conn->chans, chan);
+}
+
+/*
+ * The identifiers in a request or response are the ones its sender
+ * receives on, so they show up on packets going the other way.
+ */
+static void parse_sig_req(struct filter_conn *conn, bool in, uint8_t ident,
+				uint16_t psm, const uint8_t *scid, uint16_t num,
+				struct filter_fields *fields)
+{
+	uint16_t i;
+
+	for (i = 0; i < num; i++)
+		chan_add(conn, !in, get_le16(scid + i * 2), psm, ident);
+
+	fields->psm = psm;
+}
+
+static void parse_sig_rsp(struct filter_conn *conn, bool in, uint8_t ident,
+				const uint8_t *dcid, uint16_t num,
+				struct filter_fields *fields)
+{
+	struct filter_chan match = { .ident = ident, .in = in };
+	struct filter_chan *req;
+	uint16_t i;
+
+	/* The channels of the request are the ones received on this way */
+	req = queue_find(conn->chans, match_ident, &match);
+	if (!req)
+		return;
+
+	fields->psm = req->psm;
+
+	for (i = 0; i < num; i++) {
+		uint16_t cid = get_le16(dcid + i * 2);
+
+		if (cid)
+			chan_add(conn, !in, cid, fields->psm, 0);
+	}
+}
+
+static void parse_sig(struct filter_conn *conn, bool in, uint16_t cid,
+				const uint8_t *data, uint16_t size,
+				struct filter_fields *fields)
+{
+	while (size >= sizeof(struct bt_l2cap_hdr_sig)) {
+		const struct bt_l2cap_hdr_sig *hdr = (const void *) data;
+		uint16_t len = le16_to_cpu(hdr->len);
+		const uint8_t *pdu = data + sizeof(*hdr);
+
+		if (size - sizeof(*hdr) < len)
+			break;
+
+		switch (hdr->code) {
+		case BT_L2CAP_PDU_CONN_REQ:
+		case BT_L2CAP_PDU_CREATE_CHAN_REQ:
+		case BT_L2CAP_PDU_LE_CONN_REQ:
+			if (len >= 4)
+				parse_sig_req(conn, in, hdr->ident,
+						get_le16(pdu), pdu + 2, 1,
+						fields);
+			break;
+		case BT_L2CAP_PDU_ECRED_CONN_REQ:
+			if (len >= 8)
+				parse_sig_req(conn, in, hdr->ident,
+						get_le16(pdu), pdu + 8,
+						(len - 8) / 2, fields);
+			break;
+		case BT_L2CAP_PDU_CONN_RSP:
+		case BT_L2CAP_PDU_CREATE_CHAN_RSP:
+		case BT_L2CAP_PDU_LE_CONN_RSP:
+			if (len >= 2)
+				parse_sig_rsp(conn, in, hdr->ident, pdu, 1,
+								fields);
+			break;
+		case BT_L2CAP_PDU_ECRED_CONN_RSP:
+			if (len >= 8)
+				parse_sig_rsp(conn, in, hdr->ident, pdu + 8,
+						(len - 8) / 2, fields);
+			break;
+		}
+
+		/* LE signaling carries a single command per frame */
+		if (cid == 0x0005)
+			break;
+
+		data += sizeof(*hdr) + len;
+		size -= sizeof(*hdr) + len;
+	}
+}
+
+static void parse_acl(uint16_t index, bool in, const void *data,
+				uint16_t size, struct filter_fields *fields)
+{
+	const struct bt_hci_acl_hdr *hdr = data;
+	const struct bt_l2cap_hdr *l2cap;
+	struct filter_conn *conn;
+	struct filter_chan *chan;
+	uint16_t handle;
+
+	if (size < sizeof(*hdr))
+		return;
+
+	handle = le16_to_cpu(hdr->handle);
+	fields->handle = handle & 0x0fff;
+
+	conn = conn_lookup(index, fields->handle, true);
+	if (conn->has_addr)
+		fields->addr = conn->addr;
+
+	data += sizeof(*hdr);
+	size -= sizeof(*hdr);
+
+	/*
+	 * Continuation fragments belong to the channel of the last start
+	 * going the same way.
+	 */
+	if ((handle >> 12 & 0x03) == 0x01) {
+		fields->cid = conn->cid[in];
+	} else {
+		if (size < sizeof(*l2cap)) {
+			conn->cid[in] = 0;
+			return;
+		}
+
+		l2cap = data;
+		conn->cid[in] = le16_to_cpu(l2cap->cid);
+		fields->cid = conn->cid[in];
+
+		data += sizeof(*l2cap);
+		size -= sizeof(*l2cap);
+
+		switch (fields->cid) {
+		case 0x0001:
+		case 0x0005:
+			parse_sig(conn, in, fields->cid, data, size, fields);
+			break;
+		case 0x0004:
+			if (size)
+				fields->att = *((const uint8_t *) data);
+			break;
+		}
+	}
+
+	if (fields->cid < 0x0040)
+		return;
+
+	chan = chan_lookup(conn, in, fields->cid);
+	if (chan)
+		fields->psm = chan->psm;
+}
+
+static void parse_conn_complete(uint16_t index, uint8_t status,
+				uint16_t handle, const uint8_t *addr,
+				struct filter_fields *fields)
+{
+	struct filter_conn *conn;
+
+	fields->handle = handle;
+	fields->addr = addr;
+
+	if (status)
+		return;
+
+	conn = conn_lookup(index, handle, true);
+	memcpy(conn->addr, addr, 6);
+	conn->has_addr = true;
+}
+
+/* Isochronous channels get the address of the connection they belong to */
+static void parse_cis(uint16_t index, uint16_t cis_handle,
+					uint16_t acl_handle,
+					struct filter_fields *fields)
+{
+	struct filter_conn *acl, *cis;
+
+	fields->handle = cis_handle;
+
+	acl = conn_lookup(index, acl_handle, false);
+	if (!acl || !acl->has_addr)
+		return;
+
+	cis = conn_lookup(index, cis_handle, true);
+	memcpy(cis->addr, acl->addr, 6);
+	cis->has_addr = true;
+
+	fields->addr = cis->addr;
+}
+
+static void parse_cis_established(uint16_t index, uint8_t status,
+				uint16_t handle, struct filter_fields *fields)
+{
+	struct filter_conn *conn;
+
+	fields->handle = handle;
+
+	conn = conn_lookup(index, handle, false);
+	if (!conn)
+		return;
+
+	if (conn->has_addr)
+		fields->addr = conn->addr;
+
+	if (status)
+		fields->release = conn;
+}
+
+static void parse_event(uint16_t index, const void *data, uint16_t size,
+						struct filter_fields *fields)
+{
+	const struct bt_hci_evt_hdr *hdr = data;
+	const uint8_t *evt = data + sizeof(*hdr);
+	struct filter_conn *conn;
+
+	if (size < sizeof(*hdr))
+		return;
+
+	fields->event = hdr->evt;
+	size -= sizeof(*hdr);
+
+	switch (hdr->evt) {
+	case BT_HCI_EVT_CMD_COMPLETE:
+		if (size >= 3)
+			fields->opcode = get_le16(evt + 1);
+		break;
+	case BT_HCI_EVT_CMD_STATUS:
+		if (size >= 4)
+			fields->opcode = get_le16(evt + 2);
+		break;
+	case BT_HCI_EVT_CONN_COMPLETE:
+	case BT_HCI_EVT_SYNC_CONN_COMPLETE:
+		if (size >= 9)
+			parse_conn_complete(index, evt[0], get_le16(evt + 1),
+							evt + 3, fields);
+		break;
+	case BT_HCI_EVT_DISCONNECT_COMPLETE:
+		if (size < 3)
+			break;
+
+		fields->handle = get_le16(evt + 1);
+
+		conn = conn_lookup(index, fields->handle, false);
+		if (!conn)
+			break;
+
+		if (conn->has_addr)
+			fields->addr = conn->addr;
+
+		if (!evt[0])
+			fields->release = conn;
+		break;
+	case BT_HCI_EVT_LE_META_EVENT:
+		if (size < 1)
+			break;
+
+		switch (evt[0]) {
+		case BT_HCI_EVT_LE_CONN_COMPLETE:
+		case BT_HCI_EVT_LE_ENHANCED_CONN_COMPLETE:
+		case BT_HCI_EVT_LE_ENHANCED_CONN_COMPLETE_V2:
+			if (size >= 12)
+				parse_conn_complete(index, evt[1],
+						get_le16(evt + 2), evt + 6,
+						fields);
+			break;
+		case BT_HCI_EVT_LE_CIS_ESTABLISHED:
+			if (size >= 4)
+				parse_cis_established(index, evt[1],
+						get_le16(evt + 2), fields);
+			break;
+		case BT_HCI_EVT_LE_CIS_REQ:
+			if (size >= 5)
+				parse_cis(index, get_le16(evt + 3),
+						get_le16(evt + 1), fields);
+			break;
+		}
+		break;
+	}
+}
+
+static void parse_command(uint16_t index, const void *data, uint16_t size,
+						struct filter_fields *fields)
+{
+	const struct bt_hci_cmd_hdr *hdr = data;
+	const uint8_t *cmd = data + sizeof(*hdr);
+	struct filter_conn *conn;
+	uint8_t i;
+
+	if (size < sizeof(*hdr))
+		return;
+
+	fields->opcode = le16_to_cpu(hdr->opcode);
+	size -= sizeof(*hdr);
+
+	if (fields->opcode == BT_HCI_CMD_LE_CREATE_CIS) {
+		if (size < 1 || size - 1 < cmd[0] * 4)
+			return;
+
+		for (i = 0; i < cmd[0]; i++)
+			parse_cis(index, get_le16(cmd + 1 + i * 4),
+					get_le16(cmd + 3 + i * 4), fields);
+		return;
+	}
+
+	if (fields->opcode != BT_HCI_CMD_DISCONNECT || size < 2)
+		return;
+
+	fields->handle = get_le16(cmd) & 0x0fff;
+
+	conn = conn_lookup(index, fields->handle, false);
+	if (conn && conn->has_addr)
+		fields->addr = conn->addr;
+}
+
+static void parse_sync(uint16_t index, const void *data,
+						struct filter_fields *fields)
+{
+	struct filter_conn *conn;
+
+	fields->handle = get_le16(data) & 0x0fff;
+
+	conn = conn_lookup(index, fields->handle, false);
+	if (conn && conn->has_addr)
+		fields->addr = conn->addr;
+}
+
+static bool eval(const struct filter_node *node,
+					const struct filter_fields *fields)
+{
+	switch (node->op) {
+	case FILTER_OR:
+		return eval(node->left, fields) || eval(node->right, fields);
+	case FILTER_AND:
+		return eval(node->left, fields) && eval(node->right, fields);
+	case FILTER_NOT:
+		return !eval(node->left, fields);
+	case FILTER_INDEX:
+		return fields->index == node->value;
+	case FILTER_TYPE:
+		return fields->type & node->value;
+	case FILTER_HANDLE:
+		return fields->handle == (int) node->value;
+	case FILTER_OPCODE:
+		return fields->opcode == (int) node->value;
+	case FILTER_EVENT:
+		return fields->event == (int) node->value;
+	case FILTER_CID:
+		return fields->cid == (int) node->value;
+	case FILTER_PSM:
+		return fields->psm == (int) node->value;
+	case FILTER_ATT:
+		return fields->att == (int) node->value;
+	case FILTER_ADDR:
+		return fields->addr && !memcmp(fields->addr, node->addr, 6);
+	}
+
+	return false;
+}
+
+bool filter_match(uint16_t index, uint16_t opcode, const void *data,
+								uint16_t size)
+{
+	struct filter_fields fields;
+	bool match;
+
+	if (!filter_root)
+		return true;
+
+	fields.index = index;
+	fields.type = opcode < 32 ? 1u << opcode : 0;
+	fields.handle = -1;
+	fields.opcode = -1;
+	fields.event = -1;
+	fields.cid = -1;
+	fields.psm = -1;
+	fields.att = -1;
+	fields.addr = NULL;
+	fields.release = NULL;
+
+	switch (opcode) {
+	case BTSNOOP_OPCODE_COMMAND_PKT:
+		parse_command(index, data, size, &fields);
+		break;
+	case BTSNOOP_OPCODE_EVENT_PKT:
+		parse_event(index, data, size, &fields);
+		break;
+	case BTSNOOP_OPCODE_ACL_TX_PKT:
+		parse_acl(index, false, data, size, &fields);
+		break;
+	case BTSNOOP_OPCODE_ACL_RX_PKT:
+		parse_acl(index, true, data, size, &fields);
+		break;
+	case BTSNOOP_OPCODE_SCO_TX_PKT:
+	case BTSNOOP_OPCODE_SCO_RX_PKT:
+	case BTSNOOP_OPCODE_ISO_TX_PKT:
+	case BTSNOOP_OPCODE_ISO_RX_PKT:
+		if (size >= 2)
+			parse_sync(index, data, &fields);
+		break;
+	}
+
+	match = eval(filter_root, &fields);
+
+	/* Connections go away only after their last packet was matched */
+	if (fields.release) {
+		queue_remove(conn_list, fields.release);
+		conn_free(fields.release);
+	} else if (opcode == BTSNOOP_OPCODE_DEL_INDEX) {
+		queue_remove_all(conn_list, match_index, UINT_TO_PTR(index),
+								conn_free);
+	}
+
+	return match;
+}
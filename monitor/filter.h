@@ -0,0 +1,18 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+bool filter_compile(const char *expr);
+void filter_cleanup(void);
+
+bool filter_match(uint16_t index, uint16_t opcode, const void *data,
+								uint16_t size);
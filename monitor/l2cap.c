@@ -86,9 +86,17 @@
 #define L2CAP_SAR_END		0x02
 #define L2CAP_SAR_CONTINUE	0x03
 
-#define MAX_CHAN 64
+/*
+ * Channels are grouped per link in a hash table keyed by controller index
+ * and connection handle, so finding one only walks the channels of that
+ * link. Each channel also has a small identifier, shown as {chan N} and
+ * used to index chan_list, which grows as needed.
+ */
+#define LINK_HASH_MIN_BITS	4
+#define CHAN_LIST_MIN		64
 
 struct chan_data {
+	unsigned int id;
 	uint16_t index;
 	uint16_t handle;
 	uint8_t ident;
@@ -103,83 +111,262 @@ struct chan_data {
 	struct packet_latency tx_l;
 };
 
-static struct chan_data chan_list[MAX_CHAN];
+struct chan_link {
+	uint16_t index;
+	uint16_t handle;
+	struct queue *chans;	/* Ordered by channel identifier */
+};
+
+static struct chan_data **chan_list;
+static unsigned int chan_max;
+static unsigned int chan_first_free;
+
+/* Links are kept once seen since handles get reused by new connections */
+static struct chan_link **link_hash;
+static unsigned int link_hash_bits;
+static unsigned int link_count;
+
+/* Channels whose data is carried by another controller (AMP) */
+static struct queue *ctrl_chans;
+
+static unsigned int link_hash_slot(uint16_t index, uint16_t handle)
+{
+	uint32_t key = ((uint32_t) index << 16) | handle;
+
+	return (key * 2654435761U) >> (32 - link_hash_bits);
+}
+
+static struct chan_link *link_lookup(uint16_t index, uint16_t handle)
+{
+	unsigned int mask, i;
+
+	if (!link_hash)
+		return NULL;
+
+	mask = (1U << link_hash_bits) - 1;
+
+	for (i = link_hash_slot(index, handle); link_hash[i];
+							i = (i + 1) & mask) {
+		if (link_hash[i]->index == index &&
+					link_hash[i]->handle == handle)
+			return link_hash[i];
+	}
+
+	return NULL;
+}
+
+static void link_hash_put(struct chan_link *link)
+{
+	unsigned int mask = (1U << link_hash_bits) - 1;
+	unsigned int i;
+
+	for (i = link_hash_slot(link->index, link->handle); link_hash[i];
+							i = (i + 1) & mask)
+		;
+
+	link_hash[i] = link;
+}
+
+static bool link_hash_grow(void)
+{
+	struct chan_link **old = link_hash;
+	unsigned int old_size = old ? 1U << link_hash_bits : 0;
+	unsigned int bits, i;
+
+	bits = old ? link_hash_bits + 1 : LINK_HASH_MIN_BITS;
+
+	link_hash = new0(struct chan_link *, 1U << bits);
+	if (!link_hash) {
+		link_hash = old;
+		return false;
+	}
+
+	link_hash_bits = bits;
+
+	for (i = 0; i < old_size; i++) {
+		if (old[i])
+			link_hash_put(old[i]);
+	}
+
+	free(old);
+
+	return true;
+}
+
+static struct chan_link *link_get(uint16_t index, uint16_t handle)
+{
+	struct chan_link *link;
+
+	link = link_lookup(index, handle);
+	if (link)
+		return link;
+
+	if ((link_count + 1) * 2 > (link_hash ? 1U << link_hash_bits : 0) &&
+							!link_hash_grow())
+		return NULL;
+
+	link = new0(struct chan_link, 1);
+	link->index = index;
+	link->handle = handle;
+	link->chans = queue_new();
+
+	link_hash_put(link);
+	link_count++;
+
+	return link;
+}
+
+static struct chan_data *chan_alloc(struct chan_link *link)
+{
+	const struct queue_entry *e;
+	struct chan_data *chan, *prev = NULL;
+	unsigned int id;
+
+	for (id = chan_first_free; id < chan_max && chan_list[id]; id++)
+		;
+
+	/* Identifiers have to fit in struct l2cap_frame */
+	if (id >= UINT16_MAX)
+		return NULL;
+
+	if (id == chan_max) {
+		unsigned int max = chan_max ? chan_max * 2 : CHAN_LIST_MIN;
+		struct chan_data **list;
+
+		list = realloc(chan_list, max * sizeof(*list));
+		if (!list)
+			return NULL;
+
+		memset(list + chan_max, 0, (max - chan_max) * sizeof(*list));
+		chan_list = list;
+		chan_max = max;
+	}
+
+	chan = new0(struct chan_data, 1);
+	chan->id = id;
+
+	chan_list[id] = chan;
+	chan_first_free = id + 1;
+
+	for (e = queue_get_entries(link->chans); e; e = e->next) {
+		struct chan_data *c = e->data;
+
+		if (c->id > id)
+			break;
+
+		prev = c;
+	}
+
+	if (prev)
+		queue_push_after(link->chans, prev, chan);
+	else
+		queue_push_head(link->chans, chan);
+
+	return chan;
+}
+
+static void chan_release(struct chan_link *link, struct chan_data *chan)
+{
+	queue_remove(link->chans, chan);
+
+	if (chan->ctrlid)
+		queue_remove(ctrl_chans, chan);
+
+	chan_list[chan->id] = NULL;
+
+	if (chan->id < chan_first_free)
+		chan_first_free = chan->id;
+
+	free(chan);
+}
 
 static void assign_scid(const struct l2cap_frame *frame, uint16_t scid,
 			uint16_t psm, uint8_t mode, uint8_t ctrlid)
 {
-	int i, n = -1;
+	const struct queue_entry *e;
+	struct chan_link *link;
+	struct chan_data *chan = NULL;
 	uint8_t seq_num = 1;
+	unsigned int id;
 
 	if (!scid)
 		return;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (n < 0 && chan_list[i].handle == 0x0000) {
-			n = i;
-			continue;
-		}
-
-		if (chan_list[i].index != frame->index)
-			continue;
+	link = link_get(frame->index, frame->handle);
+	if (!link)
+		return;
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	for (e = queue_get_entries(link->chans); e; e = e->next) {
+		struct chan_data *c = e->data;
 
-		if (chan_list[i].psm == psm)
+		if (c->psm == psm)
 			seq_num++;
 
 		/* Don't break on match - we still need to go through all
 		 * channels to find proper seq_num.
 		 */
 		if (frame->in) {
-			if (chan_list[i].dcid == scid)
-				n = i;
+			if (c->dcid == scid)
+				chan = c;
 		} else {
-			if (chan_list[i].scid == scid)
-				n = i;
+			if (c->scid == scid)
+				chan = c;
 		}
 	}
 
-	if (n < 0)
-		return;
+	if (!chan) {
+		chan = chan_alloc(link);
+		if (!chan)
+			return;
+	} else if (chan->ctrlid)
+		queue_remove(ctrl_chans, chan);
 
-	memset(&chan_list[n], 0, sizeof(chan_list[n]));
-	chan_list[n].index = frame->index;
-	chan_list[n].handle = frame->handle;
-	chan_list[n].ident = frame->ident;
+	id = chan->id;
+	memset(chan, 0, sizeof(*chan));
+	chan->id = id;
+	chan->index = frame->index;
+	chan->handle = frame->handle;
+	chan->ident = frame->ident;
 
 	if (frame->in)
-		chan_list[n].dcid = scid;
+		chan->dcid = scid;
 	else
-		chan_list[n].scid = scid;
+		chan->scid = scid;
+
+	chan->psm = psm;
+	chan->ctrlid = ctrlid;
+	chan->mode = mode;
 
-	chan_list[n].psm = psm;
-	chan_list[n].ctrlid = ctrlid;
-	chan_list[n].mode = mode;
+	chan->seq_num = seq_num;
 
-	chan_list[n].seq_num = seq_num;
+	if (ctrlid) {
+		if (!ctrl_chans)
+			ctrl_chans = queue_new();
+
+		queue_push_tail(ctrl_chans, chan);
+	}
 }
 
 static void release_scid(const struct l2cap_frame *frame, uint16_t scid)
 {
-	int i;
+	const struct queue_entry *e;
+	struct chan_link *link;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
+	link = link_lookup(frame->index, frame->handle);
+	if (!link)
+		return;
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	for (e = queue_get_entries(link->chans); e; e = e->next) {
+		struct chan_data *chan = e->data;
 
 		if (frame->in) {
-			if (chan_list[i].scid == scid) {
-				chan_list[i].handle = 0;
+			if (chan->scid == scid) {
+				chan_release(link, chan);
 				break;
 			}
 		} else {
-			if (chan_list[i].dcid == scid) {
-				chan_list[i].handle = 0;
+			if (chan->dcid == scid) {
+				chan_release(link, chan);
 				break;
 			}
 		}
@@ -189,39 +376,40 @@ static void release_scid(const struct l2cap_frame *frame, uint16_t scid)
 static void assign_dcid(const struct l2cap_frame *frame, uint16_t dcid,
 								uint16_t scid)
 {
-	int i;
+	const struct queue_entry *e;
+	struct chan_link *link;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
+	link = link_lookup(frame->index, frame->handle);
+	if (!link)
+		return;
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	for (e = queue_get_entries(link->chans); e; e = e->next) {
+		struct chan_data *chan = e->data;
 
-		if (frame->ident != 0 && chan_list[i].ident != frame->ident)
+		if (frame->ident != 0 && chan->ident != frame->ident)
 			continue;
 
 		if (frame->in) {
 			if (scid) {
-				if (chan_list[i].scid == scid) {
-					chan_list[i].dcid = dcid;
+				if (chan->scid == scid) {
+					chan->dcid = dcid;
 					break;
 				}
 			} else {
-				if (chan_list[i].scid && !chan_list[i].dcid) {
-					chan_list[i].dcid = dcid;
+				if (chan->scid && !chan->dcid) {
+					chan->dcid = dcid;
 					break;
 				}
 			}
 		} else {
 			if (scid) {
-				if (chan_list[i].dcid == scid) {
-					chan_list[i].scid = dcid;
+				if (chan->dcid == scid) {
+					chan->scid = dcid;
 					break;
 				}
 			} else {
-				if (chan_list[i].dcid && !chan_list[i].scid) {
-					chan_list[i].scid = dcid;
+				if (chan->dcid && !chan->scid) {
+					chan->scid = dcid;
 					break;
 				}
 			}
@@ -229,55 +417,74 @@ static void assign_dcid(const struct l2cap_frame *frame, uint16_t dcid,
 	}
 }
 
-static void assign_mode(const struct l2cap_frame *frame,
-					uint8_t mode, uint16_t dcid)
+static struct chan_data *find_chan(const struct l2cap_frame *frame,
+								uint16_t cid)
 {
-	int i;
+	const struct queue_entry *e;
+	struct chan_link *link;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
+	link = link_lookup(frame->index, frame->handle);
+	if (!link)
+		return NULL;
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	for (e = queue_get_entries(link->chans); e; e = e->next) {
+		struct chan_data *chan = e->data;
 
 		if (frame->in) {
-			if (chan_list[i].scid == dcid) {
-				chan_list[i].mode = mode;
-				break;
-			}
+			if (chan->scid == cid)
+				return chan;
 		} else {
-			if (chan_list[i].dcid == dcid) {
-				chan_list[i].mode = mode;
-				break;
-			}
+			if (chan->dcid == cid)
+				return chan;
 		}
 	}
+
+	return NULL;
+}
+
+static void assign_mode(const struct l2cap_frame *frame,
+					uint8_t mode, uint16_t dcid)
+{
+	struct chan_data *chan;
+
+	chan = find_chan(frame, dcid);
+	if (chan)
+		chan->mode = mode;
+}
+
+static bool match_data_chan(const struct chan_data *chan,
+					const struct l2cap_frame *frame)
+{
+	if (frame->in)
+		return chan->scid == frame->cid;
+
+	return chan->dcid == frame->cid;
 }
 
 static int get_chan_data_index(const struct l2cap_frame *frame)
 {
-	int i;
+	const struct queue_entry *e;
+	struct chan_link *link;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index &&
-					chan_list[i].ctrlid == 0)
-			continue;
+	link = link_lookup(frame->index, frame->handle);
+	if (link) {
+		for (e = queue_get_entries(link->chans); e; e = e->next) {
+			struct chan_data *chan = e->data;
 
-		if (chan_list[i].ctrlid != 0 &&
-					chan_list[i].ctrlid != frame->index)
-			continue;
+			if (!chan->ctrlid && match_data_chan(chan, frame))
+				return chan->id;
+		}
+	}
 
-		if (chan_list[i].handle != frame->handle)
+	for (e = queue_get_entries(ctrl_chans); e; e = e->next) {
+		struct chan_data *chan = e->data;
+
+		if (chan->ctrlid != frame->index ||
+					chan->handle != frame->handle)
 			continue;
 
-		if (frame->in) {
-			if (chan_list[i].scid == frame->cid)
-				return i;
-		} else {
-			if (chan_list[i].dcid == frame->cid)
-				return i;
-		}
+		if (match_data_chan(chan, frame))
+			return chan->id;
 	}
 
 	return -1;
@@ -288,13 +495,13 @@ static struct chan_data *get_chan(const struct l2cap_frame *frame)
 	int i;
 
 	if (frame->chan != UINT16_MAX)
-		return &chan_list[frame->chan];
+		return frame->chan < chan_max ? chan_list[frame->chan] : NULL;
 
 	i = get_chan_data_index(frame);
 	if (i < 0)
 		return NULL;
 
-	return &chan_list[i];
+	return chan_list[i];
 }
 
 static uint16_t get_psm(const struct l2cap_frame *frame)
@@ -330,27 +537,11 @@ static uint8_t get_seq_num(const struct l2cap_frame *frame)
 static void assign_ext_ctrl(const struct l2cap_frame *frame,
 					uint8_t ext_ctrl, uint16_t dcid)
 {
-	int i;
-
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
-
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	struct chan_data *chan;
 
-		if (frame->in) {
-			if (chan_list[i].scid == dcid) {
-				chan_list[i].ext_ctrl = ext_ctrl;
-				break;
-			}
-		} else {
-			if (chan_list[i].dcid == dcid) {
-				chan_list[i].ext_ctrl = ext_ctrl;
-				break;
-			}
-		}
-	}
+	chan = find_chan(frame, dcid);
+	if (chan)
+		chan->ext_ctrl = ext_ctrl;
 }
 
 static uint8_t get_ext_ctrl(const struct l2cap_frame *frame)
@@ -488,8 +679,6 @@ static void l2cap_ctrl_parse(struct l2cap_frame *frame, uint32_t ctrl)
 		printf(" F-bit");
 }
 
-#define MAX_INDEX 16
-
 struct index_data {
 	void *frag_buf;
 	uint16_t frag_pos;
@@ -497,14 +686,36 @@ struct index_data {
 	uint16_t frag_cid;
 };
 
-static struct index_data index_list[MAX_INDEX][2];
+static struct index_data (*index_list)[2];
+static unsigned int index_max;
+
+static struct index_data *get_index_data(uint16_t index, bool in)
+{
+	if (index >= index_max) {
+		unsigned int max = index_max ? index_max : 16;
+		struct index_data (*list)[2];
+
+		while (max <= index)
+			max *= 2;
+
+		list = realloc(index_list, max * sizeof(*list));
+		if (!list)
+			return NULL;
+
+		memset(list + index_max, 0, (max - index_max) * sizeof(*list));
+		index_list = list;
+		index_max = max;
+	}
+
+	return &index_list[index][in];
+}
 
-static void clear_fragment_buffer(uint16_t index, bool in)
+static void clear_fragment_buffer(struct index_data *data)
 {
-	free(index_list[index][in].frag_buf);
-	index_list[index][in].frag_buf = NULL;
-	index_list[index][in].frag_pos = 0;
-	index_list[index][in].frag_len = 0;
+	free(data->frag_buf);
+	data->frag_buf = NULL;
+	data->frag_pos = 0;
+	data->frag_len = 0;
 }
 
 static void print_psm(uint16_t psm)
@@ -1545,7 +1756,7 @@ static void l2cap_queue_frame(struct l2cap_frame *frame)
 	struct packet_conn_data *conn;
 	struct l2cap_frame *tx;
 
-	conn = packet_get_conn_data(frame->handle);
+	conn = packet_get_conn_data(frame->index, frame->handle);
 	if (!conn)
 		return;
 
@@ -2673,10 +2884,12 @@ void l2cap_packet(uint16_t index, bool in, uint16_t handle, uint8_t flags,
 					const void *data, uint16_t size)
 {
 	const struct bt_l2cap_hdr *hdr = data;
+	struct index_data *idx;
 	uint16_t len, cid;
 
-	if (index > MAX_INDEX - 1) {
-		print_text(COLOR_ERROR, "controller index too large");
+	idx = get_index_data(index, in);
+	if (!idx) {
+		print_text(COLOR_ERROR, "failed buffer allocation");
 		packet_hexdump(data, size);
 		return;
 	}
@@ -2684,10 +2897,10 @@ void l2cap_packet(uint16_t index, bool in, uint16_t handle, uint8_t flags,
 	switch (flags) {
 	case 0x00:	/* start of a non-automatically-flushable PDU */
 	case 0x02:	/* start of an automatically-flushable PDU */
-		if (index_list[index][in].frag_len) {
+		if (idx->frag_len) {
 			print_text(COLOR_ERROR, "unexpected start frame");
 			packet_hexdump(data, size);
-			clear_fragment_buffer(index, in);
+			clear_fragment_buffer(idx);
 			return;
 		}
 
@@ -2715,54 +2928,54 @@ void l2cap_packet(uint16_t index, bool in, uint16_t handle, uint8_t flags,
 			return;
 		}
 
-		index_list[index][in].frag_buf = malloc(len);
-		if (!index_list[index][in].frag_buf) {
+		idx->frag_buf = malloc(len);
+		if (!idx->frag_buf) {
 			print_text(COLOR_ERROR, "failed buffer allocation");
 			packet_hexdump(data, size);
 			return;
 		}
 
-		memcpy(index_list[index][in].frag_buf, data, size);
-		index_list[index][in].frag_pos = size;
-		index_list[index][in].frag_len = len - size;
-		index_list[index][in].frag_cid = cid;
+		memcpy(idx->frag_buf, data, size);
+		idx->frag_pos = size;
+		idx->frag_len = len - size;
+		idx->frag_cid = cid;
 		break;
 
 	case 0x01:	/* continuing fragment */
-		if (!index_list[index][in].frag_len) {
+		if (!idx->frag_len) {
 			print_text(COLOR_ERROR, "unexpected continuation");
 			packet_hexdump(data, size);
 			return;
 		}
 
-		if (size > index_list[index][in].frag_len) {
+		if (size > idx->frag_len) {
 			print_text(COLOR_ERROR, "fragment too long");
 			packet_hexdump(data, size);
-			clear_fragment_buffer(index, in);
+			clear_fragment_buffer(idx);
 			return;
 		}
 
-		memcpy(index_list[index][in].frag_buf +
-				index_list[index][in].frag_pos, data, size);
-		index_list[index][in].frag_pos += size;
-		index_list[index][in].frag_len -= size;
+		memcpy(idx->frag_buf +
+				idx->frag_pos, data, size);
+		idx->frag_pos += size;
+		idx->frag_len -= size;
 
-		if (!index_list[index][in].frag_len) {
+		if (!idx->frag_len) {
 			/* complete frame */
 			l2cap_frame(index, in, handle,
-					index_list[index][in].frag_cid, 0,
-					index_list[index][in].frag_buf,
-					index_list[index][in].frag_pos);
-			clear_fragment_buffer(index, in);
+					idx->frag_cid, 0,
+					idx->frag_buf,
+					idx->frag_pos);
+			clear_fragment_buffer(idx);
 			return;
 		}
 		break;
 
 	case 0x03:	/* complete automatically-flushable PDU */
-		if (index_list[index][in].frag_len) {
+		if (idx->frag_len) {
 			print_text(COLOR_ERROR, "unexpected complete frame");
 			packet_hexdump(data, size);
-			clear_fragment_buffer(index, in);
+			clear_fragment_buffer(idx);
 			return;
 		}
 
@@ -31,6 +31,7 @@
 #include "ellisys.h"
 #include "control.h"
 #include "display.h"
+#include "filter.h"
 
 static void signal_callback(int signum, void *user_data)
 {
@@ -49,7 +50,9 @@ static void usage(void)
 	printf("\tbtmon [options]\n");
 	printf("options:\n"
 		"\t-r, --read <file>      Read traces in btsnoop format\n"
+		"\t-j, --jobs <num>       Decode read traces with num jobs\n"
 		"\t-w, --write <file>     Save traces in btsnoop format\n"
+		"\t-f, --filter <expr>    Show and save only matching packets\n"
 		"\t-a, --analyze <file>   Analyze traces in btsnoop format\n"
 		"\t                       If gnuplot is installed on the\n"
                 "\t                       system it will also attempt to plot\n"
@@ -79,7 +82,9 @@ static void usage(void)
 
 static const struct option main_options[] = {
 	{ "read",      required_argument, NULL, 'r' },
+	{ "jobs",      required_argument, NULL, 'j' },
 	{ "write",     required_argument, NULL, 'w' },
+	{ "filter",    required_argument, NULL, 'f' },
 	{ "analyze",   required_argument, NULL, 'a' },
 	{ "server",    required_argument, NULL, 's' },
 	{ "priority",  required_argument, NULL, 'p' },
@@ -131,7 +136,7 @@ int main(int argc, char *argv[])
 		struct sockaddr_un addr;
 
 		opt = getopt_long(argc, argv,
-				"r:w:a:s:p:i:d:B:V:MNtTSAIE:PJ:R:C:c:vh",
+				"r:j:w:f:a:s:p:i:d:B:V:MNtTSAIE:PJ:R:C:c:vh",
 				main_options, NULL);
 		if (opt < 0)
 			break;
@@ -140,9 +145,20 @@ int main(int argc, char *argv[])
 		case 'r':
 			reader_path = optarg;
 			break;
+		case 'j':
+			if (!isdigit(*optarg) || !atoi(optarg)) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			control_reader_jobs(atoi(optarg));
+			break;
 		case 'w':
 			writer_path = optarg;
 			break;
+		case 'f':
+			if (!filter_compile(optarg))
+				return EXIT_FAILURE;
+			break;
 		case 'a':
 			analyze_path = optarg;
 			break;
@@ -270,17 +286,23 @@ int main(int argc, char *argv[])
 		return EXIT_SUCCESS;
 	}
 
+	if (writer_path && !control_writer(writer_path)) {
+		printf("Failed to open '%s'\n", writer_path);
+		return EXIT_FAILURE;
+	}
+
 	if (reader_path) {
 		if (ellisys_server)
 			ellisys_enable(ellisys_server, ellisys_port);
 
-		control_reader(reader_path, use_pager);
-		return EXIT_SUCCESS;
-	}
+		if (control_reader(reader_path, use_pager) < 0)
+			exit_status = EXIT_FAILURE;
+		else
+			exit_status = EXIT_SUCCESS;
 
-	if (writer_path && !control_writer(writer_path)) {
-		printf("Failed to open '%s'\n", writer_path);
-		return EXIT_FAILURE;
+		control_cleanup();
+		filter_cleanup();
+		return exit_status;
 	}
 
 	if (ellisys_server)
@@ -297,6 +319,8 @@ int main(int argc, char *argv[])
 
 	exit_status = mainloop_run_with_signal(signal_callback, NULL);
 
+	control_cleanup();
+	filter_cleanup();
 	keys_cleanup();
 
 	return exit_status;
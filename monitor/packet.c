@@ -195,19 +195,118 @@ static uint16_t get_format(uint32_t cookie)
 	return 0xffff;
 }
 
-#define MAX_CONN 16
+/*
+ * Connections are looked up by index and handle for every packet, so keep
+ * them in an open addressing hash table that doubles once it is half full.
+ */
+#define CONN_HASH_MIN_BITS	4
 
-static struct packet_conn_data conn_list[MAX_CONN] = {
-	 [0 ... MAX_CONN - 1].handle = 0xffff
-};
+static struct packet_conn_data **conn_hash;
+static unsigned int conn_hash_bits;
+static unsigned int conn_count;
 
-static struct packet_conn_data *lookup_parent(uint16_t handle)
+static unsigned int conn_hash_slot(uint16_t index, uint16_t handle)
 {
-	int i;
+	uint32_t key = ((uint32_t) index << 16) | handle;
+
+	return (key * 2654435761U) >> (32 - conn_hash_bits);
+}
+
+static struct packet_conn_data *conn_lookup(uint16_t index, uint16_t handle)
+{
+	unsigned int mask, i;
+
+	if (!conn_hash)
+		return NULL;
+
+	mask = (1U << conn_hash_bits) - 1;
+
+	for (i = conn_hash_slot(index, handle); conn_hash[i];
+							i = (i + 1) & mask) {
+		if (conn_hash[i]->index == index &&
+					conn_hash[i]->handle == handle)
+			return conn_hash[i];
+	}
+
+	return NULL;
+}
+
+static void conn_hash_put(struct packet_conn_data *conn)
+{
+	unsigned int mask = (1U << conn_hash_bits) - 1;
+	unsigned int i;
+
+	for (i = conn_hash_slot(conn->index, conn->handle); conn_hash[i];
+							i = (i + 1) & mask)
+		;
+
+	conn_hash[i] = conn;
+}
+
+static bool conn_hash_grow(void)
+{
+	struct packet_conn_data **old = conn_hash;
+	unsigned int old_size = old ? 1U << conn_hash_bits : 0;
+	unsigned int bits, i;
+
+	bits = old ? conn_hash_bits + 1 : CONN_HASH_MIN_BITS;
 
-	for (i = 0; i < MAX_CONN; i++) {
-		if (conn_list[i].link == handle)
-			return &conn_list[i];
+	conn_hash = new0(struct packet_conn_data *, 1U << bits);
+	if (!conn_hash) {
+		conn_hash = old;
+		return false;
+	}
+
+	conn_hash_bits = bits;
+
+	for (i = 0; i < old_size; i++) {
+		if (old[i])
+			conn_hash_put(old[i]);
+	}
+
+	free(old);
+
+	return true;
+}
+
+static void conn_hash_remove(struct packet_conn_data *conn)
+{
+	unsigned int mask = (1U << conn_hash_bits) - 1;
+	unsigned int i, j;
+
+	for (i = conn_hash_slot(conn->index, conn->handle);
+					conn_hash[i] != conn; i = (i + 1) & mask)
+		;
+
+	/* Shift back the entries that probed past the freed slot */
+	for (j = (i + 1) & mask; conn_hash[j]; j = (j + 1) & mask) {
+		unsigned int k = conn_hash_slot(conn_hash[j]->index,
+							conn_hash[j]->handle);
+
+		if ((j > i && (k <= i || k > j)) ||
+					(j < i && (k <= i && k > j))) {
+			conn_hash[i] = conn_hash[j];
+			i = j;
+		}
+	}
+
+	conn_hash[i] = NULL;
+	conn_count--;
+}
+
+static struct packet_conn_data *lookup_parent(uint16_t index, uint16_t handle)
+{
+	unsigned int i;
+
+	if (!conn_hash)
+		return NULL;
+
+	/* Only done when a connection is created, a scan is good enough */
+	for (i = 0; i < 1U << conn_hash_bits; i++) {
+		struct packet_conn_data *conn = conn_hash[i];
+
+		if (conn && conn->index == index && conn->link == handle)
+			return conn;
 	}
 
 	return NULL;
@@ -240,49 +339,41 @@ static struct index_buf_pool *get_pool(uint16_t index, uint8_t type)
 	return NULL;
 }
 
-static struct packet_conn_data *release_handle(uint16_t handle)
+static void release_handle(uint16_t index, uint16_t handle)
 {
-	int i;
-
-	for (i = 0; i < MAX_CONN; i++) {
-		struct packet_conn_data *conn = &conn_list[i];
+	struct packet_conn_data *conn;
+	struct index_buf_pool *pool;
 
-		if (conn->handle == handle) {
-			struct index_buf_pool *pool;
+	conn = conn_lookup(index, handle);
+	if (!conn)
+		return;
 
-			if (conn->destroy)
-				conn->destroy(conn, conn->data);
+	conn_hash_remove(conn);
 
-			pool = get_pool(conn->index, conn->type);
-			if (pool)
-				pool->tx -= queue_length(conn->tx_q);
+	if (conn->destroy)
+		conn->destroy(conn, conn->data);
 
-			queue_destroy(conn->tx_q, free);
-			queue_destroy(conn->chan_q, free);
-			memset(conn, 0, sizeof(*conn));
-			conn->handle = 0xffff;
-			return conn;
-		}
-	}
+	pool = get_pool(conn->index, conn->type);
+	if (pool)
+		pool->tx -= queue_length(conn->tx_q);
 
-	return NULL;
+	queue_destroy(conn->tx_q, free);
+	queue_destroy(conn->chan_q, free);
+	free(conn);
 }
 
 static void assign_handle(uint16_t index, uint16_t handle, uint8_t type,
 					uint8_t *dst, uint8_t dst_type)
 {
-	struct packet_conn_data *conn = release_handle(handle);
-	int i;
+	struct packet_conn_data *conn;
 
-	if (!conn) {
-		for (i = 0; i < MAX_CONN; i++) {
-			if (conn_list[i].handle == 0xffff) {
-				conn = &conn_list[i];
-				break;
-			}
-		}
-	}
+	release_handle(index, handle);
+
+	if ((conn_count + 1) * 2 > (conn_hash ? 1U << conn_hash_bits : 0) &&
+							!conn_hash_grow())
+		return;
 
+	conn = new0(struct packet_conn_data, 1);
 	if (!conn)
 		return;
 
@@ -298,7 +389,7 @@ static void assign_handle(uint16_t index, uint16_t handle, uint8_t type,
 		/* If destination is not set attempt to use the parent one if
 		 * that exists.
 		 */
-		p = lookup_parent(handle);
+		p = lookup_parent(index, handle);
 		if (p) {
 			memcpy(conn->dst, p->dst, sizeof(conn->dst));
 			conn->dst_type = p->dst_type;
@@ -307,25 +398,21 @@ static void assign_handle(uint16_t index, uint16_t handle, uint8_t type,
 		memcpy(conn->dst, dst, sizeof(conn->dst));
 		conn->dst_type = dst_type;
 	}
+
+	conn_hash_put(conn);
+	conn_count++;
 }
 
-struct packet_conn_data *packet_get_conn_data(uint16_t handle)
+struct packet_conn_data *packet_get_conn_data(uint16_t index, uint16_t handle)
 {
-	int i;
-
-	for (i = 0; i < MAX_CONN; i++) {
-		if (conn_list[i].handle == handle)
-			return &conn_list[i];
-	}
-
-	return NULL;
+	return conn_lookup(index, handle);
 }
 
 static uint8_t get_type(uint16_t handle)
 {
 	struct packet_conn_data *conn;
 
-	conn = packet_get_conn_data(handle);
+	conn = packet_get_conn_data(index_current, handle);
 	if (!conn)
 		return 0xff;
 
@@ -423,6 +510,12 @@ static void print_packet(struct timeval *tv, struct ucred *cred, char ident,
 	int n, ts_len = 0, ts_pos = 0, len = 0, pos = 0;
 	static size_t last_frame;
 
+	if (display_quiet) {
+		if (!channel && index != HCI_DEV_NONE && index < MAX_INDEX)
+			last_frame = index_list[index].frame;
+		return;
+	}
+
 	if (channel) {
 		if (use_color()) {
 			n = sprintf(ts_str + ts_pos, "%s", COLOR_CHANNEL_LABEL);
@@ -875,7 +968,7 @@ static void print_handle_native(uint16_t handle)
 	struct packet_conn_data *conn;
 	char label[25];
 
-	conn = packet_get_conn_data(handle);
+	conn = packet_get_conn_data(index_current, handle);
 	if (!conn) {
 		print_field("Handle: %d", handle);
 		return;
@@ -4201,7 +4294,7 @@ void packet_hexdump(const unsigned char *buf, uint16_t len)
 	char str[68];
 	uint16_t i;
 
-	if (!len)
+	if (!len || display_quiet)
 		return;
 
 	for (i = 0; i < len; i++) {
@@ -8886,7 +8979,7 @@ static void print_cis(const void *data, int i)
 	print_field("CIS Handle: %d", cis->cis_handle);
 	print_field("ACL Handle: %d", cis->acl_handle);
 
-	conn = packet_get_conn_data(cis->acl_handle);
+	conn = packet_get_conn_data(index_current, cis->acl_handle);
 	if (conn)
 		conn->link = cis->cis_handle;
 }
@@ -10714,6 +10807,61 @@ static const struct opcode_data opcode_table[] = {
 	{ }
 };
 
+/*
+ * The tables above are searched for every packet, so they get indexed on
+ * first use: commands by OGF and then OCF, events and LE subevents by
+ * their code and mgmt commands and events by their opcode. The first
+ * entry wins in case of duplicates, the same as a linear search would.
+ */
+static const struct opcode_data **opcode_index[64];
+static uint16_t opcode_index_len[64];
+static bool opcode_index_done;
+
+static void build_opcode_index(void)
+{
+	int i;
+
+	opcode_index_done = true;
+
+	for (i = 0; opcode_table[i].str; i++) {
+		uint16_t ogf = cmd_opcode_ogf(opcode_table[i].opcode);
+		uint16_t ocf = cmd_opcode_ocf(opcode_table[i].opcode);
+
+		if (ocf >= opcode_index_len[ogf])
+			opcode_index_len[ogf] = ocf + 1;
+	}
+
+	for (i = 0; i < 64; i++) {
+		if (!opcode_index_len[i])
+			continue;
+
+		opcode_index[i] = new0(const struct opcode_data *,
+						opcode_index_len[i]);
+	}
+
+	for (i = 0; opcode_table[i].str; i++) {
+		uint16_t ogf = cmd_opcode_ogf(opcode_table[i].opcode);
+		uint16_t ocf = cmd_opcode_ocf(opcode_table[i].opcode);
+
+		if (!opcode_index[ogf][ocf])
+			opcode_index[ogf][ocf] = &opcode_table[i];
+	}
+}
+
+static const struct opcode_data *find_opcode(uint16_t opcode)
+{
+	uint16_t ogf = cmd_opcode_ogf(opcode);
+	uint16_t ocf = cmd_opcode_ocf(opcode);
+
+	if (!opcode_index_done)
+		build_opcode_index();
+
+	if (ocf >= opcode_index_len[ogf])
+		return NULL;
+
+	return opcode_index[ogf][ocf];
+}
+
 static const char *get_supported_command(int bit)
 {
 	int i;
@@ -10886,7 +11034,7 @@ static void disconnect_complete_evt(struct timeval *tv, uint16_t index,
 	print_reason(evt->reason);
 
 	if (evt->status == 0x00)
-		release_handle(le16_to_cpu(evt->handle));
+		release_handle(index, le16_to_cpu(evt->handle));
 }
 
 static void auth_complete_evt(struct timeval *tv, uint16_t index,
@@ -10993,14 +11141,8 @@ static void cmd_complete_evt(struct timeval *tv, uint16_t index,
 	const struct opcode_data *opcode_data = NULL;
 	const char *opcode_color, *opcode_str;
 	char vendor_str[150];
-	int i;
 
-	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].opcode == opcode) {
-			opcode_data = &opcode_table[i];
-			break;
-		}
-	}
+	opcode_data = find_opcode(opcode);
 
 	if (opcode_data) {
 		if (opcode_data->rsp_func)
@@ -11089,14 +11231,8 @@ static void cmd_status_evt(struct timeval *tv, uint16_t index,
 	const struct opcode_data *opcode_data = NULL;
 	const char *opcode_color, *opcode_str;
 	char vendor_str[150];
-	int i;
 
-	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].opcode == opcode) {
-			opcode_data = &opcode_table[i];
-			break;
-		}
-	}
+	opcode_data = find_opcode(opcode);
 
 	if (opcode_data) {
 		opcode_color = COLOR_HCI_COMMAND;
@@ -11189,14 +11325,15 @@ void packet_latency_add(struct packet_latency *latency, struct timeval *delta)
 		latency->med = *delta;
 }
 
-static void packet_dequeue_tx(struct timeval *tv, uint16_t handle)
+static void packet_dequeue_tx(struct timeval *tv, uint16_t index,
+							uint16_t handle)
 {
 	struct packet_conn_data *conn;
 	struct packet_frame *frame;
 	struct index_buf_pool *pool;
 	struct timeval delta;
 
-	conn = packet_get_conn_data(handle);
+	conn = packet_get_conn_data(index, handle);
 	if (!conn)
 		return;
 
@@ -11204,8 +11341,10 @@ static void packet_dequeue_tx(struct timeval *tv, uint16_t handle)
 	if (pool) {
 		if (!pool->tx)
 			print_field("Buffers: underflow/%u", pool->total);
-		else
-			print_field("Buffers: %u/%u", --pool->tx, pool->total);
+		else {
+			pool->tx--;
+			print_field("Buffers: %u/%u", pool->tx, pool->total);
+		}
 	}
 
 	frame = queue_pop_head(conn->tx_q);
@@ -11257,7 +11396,7 @@ static void num_completed_packets_evt(struct timeval *tv, uint16_t index,
 		print_field("Count: %d", count);
 
 		for (j = 0; j < count; j++)
-			packet_dequeue_tx(tv, handle);
+			packet_dequeue_tx(tv, index, handle);
 	}
 
 	if (iov.iov_len)
@@ -12425,7 +12564,7 @@ static void le_req_cis_evt(struct timeval *tv, uint16_t index,
 	print_field("CIG ID: 0x%2.2x", evt->cig_id);
 	print_field("CIS ID: 0x%2.2x", evt->cis_id);
 
-	conn = packet_get_conn_data(evt->acl_handle);
+	conn = packet_get_conn_data(index, evt->acl_handle);
 	if (conn)
 		conn->link = evt->cis_handle;
 }
@@ -13344,13 +13483,34 @@ static const struct subevent_data le_meta_event_table[] = {
 	{ }
 };
 
+static const struct subevent_data *le_meta_event_index[256];
+static bool le_meta_event_index_done;
+
+static const struct subevent_data *find_le_meta_event(uint8_t subevent)
+{
+	int i;
+
+	if (le_meta_event_index_done)
+		return le_meta_event_index[subevent];
+
+	le_meta_event_index_done = true;
+
+	for (i = 0; le_meta_event_table[i].str; i++) {
+		const struct subevent_data *data = &le_meta_event_table[i];
+
+		if (!le_meta_event_index[data->subevent])
+			le_meta_event_index[data->subevent] = data;
+	}
+
+	return le_meta_event_index[subevent];
+}
+
 static void le_meta_event_evt(struct timeval *tv, uint16_t index,
 				const void *data, uint8_t size)
 {
 	uint8_t subevent = *((const uint8_t *) data);
 	struct subevent_data unknown;
-	const struct subevent_data *subevent_data = &unknown;
-	int i;
+	const struct subevent_data *subevent_data;
 
 	unknown.subevent = subevent;
 	unknown.str = "Unknown";
@@ -13358,12 +13518,9 @@ static void le_meta_event_evt(struct timeval *tv, uint16_t index,
 	unknown.size = 0;
 	unknown.fixed = true;
 
-	for (i = 0; le_meta_event_table[i].str; i++) {
-		if (le_meta_event_table[i].subevent == subevent) {
-			subevent_data = &le_meta_event_table[i];
-			break;
-		}
-	}
+	subevent_data = find_le_meta_event(subevent);
+	if (!subevent_data)
+		subevent_data = &unknown;
 
 	print_subevent(tv, index, subevent_data, data + 1, size - 1);
 }
@@ -13569,6 +13726,26 @@ static const struct event_data event_table[] = {
 	{ }
 };
 
+static const struct event_data *event_index[256];
+static bool event_index_done;
+
+static const struct event_data *find_event(uint8_t event)
+{
+	int i;
+
+	if (event_index_done)
+		return event_index[event];
+
+	event_index_done = true;
+
+	for (i = 0; event_table[i].str; i++) {
+		if (!event_index[event_table[i].event])
+			event_index[event_table[i].event] = &event_table[i];
+	}
+
+	return event_index[event];
+}
+
 void packet_new_index(struct timeval *tv, uint16_t index, const char *label,
 				uint8_t type, uint8_t bus, const char *name)
 {
@@ -13724,7 +13901,6 @@ void packet_hci_command(struct timeval *tv, struct ucred *cred, uint16_t index,
 	const struct opcode_data *opcode_data = NULL;
 	const char *opcode_color, *opcode_str;
 	char extra_str[25], vendor_str[150];
-	int i;
 
 	if (index >= MAX_INDEX) {
 		print_field("Invalid index (%d).", index);
@@ -13743,12 +13919,7 @@ void packet_hci_command(struct timeval *tv, struct ucred *cred, uint16_t index,
 	data += HCI_COMMAND_HDR_SIZE;
 	size -= HCI_COMMAND_HDR_SIZE;
 
-	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].opcode == opcode) {
-			opcode_data = &opcode_table[i];
-			break;
-		}
-	}
+	opcode_data = find_opcode(opcode);
 
 	if (opcode_data) {
 		if (opcode_data->cmd_func)
@@ -13831,7 +14002,6 @@ void packet_hci_event(struct timeval *tv, struct ucred *cred, uint16_t index,
 	const struct event_data *event_data = NULL;
 	const char *event_color, *event_str;
 	char extra_str[25];
-	int i;
 
 	if (index >= MAX_INDEX) {
 		print_field("Invalid index (%d).", index);
@@ -13852,12 +14022,7 @@ void packet_hci_event(struct timeval *tv, struct ucred *cred, uint16_t index,
 	data += HCI_EVENT_HDR_SIZE;
 	size -= HCI_EVENT_HDR_SIZE;
 
-	for (i = 0; event_table[i].str; i++) {
-		if (event_table[i].event == hdr->evt) {
-			event_data = &event_table[i];
-			break;
-		}
-	}
+	event_data = find_event(hdr->evt);
 
 	if (event_data) {
 		if (event_data->func)
@@ -13904,13 +14069,13 @@ void packet_hci_event(struct timeval *tv, struct ucred *cred, uint16_t index,
 	event_data->func(tv, index, data, hdr->plen);
 }
 
-static void packet_enqueue_tx(struct timeval *tv, uint16_t handle,
-				size_t num, uint16_t len)
+static void packet_enqueue_tx(struct timeval *tv, uint16_t index,
+				uint16_t handle, size_t num, uint16_t len)
 {
 	struct packet_conn_data *conn;
 	struct packet_frame *frame;
 
-	conn = packet_get_conn_data(handle);
+	conn = packet_get_conn_data(index, handle);
 	if (!conn)
 		return;
 
@@ -13957,7 +14122,7 @@ void packet_hci_acldata(struct timeval *tv, struct ucred *cred, uint16_t index,
 	data += HCI_ACL_HDR_SIZE;
 	size -= HCI_ACL_HDR_SIZE;
 
-	conn = packet_get_conn_data(handle);
+	conn = packet_get_conn_data(index, handle);
 	if (conn && conn->type == 0x01 && index_list[index].le.total)
 		pool = &index_list[index].le;
 
@@ -13974,7 +14139,7 @@ void packet_hci_acldata(struct timeval *tv, struct ucred *cred, uint16_t index,
 						handle_str, extra_str);
 
 	if (!in)
-		packet_enqueue_tx(tv, acl_handle(handle),
+		packet_enqueue_tx(tv, index, acl_handle(handle),
 					index_list[index].frame, dlen);
 
 	if (size != dlen) {
@@ -14032,7 +14197,7 @@ void packet_hci_scodata(struct timeval *tv, struct ucred *cred, uint16_t index,
 						handle_str, extra_str);
 
 	if (!in)
-		packet_enqueue_tx(tv, acl_handle(handle),
+		packet_enqueue_tx(tv, index, acl_handle(handle),
 					index_list[index].frame, hdr->dlen);
 
 	if (size != hdr->dlen) {
@@ -14095,7 +14260,7 @@ void packet_hci_isodata(struct timeval *tv, struct ucred *cred, uint16_t index,
 						handle_str, extra_str);
 
 	if (!in)
-		packet_enqueue_tx(tv, acl_handle(handle),
+		packet_enqueue_tx(tv, index, acl_handle(handle),
 					index_list[index].frame, hdr->dlen);
 
 	if (size != hdr->dlen) {
@@ -16454,6 +16619,48 @@ static const struct mgmt_data mgmt_command_table[] = {
 	{ }
 };
 
+struct mgmt_index {
+	const struct mgmt_data **data;
+	uint16_t len;
+	bool done;
+};
+
+static struct mgmt_index mgmt_command_index;
+static struct mgmt_index mgmt_event_index;
+
+static const struct mgmt_data *find_mgmt(struct mgmt_index *index,
+					const struct mgmt_data *table,
+					uint16_t opcode)
+{
+	int i;
+
+	if (!index->done) {
+		index->done = true;
+
+		for (i = 0; table[i].str; i++) {
+			if (table[i].opcode >= index->len)
+				index->len = table[i].opcode + 1;
+		}
+
+		index->data = new0(const struct mgmt_data *, index->len);
+
+		for (i = 0; table[i].str; i++) {
+			if (!index->data[table[i].opcode])
+				index->data[table[i].opcode] = &table[i];
+		}
+	}
+
+	if (opcode >= index->len)
+		return NULL;
+
+	return index->data[opcode];
+}
+
+static const struct mgmt_data *find_mgmt_command(uint16_t opcode)
+{
+	return find_mgmt(&mgmt_command_index, mgmt_command_table, opcode);
+}
+
 static void mgmt_null_evt(const void *data, uint16_t size)
 {
 }
@@ -16464,7 +16671,6 @@ static void mgmt_command_complete_evt(const void *data, uint16_t size)
 	uint8_t status;
 	const struct mgmt_data *mgmt_data = NULL;
 	const char *mgmt_color, *mgmt_str;
-	int i;
 
 	opcode = get_le16(data);
 	status = get_u8(data + 2);
@@ -16472,12 +16678,7 @@ static void mgmt_command_complete_evt(const void *data, uint16_t size)
 	data += 3;
 	size -= 3;
 
-	for (i = 0; mgmt_command_table[i].str; i++) {
-		if (mgmt_command_table[i].opcode == opcode) {
-			mgmt_data = &mgmt_command_table[i];
-			break;
-		}
-	}
+	mgmt_data = find_mgmt_command(opcode);
 
 	if (mgmt_data) {
 		if (mgmt_data->rsp_func)
@@ -16523,17 +16724,11 @@ static void mgmt_command_status_evt(const void *data, uint16_t size)
 	uint8_t status;
 	const struct mgmt_data *mgmt_data = NULL;
 	const char *mgmt_color, *mgmt_str;
-	int i;
 
 	opcode = get_le16(data);
 	status = get_u8(data + 2);
 
-	for (i = 0; mgmt_command_table[i].str; i++) {
-		if (mgmt_command_table[i].opcode == opcode) {
-			mgmt_data = &mgmt_command_table[i];
-			break;
-		}
-	}
+	mgmt_data = find_mgmt_command(opcode);
 
 	if (mgmt_data) {
 		mgmt_color = COLOR_CTRL_COMMAND;
@@ -17075,6 +17270,11 @@ static const struct mgmt_data mgmt_event_table[] = {
 	{ }
 };
 
+static const struct mgmt_data *find_mgmt_event(uint16_t opcode)
+{
+	return find_mgmt(&mgmt_event_index, mgmt_event_table, opcode);
+}
+
 static void mgmt_print_commands(const void *data, uint16_t num)
 {
 	int i;
@@ -17127,7 +17327,6 @@ void packet_ctrl_command(struct timeval *tv, struct ucred *cred, uint16_t index,
 	const struct mgmt_data *mgmt_data = NULL;
 	const char *mgmt_color, *mgmt_str;
 	char channel[11], extra_str[25];
-	int i;
 
 	if (size < 4) {
 		print_packet(tv, cred, '*', index, NULL, COLOR_ERROR,
@@ -17168,12 +17367,7 @@ void packet_ctrl_command(struct timeval *tv, struct ucred *cred, uint16_t index,
 	data += 2;
 	size -= 2;
 
-	for (i = 0; mgmt_command_table[i].str; i++) {
-		if (mgmt_command_table[i].opcode == opcode) {
-			mgmt_data = &mgmt_command_table[i];
-			break;
-		}
-	}
+	mgmt_data = find_mgmt_command(opcode);
 
 	if (mgmt_data) {
 		if (mgmt_data->func)
@@ -17221,7 +17415,6 @@ void packet_ctrl_event(struct timeval *tv, struct ucred *cred, uint16_t index,
 	const struct mgmt_data *mgmt_data = NULL;
 	const char *mgmt_color, *mgmt_str;
 	char channel[11], extra_str[25];
-	int i;
 
 	if (size < 4) {
 		print_packet(tv, cred, '*', index, NULL, COLOR_ERROR,
@@ -17262,12 +17455,7 @@ void packet_ctrl_event(struct timeval *tv, struct ucred *cred, uint16_t index,
 	data += 2;
 	size -= 2;
 
-	for (i = 0; mgmt_event_table[i].str; i++) {
-		if (mgmt_event_table[i].opcode == opcode) {
-			mgmt_data = &mgmt_event_table[i];
-			break;
-		}
-	}
+	mgmt_data = find_mgmt_event(opcode);
 
 	if (mgmt_data) {
 		if (mgmt_data->func)
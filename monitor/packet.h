@@ -53,7 +53,8 @@ struct packet_conn_data {
 	void     (*destroy)(struct packet_conn_data *conn, void *data);
 };
 
-struct packet_conn_data *packet_get_conn_data(uint16_t handle);
+struct packet_conn_data *packet_get_conn_data(uint16_t index,
+						uint16_t handle);
 void packet_latency_add(struct packet_latency *latency, struct timeval *delta);
 
 bool packet_has_filter(unsigned long filter);
@@ -158,8 +158,54 @@ static char *file_stat_line(char *filename, struct stat *fstat,
 	return ret;
 }
 
-static void *filesystem_open(const char *name, int oflag, mode_t mode,
-					void *context, size_t *size, int *err)
+#define FILE_IO_BUF_SIZE	(64 * 1024)
+
+/*
+ * Regular files are read ahead and written behind by a worker thread
+ * using two buffers: while the OBEX layer consumes (or fills) one of them
+ * the worker reads (or writes) the other. Whenever the main thread finds
+ * no buffer available the driver returns -EAGAIN and the worker reports
+ * back through the mainloop once one is. Closing never waits for the
+ * worker: it finishes pending writes, closes the file and is then reaped
+ * from the mainloop.
+ */
+struct file_io {
+	int fd;
+	gboolean writing;
+	GThread *thread;
+	GMutex lock;
+	GCond cond;
+	uint8_t *buf[2];
+	size_t len[2];
+	gboolean ready[2];
+	unsigned int p;
+	unsigned int c;
+	size_t offset;
+	int err;
+	gboolean eof;
+	gboolean stop;
+	gboolean waiting;
+	gboolean flushing;
+	guint idle_id;
+	int close_err;
+	guint done_id;
+};
+
+struct file_copy {
+	int in_fd;
+	int out_fd;
+	size_t size;
+	char *name;
+	char *destname;
+	GThread *thread;
+	int err;
+	guint idle_id;
+};
+
+static GSList *copies = NULL;
+static GSList *closing = NULL;
+
+static int open_file(const char *name, int oflag, mode_t mode, size_t *size)
 {
 	struct stat stats;
 	struct statvfs buf;
@@ -167,84 +213,401 @@ static void *filesystem_open(const char *name, int oflag, mode_t mode,
 	uint64_t avail;
 
 	fd = open(name, oflag, mode);
-	if (fd < 0) {
-		if (err)
-			*err = -errno;
-		return NULL;
-	}
+	if (fd < 0)
+		return -errno;
 
 	if (fstat(fd, &stats) < 0) {
-		if (err)
-			*err = -errno;
+		ret = -errno;
 		goto failed;
 	}
 
 	ret = verify_path(name);
-	if (ret < 0) {
-		if (err)
-			*err = ret;
+	if (ret < 0)
 		goto failed;
-	}
 
 	if (oflag == O_RDONLY) {
 		if (size)
 			*size = stats.st_size;
-		goto done;
+		return fd;
 	}
 
 	if (fstatvfs(fd, &buf) < 0) {
-		if (err)
-			*err = -errno;
+		ret = -errno;
 		goto failed;
 	}
 
 	if (size == NULL)
-		goto done;
+		return fd;
 
 	avail = (uint64_t) buf.f_bsize * buf.f_bavail;
 	if (avail < *size) {
-		if (err)
-			*err = -ENOSPC;
+		ret = -ENOSPC;
 		goto failed;
 	}
 
-done:
-	if (err)
-		*err = 0;
-
-	return GINT_TO_POINTER(fd);
+	return fd;
 
 failed:
 	close(fd);
+	return ret;
+}
+
+static gboolean file_io_notify(gpointer user_data)
+{
+	struct file_io *io = user_data;
+	int err;
+
+	g_mutex_lock(&io->lock);
+	io->idle_id = 0;
+	err = io->err;
+	g_mutex_unlock(&io->lock);
+
+	obex_object_set_io_flags(io, io->writing ? G_IO_OUT : G_IO_IN, err);
+
+	return FALSE;
+}
+
+/* Called with io->lock held */
+static void file_io_wakeup(struct file_io *io)
+{
+	if (!io->waiting || io->idle_id)
+		return;
+
+	io->waiting = FALSE;
+	io->idle_id = g_idle_add(file_io_notify, io);
+}
+
+static void file_io_read_ahead(struct file_io *io)
+{
+	g_mutex_lock(&io->lock);
+
+	while (!io->stop) {
+		unsigned int i = io->p;
+		ssize_t ret;
+
+		if (io->ready[i]) {
+			g_cond_wait(&io->cond, &io->lock);
+			continue;
+		}
+
+		/* Free buffers are only ever touched by the worker */
+		g_mutex_unlock(&io->lock);
+		ret = read(io->fd, io->buf[i], FILE_IO_BUF_SIZE);
+		g_mutex_lock(&io->lock);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			io->err = -errno;
+			break;
+		}
+
+		if (ret == 0) {
+			io->eof = TRUE;
+			break;
+		}
+
+		io->len[i] = ret;
+		io->ready[i] = TRUE;
+		io->p ^= 1;
+		file_io_wakeup(io);
+	}
+
+	file_io_wakeup(io);
+	g_mutex_unlock(&io->lock);
+}
+
+static int write_all(int fd, const uint8_t *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t ret;
+
+		ret = write(fd, buf, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static void file_io_write_behind(struct file_io *io)
+{
+	g_mutex_lock(&io->lock);
+
+	while (1) {
+		unsigned int i = io->c;
+		int err = 0;
+
+		if (!io->ready[i]) {
+			if (io->stop)
+				break;
+			g_cond_wait(&io->cond, &io->lock);
+			continue;
+		}
+
+		/* Once writing has failed the remaining data is dropped */
+		if (io->err == 0) {
+			g_mutex_unlock(&io->lock);
+			err = write_all(io->fd, io->buf[i], io->len[i]);
+			g_mutex_lock(&io->lock);
+		}
+
+		if (err < 0)
+			io->err = err;
+
+		io->len[i] = 0;
+		io->ready[i] = FALSE;
+		io->c ^= 1;
+
+		/* A flush only completes once both buffers are written */
+		if (!io->flushing || !io->ready[io->c])
+			file_io_wakeup(io);
+	}
+
+	g_mutex_unlock(&io->lock);
+}
+
+static void file_io_free(struct file_io *io)
+{
+	g_mutex_clear(&io->lock);
+	g_cond_clear(&io->cond);
+	g_free(io->buf[0]);
+	g_free(io->buf[1]);
+	g_free(io);
+}
+
+static gboolean file_io_done(gpointer user_data)
+{
+	struct file_io *io = user_data;
+
+	g_thread_join(io->thread);
+	closing = g_slist_remove(closing, io);
+
+	/* Errors seen before closing were already returned by close */
+	if (io->err < 0 && io->err != io->close_err)
+		error("write(): %s (%d)", strerror(-io->err), -io->err);
+
+	file_io_free(io);
+
+	return FALSE;
+}
+
+static gpointer file_io_thread(gpointer user_data)
+{
+	struct file_io *io = user_data;
+
+	if (io->writing)
+		file_io_write_behind(io);
+	else
+		file_io_read_ahead(io);
+
+	/* The object stays in use until the main thread closes it */
+	g_mutex_lock(&io->lock);
+	while (!io->stop)
+		g_cond_wait(&io->cond, &io->lock);
+	g_mutex_unlock(&io->lock);
+
+	if (close(io->fd) < 0 && io->err == 0)
+		io->err = -errno;
+
+	io->done_id = g_idle_add(file_io_done, io);
+
 	return NULL;
 }
 
+static struct file_io *file_io_new(int fd, gboolean writing, int *err)
+{
+	struct file_io *io;
+	GError *gerr = NULL;
+
+	io = g_new0(struct file_io, 1);
+	io->fd = fd;
+	io->writing = writing;
+	io->buf[0] = g_malloc(FILE_IO_BUF_SIZE);
+	io->buf[1] = g_malloc(FILE_IO_BUF_SIZE);
+	g_mutex_init(&io->lock);
+	g_cond_init(&io->cond);
+
+	io->thread = g_thread_try_new("obexd-file", file_io_thread, io, &gerr);
+	if (io->thread == NULL) {
+		error("Unable to start file I/O thread: %s", gerr->message);
+		g_error_free(gerr);
+		file_io_free(io);
+		*err = -EIO;
+		return NULL;
+	}
+
+	return io;
+}
+
+static void *filesystem_open(const char *name, int oflag, mode_t mode,
+					void *context, size_t *size, int *err)
+{
+	struct file_io *io;
+	int fd, ret;
+
+	fd = open_file(name, oflag, mode, size);
+	if (fd < 0) {
+		if (err)
+			*err = fd;
+		return NULL;
+	}
+
+	io = file_io_new(fd, oflag != O_RDONLY, &ret);
+	if (io == NULL) {
+		close(fd);
+		if (err)
+			*err = ret;
+		return NULL;
+	}
+
+	if (err)
+		*err = 0;
+
+	return io;
+}
+
 static int filesystem_close(void *object)
 {
-	if (close(GPOINTER_TO_INT(object)) < 0)
-		return -errno;
+	struct file_io *io = object;
+	int err;
 
-	return 0;
+	g_mutex_lock(&io->lock);
+
+	/* Hand over what is left in the current buffer */
+	if (io->writing && io->len[io->p] > 0 && !io->ready[io->p])
+		io->ready[io->p] = TRUE;
+
+	/* The object is gone for the OBEX layer, stop waking it up */
+	io->waiting = FALSE;
+	if (io->idle_id > 0) {
+		g_source_remove(io->idle_id);
+		io->idle_id = 0;
+	}
+
+	err = io->err;
+	io->close_err = err;
+	io->stop = TRUE;
+	g_cond_signal(&io->cond);
+	g_mutex_unlock(&io->lock);
+
+	closing = g_slist_prepend(closing, io);
+
+	return err;
+}
+
+static int filesystem_flush(void *object)
+{
+	struct file_io *io = object;
+	unsigned int i;
+	int err;
+
+	if (!io->writing)
+		return 0;
+
+	g_mutex_lock(&io->lock);
+
+	i = io->p;
+
+	/* Hand over what is left in the current buffer */
+	if (io->len[i] > 0 && !io->ready[i]) {
+		io->ready[i] = TRUE;
+		io->p ^= 1;
+		g_cond_signal(&io->cond);
+	}
+
+	err = io->err;
+
+	if (err == 0 && (io->ready[0] || io->ready[1])) {
+		io->flushing = TRUE;
+		io->waiting = TRUE;
+		err = -EAGAIN;
+	}
+
+	g_mutex_unlock(&io->lock);
+
+	return err;
 }
 
 static ssize_t filesystem_read(void *object, void *buf, size_t count)
 {
+	struct file_io *io = object;
+	unsigned int i;
 	ssize_t ret;
 
-	ret = read(GPOINTER_TO_INT(object), buf, count);
-	if (ret < 0)
-		return -errno;
+	g_mutex_lock(&io->lock);
+
+	i = io->c;
+
+	if (!io->ready[i]) {
+		if (io->err < 0)
+			ret = io->err;
+		else if (io->eof)
+			ret = 0;
+		else {
+			io->waiting = TRUE;
+			ret = -EAGAIN;
+		}
+		goto done;
+	}
+
+	ret = MIN(count, io->len[i] - io->offset);
+	memcpy(buf, io->buf[i] + io->offset, ret);
+	io->offset += ret;
+
+	if (io->offset == io->len[i]) {
+		io->offset = 0;
+		io->ready[i] = FALSE;
+		io->c ^= 1;
+		g_cond_signal(&io->cond);
+	}
+
+done:
+	g_mutex_unlock(&io->lock);
 
 	return ret;
 }
 
 static ssize_t filesystem_write(void *object, const void *buf, size_t count)
 {
+	struct file_io *io = object;
+	unsigned int i;
 	ssize_t ret;
 
-	ret = write(GPOINTER_TO_INT(object), buf, count);
-	if (ret < 0)
-		return -errno;
+	g_mutex_lock(&io->lock);
+
+	if (io->err < 0) {
+		ret = io->err;
+		goto done;
+	}
+
+	i = io->p;
+
+	/* Both buffers are still queued for the worker */
+	if (io->ready[i]) {
+		io->waiting = TRUE;
+		ret = -EAGAIN;
+		goto done;
+	}
+
+	ret = MIN(count, FILE_IO_BUF_SIZE - io->len[i]);
+	memcpy(io->buf[i] + io->len[i], buf, ret);
+	io->len[i] += ret;
+
+	if (io->len[i] == FILE_IO_BUF_SIZE) {
+		io->ready[i] = TRUE;
+		io->p ^= 1;
+		g_cond_signal(&io->cond);
+	}
+
+done:
+	g_mutex_unlock(&io->lock);
 
 	return ret;
 }
@@ -263,83 +626,134 @@ static int filesystem_rename(const char *name, const char *destname)
 	return ret;
 }
 
-static int sendfile_async(int out_fd, int in_fd, off_t *offset, size_t count)
+static int copy_range(int out_fd, int in_fd, size_t count)
 {
-	int pid;
+	gboolean fallback = FALSE;
+
+	while (count > 0) {
+		ssize_t ret;
+
+		if (!fallback)
+			ret = copy_file_range(in_fd, NULL, out_fd, NULL, count,
+									0);
+		else
+			ret = sendfile(out_fd, in_fd, NULL, count);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			/* Cross filesystem or unsupported, use sendfile */
+			if (!fallback && (errno == EXDEV || errno == ENOSYS ||
+							errno == EINVAL ||
+							errno == EOPNOTSUPP)) {
+				fallback = TRUE;
+				continue;
+			}
 
-	/* Run sendfile on child process */
-	pid = fork();
-	switch (pid) {
-		case 0:
-			break;
-		case -1:
-			error("fork() %s (%d)", strerror(errno), errno);
 			return -errno;
-		default:
-			DBG("child %d forked", pid);
-			return pid;
+		}
+
+		/* File got truncated while copying */
+		if (ret == 0)
+			break;
+
+		count -= ret;
 	}
 
-	/* At child */
-	if (sendfile(out_fd, in_fd, offset, count) < 0)
-		error("sendfile(): %s (%d)", strerror(errno), errno);
+	return 0;
+}
+
+static gboolean copy_complete(gpointer user_data)
+{
+	struct file_copy *copy = user_data;
+
+	g_thread_join(copy->thread);
+	copies = g_slist_remove(copies, copy);
 
-	close(in_fd);
-	close(out_fd);
+	if (copy->err < 0)
+		error("copy(%s, %s): %s (%d)", copy->name, copy->destname,
+					strerror(-copy->err), -copy->err);
+	else
+		DBG("%s copied to %s", copy->name, copy->destname);
 
-	exit(errno);
+	g_free(copy->name);
+	g_free(copy->destname);
+	g_free(copy);
+
+	return FALSE;
+}
+
+static gpointer copy_thread(gpointer user_data)
+{
+	struct file_copy *copy = user_data;
+
+	copy->err = copy_range(copy->out_fd, copy->in_fd, copy->size);
+
+	close(copy->in_fd);
+	close(copy->out_fd);
+
+	copy->idle_id = g_idle_add(copy_complete, copy);
+
+	return NULL;
 }
 
 static int filesystem_copy(const char *name, const char *destname)
 {
-	void *in, *out;
-	ssize_t ret;
+	struct file_copy *copy;
+	GError *gerr = NULL;
 	size_t size;
 	struct stat st;
-	int in_fd, out_fd, err;
+	int in_fd, out_fd;
 
-	in = filesystem_open(name, O_RDONLY, 0, NULL, &size, &err);
-	if (in == NULL) {
-		error("open(%s): %s (%d)", name, strerror(-err), -err);
-		return -err;
+	in_fd = open_file(name, O_RDONLY, 0, &size);
+	if (in_fd < 0) {
+		error("open(%s): %s (%d)", name, strerror(-in_fd), -in_fd);
+		return in_fd;
 	}
 
-	in_fd = GPOINTER_TO_INT(in);
-	ret = fstat(in_fd, &st);
-	if (ret < 0) {
-		error("stat(%s): %s (%d)", name, strerror(errno), errno);
-		return -errno;
-	}
+	if (fstat(in_fd, &st) < 0) {
+		int err = -errno;
 
-	out = filesystem_open(destname, O_WRONLY | O_CREAT | O_TRUNC,
-					st.st_mode, NULL, &size, &err);
-	if (out == NULL) {
-		error("open(%s): %s (%d)", destname, strerror(-err), -err);
-		filesystem_close(in);
-		return -errno;
+		error("stat(%s): %s (%d)", name, strerror(-err), -err);
+		close(in_fd);
+		return err;
 	}
 
-	out_fd = GPOINTER_TO_INT(out);
-
-	/* Check if sendfile is supported */
-	ret = sendfile(out_fd, in_fd, NULL, 0);
-	if (ret < 0) {
-		ret = -errno;
-		error("sendfile: %s (%zd)", strerror(-ret), -ret);
-		goto done;
+	out_fd = open_file(destname, O_WRONLY | O_CREAT | O_TRUNC, st.st_mode,
+									&size);
+	if (out_fd < 0) {
+		error("open(%s): %s (%d)", destname, strerror(-out_fd),
+								-out_fd);
+		close(in_fd);
+		return out_fd;
 	}
 
-	ret = sendfile_async(out_fd, in_fd, NULL, st.st_size);
-	if (ret < 0)
-		goto done;
+	copy = g_new0(struct file_copy, 1);
+	copy->in_fd = in_fd;
+	copy->out_fd = out_fd;
+	copy->size = st.st_size;
+	copy->name = g_strdup(name);
+	copy->destname = g_strdup(destname);
+
+	copy->thread = g_thread_try_new("obexd-copy", copy_thread, copy,
+									&gerr);
+	if (copy->thread == NULL) {
+		error("Unable to start copy thread: %s", gerr->message);
+		g_error_free(gerr);
+		close(in_fd);
+		close(out_fd);
+		g_free(copy->name);
+		g_free(copy->destname);
+		g_free(copy);
+		return -EIO;
+	}
 
-	return 0;
+	copies = g_slist_prepend(copies, copy);
 
-done:
-	filesystem_close(in);
-	filesystem_close(out);
+	DBG("copying %s to %s", name, destname);
 
-	return ret;
+	return 0;
 }
 
 struct capability_object {
@@ -656,6 +1070,7 @@ static const struct obex_mime_type_driver file = {
 	.close = filesystem_close,
 	.read = filesystem_read,
 	.write = filesystem_write,
+	.flush = filesystem_flush,
 	.remove = remove,
 	.move = filesystem_rename,
 	.copy = filesystem_copy,
@@ -709,8 +1124,42 @@ static int filesystem_init(void)
 	return obex_mime_type_driver_register(&file);
 }
 
+static void copy_cancel(gpointer data)
+{
+	struct file_copy *copy = data;
+
+	/* Let pending copies finish, there is no way to interrupt them */
+	g_thread_join(copy->thread);
+
+	if (copy->idle_id > 0)
+		g_source_remove(copy->idle_id);
+
+	g_free(copy->name);
+	g_free(copy->destname);
+	g_free(copy);
+}
+
+static void file_io_cancel(gpointer data)
+{
+	struct file_io *io = data;
+
+	/* Pending writes are not interrupted, wait for them to finish */
+	g_thread_join(io->thread);
+
+	if (io->done_id > 0)
+		g_source_remove(io->done_id);
+
+	file_io_free(io);
+}
+
 static void filesystem_exit(void)
 {
+	g_slist_free_full(closing, file_io_cancel);
+	closing = NULL;
+
+	g_slist_free_full(copies, copy_cancel);
+	copies = NULL;
+
 	obex_mime_type_driver_unregister(&folder);
 	obex_mime_type_driver_unregister(&capability);
 	obex_mime_type_driver_unregister(&file);
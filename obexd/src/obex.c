@@ -164,6 +164,7 @@ static void os_reset_session(struct obex_session *os)
 	os->size = OBJECT_SIZE_DELETE;
 	os->headers_sent = FALSE;
 	os->checked = FALSE;
+	os->flushing = FALSE;
 }
 
 static void obex_session_free(struct obex_session *os)
@@ -319,12 +320,16 @@ static ssize_t driver_write(struct obex_session *os)
 
 		w = os->driver->write(os->object, os->buf + len, os->pending);
 		if (w < 0) {
-			error("write(): %s (%zd)", strerror(-w), -w);
 			if (w == -EINTR)
 				continue;
-			else if (w == -EINVAL)
+
+			/* Keep only what the driver has not consumed yet */
+			if (w == -EAGAIN || w == -EINVAL)
 				memmove(os->buf, os->buf + len, os->pending);
 
+			if (w != -EAGAIN)
+				error("write(): %s (%zd)", strerror(-w), -w);
+
 			return w;
 		}
 
@@ -353,12 +358,15 @@ static gssize driver_read(struct obex_session *os, void *buf, gsize size)
 
 	len = os->driver->read(os->object, buf, size);
 	if (len < 0) {
-		error("read(): %s (%zd)", strerror(-len), -len);
+		/* Not an error, the driver wakes the session up later */
+		if (len != -EAGAIN)
+			error("read(): %s (%zd)", strerror(-len), -len);
 		if (len == -ENOSTR)
 			return 0;
 		if (len == -EAGAIN)
 			obex_object_set_io_watch(os->object, handle_async_io,
 									os);
+		return len;
 	}
 
 	os->offset += len;
@@ -381,6 +389,32 @@ static gssize send_data(void *buf, gsize size, gpointer user_data)
 	return driver_read(os, buf, size);
 }
 
+/* Returns -EAGAIN while the driver is still writing out the object */
+static int driver_flush(struct obex_session *os)
+{
+	int err;
+
+	if (os->object == NULL || os->driver == NULL ||
+					os->driver->flush == NULL)
+		return 0;
+
+	err = os->driver->flush(os->object);
+	if (err == -EAGAIN) {
+		os->flushing = TRUE;
+		return err;
+	}
+
+	os->flushing = FALSE;
+
+	if (err < 0) {
+		error("flush(): %s (%d)", strerror(-err), -err);
+		os->err = err;
+		os->aborted = TRUE;
+	}
+
+	return err;
+}
+
 static void transfer_complete(GObex *obex, GError *err, gpointer user_data)
 {
 	struct obex_session *os = user_data;
@@ -392,13 +426,15 @@ static void transfer_complete(GObex *obex, GError *err, gpointer user_data)
 		goto reset;
 	}
 
-	if (os->object && os->driver && os->driver->flush) {
-		if (os->driver->flush(os->object) == -EAGAIN) {
-			g_obex_suspend(os->obex);
-			obex_object_set_io_watch(os->object, handle_async_io,
-									os);
-			return;
-		}
+	/*
+	 * The final response is already queued, suspending holds it back
+	 * until the object is on disk. handle_async_io() then completes the
+	 * transfer.
+	 */
+	if (driver_flush(os) == -EAGAIN) {
+		g_obex_suspend(os->obex);
+		obex_object_set_io_watch(os->object, handle_async_io, os);
+		return;
 	}
 
 reset:
@@ -471,6 +507,19 @@ static gboolean handle_async_io(void *object, int flags, int err,
 {
 	struct obex_session *os = user_data;
 
+	if (os->flushing) {
+		if (err < 0) {
+			os->err = err;
+			os->aborted = TRUE;
+		} else if (driver_flush(os) == -EAGAIN)
+			return TRUE;
+
+		os_reset_session(os);
+		g_obex_resume(os->obex);
+
+		return FALSE;
+	}
+
 	if (err < 0)
 		goto done;
 
@@ -24,6 +24,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <time.h>
 
 #include <glib.h>
 
@@ -98,6 +99,9 @@ struct bt_hog {
 	struct queue		*gatt_op;
 	struct gatt_db		*gatt_db;
 	struct gatt_db_attribute	*report_map_attr;
+	uint64_t		input_count;
+	uint64_t		input_latency;	/* Total ns from read to uHID */
+	uint64_t		input_latency_max;
 };
 
 struct report {
@@ -112,6 +116,7 @@ struct report {
 	guint			notifyid;
 	uint16_t		len;
 	uint8_t			*value;
+	struct uhid_event	*ev;
 };
 
 struct gatt_request {
@@ -320,32 +325,82 @@ static void find_included(struct bt_hog *hog, GAttrib *attrib,
 	}
 }
 
-static void report_value_cb(const guint8 *pdu, guint16 len, gpointer user_data)
+static void input_latency(struct bt_hog *hog)
+{
+	struct timespec rx, now;
+	uint64_t ns;
+
+	if (!bt_att_get_rx_time(g_attrib_get_att(hog->attrib), &rx))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	ns = (now.tv_sec - rx.tv_sec) * 1000000000ULL +
+					now.tv_nsec - rx.tv_nsec;
+
+	hog->input_count++;
+	hog->input_latency += ns;
+
+	if (ns > hog->input_latency_max)
+		hog->input_latency_max = ns;
+}
+
+static void report_notify_cb(struct bt_att_chan *chan, uint16_t mtu,
+					uint8_t opcode, const void *pdu,
+					uint16_t length, void *user_data)
 {
 	struct report *report = user_data;
 	struct bt_hog *hog = report->hog;
+	struct uhid_input2_req *req = &report->ev->u.input2;
+	const uint8_t *value = pdu;
+	uint16_t len = 0;
 	int err;
 
-	if (len < ATT_NOTIFICATION_HEADER_SIZE) {
-		error("Malformed ATT notification");
+	if (length < 2 || get_le16(value) != report->value_handle)
 		return;
-	}
 
-	pdu += ATT_NOTIFICATION_HEADER_SIZE;
-	len -= ATT_NOTIFICATION_HEADER_SIZE;
+	value += 2;
+	length -= 2;
 
-	err = bt_uhid_input(hog->uhid, report->numbered ? report->id : 0, pdu,
-				len);
-	if (err < 0)
-		error("bt_uhid_input: %s (%d)", strerror(-err), -err);
+	/* Build the event in place, the notification value is only copied
+	 * once straight from the ATT buffer.
+	 */
+	if (report->numbered)
+		req->data[len++] = report->id;
+
+	req->size = len + MIN(length, sizeof(req->data) - len);
+	memcpy(&req->data[len], value, req->size - len);
+
+	err = bt_uhid_send_input(hog->uhid, report->ev);
+	if (err < 0) {
+		error("bt_uhid_send_input: %s (%d)", strerror(-err), -err);
+		return;
+	}
+
+	input_latency(hog);
 }
 
-static void report_notify_destroy(void *user_data)
+/* The CCC is only ever written by HoG itself, notifications are taken
+ * straight from bt_att so that no GATT client registration enables or
+ * disables them behind its back.
+ */
+static unsigned int report_notify_register(struct bt_hog *hog,
+						struct report *report)
 {
-	struct report *report = user_data;
+	if (!report->ev) {
+		report->ev = new0(struct uhid_event, 1);
+		report->ev->type = UHID_INPUT2;
+	}
 
-	DBG("");
+	return bt_att_register(g_attrib_get_att(hog->attrib),
+					BT_ATT_OP_HANDLE_NFY,
+					report_notify_cb, report, NULL);
+}
 
+static void report_notify_unregister(struct bt_hog *hog,
+						struct report *report)
+{
+	bt_att_unregister(g_attrib_get_att(hog->attrib), report->notifyid);
 	report->notifyid = 0;
 }
 
@@ -365,11 +420,7 @@ static void report_ccc_written_cb(guint8 status, const guint8 *pdu,
 	if (report->notifyid)
 		goto remove;
 
-	report->notifyid = g_attrib_register(hog->attrib,
-					ATT_OP_HANDLE_NOTIFY,
-					report->value_handle,
-					report_value_cb, report,
-					report_notify_destroy);
+	report->notifyid = report_notify_register(hog, report);
 	if (!report->notifyid) {
 		error("Unable to register report notification: handle 0x%04x",
 					report->value_handle);
@@ -1221,6 +1272,7 @@ static void report_free(void *data)
 	struct report *report = data;
 
 	free(report->value);
+	free(report->ev);
 	g_free(report);
 }
 
@@ -1741,11 +1793,7 @@ bool bt_hog_attach(struct bt_hog *hog, void *gatt)
 		if (r->notifyid)
 			continue;
 
-		r->notifyid = g_attrib_register(hog->attrib,
-					ATT_OP_HANDLE_NOTIFY,
-					r->value_handle,
-					report_value_cb, r,
-					report_notify_destroy);
+		r->notifyid = report_notify_register(hog, r);
 		if (!r->notifyid)
 			error("Unable to register report notification: "
 				"handle 0x%04x", r->value_handle);
@@ -1780,12 +1828,16 @@ void bt_hog_detach(struct bt_hog *hog, bool force)
 	for (l = hog->reports; l; l = l->next) {
 		struct report *r = l->data;
 
-		if (r->notifyid > 0) {
-			g_attrib_unregister(hog->attrib, r->notifyid);
-			r->notifyid = 0;
-		}
+		if (r->notifyid > 0)
+			report_notify_unregister(hog, r);
 	}
 
+	if (hog->input_count)
+		DBG("%" PRIu64 " input reports: latency avg %" PRIu64
+			" max %" PRIu64 " us", hog->input_count,
+			hog->input_latency / hog->input_count / 1000,
+			hog->input_latency_max / 1000);
+
 	if (hog->scpp)
 		bt_scpp_detach(hog->scpp);
 
@@ -313,6 +313,9 @@ struct btd_adapter {
 	bool pincode_requested;		/* PIN requested during last bonding */
 	GSList *connections;		/* Connected devices */
 	GSList *devices;		/* Devices structure pointers */
+	GHashTable *devices_addr;	/* Address to struct device_bucket */
+	GHashTable *devices_path;	/* Object path to device */
+	GHashTable *devices_index;	/* Device to struct device_index */
 	GSList *connect_list;		/* Devices to connect when found */
 	struct btd_device *connect_le;	/* LE device waiting to be connected */
 	sdp_list_t *services;		/* Services associated to adapter */
@@ -1023,13 +1026,179 @@ int adapter_set_name(struct btd_adapter *adapter, const char *name)
 	return set_name(adapter, name);
 }
 
+/*
+ * Devices are indexed by their address and, if it differs, by the address
+ * used for the last connection since device_addr_type_cmp() matches either
+ * of them. Each address maps to a bucket of the devices using it.
+ */
+struct device_bucket {
+	bdaddr_t bdaddr;
+	GSList *devices;
+};
+
+/* The addresses a device has been indexed with */
+struct device_index {
+	bdaddr_t bdaddr;
+	bdaddr_t conn_bdaddr;
+};
+
+static guint bdaddr_hash(gconstpointer key)
+{
+	const bdaddr_t *bdaddr = key;
+
+	return ((guint) bdaddr->b[0] | bdaddr->b[1] << 8 | bdaddr->b[2] << 16 |
+			(guint) bdaddr->b[3] << 24) ^
+			(bdaddr->b[4] | bdaddr->b[5] << 8);
+}
+
+static gboolean bdaddr_equal(gconstpointer a, gconstpointer b)
+{
+	return !bacmp(a, b);
+}
+
+/* Object paths are compared case insensitively */
+static guint path_hash(gconstpointer key)
+{
+	const char *path = key;
+	guint hash = 5381;
+
+	for (; *path; path++)
+		hash = hash * 33 + g_ascii_tolower(*path);
+
+	return hash;
+}
+
+static gboolean path_equal(gconstpointer a, gconstpointer b)
+{
+	return !g_ascii_strcasecmp(a, b);
+}
+
+static void device_bucket_free(gpointer data)
+{
+	struct device_bucket *bucket = data;
+
+	g_slist_free(bucket->devices);
+	g_free(bucket);
+}
+
+static void device_bucket_add(struct btd_adapter *adapter,
+				const bdaddr_t *bdaddr,
+				struct btd_device *device)
+{
+	struct device_bucket *bucket;
+
+	bucket = g_hash_table_lookup(adapter->devices_addr, bdaddr);
+	if (!bucket) {
+		bucket = g_new0(struct device_bucket, 1);
+		bacpy(&bucket->bdaddr, bdaddr);
+		g_hash_table_insert(adapter->devices_addr, &bucket->bdaddr,
+								bucket);
+	}
+
+	bucket->devices = g_slist_prepend(bucket->devices, device);
+}
+
+static void device_bucket_remove(struct btd_adapter *adapter,
+				const bdaddr_t *bdaddr,
+				struct btd_device *device)
+{
+	struct device_bucket *bucket;
+
+	bucket = g_hash_table_lookup(adapter->devices_addr, bdaddr);
+	if (!bucket)
+		return;
+
+	bucket->devices = g_slist_remove(bucket->devices, device);
+	if (!bucket->devices)
+		g_hash_table_remove(adapter->devices_addr, bdaddr);
+}
+
+static void device_index_add(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	struct device_index *index;
+
+	index = g_new0(struct device_index, 1);
+	bacpy(&index->bdaddr, device_get_address(device));
+	bacpy(&index->conn_bdaddr, device_get_conn_address(device));
+
+	device_bucket_add(adapter, &index->bdaddr, device);
+
+	if (bacmp(&index->conn_bdaddr, BDADDR_ANY) &&
+			bacmp(&index->conn_bdaddr, &index->bdaddr))
+		device_bucket_add(adapter, &index->conn_bdaddr, device);
+
+	g_hash_table_insert(adapter->devices_index, device, index);
+	g_hash_table_insert(adapter->devices_path,
+				(gpointer) device_get_path(device), device);
+}
+
+static void device_index_remove(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	struct device_index *index;
+
+	index = g_hash_table_lookup(adapter->devices_index, device);
+	if (!index)
+		return;
+
+	device_bucket_remove(adapter, &index->bdaddr, device);
+
+	if (bacmp(&index->conn_bdaddr, BDADDR_ANY) &&
+			bacmp(&index->conn_bdaddr, &index->bdaddr))
+		device_bucket_remove(adapter, &index->conn_bdaddr, device);
+
+	g_hash_table_remove(adapter->devices_path, device_get_path(device));
+	g_hash_table_remove(adapter->devices_index, device);
+}
+
+void adapter_device_addr_changed(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	if (!g_hash_table_contains(adapter->devices_index, device))
+		return;
+
+	device_index_remove(adapter, device);
+	device_index_add(adapter, device);
+}
+
+static struct btd_device *find_device(struct btd_adapter *adapter,
+					const struct device_addr_type *addr)
+{
+	struct device_bucket *bucket;
+	struct btd_device *found = NULL;
+	GSList *l;
+
+	bucket = g_hash_table_lookup(adapter->devices_addr, &addr->bdaddr);
+	if (!bucket)
+		return NULL;
+
+	for (l = bucket->devices; l; l = l->next) {
+		if (device_addr_type_cmp(l->data, addr))
+			continue;
+
+		/*
+		 * If several devices match, the one coming first in the
+		 * devices list is the one to return.
+		 */
+		if (found) {
+			l = g_slist_find_custom(adapter->devices, addr,
+							device_addr_type_cmp);
+			return l ? l->data : NULL;
+		}
+
+		found = l->data;
+	}
+
+	return found;
+}
+
 struct btd_device *btd_adapter_find_device(struct btd_adapter *adapter,
 							const bdaddr_t *dst,
 							uint8_t bdaddr_type)
 {
 	struct device_addr_type addr;
 	struct btd_device *device;
-	GSList *list;
 
 	if (!adapter)
 		return NULL;
@@ -1037,13 +1206,10 @@ struct btd_device *btd_adapter_find_device(struct btd_adapter *adapter,
 	bacpy(&addr.bdaddr, dst);
 	addr.bdaddr_type = bdaddr_type;
 
-	list = g_slist_find_custom(adapter->devices, &addr,
-							device_addr_type_cmp);
-	if (!list)
+	device = find_device(adapter, &addr);
+	if (!device)
 		return NULL;
 
-	device = list->data;
-
 	/*
 	 * If we're looking up based on public address and the address
 	 * was not previously used over this bearer we may need to
@@ -1057,28 +1223,13 @@ struct btd_device *btd_adapter_find_device(struct btd_adapter *adapter,
 	return device;
 }
 
-static int device_path_cmp(gconstpointer a, gconstpointer b)
-{
-	const struct btd_device *device = a;
-	const char *path = b;
-	const char *dev_path = device_get_path(device);
-
-	return strcasecmp(dev_path, path);
-}
-
 struct btd_device *btd_adapter_find_device_by_path(struct btd_adapter *adapter,
 						   const char *path)
 {
-	GSList *list;
-
-	if (!adapter)
-		return NULL;
-
-	list = g_slist_find_custom(adapter->devices, path, device_path_cmp);
-	if (!list)
+	if (!adapter || !path)
 		return NULL;
 
-	return list->data;
+	return g_hash_table_lookup(adapter->devices_path, path);
 }
 
 static void uuid_to_uuid128(uuid_t *uuid128, const uuid_t *uuid)
@@ -3629,21 +3780,18 @@ static DBusMessage *remove_device(DBusConnection *conn,
 	struct btd_adapter *adapter = user_data;
 	struct btd_device *device;
 	const char *path;
-	GSList *list;
 
 	if (dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &path,
 						DBUS_TYPE_INVALID) == FALSE)
 		return btd_error_invalid_args(msg);
 
-	list = g_slist_find_custom(adapter->devices, path, device_path_cmp);
-	if (!list)
+	device = btd_adapter_find_device_by_path(adapter, path);
+	if (!device)
 		return btd_error_does_not_exist(msg);
 
 	if (!btd_adapter_get_powered(adapter))
 		return btd_error_not_ready(msg);
 
-	device = list->data;
-
 	btd_device_set_temporary(device, true);
 
 	if (!btd_device_is_connected(device)) {
@@ -5290,6 +5438,7 @@ static void adapter_add_device(struct btd_adapter *adapter,
 						struct btd_device *device)
 {
 	adapter->devices = g_slist_prepend(adapter->devices, device);
+	device_index_add(adapter, device);
 	device_added_drivers(adapter, device);
 }
 
@@ -5297,6 +5446,7 @@ static void adapter_remove_device(struct btd_adapter *adapter,
 						struct btd_device *device)
 {
 	adapter->devices = g_slist_remove(adapter->devices, device);
+	device_index_remove(adapter, device);
 	device_removed_drivers(adapter, device);
 }
 
@@ -6001,6 +6151,10 @@ static void adapter_free(gpointer user_data)
 	if (adapter->allowed_uuid_set)
 		g_hash_table_destroy(adapter->allowed_uuid_set);
 
+	g_hash_table_destroy(adapter->devices_path);
+	g_hash_table_destroy(adapter->devices_index);
+	g_hash_table_destroy(adapter->devices_addr);
+
 	g_free(adapter);
 }
 
@@ -7000,6 +7154,11 @@ static struct btd_adapter *btd_adapter_new(uint16_t index)
 
 	adapter->dev_id = index;
 	adapter->mgmt = mgmt_ref(mgmt_primary);
+	adapter->devices_addr = g_hash_table_new_full(bdaddr_hash, bdaddr_equal,
+						NULL, device_bucket_free);
+	adapter->devices_path = g_hash_table_new(path_hash, path_equal);
+	adapter->devices_index = g_hash_table_new_full(g_direct_hash,
+						g_direct_equal, NULL, g_free);
 	adapter->pincode_requested = false;
 	blocked = rfkill_get_blocked(index);
 	if (blocked > 0)
@@ -7057,6 +7216,9 @@ static void adapter_remove(struct btd_adapter *adapter)
 
 	g_slist_free(adapter->devices);
 	adapter->devices = NULL;
+	g_hash_table_remove_all(adapter->devices_path);
+	g_hash_table_remove_all(adapter->devices_index);
+	g_hash_table_remove_all(adapter->devices_addr);
 
 	discovery_cleanup(adapter, 0);
 
@@ -7290,7 +7452,6 @@ void btd_adapter_device_found(struct btd_adapter *adapter,
 					bool monitoring)
 {
 	struct btd_device *dev;
-	struct bt_ad *ad = NULL;
 	struct eir_data eir_data;
 	bool name_known, discoverable;
 	char addr[18];
@@ -7312,20 +7473,16 @@ void btd_adapter_device_found(struct btd_adapter *adapter,
 	if (!btd_adv_monitor_offload_enabled(adapter->adv_monitor_manager) ||
 				(MGMT_VERSION(mgmt_version, mgmt_revision) <
 							MGMT_VERSION(1, 22))) {
-		if (bdaddr_type != BDADDR_BREDR)
-			ad = bt_ad_new_with_data(data_len, data);
-
 		/* During the background scanning, update the device only when
-		 * the data match at least one Adv monitor
+		 * the data match at least one Adv monitor. Data that cannot be
+		 * parsed leaves monitoring as it is.
 		 */
-		if (ad) {
-			matched_monitors = btd_adv_monitor_content_filter(
+		if (bdaddr_type != BDADDR_BREDR &&
+				!btd_adv_monitor_content_filter(
 						adapter->adv_monitor_manager,
-						ad);
-			bt_ad_unref(ad);
-			ad = NULL;
+						data, data_len,
+						&matched_monitors))
 			monitoring = matched_monitors ? true : false;
-		}
 	}
 
 	if (!adapter->discovering && !monitoring)
@@ -135,6 +135,8 @@ struct btd_adapter_driver {
 
 void device_resolved_drivers(struct btd_adapter *adapter,
 						struct btd_device *device);
+void adapter_device_addr_changed(struct btd_adapter *adapter,
+						struct btd_device *device);
 typedef void (*service_auth_cb) (DBusError *derr, void *user_data);
 
 void adapter_add_profile(struct btd_adapter *adapter, gpointer p);
@@ -63,6 +63,9 @@ struct btd_adv_monitor_manager {
 
 	struct queue *apps;	/* apps who registered for Adv monitoring */
 	struct queue *merged_patterns;
+
+	/* OR-patterns of every monitor, rebuilt on demand once stale */
+	struct bt_ad_matcher *matcher;
 };
 
 struct adv_monitor_app {
@@ -166,7 +169,6 @@ struct app_match_data {
 };
 
 struct adv_content_filter_info {
-	struct bt_ad *ad;
 	struct queue *matched_monitors;	/* List of matched monitors */
 };
 
@@ -490,9 +492,18 @@ print_state:
 			get_merged_pattern_state_name(mp->next_state));
 }
 
+/* Drops the compiled patterns so that they are rebuilt on the next match */
+static void manager_invalidate_matcher(struct btd_adv_monitor_manager *manager)
+{
+	bt_ad_matcher_free(manager->matcher);
+	manager->matcher = NULL;
+}
+
 /* Frees a monitor object */
 static void monitor_free(struct adv_monitor *monitor)
 {
+	manager_invalidate_matcher(monitor->app->manager);
+
 	g_dbus_proxy_unref(monitor->proxy);
 	g_free(monitor->path);
 
@@ -1228,6 +1239,7 @@ static void monitor_proxy_added_cb(GDBusProxy *proxy, void *user_data)
 	}
 
 	queue_push_tail(app->monitors, monitor);
+	manager_invalidate_matcher(app->manager);
 
 	existing_pattern = queue_find(monitor->app->manager->merged_patterns,
 					merged_pattern_is_equal,
@@ -1733,6 +1745,7 @@ static void manager_free(struct btd_adv_monitor_manager *manager)
 
 	queue_destroy(manager->apps, app_destroy);
 	queue_destroy(manager->merged_patterns, merged_pattern_free);
+	bt_ad_matcher_free(manager->matcher);
 
 	free(manager);
 }
@@ -1843,72 +1856,102 @@ bool btd_adv_monitor_offload_enabled(struct btd_adv_monitor_manager *manager)
 				MGMT_ADV_MONITOR_FEATURE_MASK_OR_PATTERNS);
 }
 
-/* Processes the content matching based pattern(s) of a monitor */
-static void adv_match_per_monitor(void *data, void *user_data)
+/* Adds the content matching pattern(s) of a monitor to the matcher */
+static void matcher_add_monitor(void *data, void *user_data)
 {
 	struct adv_monitor *monitor = data;
-	struct adv_content_filter_info *info = user_data;
-	struct queue *patterns;
+	struct bt_ad_matcher *matcher = user_data;
 
-	if (!monitor) {
-		error("Unexpected NULL adv_monitor object upon match");
+	if (!monitor->merged_pattern ||
+		monitor->merged_pattern->type != MONITOR_TYPE_OR_PATTERNS)
 		return;
-	}
 
-	if (monitor->state != MONITOR_STATE_ACTIVE)
-		return;
+	bt_ad_matcher_add(matcher, monitor->merged_pattern->patterns, monitor);
+}
 
-	if (!monitor->merged_pattern)
-		return;
+/* Adds the content matching pattern(s) of the monitor(s) of an app */
+static void matcher_add_app(void *data, void *user_data)
+{
+	struct adv_monitor_app *app = data;
 
-	patterns = monitor->merged_pattern->patterns;
-	if (monitor->merged_pattern->type == MONITOR_TYPE_OR_PATTERNS &&
-				bt_ad_pattern_match(info->ad, patterns)) {
-		goto matched;
-	}
+	queue_foreach(app->monitors, matcher_add_monitor, user_data);
+}
 
-	return;
+/* Compiles the patterns of every monitor unless that is already done. The
+ * monitors are added in the order of apps and their monitors so that the
+ * matches are reported in that order.
+ */
+static struct bt_ad_matcher *manager_get_matcher(
+				struct btd_adv_monitor_manager *manager)
+{
+	if (manager->matcher)
+		return manager->matcher;
 
-matched:
-	if (!info->matched_monitors)
-		info->matched_monitors = queue_new();
+	manager->matcher = bt_ad_matcher_new();
+	if (!manager->matcher)
+		return NULL;
 
-	queue_push_tail(info->matched_monitors, monitor);
+	queue_foreach(manager->apps, matcher_add_app, manager->matcher);
+
+	return manager->matcher;
 }
 
-/* Processes the content matching for the monitor(s) of an app */
-static void adv_match_per_app(void *data, void *user_data)
+/* Collects a monitor whose pattern(s) matched the ad data */
+static void adv_match_monitor(void *data, void *user_data)
 {
-	struct adv_monitor_app *app = data;
+	struct adv_monitor *monitor = data;
+	struct adv_content_filter_info *info = user_data;
 
-	if (!app) {
-		error("Unexpected NULL adv_monitor_app object upon match");
+	if (monitor->state != MONITOR_STATE_ACTIVE)
 		return;
-	}
 
-	queue_foreach(app->monitors, adv_match_per_monitor, user_data);
+	if (!monitor->merged_pattern)
+		return;
+
+	if (!info->matched_monitors)
+		info->matched_monitors = queue_new();
+
+	queue_push_tail(info->matched_monitors, monitor);
 }
 
 /* Processes the content matching for every app without RSSI filtering and
- * notifying monitors. The caller is responsible of releasing the memory of the
- * list but not the ad data.
- * Returns the list of monitors whose content match the ad data.
+ * notifying monitors. The ad data is matched as is, without being parsed
+ * into a bt_ad first. On success matched is set to the list of monitors
+ * whose content match the ad data, or NULL if there are none. The caller is
+ * responsible of releasing the memory of the list but not the ad data.
+ * Returns -EINVAL if the ad data is malformed, in which case it is not
+ * matched at all.
  */
-struct queue *btd_adv_monitor_content_filter(
-				struct btd_adv_monitor_manager *manager,
-				struct bt_ad *ad)
+int btd_adv_monitor_content_filter(struct btd_adv_monitor_manager *manager,
+					const uint8_t *data, uint8_t len,
+					struct queue **matched)
 {
 	struct adv_content_filter_info info;
+	struct bt_ad_matcher *matcher;
+	int err;
 
-	if (!manager || !ad)
-		return NULL;
+	*matched = NULL;
+
+	if (!data || !len)
+		return -EINVAL;
+
+	if (!manager)
+		return 0;
+
+	matcher = manager_get_matcher(manager);
+	if (!matcher)
+		return -ENOMEM;
 
-	info.ad = ad;
 	info.matched_monitors = NULL;
 
-	queue_foreach(manager->apps, adv_match_per_app, &info);
+	err = bt_ad_matcher_match(matcher, data, len, adv_match_monitor,
+									&info);
+	if (err < 0)
+		return err;
+
+	*matched = info.matched_monitors;
 
-	return info.matched_monitors;
+	return 0;
 }
 
 /* Wraps adv_monitor_filter_rssi() to processes the content-matched monitor with
@@ -29,9 +29,9 @@ void btd_adv_monitor_manager_destroy(struct btd_adv_monitor_manager *manager);
 
 bool btd_adv_monitor_offload_enabled(struct btd_adv_monitor_manager *manager);
 
-struct queue *btd_adv_monitor_content_filter(
-				struct btd_adv_monitor_manager *manager,
-				struct bt_ad *ad);
+int btd_adv_monitor_content_filter(struct btd_adv_monitor_manager *manager,
+					const uint8_t *data, uint8_t len,
+					struct queue **matched);
 
 void btd_adv_monitor_notify_monitors(struct btd_adv_monitor_manager *manager,
 					struct btd_device *device, int8_t rssi,
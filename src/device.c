@@ -3710,6 +3710,7 @@ void device_add_connection(struct btd_device *dev, uint8_t bdaddr_type,
 
 	bacpy(&dev->conn_bdaddr, &dev->bdaddr);
 	dev->conn_bdaddr_type = dev->bdaddr_type;
+	adapter_device_addr_changed(dev->adapter, dev);
 
 	/* If this is the first connection over this bearer */
 	if (bdaddr_type == BDADDR_BREDR) {
@@ -5022,6 +5023,7 @@ void device_update_addr(struct btd_device *device, const bdaddr_t *bdaddr,
 
 	bacpy(&device->bdaddr, bdaddr);
 	device->bdaddr_type = bdaddr_type;
+	adapter_device_addr_changed(device->adapter, device);
 
 	if (device->temporary)
 		btd_device_set_temporary(device, false);
@@ -6550,6 +6552,11 @@ const bdaddr_t *device_get_address(struct btd_device *device)
 {
 	return &device->bdaddr;
 }
+
+const bdaddr_t *device_get_conn_address(struct btd_device *device)
+{
+	return &device->conn_bdaddr;
+}
 uint8_t device_get_le_address_type(struct btd_device *device)
 {
 	return device->bdaddr_type;
@@ -37,6 +37,7 @@
 #include "adapter.h"
 #include "device.h"
 #include "gatt-database.h"
+#include "gatt-subscribers.h"
 #include "dbus-common.h"
 #include "profile.h"
 #include "service.h"
@@ -73,6 +74,7 @@ struct btd_gatt_database {
 	GIOChannel *bredr_io;
 	struct queue *records;
 	struct queue *device_states;
+	struct gatt_subscribers *subscribers;
 	struct queue *ccc_callbacks;
 	struct gatt_db_attribute *svc_chngd;
 	struct gatt_db_attribute *svc_chngd_ccc;
@@ -193,6 +195,7 @@ typedef uint8_t (*btd_gatt_database_ccc_write_t) (struct pending_op *op,
 typedef void (*btd_gatt_database_destroy_t) (void *data);
 
 struct ccc_state {
+	struct device_state *state;
 	uint16_t handle;
 	uint16_t value;
 };
@@ -277,6 +280,44 @@ static struct ccc_state *find_ccc_state(struct device_state *dev_state,
 							UINT_TO_PTR(handle));
 }
 
+static void ccc_state_set_value(struct ccc_state *ccc, uint16_t value)
+{
+	struct btd_gatt_database *database = ccc->state->db;
+	bool subscribed = ccc->value & 0x0003;
+
+	ccc->value = value;
+
+	if (subscribed == !!(value & 0x0003))
+		return;
+
+	if (subscribed)
+		gatt_subscribers_remove(database->subscribers, ccc->handle,
+									ccc);
+	else
+		gatt_subscribers_add(database->subscribers, ccc->handle, ccc);
+}
+
+static struct ccc_state *ccc_state_new(struct device_state *dev_state,
+							uint16_t handle)
+{
+	struct ccc_state *ccc;
+
+	ccc = new0(struct ccc_state, 1);
+	ccc->state = dev_state;
+	ccc->handle = handle;
+	queue_push_tail(dev_state->ccc_states, ccc);
+
+	return ccc;
+}
+
+static void ccc_state_free(void *data)
+{
+	struct ccc_state *ccc = data;
+
+	ccc_state_set_value(ccc, 0);
+	free(ccc);
+}
+
 static struct device_state *device_state_create(struct btd_gatt_database *db,
 							const bdaddr_t *bdaddr,
 							uint8_t bdaddr_type)
@@ -296,7 +337,7 @@ static void device_state_free(void *data)
 {
 	struct device_state *state = data;
 
-	queue_destroy(state->ccc_states, free);
+	queue_destroy(state->ccc_states, ccc_state_free);
 
 	if (state->pending) {
 		free(state->pending->value);
@@ -446,11 +487,7 @@ static struct ccc_state *get_ccc_state(struct btd_gatt_database *database,
 	if (ccc)
 		return ccc;
 
-	ccc = new0(struct ccc_state, 1);
-	ccc->handle = handle;
-	queue_push_tail(dev_state->ccc_states, ccc);
-
-	return ccc;
+	return ccc_state_new(dev_state, handle);
 }
 
 static void cancel_pending_read(void *data)
@@ -633,10 +670,12 @@ static void gatt_database_free(void *data)
 
 	queue_destroy(database->records, gatt_record_free);
 	queue_destroy(database->device_states, device_state_free);
+	gatt_subscribers_free(database->subscribers);
 	queue_destroy(database->apps, app_free);
 	queue_destroy(database->profiles, profile_free);
 	queue_destroy(database->ccc_callbacks, ccc_cb_free);
 	database->device_states = NULL;
+	database->subscribers = NULL;
 	database->ccc_callbacks = NULL;
 
 	gatt_db_unref(database->db);
@@ -1094,7 +1133,7 @@ static void gatt_ccc_write_cb(struct gatt_db_attribute *attrib,
 	}
 
 	if (!ecode)
-		ccc->value = val;
+		ccc_state_set_value(ccc, val);
 
 done:
 	gatt_db_attribute_write_result(attrib, id, ecode);
@@ -1404,26 +1443,12 @@ static void state_set_pending(struct device_state *state, struct notify *notify)
 	memcpy(state->pending->value, notify->value, notify->len);
 }
 
-static void send_notification_to_device(void *data, void *user_data)
+static void notify_device(struct device_state *device_state,
+				struct ccc_state *ccc, struct notify *notify)
 {
-	struct device_state *device_state = data;
-	struct notify *notify = user_data;
-	struct ccc_state *ccc;
 	struct btd_device *device;
 	struct bt_gatt_server *server;
 
-	if (notify->conf == service_changed_conf) {
-		if (device_state->cli_feat[0] &
-				BT_GATT_CHRC_CLI_FEAT_ROBUST_CACHING) {
-			device_state->change_aware = false;
-			notify->user_data = device_state;
-		}
-	}
-
-	ccc = find_ccc_state(device_state, notify->ccc_handle);
-	if (!ccc || !(ccc->value & 0x0003))
-		return;
-
 	device = btd_adapter_find_device(notify->database->adapter,
 						&device_state->bdaddr,
 						device_state->bdaddr_type);
@@ -1473,6 +1498,51 @@ remove:
 	}
 }
 
+static void send_notification_to_device(void *data, void *user_data)
+{
+	struct device_state *device_state = data;
+	struct notify *notify = user_data;
+	struct ccc_state *ccc;
+
+	if (notify->conf == service_changed_conf) {
+		if (device_state->cli_feat[0] &
+				BT_GATT_CHRC_CLI_FEAT_ROBUST_CACHING) {
+			device_state->change_aware = false;
+			notify->user_data = device_state;
+		}
+	}
+
+	ccc = find_ccc_state(device_state, notify->ccc_handle);
+	if (!ccc || !(ccc->value & 0x0003))
+		return;
+
+	notify_device(device_state, ccc, notify);
+}
+
+static void send_notification_to_subscriber(void *data, void *user_data)
+{
+	struct ccc_state *ccc = data;
+
+	notify_device(ccc->state, ccc, user_data);
+}
+
+static void send_notification_to_subscribers(struct notify *notify)
+{
+	struct btd_gatt_database *database = notify->database;
+
+	/* Service Changed also marks devices which have not subscribed as
+	 * change unaware, so it has to go through all of them.
+	 */
+	if (notify->conf == service_changed_conf) {
+		queue_foreach(database->device_states,
+				send_notification_to_device, notify);
+		return;
+	}
+
+	gatt_subscribers_foreach(database->subscribers, notify->ccc_handle,
+				send_notification_to_subscriber, notify);
+}
+
 static void gatt_notify_cb(struct gatt_db_attribute *attrib,
 					struct gatt_db_attribute *ccc,
 					const uint8_t *value, size_t len,
@@ -1502,8 +1572,7 @@ static void gatt_notify_cb(struct gatt_db_attribute *attrib,
 
 		send_notification_to_device(state, &notify);
 	} else
-		queue_foreach(database->device_states,
-				send_notification_to_device, &notify);
+		send_notification_to_subscribers(&notify);
 }
 
 static void register_core_services(struct btd_gatt_database *database)
@@ -1534,8 +1603,7 @@ static void send_notification_to_devices(struct btd_gatt_database *database,
 	notify.conf = conf;
 	notify.user_data = user_data;
 
-	queue_foreach(database->device_states, send_notification_to_device,
-								&notify);
+	send_notification_to_subscribers(&notify);
 }
 
 static void send_service_changed(struct btd_gatt_database *database,
@@ -1608,7 +1676,8 @@ static void remove_device_ccc(void *data, void *user_data)
 {
 	struct device_state *state = data;
 
-	queue_remove_all(state->ccc_states, ccc_match_service, user_data, free);
+	queue_remove_all(state->ccc_states, ccc_match_service, user_data,
+							ccc_state_free);
 }
 
 static bool match_gatt_record(const void *data, const void *user_data)
@@ -1624,6 +1693,7 @@ static void gatt_db_service_removed(struct gatt_db_attribute *attrib,
 {
 	struct btd_gatt_database *database = user_data;
 	struct gatt_record *rec;
+	uint16_t start, end;
 
 	DBG("Local GATT service removed");
 
@@ -1634,6 +1704,11 @@ static void gatt_db_service_removed(struct gatt_db_attribute *attrib,
 	send_service_changed(database, attrib);
 
 	queue_foreach(database->device_states, remove_device_ccc, attrib);
+
+	if (gatt_db_attribute_get_service_handles(attrib, &start, &end))
+		gatt_subscribers_remove_range(database->subscribers, start,
+									end);
+
 	queue_remove_all(database->ccc_callbacks, ccc_cb_match_service, attrib,
 								ccc_cb_free);
 }
@@ -4054,6 +4129,7 @@ struct btd_gatt_database *btd_gatt_database_new(struct btd_adapter *adapter)
 	database->db = gatt_db_new();
 	database->records = queue_new();
 	database->device_states = queue_new();
+	database->subscribers = gatt_subscribers_new();
 	database->apps = queue_new();
 	database->profiles = queue_new();
 	database->ccc_callbacks = queue_new();
@@ -4212,10 +4288,9 @@ static void restore_ccc(struct btd_gatt_database *database,
 	dev_state = device_state_create(database, addr, addr_type);
 	queue_push_tail(database->device_states, dev_state);
 
-	ccc = new0(struct ccc_state, 1);
-	ccc->handle = gatt_db_attribute_get_handle(database->svc_chngd_ccc);
-	ccc->value = value;
-	queue_push_tail(dev_state->ccc_states, ccc);
+	ccc = ccc_state_new(dev_state,
+			gatt_db_attribute_get_handle(database->svc_chngd_ccc));
+	ccc_state_set_value(ccc, value);
 }
 
 static void restore_state(struct btd_device *device, void *data)
@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <glib.h>
+
+#include "src/shared/queue.h"
+#include "gatt-subscribers.h"
+
+/*
+ * Value changes only visit the devices which enabled notifications or
+ * indications on the CCC. The set of a handle is kept once created, so it
+ * remains valid while being iterated, until its range is removed together
+ * with the service owning the CCC.
+ */
+struct gatt_subscribers {
+	GHashTable *handles;		/* CCC handle to struct queue */
+};
+
+struct remove_range {
+	uint16_t start;
+	uint16_t end;
+};
+
+static void subscribers_destroy(gpointer data)
+{
+	queue_destroy(data, NULL);
+}
+
+struct gatt_subscribers *gatt_subscribers_new(void)
+{
+	struct gatt_subscribers *subs;
+
+	subs = g_new0(struct gatt_subscribers, 1);
+	subs->handles = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+						NULL, subscribers_destroy);
+
+	return subs;
+}
+
+void gatt_subscribers_free(struct gatt_subscribers *subs)
+{
+	if (!subs)
+		return;
+
+	g_hash_table_destroy(subs->handles);
+	g_free(subs);
+}
+
+void gatt_subscribers_add(struct gatt_subscribers *subs, uint16_t handle,
+								void *data)
+{
+	struct queue *q;
+
+	q = g_hash_table_lookup(subs->handles, GUINT_TO_POINTER(handle));
+	if (!q) {
+		q = queue_new();
+		g_hash_table_insert(subs->handles, GUINT_TO_POINTER(handle), q);
+	}
+
+	queue_push_tail(q, data);
+}
+
+void gatt_subscribers_remove(struct gatt_subscribers *subs, uint16_t handle,
+								void *data)
+{
+	struct queue *q;
+
+	q = g_hash_table_lookup(subs->handles, GUINT_TO_POINTER(handle));
+	if (q)
+		queue_remove(q, data);
+}
+
+static gboolean match_range(gpointer key, gpointer value, gpointer user_data)
+{
+	struct remove_range *range = user_data;
+	unsigned int handle = GPOINTER_TO_UINT(key);
+
+	return handle >= range->start && handle <= range->end;
+}
+
+void gatt_subscribers_remove_range(struct gatt_subscribers *subs,
+						uint16_t start, uint16_t end)
+{
+	struct remove_range range = { start, end };
+
+	g_hash_table_foreach_remove(subs->handles, match_range, &range);
+}
+
+unsigned int gatt_subscribers_count(struct gatt_subscribers *subs,
+							uint16_t handle)
+{
+	struct queue *q;
+
+	q = g_hash_table_lookup(subs->handles, GUINT_TO_POINTER(handle));
+
+	return queue_length(q);
+}
+
+void gatt_subscribers_foreach(struct gatt_subscribers *subs, uint16_t handle,
+				queue_foreach_func_t func, void *user_data)
+{
+	struct queue *q;
+
+	q = g_hash_table_lookup(subs->handles, GUINT_TO_POINTER(handle));
+	if (q)
+		queue_foreach(q, func, user_data);
+}
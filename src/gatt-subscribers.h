@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ */
+
+/* Subscribers of each CCC, keyed by the CCC handle */
+struct gatt_subscribers;
+
+struct gatt_subscribers *gatt_subscribers_new(void);
+void gatt_subscribers_free(struct gatt_subscribers *subs);
+
+void gatt_subscribers_add(struct gatt_subscribers *subs, uint16_t handle,
+								void *data);
+void gatt_subscribers_remove(struct gatt_subscribers *subs, uint16_t handle,
+								void *data);
+void gatt_subscribers_remove_range(struct gatt_subscribers *subs,
+						uint16_t start, uint16_t end);
+
+unsigned int gatt_subscribers_count(struct gatt_subscribers *subs,
+							uint16_t handle);
+void gatt_subscribers_foreach(struct gatt_subscribers *subs, uint16_t handle,
+				queue_foreach_func_t func, void *user_data);
@@ -15,6 +15,7 @@
 #define _GNU_SOURCE
 
 #include <ctype.h>
+#include <errno.h>
 
 #include "lib/bluetooth.h"
 #include "lib/hci.h"
@@ -1477,3 +1478,304 @@ struct bt_ad_pattern *bt_ad_pattern_match(struct bt_ad *ad,
 
 	return info.matched_pattern;
 }
+
+/*
+ * Compiled form of the OR-patterns of any number of entries. Patterns are
+ * grouped by AD type and offset into slots, and each slot buckets its
+ * patterns by their first octet so that matching an AD element costs a
+ * table lookup per distinct offset rather than a comparison per pattern.
+ */
+struct ad_matcher_pattern {
+	struct bt_ad_pattern pattern;
+	unsigned int entry;
+	int next;
+};
+
+struct ad_matcher_slot {
+	uint8_t offset;
+	int first[256];
+};
+
+struct bt_ad_matcher {
+	struct queue *slots[256];
+	struct ad_matcher_pattern *patterns;
+	unsigned int num_patterns;
+	void **entries;
+	unsigned int *stamps;
+	unsigned int *matched;
+	unsigned int num_entries;
+	unsigned int generation;
+};
+
+struct bt_ad_matcher *bt_ad_matcher_new(void)
+{
+	return new0(struct bt_ad_matcher, 1);
+}
+
+void bt_ad_matcher_free(struct bt_ad_matcher *matcher)
+{
+	unsigned int i;
+
+	if (!matcher)
+		return;
+
+	for (i = 0; i < 256; i++)
+		queue_destroy(matcher->slots[i], free);
+
+	free(matcher->patterns);
+	free(matcher->entries);
+	free(matcher->stamps);
+	free(matcher->matched);
+	free(matcher);
+}
+
+static bool match_slot_offset(const void *data, const void *user_data)
+{
+	const struct ad_matcher_slot *slot = data;
+
+	return slot->offset == PTR_TO_UINT(user_data);
+}
+
+static struct ad_matcher_slot *matcher_get_slot(struct bt_ad_matcher *matcher,
+						uint8_t type, uint8_t offset)
+{
+	struct ad_matcher_slot *slot;
+	unsigned int i;
+
+	if (!matcher->slots[type])
+		matcher->slots[type] = queue_new();
+
+	slot = queue_find(matcher->slots[type], match_slot_offset,
+							UINT_TO_PTR(offset));
+	if (slot)
+		return slot;
+
+	slot = new0(struct ad_matcher_slot, 1);
+	slot->offset = offset;
+
+	for (i = 0; i < 256; i++)
+		slot->first[i] = -1;
+
+	queue_push_tail(matcher->slots[type], slot);
+
+	return slot;
+}
+
+static bool is_service_data(uint8_t type)
+{
+	switch (type) {
+	case BT_AD_SERVICE_DATA16:
+	case BT_AD_SERVICE_DATA32:
+	case BT_AD_SERVICE_DATA128:
+		return true;
+	}
+
+	return false;
+}
+
+static void matcher_add_pattern(struct bt_ad_matcher *matcher,
+					const struct bt_ad_pattern *pattern,
+					uint8_t type, unsigned int entry)
+{
+	struct ad_matcher_pattern *p;
+	struct ad_matcher_slot *slot;
+
+	slot = matcher_get_slot(matcher, type, pattern->offset);
+
+	p = &matcher->patterns[matcher->num_patterns];
+	p->pattern = *pattern;
+	p->entry = entry;
+	p->next = slot->first[pattern->data[0]];
+	slot->first[pattern->data[0]] = matcher->num_patterns++;
+}
+
+bool bt_ad_matcher_add(struct bt_ad_matcher *matcher, struct queue *patterns,
+							void *user_data)
+{
+	const struct queue_entry *e;
+	unsigned int count = 0, entry;
+	void *tmp;
+
+	if (!matcher || queue_isempty(patterns))
+		return false;
+
+	for (e = queue_get_entries(patterns); e; e = e->next) {
+		const struct bt_ad_pattern *pattern = e->data;
+
+		count += is_service_data(pattern->type) ? 3 : 1;
+	}
+
+	entry = matcher->num_entries;
+
+	tmp = realloc(matcher->patterns, (matcher->num_patterns + count) *
+					sizeof(struct ad_matcher_pattern));
+	if (!tmp)
+		return false;
+
+	matcher->patterns = tmp;
+
+	tmp = realloc(matcher->entries, (entry + 1) * sizeof(void *));
+	if (!tmp)
+		return false;
+
+	matcher->entries = tmp;
+
+	tmp = realloc(matcher->stamps, (entry + 1) * sizeof(unsigned int));
+	if (!tmp)
+		return false;
+
+	matcher->stamps = tmp;
+
+	tmp = realloc(matcher->matched, (entry + 1) * sizeof(unsigned int));
+	if (!tmp)
+		return false;
+
+	matcher->matched = tmp;
+
+	for (e = queue_get_entries(patterns); e; e = e->next) {
+		const struct bt_ad_pattern *pattern = e->data;
+
+		if (!pattern->len)
+			continue;
+
+		/*
+		 * bt_ad_pattern_match() matches a service data pattern
+		 * against service data of any UUID size, so file it under
+		 * all three types.
+		 */
+		if (is_service_data(pattern->type)) {
+			matcher_add_pattern(matcher, pattern,
+						BT_AD_SERVICE_DATA16, entry);
+			matcher_add_pattern(matcher, pattern,
+						BT_AD_SERVICE_DATA32, entry);
+			matcher_add_pattern(matcher, pattern,
+						BT_AD_SERVICE_DATA128, entry);
+			continue;
+		}
+
+		matcher_add_pattern(matcher, pattern, pattern->type, entry);
+	}
+
+	matcher->entries[entry] = user_data;
+	matcher->stamps[entry] = 0;
+	matcher->num_entries++;
+
+	return true;
+}
+
+/*
+ * Service data patterns are matched against the data following the UUID,
+ * the same as bt_ad_pattern_match() does, while for manufacturer data the
+ * company identifier is part of the matched data.
+ */
+static size_t matcher_data_start(uint8_t type)
+{
+	switch (type) {
+	case BT_AD_SERVICE_DATA16:
+		return 2;
+	case BT_AD_SERVICE_DATA32:
+		return 4;
+	case BT_AD_SERVICE_DATA128:
+		return 16;
+	}
+
+	return 0;
+}
+
+static void matcher_match_slot(struct bt_ad_matcher *matcher,
+				const struct ad_matcher_slot *slot,
+				const uint8_t *data, size_t len,
+				unsigned int *count)
+{
+	int i;
+
+	if (len <= slot->offset)
+		return;
+
+	data += slot->offset;
+	len -= slot->offset;
+
+	for (i = slot->first[data[0]]; i >= 0;
+					i = matcher->patterns[i].next) {
+		const struct ad_matcher_pattern *p = &matcher->patterns[i];
+		unsigned int pos;
+
+		if (matcher->stamps[p->entry] == matcher->generation)
+			continue;
+
+		if (p->pattern.len > len ||
+				memcmp(data, p->pattern.data, p->pattern.len))
+			continue;
+
+		matcher->stamps[p->entry] = matcher->generation;
+
+		/* Keep the matches in the order the entries were added */
+		for (pos = *count; pos > 0; pos--) {
+			if (matcher->matched[pos - 1] < p->entry)
+				break;
+
+			matcher->matched[pos] = matcher->matched[pos - 1];
+		}
+
+		matcher->matched[pos] = p->entry;
+		(*count)++;
+	}
+}
+
+/*
+ * Returns the number of entries with a matching pattern, or -EINVAL if
+ * the data would be rejected by bt_ad_new_with_data().
+ */
+int bt_ad_matcher_match(struct bt_ad_matcher *matcher,
+					const uint8_t *data, size_t len,
+					bt_ad_func_t func, void *user_data)
+{
+	unsigned int count = 0;
+	unsigned int i;
+	size_t pos = 0;
+
+	if (!matcher || !data || !len)
+		return -EINVAL;
+
+	if (++matcher->generation == 0) {
+		memset(matcher->stamps, 0,
+				matcher->num_entries * sizeof(unsigned int));
+		matcher->generation = 1;
+	}
+
+	while (pos < len) {
+		const struct queue_entry *e;
+		uint8_t elen = data[pos];
+		uint8_t type;
+		size_t start;
+
+		if (elen == 0 || elen > len - pos - 1)
+			break;
+
+		type = data[pos + 1];
+
+		/* Same rules as bt_ad_new_with_data() */
+		if (!ad_is_type_valid(type))
+			return -EINVAL;
+
+		start = matcher_data_start(type);
+		if (elen < start + 1 ||
+				(type == BT_AD_MANUFACTURER_DATA && elen < 3))
+			return -EINVAL;
+
+		for (e = queue_get_entries(matcher->slots[type]); e;
+								e = e->next)
+			matcher_match_slot(matcher, e->data,
+					data + pos + 2 + start,
+					elen - 1 - start, &count);
+
+		pos += elen + 1;
+	}
+
+	if (func) {
+		for (i = 0; i < count; i++)
+			func(matcher->entries[matcher->matched[i]], user_data);
+	}
+
+	return count;
+}
@@ -189,3 +189,16 @@ struct bt_ad_pattern *bt_ad_pattern_new(uint8_t type, size_t offset,
 
 struct bt_ad_pattern *bt_ad_pattern_match(struct bt_ad *ad,
 							struct queue *patterns);
+
+struct bt_ad_matcher;
+
+struct bt_ad_matcher *bt_ad_matcher_new(void);
+
+void bt_ad_matcher_free(struct bt_ad_matcher *matcher);
+
+bool bt_ad_matcher_add(struct bt_ad_matcher *matcher, struct queue *patterns,
+							void *user_data);
+
+int bt_ad_matcher_match(struct bt_ad_matcher *matcher,
+					const uint8_t *data, size_t len,
+					bt_ad_func_t func, void *user_data);
@@ -0,0 +1,459 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <wmmintrin.h>
+#define HAVE_AESNI 1
+#endif
+
+#include "src/shared/aes.h"
+
+/*
+ * The software implementation must not index memory with secret data, as
+ * a table based S-box leaks the key through cache timing. Instead the
+ * bytes are bitsliced into eight planes (bit i of byte j is bit j of
+ * plane i) and the S-box is computed as the GF(2^8) inverse followed by
+ * the affine transform, using only AND and XOR on the planes.
+ */
+#define SBOX_PLANES	8
+
+/* Reduce modulo x^8 + x^4 + x^3 + x + 1 */
+static void gf_reduce_bs(uint32_t r[SBOX_PLANES],
+					uint32_t t[2 * SBOX_PLANES - 1])
+{
+	int i;
+
+	for (i = 2 * SBOX_PLANES - 2; i >= SBOX_PLANES; i--) {
+		t[i - 4] ^= t[i];
+		t[i - 5] ^= t[i];
+		t[i - 7] ^= t[i];
+		t[i - 8] ^= t[i];
+	}
+
+	memcpy(r, t, SBOX_PLANES * sizeof(*r));
+}
+
+static void gf_mul_bs(uint32_t r[SBOX_PLANES], const uint32_t a[SBOX_PLANES],
+					const uint32_t b[SBOX_PLANES])
+{
+	uint32_t t[2 * SBOX_PLANES - 1] = {};
+	int i, j;
+
+	for (i = 0; i < SBOX_PLANES; i++)
+		for (j = 0; j < SBOX_PLANES; j++)
+			t[i + j] ^= a[i] & b[j];
+
+	gf_reduce_bs(r, t);
+}
+
+/* Squaring is linear in GF(2^8), it only spreads the coefficients */
+static void gf_sqr_bs(uint32_t r[SBOX_PLANES], const uint32_t a[SBOX_PLANES])
+{
+	uint32_t t[2 * SBOX_PLANES - 1] = {};
+	int i;
+
+	for (i = 0; i < SBOX_PLANES; i++)
+		t[2 * i] = a[i];
+
+	gf_reduce_bs(r, t);
+}
+
+/* Substitute up to 32 bytes in place */
+static void sub_bytes(uint8_t *s, int len)
+{
+	uint32_t x[SBOX_PLANES] = {}, x3[SBOX_PLANES], x7[SBOX_PLANES];
+	uint32_t y[SBOX_PLANES], out;
+	int i, j;
+
+	for (j = 0; j < len; j++)
+		for (i = 0; i < SBOX_PLANES; i++)
+			x[i] |= (uint32_t) ((s[j] >> i) & 1) << j;
+
+	/* y = x^254, which is the inverse of x and maps 0 to 0 */
+	gf_sqr_bs(y, x);
+	gf_mul_bs(x3, y, x);
+	gf_sqr_bs(y, x3);
+	gf_mul_bs(x7, y, x);
+	gf_sqr_bs(y, y);
+	gf_mul_bs(y, y, x3);
+	gf_sqr_bs(y, y);
+	gf_sqr_bs(y, y);
+	gf_sqr_bs(y, y);
+	gf_mul_bs(y, y, x7);
+	gf_sqr_bs(y, y);
+
+	for (j = 0; j < len; j++)
+		s[j] = 0;
+
+	for (i = 0; i < SBOX_PLANES; i++) {
+		/* b ^ (b <<< 1) ^ (b <<< 2) ^ (b <<< 3) ^ (b <<< 4) ^ 0x63 */
+		out = y[i] ^ y[(i + 7) % 8] ^ y[(i + 6) % 8] ^
+					y[(i + 5) % 8] ^ y[(i + 4) % 8];
+		if ((0x63 >> i) & 1)
+			out = ~out;
+
+		for (j = 0; j < len; j++)
+			s[j] |= ((out >> j) & 1) << i;
+	}
+}
+
+static inline uint8_t xtime(uint8_t x)
+{
+	return (x << 1) ^ (-(x >> 7) & 0x1b);
+}
+
+void bt_aes_set_key(struct bt_aes_key *key, const uint8_t k[16])
+{
+	uint8_t *rk = key->rk;
+	uint8_t rcon = 0x01;
+	int i;
+
+	memcpy(rk, k, 16);
+
+	for (i = 16; i < 176; i += 4) {
+		uint8_t t[4];
+
+		memcpy(t, &rk[i - 4], 4);
+
+		if (!(i % 16)) {
+			uint8_t tmp = t[0];
+
+			t[0] = t[1];
+			t[1] = t[2];
+			t[2] = t[3];
+			t[3] = tmp;
+
+			sub_bytes(t, 4);
+			t[0] ^= rcon;
+
+			rcon = xtime(rcon);
+		}
+
+		rk[i + 0] = rk[i - 16] ^ t[0];
+		rk[i + 1] = rk[i - 15] ^ t[1];
+		rk[i + 2] = rk[i - 14] ^ t[2];
+		rk[i + 3] = rk[i - 13] ^ t[3];
+	}
+}
+
+static void add_round_key(uint8_t s[16], const uint8_t *rk)
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		s[i] ^= rk[i];
+}
+
+static void sub_shift_rows(uint8_t s[16])
+{
+	uint8_t t[16];
+	int i;
+
+	sub_bytes(s, 16);
+
+	/* State is column major, row r is rotated left by r columns */
+	for (i = 0; i < 16; i++)
+		t[i] = s[(i + 4 * (i % 4)) % 16];
+
+	memcpy(s, t, 16);
+}
+
+static void mix_columns(uint8_t s[16])
+{
+	int i;
+
+	for (i = 0; i < 16; i += 4) {
+		uint8_t a0 = s[i], a1 = s[i + 1], a2 = s[i + 2], a3 = s[i + 3];
+		uint8_t all = a0 ^ a1 ^ a2 ^ a3;
+
+		s[i + 0] ^= all ^ xtime(a0 ^ a1);
+		s[i + 1] ^= all ^ xtime(a1 ^ a2);
+		s[i + 2] ^= all ^ xtime(a2 ^ a3);
+		s[i + 3] ^= all ^ xtime(a3 ^ a0);
+	}
+}
+
+static void aes_encrypt_generic(const struct bt_aes_key *key,
+				const uint8_t in[16], uint8_t out[16])
+{
+	uint8_t s[16];
+	int round;
+
+	memcpy(s, in, 16);
+	add_round_key(s, key->rk);
+
+	for (round = 1; round < 10; round++) {
+		sub_shift_rows(s);
+		mix_columns(s);
+		add_round_key(s, &key->rk[round * 16]);
+	}
+
+	sub_shift_rows(s);
+	add_round_key(s, &key->rk[160]);
+
+	memcpy(out, s, 16);
+	explicit_bzero(s, sizeof(s));
+}
+
+#ifdef HAVE_AESNI
+/*
+ * The AES-NI round instructions consume the standard FIPS-197 expanded
+ * key, so both implementations share bt_aes_set_key().
+ */
+__attribute__((target("aes,sse2")))
+static void aes_encrypt_aesni(const struct bt_aes_key *key,
+				const uint8_t in[16], uint8_t out[16])
+{
+	const __m128i *rk = (const __m128i *) key->rk;
+	__m128i s;
+	int round;
+
+	s = _mm_loadu_si128((const __m128i *) in);
+	s = _mm_xor_si128(s, _mm_loadu_si128(&rk[0]));
+
+	for (round = 1; round < 10; round++)
+		s = _mm_aesenc_si128(s, _mm_loadu_si128(&rk[round]));
+
+	s = _mm_aesenclast_si128(s, _mm_loadu_si128(&rk[10]));
+
+	_mm_storeu_si128((__m128i *) out, s);
+}
+
+/*
+ * Encrypt one block under four keys at once. The AES round instructions
+ * are pipelined, so interleaving independent blocks hides their latency.
+ */
+__attribute__((target("aes,sse2")))
+static void aes_encrypt_x4_aesni(const struct bt_aes_key *keys,
+				const uint8_t in[16], uint8_t out[][16])
+{
+	const __m128i *rk0 = (const __m128i *) keys[0].rk;
+	const __m128i *rk1 = (const __m128i *) keys[1].rk;
+	const __m128i *rk2 = (const __m128i *) keys[2].rk;
+	const __m128i *rk3 = (const __m128i *) keys[3].rk;
+	__m128i p, s0, s1, s2, s3;
+	int round;
+
+	p = _mm_loadu_si128((const __m128i *) in);
+
+	s0 = _mm_xor_si128(p, _mm_loadu_si128(&rk0[0]));
+	s1 = _mm_xor_si128(p, _mm_loadu_si128(&rk1[0]));
+	s2 = _mm_xor_si128(p, _mm_loadu_si128(&rk2[0]));
+	s3 = _mm_xor_si128(p, _mm_loadu_si128(&rk3[0]));
+
+	for (round = 1; round < 10; round++) {
+		s0 = _mm_aesenc_si128(s0, _mm_loadu_si128(&rk0[round]));
+		s1 = _mm_aesenc_si128(s1, _mm_loadu_si128(&rk1[round]));
+		s2 = _mm_aesenc_si128(s2, _mm_loadu_si128(&rk2[round]));
+		s3 = _mm_aesenc_si128(s3, _mm_loadu_si128(&rk3[round]));
+	}
+
+	s0 = _mm_aesenclast_si128(s0, _mm_loadu_si128(&rk0[10]));
+	s1 = _mm_aesenclast_si128(s1, _mm_loadu_si128(&rk1[10]));
+	s2 = _mm_aesenclast_si128(s2, _mm_loadu_si128(&rk2[10]));
+	s3 = _mm_aesenclast_si128(s3, _mm_loadu_si128(&rk3[10]));
+
+	_mm_storeu_si128((__m128i *) out[0], s0);
+	_mm_storeu_si128((__m128i *) out[1], s1);
+	_mm_storeu_si128((__m128i *) out[2], s2);
+	_mm_storeu_si128((__m128i *) out[3], s3);
+}
+
+static bool cpu_has_aesni(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+
+	return (ecx & bit_AES) && (edx & bit_SSE2);
+}
+#endif
+
+typedef void (*aes_encrypt_func_t)(const struct bt_aes_key *key,
+				const uint8_t in[16], uint8_t out[16]);
+
+static aes_encrypt_func_t aes_encrypt_func;
+
+static aes_encrypt_func_t aes_select(void)
+{
+	if (aes_encrypt_func)
+		return aes_encrypt_func;
+
+	aes_encrypt_func = aes_encrypt_generic;
+
+#ifdef HAVE_AESNI
+	if (cpu_has_aesni())
+		aes_encrypt_func = aes_encrypt_aesni;
+#endif
+
+	return aes_encrypt_func;
+}
+
+bool bt_aes_accelerated(void)
+{
+#ifdef HAVE_AESNI
+	return aes_select() == aes_encrypt_aesni;
+#else
+	return false;
+#endif
+}
+
+void bt_aes_encrypt(const struct bt_aes_key *key, const uint8_t in[16],
+							uint8_t out[16])
+{
+	aes_select()(key, in, out);
+}
+
+void bt_aes_encrypt_multi(const struct bt_aes_key *keys, unsigned int num,
+				const uint8_t in[16], uint8_t out[][16])
+{
+	aes_encrypt_func_t encrypt = aes_select();
+	unsigned int i = 0;
+
+#ifdef HAVE_AESNI
+	if (encrypt == aes_encrypt_aesni) {
+		for (; i + 4 <= num; i += 4)
+			aes_encrypt_x4_aesni(&keys[i], in, &out[i]);
+	}
+#endif
+
+	for (; i < num; i++)
+		encrypt(&keys[i], in, out[i]);
+}
+
+/* Multiply by x in GF(2^128) as needed for the CMAC subkeys */
+static void cmac_dbl(const uint8_t in[16], uint8_t out[16])
+{
+	uint8_t msb = in[0] & 0x80;
+	int i;
+
+	for (i = 0; i < 15; i++)
+		out[i] = (in[i] << 1) | (in[i + 1] >> 7);
+
+	out[15] = (in[15] << 1) ^ (-(msb >> 7) & 0x87);
+}
+
+/*
+ * AES-CMAC as specified in RFC 4493. The message is given as an iovec so
+ * callers such as the GATT database hash do not need to linearize it.
+ */
+void bt_aes_cmac(const uint8_t k[16], const struct iovec *iov,
+					size_t iov_len, uint8_t res[16])
+{
+	aes_encrypt_func_t encrypt = aes_select();
+	struct bt_aes_key key;
+	uint8_t x[16] = {}, buf[16], sub[16];
+	size_t i, buf_len = 0;
+	bool blocks = false;
+
+	bt_aes_set_key(&key, k);
+
+	for (i = 0; i < iov_len; i++) {
+		const uint8_t *data = iov[i].iov_base;
+		size_t len = iov[i].iov_len;
+
+		while (len) {
+			size_t n;
+
+			/*
+			 * Only process a full block once more data follows,
+			 * the last block needs the subkey applied first.
+			 */
+			if (buf_len == 16) {
+				int j;
+
+				for (j = 0; j < 16; j++)
+					x[j] ^= buf[j];
+
+				encrypt(&key, x, x);
+				buf_len = 0;
+			}
+
+			n = 16 - buf_len;
+			if (n > len)
+				n = len;
+
+			memcpy(buf + buf_len, data, n);
+			buf_len += n;
+			data += n;
+			len -= n;
+			blocks = true;
+		}
+	}
+
+	/* K1 = dbl(E(K, 0)), K2 = dbl(K1) */
+	memset(sub, 0, 16);
+	encrypt(&key, sub, sub);
+	cmac_dbl(sub, sub);
+
+	if (!blocks || buf_len < 16) {
+		cmac_dbl(sub, sub);
+
+		buf[buf_len] = 0x80;
+		memset(buf + buf_len + 1, 0, 15 - buf_len);
+	}
+
+	for (i = 0; i < 16; i++)
+		x[i] ^= buf[i] ^ sub[i];
+
+	encrypt(&key, x, res);
+
+	explicit_bzero(&key, sizeof(key));
+	explicit_bzero(x, sizeof(x));
+	explicit_bzero(buf, sizeof(buf));
+	explicit_bzero(sub, sizeof(sub));
+}
+
+bool bt_aes_self_test(void)
+{
+	/* FIPS-197 Appendix C.1 and RFC 4493 Example 2 */
+	static const uint8_t key[16] = {
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+		0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f };
+	static const uint8_t plaintext[16] = {
+		0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+		0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff };
+	static const uint8_t ciphertext[16] = {
+		0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+		0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a };
+	static const uint8_t cmac_key[16] = {
+		0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+		0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+	static const uint8_t cmac_msg[16] = {
+		0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96,
+		0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a };
+	static const uint8_t cmac_res[16] = {
+		0x07, 0x0a, 0x16, 0xb4, 0x6b, 0x4d, 0x41, 0x44,
+		0xf7, 0x9b, 0xdd, 0x9d, 0xd0, 0x4a, 0x28, 0x7c };
+	struct bt_aes_key aes;
+	struct iovec iov;
+	uint8_t out[16];
+
+	bt_aes_set_key(&aes, key);
+	bt_aes_encrypt(&aes, plaintext, out);
+
+	if (memcmp(out, ciphertext, 16))
+		return false;
+
+	iov.iov_base = (void *) cmac_msg;
+	iov.iov_len = sizeof(cmac_msg);
+
+	bt_aes_cmac(cmac_key, &iov, 1, out);
+
+	return !memcmp(out, cmac_res, 16);
+}
@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+ * In-process AES-128 and AES-CMAC. All keys, blocks and digests use the
+ * standard (most significant octet first) byte order, the same as what
+ * the kernel AF_ALG "ecb(aes)" and "cmac(aes)" transforms expect.
+ */
+
+struct bt_aes_key {
+	uint8_t rk[176] __attribute__((aligned(16)));
+};
+
+void bt_aes_set_key(struct bt_aes_key *key, const uint8_t k[16]);
+void bt_aes_encrypt(const struct bt_aes_key *key, const uint8_t in[16],
+							uint8_t out[16]);
+
+/* Encrypt the same block under each of num keys */
+void bt_aes_encrypt_multi(const struct bt_aes_key *keys, unsigned int num,
+				const uint8_t in[16], uint8_t out[][16]);
+
+void bt_aes_cmac(const uint8_t k[16], const struct iovec *iov,
+					size_t iov_len, uint8_t res[16]);
+
+/* Returns true if the AES-NI instructions are used */
+bool bt_aes_accelerated(void);
+
+/* Known answer test of the selected implementation */
+bool bt_aes_self_test(void);
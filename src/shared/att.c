@@ -12,9 +12,12 @@
 #include <config.h>
 #endif
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
 
 #include "src/shared/io.h"
 #include "src/shared/queue.h"
@@ -30,6 +33,8 @@
 #define ATT_OP_CMD_MASK			0x40
 #define ATT_OP_SIGNED_MASK		0x80
 #define ATT_TIMEOUT_INTERVAL		30000  /* 30000 ms */
+#define ATT_WRITE_BUDGET		8  /* PDUs written per wakeup */
+#define ATT_WRITE_BUDGET_MAX		32
 
 /* Length of signature in write signed packet */
 #define BT_ATT_SIGNATURE_LEN		12
@@ -53,6 +58,15 @@ struct bt_att_chan {
 
 	uint8_t *buf;
 	uint16_t mtu;
+
+	bool no_batch;			/* sendmmsg() is not supported */
+
+	uint64_t tx_pdus;
+	uint64_t rx_pdus;
+	uint64_t tx_bytes;
+	uint64_t rx_bytes;
+	uint64_t tx_wakeups;
+	unsigned int tx_batch_max;
 };
 
 struct bt_att {
@@ -73,6 +87,8 @@ struct bt_att {
 	struct queue *ind_queue;	/* Queued ATT protocol indications */
 	struct queue *write_queue;	/* Queue of PDUs ready to send */
 	bool in_disc;			/* Cleanup queues on disconnect_cb */
+	struct timespec rx_time;	/* When the last PDU was read */
+	unsigned int write_budget;	/* PDUs written per writer wakeup */
 
 	bt_att_timeout_func_t timeout_callback;
 	bt_att_destroy_func_t timeout_destroy;
@@ -413,44 +429,122 @@ static struct att_send_op *create_att_send_op(struct bt_att *att,
 	return op;
 }
 
-static struct att_send_op *pick_next_send_op(struct bt_att_chan *chan)
+static bool chan_can_send(struct bt_att_chan *chan, struct att_send_op *op)
+{
+	if (op->len > chan->mtu)
+		return false;
+
+	switch (op->type) {
+	case ATT_OP_TYPE_REQ:
+		/* Don't send Exchange MTU over EATT */
+		if (op->opcode == BT_ATT_OP_MTU_REQ &&
+					chan->type == BT_ATT_EATT)
+			return false;
+
+		return !chan->pending_req;
+	case ATT_OP_TYPE_IND:
+		return !chan->pending_ind;
+	case ATT_OP_TYPE_RSP:
+	case ATT_OP_TYPE_CMD:
+	case ATT_OP_TYPE_NFY:
+	case ATT_OP_TYPE_CONF:
+	case ATT_OP_TYPE_UNKNOWN:
+		return true;
+	}
+
+	return true;
+}
+
+static unsigned int chan_load(struct bt_att_chan *chan)
+{
+	return queue_length(chan->queue) + !!chan->pending_req +
+							!!chan->pending_ind;
+}
+
+/* Pick the channel a queued request or indication should be sent on: the
+ * least loaded channel able to take it, preferring the bigger MTU and then
+ * the channel which has sent the least so far.
+ */
+static struct bt_att_chan *pick_chan(struct bt_att *att,
+						struct att_send_op *op)
+{
+	const struct queue_entry *entry;
+	struct bt_att_chan *best = NULL;
+	unsigned int best_load = 0;
+
+	for (entry = queue_get_entries(att->chans); entry;
+						entry = entry->next) {
+		struct bt_att_chan *chan = entry->data;
+		unsigned int load;
+
+		if (!chan_can_send(chan, op))
+			continue;
+
+		load = chan_load(chan);
+
+		if (best) {
+			if (load > best_load)
+				continue;
+
+			if (load == best_load) {
+				if (chan->mtu < best->mtu)
+					continue;
+
+				if (chan->mtu == best->mtu &&
+					chan->tx_bytes >= best->tx_bytes)
+					continue;
+			}
+		}
+
+		best = chan;
+		best_load = load;
+	}
+
+	return best;
+}
+
+static bool chan_is_next(struct bt_att_chan *chan, struct queue *queue)
+{
+	struct att_send_op *op = queue_peek_head(queue);
+
+	return op && pick_chan(chan->att, op) == chan;
+}
+
+/* Returns the next operation to send along with the queue it was taken
+ * from, which is where it goes back to if it cannot be written.
+ */
+static struct att_send_op *pick_next_send_op(struct bt_att_chan *chan,
+							struct queue **queue)
 {
 	struct bt_att *att = chan->att;
 	struct att_send_op *op;
 
 	/* Check if there is anything queued on the channel */
 	op = queue_pop_head(chan->queue);
-	if (op)
+	if (op) {
+		*queue = chan->queue;
 		return op;
+	}
 
 	/* See if any operations are already in the write queue */
 	op = queue_peek_head(att->write_queue);
-	if (op && op->len <= chan->mtu)
+	if (op && op->len <= chan->mtu) {
+		*queue = att->write_queue;
 		return queue_pop_head(att->write_queue);
+	}
 
-	/* If there is no pending request, pick an operation from the
-	 * request queue.
+	/* Requests and indications are only picked by the channel they have
+	 * been scheduled to, so they get spread over all channels instead of
+	 * going to whichever writer wakes up first.
 	 */
-	if (!chan->pending_req) {
-		op = queue_peek_head(att->req_queue);
-		if (op && op->len <= chan->mtu) {
-			/* Don't send Exchange MTU over EATT */
-			if (op->opcode == BT_ATT_OP_MTU_REQ &&
-					chan->type == BT_ATT_EATT)
-				goto indicate;
-
-			return queue_pop_head(att->req_queue);
-		}
+	if (chan_is_next(chan, att->req_queue)) {
+		*queue = att->req_queue;
+		return queue_pop_head(att->req_queue);
 	}
 
-indicate:
-	/* There is either a request pending or no requests queued. If there is
-	 * no pending indication, pick an operation from the indication queue.
-	 */
-	if (!chan->pending_ind) {
-		op = queue_peek_head(att->ind_queue);
-		if (op && op->len <= chan->mtu)
-			return queue_pop_head(att->ind_queue);
+	if (chan_is_next(chan, att->ind_queue)) {
+		*queue = att->ind_queue;
+		return queue_pop_head(att->ind_queue);
 	}
 
 	return NULL;
@@ -515,6 +609,19 @@ static void write_watch_destroy(void *user_data)
 	chan->writer_active = false;
 }
 
+static void bt_att_chan_written(struct bt_att_chan *chan, const void *pdu,
+								size_t len)
+{
+	struct bt_att *att = chan->att;
+
+	if (att->debug_level)
+		util_hexdump('<', pdu, len, att->debug_callback,
+						att->debug_data);
+
+	chan->tx_pdus++;
+	chan->tx_bytes += len;
+}
+
 static ssize_t bt_att_chan_write(struct bt_att_chan *chan, uint8_t opcode,
 					const void *pdu, uint16_t len)
 {
@@ -534,31 +641,75 @@ static ssize_t bt_att_chan_write(struct bt_att_chan *chan, uint8_t opcode,
 		return ret;
 	}
 
-	if (att->debug_level)
-		util_hexdump('<', pdu, ret, att->debug_callback,
-						att->debug_data);
+	bt_att_chan_written(chan, pdu, ret);
 
 	return ret;
 }
 
-static bool can_write_data(struct io *io, void *user_data)
+/* Write as many of the operations as possible with a single sendmmsg(),
+ * returning how many of them have been written.
+ */
+static int bt_att_chan_write_ops(struct bt_att_chan *chan,
+					struct att_send_op **ops,
+					unsigned int count)
 {
-	struct bt_att_chan *chan = user_data;
-	struct att_send_op *op;
-	struct timeout_data *timeout;
+	struct bt_att *att = chan->att;
+	struct mmsghdr msgs[ATT_WRITE_BUDGET_MAX];
+	struct iovec iov[ATT_WRITE_BUDGET_MAX];
+	unsigned int i;
+	int ret;
 
-	op = pick_next_send_op(chan);
-	if (!op)
-		return false;
+	if (count == 1 || chan->no_batch)
+		goto single;
 
-	if (bt_att_chan_write(chan, op->opcode, op->pdu, op->len) < 0) {
-		if (op->callback)
-			op->callback(BT_ATT_OP_ERROR_RSP, NULL, 0,
-							op->user_data);
-		destroy_att_send_op(op);
-		return true;
+	memset(msgs, 0, count * sizeof(*msgs));
+
+	for (i = 0; i < count; i++) {
+		VERBOSE(att, "(chan %p) ATT op 0x%02x", chan,
+							ops[i]->opcode);
+
+		iov[i].iov_base = ops[i]->pdu;
+		iov[i].iov_len = ops[i]->len;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
 	}
 
+	ret = sendmmsg(chan->fd, msgs, count, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (ret < 0) {
+		ret = -errno;
+
+		/* Fallback to plain writes if the fd is not a socket */
+		if (ret == -ENOTSOCK || ret == -ENOSYS || ret == -EOPNOTSUPP) {
+			chan->no_batch = true;
+			goto single;
+		}
+
+		DBG(att, "(chan %p) write failed: %s", chan, strerror(-ret));
+		return ret;
+	}
+
+	for (i = 0; i < (unsigned int) ret; i++)
+		bt_att_chan_written(chan, ops[i]->pdu, msgs[i].msg_len);
+
+	return ret;
+
+single:
+	for (i = 0; i < count; i++) {
+		ret = bt_att_chan_write(chan, ops[i]->opcode, ops[i]->pdu,
+								ops[i]->len);
+		if (ret < 0)
+			return i ? (int) i : ret;
+	}
+
+	return count;
+}
+
+static void wakeup_writer(struct bt_att *att);
+
+static void write_complete(struct bt_att_chan *chan, struct att_send_op *op)
+{
+	struct timeout_data *timeout;
+
 	/* Based on the operation type, set either the pending request or the
 	 * pending indication. If it came from the write queue, then there is
 	 * no need to keep it around.
@@ -580,7 +731,7 @@ static bool can_write_data(struct io *io, void *user_data)
 	case ATT_OP_TYPE_UNKNOWN:
 	default:
 		destroy_att_send_op(op);
-		return true;
+		return;
 	}
 
 	timeout = new0(struct timeout_data, 1);
@@ -589,6 +740,69 @@ static bool can_write_data(struct io *io, void *user_data)
 	op->timeout_id = timeout_add(ATT_TIMEOUT_INTERVAL, timeout_cb,
 								timeout, free);
 
+	/* The next queued operation may now be scheduled to another channel */
+	wakeup_writer(chan->att);
+}
+
+static bool can_write_data(struct io *io, void *user_data)
+{
+	struct bt_att_chan *chan = user_data;
+	struct att_send_op *ops[ATT_WRITE_BUDGET_MAX];
+	struct queue *queues[ATT_WRITE_BUDGET_MAX];
+	struct att_send_op *op;
+	unsigned int count = 0, i;
+	int sent;
+
+	/* Drain up to the budget of PDUs per wakeup, stopping at operations
+	 * waiting for a reply since they change what the channel can pick.
+	 */
+	while (count < chan->att->write_budget) {
+		op = pick_next_send_op(chan, &queues[count]);
+		if (!op)
+			break;
+
+		ops[count++] = op;
+
+		if (op->type == ATT_OP_TYPE_REQ || op->type == ATT_OP_TYPE_IND)
+			break;
+	}
+
+	if (!count)
+		return false;
+
+	sent = bt_att_chan_write_ops(chan, ops, count);
+	if (sent == -EAGAIN)
+		sent = 0;
+	else if (sent < 0) {
+		/* None of the batch made it out, fail all of it */
+		for (i = 0; i < count; i++) {
+			op = ops[i];
+
+			if (op->callback)
+				op->callback(BT_ATT_OP_ERROR_RSP, NULL, 0,
+							op->user_data);
+			destroy_att_send_op(op);
+		}
+
+		return true;
+	}
+
+	/* Put back whatever could not be written where it came from, in
+	 * the same order.
+	 */
+	for (i = count; i > (unsigned int) sent; i--)
+		queue_push_head(queues[i - 1], ops[i - 1]);
+
+	if (sent) {
+		chan->tx_wakeups++;
+
+		if ((unsigned int) sent > chan->tx_batch_max)
+			chan->tx_batch_max = sent;
+	}
+
+	for (i = 0; i < (unsigned int) sent; i++)
+		write_complete(chan, ops[i]);
+
 	/* Return true as there may be more operations ready to write. */
 	return true;
 }
@@ -604,11 +818,10 @@ static void wakeup_chan_writer(void *data, void *user_data)
 	/* Set the write handler only if there is anything that can be sent
 	 * at all.
 	 */
-	if (queue_isempty(chan->queue) && queue_isempty(att->write_queue)) {
-		if ((chan->pending_req || queue_isempty(att->req_queue)) &&
-			(chan->pending_ind || queue_isempty(att->ind_queue)))
-			return;
-	}
+	if (queue_isempty(chan->queue) && queue_isempty(att->write_queue) &&
+			!chan_is_next(chan, att->req_queue) &&
+			!chan_is_next(chan, att->ind_queue))
+		return;
 
 	if (!io_set_write_handler(chan->io, can_write_data, chan,
 							write_watch_destroy))
@@ -877,7 +1090,7 @@ done:
 	destroy_att_send_op(op);
 	chan->pending_req = NULL;
 
-	wakeup_chan_writer(chan, NULL);
+	wakeup_writer(att);
 }
 
 static void handle_conf(struct bt_att_chan *chan, uint8_t *pdu, ssize_t pdu_len)
@@ -902,7 +1115,7 @@ static void handle_conf(struct bt_att_chan *chan, uint8_t *pdu, ssize_t pdu_len)
 	destroy_att_send_op(op);
 	chan->pending_ind = NULL;
 
-	wakeup_chan_writer(chan, NULL);
+	wakeup_writer(att);
 }
 
 struct notify_data {
@@ -1048,8 +1261,13 @@ static bool can_read_data(struct io *io, void *user_data)
 	if (bytes_read < 0)
 		return false;
 
+	clock_gettime(CLOCK_MONOTONIC, &att->rx_time);
+
 	VERBOSE(att, "(chan %p) ATT received: %zd", chan, bytes_read);
 
+	chan->rx_pdus++;
+	chan->rx_bytes += bytes_read;
+
 	att_hexdump(att, '>', chan->buf, bytes_read);
 
 	if (bytes_read < ATT_MIN_PDU_LEN)
@@ -1222,7 +1440,11 @@ static struct bt_att_chan *bt_att_chan_new(int fd, uint8_t type)
 		chan->mtu = BT_ATT_DEFAULT_LE_MTU;
 		break;
 	default:
-		chan->mtu = io_get_mtu(chan->fd);
+		/* Like local channels, sockets not on L2CAP have no MTU */
+		if (is_io_l2cap_based(chan->fd))
+			chan->mtu = io_get_mtu(chan->fd);
+		else
+			chan->mtu = BT_ATT_DEFAULT_LE_MTU;
 	}
 
 	if (chan->mtu < BT_ATT_DEFAULT_LE_MTU)
@@ -1270,6 +1492,7 @@ struct bt_att *bt_att_new(int fd, bool ext_signed)
 	att = new0(struct bt_att, 1);
 	att->chans = queue_new();
 	att->mtu = chan->mtu;
+	att->write_budget = ATT_WRITE_BUDGET;
 
 	/* crypto is optional, if not available leave it NULL */
 	if (!ext_signed)
@@ -1370,6 +1593,58 @@ int bt_att_get_channels(struct bt_att *att)
 	return queue_length(att->chans);
 }
 
+bool bt_att_get_chan_stats(struct bt_att *att, unsigned int index,
+					struct bt_att_chan_stats *stats)
+{
+	const struct queue_entry *entry;
+	struct bt_att_chan *chan;
+
+	if (!att || !stats)
+		return false;
+
+	for (entry = queue_get_entries(att->chans); entry && index;
+						entry = entry->next)
+		index--;
+
+	if (!entry)
+		return false;
+
+	chan = entry->data;
+
+	stats->type = chan->type;
+	stats->mtu = chan->mtu;
+	stats->queued = queue_length(chan->queue);
+	stats->in_flight = !!chan->pending_req + !!chan->pending_ind;
+	stats->tx_pdus = chan->tx_pdus;
+	stats->rx_pdus = chan->rx_pdus;
+	stats->tx_bytes = chan->tx_bytes;
+	stats->rx_bytes = chan->rx_bytes;
+	stats->tx_wakeups = chan->tx_wakeups;
+	stats->tx_batch_max = chan->tx_batch_max;
+
+	return true;
+}
+
+bool bt_att_set_write_budget(struct bt_att *att, unsigned int budget)
+{
+	if (!att || !budget || budget > ATT_WRITE_BUDGET_MAX)
+		return false;
+
+	att->write_budget = budget;
+
+	return true;
+}
+
+bool bt_att_get_rx_time(struct bt_att *att, struct timespec *ts)
+{
+	if (!att || !ts || !att->rx_time.tv_sec)
+		return false;
+
+	*ts = att->rx_time;
+
+	return true;
+}
+
 bool bt_att_set_debug(struct bt_att *att, uint8_t level,
 			bt_att_debug_func_t callback, void *user_data,
 			bt_att_destroy_func_t destroy)
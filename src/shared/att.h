@@ -10,6 +10,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
 
 #include "src/shared/att-types.h"
 
@@ -33,6 +34,29 @@ int bt_att_attach_fd(struct bt_att *att, int fd);
 
 int bt_att_get_channels(struct bt_att *att);
 
+struct bt_att_chan_stats {
+	uint8_t type;
+	uint16_t mtu;
+	unsigned int queued;		/* PDUs queued on the channel itself */
+	unsigned int in_flight;		/* Requests/indications awaiting reply */
+	uint64_t tx_pdus;
+	uint64_t rx_pdus;
+	uint64_t tx_bytes;
+	uint64_t rx_bytes;
+	uint64_t tx_wakeups;		/* Writer wakeups which sent PDUs */
+	unsigned int tx_batch_max;	/* Most PDUs sent in one wakeup */
+};
+
+/* Channels are indexed with EATT first, the fixed channel being last */
+bool bt_att_get_chan_stats(struct bt_att *att, unsigned int index,
+					struct bt_att_chan_stats *stats);
+
+/* Number of PDUs a channel writes at most each time it becomes writable */
+bool bt_att_set_write_budget(struct bt_att *att, unsigned int budget);
+
+/* Monotonic time at which the PDU being processed, if any, was read */
+bool bt_att_get_rx_time(struct bt_att *att, struct timespec *ts);
+
 typedef void (*bt_att_response_func_t)(uint8_t opcode, const void *pdu,
 					uint16_t length, void *user_data);
 typedef void (*bt_att_notify_func_t)(struct bt_att_chan *chan, uint16_t mtu,
@@ -20,8 +20,11 @@
 #include <string.h>
 #include <stdio.h>
 #include <limits.h>
+#include <errno.h>
 #include <arpa/inet.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "src/shared/btsnoop.h"
 
@@ -54,6 +57,10 @@ struct pklg_pkt {
 } __attribute__ ((packed));
 #define PKLG_PKT_SIZE (sizeof(struct pklg_pkt))
 
+/* Large enough for any single record */
+#define READ_BUFFER_SIZE	65536
+#define WRITE_BUFFER_SIZE	65536
+
 struct btsnoop {
 	int ref_count;
 	int fd;
@@ -68,13 +75,121 @@ struct btsnoop {
 	size_t cur_size;
 	unsigned int max_count;
 	unsigned int cur_count;
+	uint8_t *map;
+	size_t map_size;
+	size_t offset;
+	uint8_t *buf;
+	size_t buf_len;
+	size_t buf_pos;
+	size_t *records;
+	unsigned long num_records;
+	bool indexed;
 };
 
+/*
+ * Readers use the file mapped into memory when possible, and otherwise
+ * (pipes or mmap failure) go through a read buffer. Makes up to len bytes
+ * available at the current position and returns how many there are.
+ */
+static size_t read_fill(struct btsnoop *btsnoop, size_t len)
+{
+	ssize_t n;
+
+	if (btsnoop->map) {
+		if (btsnoop->map_size - btsnoop->offset < len)
+			return btsnoop->map_size - btsnoop->offset;
+
+		return len;
+	}
+
+	if (btsnoop->buf_len - btsnoop->buf_pos >= len)
+		return len;
+
+	memmove(btsnoop->buf, btsnoop->buf + btsnoop->buf_pos,
+				btsnoop->buf_len - btsnoop->buf_pos);
+	btsnoop->buf_len -= btsnoop->buf_pos;
+	btsnoop->buf_pos = 0;
+
+	while (btsnoop->buf_len < len) {
+		n = read(btsnoop->fd, btsnoop->buf + btsnoop->buf_len,
+					READ_BUFFER_SIZE - btsnoop->buf_len);
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			break;
+
+		btsnoop->buf_len += n;
+	}
+
+	if (btsnoop->buf_len < len)
+		return btsnoop->buf_len;
+
+	return len;
+}
+
+/* Returns the len bytes made available by read_fill() and skips them */
+static const uint8_t *read_consume(struct btsnoop *btsnoop, size_t len)
+{
+	const uint8_t *ptr;
+
+	if (btsnoop->map) {
+		ptr = btsnoop->map + btsnoop->offset;
+	} else {
+		ptr = btsnoop->buf + btsnoop->buf_pos;
+		btsnoop->buf_pos += len;
+	}
+
+	btsnoop->offset += len;
+
+	return ptr;
+}
+
+static bool read_data(struct btsnoop *btsnoop, void *data, size_t len)
+{
+	if (read_fill(btsnoop, len) != len)
+		return false;
+
+	memcpy(data, read_consume(btsnoop, len), len);
+
+	return true;
+}
+
+static bool write_all(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t written;
+
+	while (iovcnt > 0) {
+		written = writev(fd, iov, iovcnt);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return false;
+		}
+
+		/* Skip whatever a short write did get out */
+		while (iovcnt > 0 && (size_t) written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+
+		if (iovcnt > 0) {
+			iov->iov_base = (uint8_t *) iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+
+	return true;
+}
+
 struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 {
 	struct btsnoop *btsnoop;
 	struct btsnoop_hdr hdr;
-	ssize_t len;
+	struct stat st;
+	void *map;
 
 	btsnoop = calloc(1, sizeof(*btsnoop));
 	if (!btsnoop)
@@ -88,8 +203,25 @@ struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 
 	btsnoop->flags = flags;
 
-	len = read(btsnoop->fd, &hdr, BTSNOOP_HDR_SIZE);
-	if (len < 0 || len != BTSNOOP_HDR_SIZE)
+	if (fstat(btsnoop->fd, &st) == 0 && S_ISREG(st.st_mode) &&
+				st.st_size >= (off_t) BTSNOOP_HDR_SIZE &&
+					(uintmax_t) st.st_size <= SIZE_MAX) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+							btsnoop->fd, 0);
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			btsnoop->map = map;
+			btsnoop->map_size = st.st_size;
+		}
+	}
+
+	if (!btsnoop->map) {
+		btsnoop->buf = malloc(READ_BUFFER_SIZE);
+		if (!btsnoop->buf)
+			goto failed;
+	}
+
+	if (!read_data(btsnoop, &hdr, BTSNOOP_HDR_SIZE))
 		goto failed;
 
 	if (!memcmp(hdr.id, btsnoop_id, sizeof(btsnoop_id))) {
@@ -114,12 +246,17 @@ struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 		btsnoop->pklg_v2 = (hdr.id[1] == 0x01);
 
 		/* Apple Packet Logger format has no header */
-		lseek(btsnoop->fd, 0, SEEK_SET);
+		btsnoop->offset = 0;
+		btsnoop->buf_pos = 0;
 	}
 
 	return btsnoop_ref(btsnoop);
 
 failed:
+	if (btsnoop->map)
+		munmap(btsnoop->map, btsnoop->map_size);
+
+	free(btsnoop->buf);
 	close(btsnoop->fd);
 	free(btsnoop);
 
@@ -176,6 +313,9 @@ struct btsnoop *btsnoop_create(const char *path, size_t max_size,
 
 	btsnoop->cur_size = BTSNOOP_HDR_SIZE;
 
+	/* Without a buffer every packet is simply written right away */
+	btsnoop->buf = malloc(WRITE_BUFFER_SIZE);
+
 	return btsnoop_ref(btsnoop);
 }
 
@@ -197,9 +337,16 @@ void btsnoop_unref(struct btsnoop *btsnoop)
 	if (__sync_sub_and_fetch(&btsnoop->ref_count, 1))
 		return;
 
+	if (btsnoop->map)
+		munmap(btsnoop->map, btsnoop->map_size);
+	else if (btsnoop->path)
+		btsnoop_flush(btsnoop);
+
 	if (btsnoop->fd >= 0)
 		close(btsnoop->fd);
 
+	free(btsnoop->records);
+	free(btsnoop->buf);
 	free(btsnoop);
 }
 
@@ -211,12 +358,31 @@ uint32_t btsnoop_get_format(struct btsnoop *btsnoop)
 	return btsnoop->format;
 }
 
+bool btsnoop_flush(struct btsnoop *btsnoop)
+{
+	struct iovec iov;
+
+	if (!btsnoop || btsnoop->fd < 0)
+		return false;
+
+	if (!btsnoop->path || !btsnoop->buf_len)
+		return true;
+
+	iov.iov_base = btsnoop->buf;
+	iov.iov_len = btsnoop->buf_len;
+	btsnoop->buf_len = 0;
+
+	return write_all(btsnoop->fd, &iov, 1);
+}
+
 static bool btsnoop_rotate(struct btsnoop *btsnoop)
 {
 	struct btsnoop_hdr hdr;
 	char path[PATH_MAX];
 	ssize_t written;
 
+	/* Whatever is pending still belongs to the current file */
+	btsnoop_flush(btsnoop);
 	close(btsnoop->fd);
 
 	/* Check if max number of log files has been reached */
@@ -252,12 +418,16 @@ bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 			uint16_t size)
 {
 	struct btsnoop_pkt pkt;
+	struct iovec iov[3];
 	uint64_t ts;
-	ssize_t written;
+	int iovcnt = 0;
 
 	if (!btsnoop || !tv)
 		return false;
 
+	if (btsnoop->fd < 0)
+		return false;
+
 	if (btsnoop->max_size && btsnoop->max_size <=
 			btsnoop->cur_size + size + BTSNOOP_PKT_SIZE)
 		if (!btsnoop_rotate(btsnoop))
@@ -271,21 +441,45 @@ bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 	pkt.drops = htobe32(drops);
 	pkt.ts    = htobe64(ts + 0x00E03AB44A676000ll);
 
-	written = write(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE);
-	if (written < 0)
-		return false;
+	if (!data)
+		size = 0;
 
-	btsnoop->cur_size += BTSNOOP_PKT_SIZE;
+	btsnoop->cur_size += BTSNOOP_PKT_SIZE + size;
 
-	if (data && size > 0) {
-		written = write(btsnoop->fd, data, size);
-		if (written < 0)
-			return false;
+	/* Batch records in the write buffer as long as they fit */
+	if (btsnoop->buf && btsnoop->buf_len + BTSNOOP_PKT_SIZE + size <=
+							WRITE_BUFFER_SIZE) {
+		memcpy(btsnoop->buf + btsnoop->buf_len, &pkt,
+							BTSNOOP_PKT_SIZE);
+		btsnoop->buf_len += BTSNOOP_PKT_SIZE;
+
+		if (size > 0)
+			memcpy(btsnoop->buf + btsnoop->buf_len, data, size);
+
+		btsnoop->buf_len += size;
+
+		return true;
 	}
 
-	btsnoop->cur_size += size;
+	/* Otherwise write out everything pending with this record */
+	if (btsnoop->buf_len) {
+		iov[iovcnt].iov_base = btsnoop->buf;
+		iov[iovcnt].iov_len = btsnoop->buf_len;
+		iovcnt++;
+		btsnoop->buf_len = 0;
+	}
 
-	return true;
+	iov[iovcnt].iov_base = &pkt;
+	iov[iovcnt].iov_len = BTSNOOP_PKT_SIZE;
+	iovcnt++;
+
+	if (size > 0) {
+		iov[iovcnt].iov_base = (void *) data;
+		iov[iovcnt].iov_len = size;
+		iovcnt++;
+	}
+
+	return write_all(btsnoop->fd, iov, iovcnt);
 }
 
 static uint32_t get_flags_from_opcode(uint16_t opcode)
@@ -376,17 +570,19 @@ static bool pklg_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 	struct pklg_pkt pkt;
 	uint32_t toread;
 	uint64_t ts;
-	ssize_t len;
+	size_t len;
 
-	len = read(btsnoop->fd, &pkt, PKLG_PKT_SIZE);
+	len = read_fill(btsnoop, PKLG_PKT_SIZE);
 	if (len == 0)
 		return false;
 
-	if (len < 0 || len != PKLG_PKT_SIZE) {
+	if (len != PKLG_PKT_SIZE) {
 		btsnoop->aborted = true;
 		return false;
 	}
 
+	memcpy(&pkt, read_consume(btsnoop, PKLG_PKT_SIZE), PKLG_PKT_SIZE);
+
 	if (btsnoop->pklg_v2) {
 		toread = le32toh(pkt.len) - (PKLG_PKT_SIZE - 4);
 
@@ -453,8 +649,7 @@ static bool pklg_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		break;
 	}
 
-	len = read(btsnoop->fd, data, toread);
-	if (len < 0) {
+	if (!read_data(btsnoop, data, toread)) {
 		btsnoop->aborted = true;
 		return false;
 	}
@@ -512,7 +707,7 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 	uint32_t toread, flags;
 	uint64_t ts;
 	uint8_t pkt_type;
-	ssize_t len;
+	size_t len;
 
 	if (!btsnoop || btsnoop->aborted)
 		return false;
@@ -520,15 +715,18 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 	if (btsnoop->pklg_format)
 		return pklg_read_hci(btsnoop, tv, index, opcode, data, size);
 
-	len = read(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE);
+	len = read_fill(btsnoop, BTSNOOP_PKT_SIZE);
 	if (len == 0)
 		return false;
 
-	if (len < 0 || len != BTSNOOP_PKT_SIZE) {
+	if (len != BTSNOOP_PKT_SIZE) {
 		btsnoop->aborted = true;
 		return false;
 	}
 
+	memcpy(&pkt, read_consume(btsnoop, BTSNOOP_PKT_SIZE),
+							BTSNOOP_PKT_SIZE);
+
 	toread = be32toh(pkt.len);
 	if (toread > BTSNOOP_MAX_PACKET_SIZE) {
 		btsnoop->aborted = true;
@@ -548,8 +746,7 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		break;
 
 	case BTSNOOP_FORMAT_UART:
-		len = read(btsnoop->fd, &pkt_type, 1);
-		if (len < 0) {
+		if (!toread || !read_data(btsnoop, &pkt_type, 1)) {
 			btsnoop->aborted = true;
 			return false;
 		}
@@ -569,8 +766,7 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		return false;
 	}
 
-	len = read(btsnoop->fd, data, toread);
-	if (len < 0) {
+	if (!read_data(btsnoop, data, toread)) {
 		btsnoop->aborted = true;
 		return false;
 	}
@@ -580,6 +776,99 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 	return true;
 }
 
+static bool build_index(struct btsnoop *btsnoop)
+{
+	size_t pos, len, alloc = 0;
+	size_t *records;
+
+	if (btsnoop->indexed)
+		return true;
+
+	/* Random access needs the whole file mapped */
+	if (!btsnoop->map)
+		return false;
+
+	pos = btsnoop->pklg_format ? 0 : BTSNOOP_HDR_SIZE;
+
+	while (1) {
+		const uint8_t *ptr = btsnoop->map + pos;
+
+		if (btsnoop->pklg_format) {
+			struct pklg_pkt pkt;
+
+			if (btsnoop->map_size - pos < PKLG_PKT_SIZE)
+				break;
+
+			memcpy(&pkt, ptr, PKLG_PKT_SIZE);
+			len = btsnoop->pklg_v2 ? le32toh(pkt.len) :
+							be32toh(pkt.len);
+			if (len < PKLG_PKT_SIZE - 4 || len - (PKLG_PKT_SIZE - 4)
+						> BTSNOOP_MAX_PACKET_SIZE)
+				break;
+
+			len += 4;
+		} else {
+			struct btsnoop_pkt pkt;
+
+			if (btsnoop->map_size - pos < BTSNOOP_PKT_SIZE)
+				break;
+
+			memcpy(&pkt, ptr, BTSNOOP_PKT_SIZE);
+			len = be32toh(pkt.len);
+			if (len > BTSNOOP_MAX_PACKET_SIZE)
+				break;
+
+			len += BTSNOOP_PKT_SIZE;
+		}
+
+		if (btsnoop->map_size - pos < len)
+			break;
+
+		if (btsnoop->num_records == alloc) {
+			alloc = alloc ? alloc * 2 : 1024;
+			records = realloc(btsnoop->records,
+						alloc * sizeof(*records));
+			if (!records)
+				return false;
+
+			btsnoop->records = records;
+		}
+
+		btsnoop->records[btsnoop->num_records++] = pos;
+		pos += len;
+	}
+
+	btsnoop->indexed = true;
+
+	return true;
+}
+
+unsigned long btsnoop_get_count(struct btsnoop *btsnoop)
+{
+	if (!btsnoop || !build_index(btsnoop))
+		return 0;
+
+	return btsnoop->num_records;
+}
+
+bool btsnoop_seek(struct btsnoop *btsnoop, unsigned long index)
+{
+	if (!btsnoop || !build_index(btsnoop))
+		return false;
+
+	if (index > btsnoop->num_records)
+		return false;
+
+	if (index == btsnoop->num_records)
+		btsnoop->offset = btsnoop->map_size;
+	else
+		btsnoop->offset = btsnoop->records[index];
+
+	btsnoop->aborted = false;
+
+	return true;
+}
+
 bool btsnoop_read_phy(struct btsnoop *btsnoop, struct timeval *tv,
 			uint16_t *frequency, void *data, uint16_t *size)
 {
@@ -98,6 +98,8 @@ void btsnoop_unref(struct btsnoop *btsnoop);
 
 uint32_t btsnoop_get_format(struct btsnoop *btsnoop);
 
+bool btsnoop_flush(struct btsnoop *btsnoop);
+
 bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv, uint32_t flags,
 			uint32_t drops, const void *data, uint16_t size);
 bool btsnoop_write_hci(struct btsnoop *btsnoop, struct timeval *tv,
@@ -111,3 +113,7 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 					void *data, uint16_t *size);
 bool btsnoop_read_phy(struct btsnoop *btsnoop, struct timeval *tv,
 			uint16_t *frequency, void *data, uint16_t *size);
+
+/* Random access, only for files that could be mapped into memory */
+unsigned long btsnoop_get_count(struct btsnoop *btsnoop);
+bool btsnoop_seek(struct btsnoop *btsnoop, unsigned long index);
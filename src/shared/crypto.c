@@ -15,9 +15,11 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 #include <sys/socket.h>
 
 #include "src/shared/util.h"
+#include "src/shared/aes.h"
 #include "src/shared/crypto.h"
 
 #ifndef HAVE_LINUX_IF_ALG_H
@@ -64,6 +66,13 @@ struct af_alg_iv {
 
 #define ATT_SIGN_LEN	12
 
+/*
+ * AES and AES-CMAC are computed in-process with AES-NI when the CPU has
+ * it, which avoids several syscalls per operation. Otherwise the kernel
+ * AF_ALG transforms are used and ecb_aes and cmac_aes are valid sockets.
+ * Only if those are not available either does the slower, constant time
+ * software implementation of src/shared/aes.c get used.
+ */
 struct bt_crypto {
 	int ref_count;
 	int ecb_aes;
@@ -134,26 +143,36 @@ struct bt_crypto *bt_crypto_new(void)
 		return bt_crypto_ref(singleton);
 
 	singleton = new0(struct bt_crypto, 1);
-
-	singleton->ecb_aes = ecb_aes_setup();
-	if (singleton->ecb_aes < 0) {
-		free(singleton);
-		singleton = NULL;
-		return NULL;
-	}
+	singleton->ecb_aes = -1;
+	singleton->cmac_aes = -1;
 
 	singleton->urandom = urandom_setup();
 	if (singleton->urandom < 0) {
-		close(singleton->ecb_aes);
 		free(singleton);
 		singleton = NULL;
 		return NULL;
 	}
 
+	if (bt_aes_accelerated() && bt_aes_self_test())
+		return bt_crypto_ref(singleton);
+
+	singleton->ecb_aes = ecb_aes_setup();
 	singleton->cmac_aes = cmac_aes_setup();
-	if (singleton->cmac_aes < 0) {
-		close(singleton->urandom);
+
+	if (singleton->ecb_aes >= 0 && singleton->cmac_aes >= 0)
+		return bt_crypto_ref(singleton);
+
+	if (singleton->ecb_aes >= 0)
 		close(singleton->ecb_aes);
+
+	if (singleton->cmac_aes >= 0)
+		close(singleton->cmac_aes);
+
+	singleton->ecb_aes = -1;
+	singleton->cmac_aes = -1;
+
+	if (!bt_aes_self_test()) {
+		close(singleton->urandom);
 		free(singleton);
 		singleton = NULL;
 		return NULL;
@@ -181,8 +200,12 @@ void bt_crypto_unref(struct bt_crypto *crypto)
 		return;
 
 	close(crypto->urandom);
-	close(crypto->ecb_aes);
-	close(crypto->cmac_aes);
+
+	if (crypto->ecb_aes >= 0)
+		close(crypto->ecb_aes);
+
+	if (crypto->cmac_aes >= 0)
+		close(crypto->cmac_aes);
 
 	free(crypto);
 	singleton = NULL;
@@ -259,17 +282,76 @@ static inline void swap_buf(const uint8_t *src, uint8_t *dst, uint16_t len)
 		dst[len - 1 - i] = src[i];
 }
 
+/* Plain AES-128 encryption, key and blocks in standard byte order */
+static bool crypto_ecb(struct bt_crypto *crypto, const uint8_t key[16],
+				const uint8_t in[16], uint8_t out[16])
+{
+	struct bt_aes_key aes;
+	bool ret;
+	int fd;
+
+	if (crypto->ecb_aes < 0) {
+		bt_aes_set_key(&aes, key);
+		bt_aes_encrypt(&aes, in, out);
+		explicit_bzero(&aes, sizeof(aes));
+		return true;
+	}
+
+	fd = alg_new(crypto->ecb_aes, key, 16);
+	if (fd < 0)
+		return false;
+
+	ret = alg_encrypt(fd, in, 16, out, 16);
+
+	close(fd);
+
+	return ret;
+}
+
+/* AES-CMAC, key, message and result in standard byte order */
+static bool crypto_cmac(struct bt_crypto *crypto, const uint8_t key[16],
+				const struct iovec *iov, size_t iov_len,
+				uint8_t res[16])
+{
+	ssize_t len;
+	int fd;
+
+	if (crypto->cmac_aes < 0) {
+		bt_aes_cmac(key, iov, iov_len, res);
+		return true;
+	}
+
+	fd = alg_new(crypto->cmac_aes, key, 16);
+	if (fd < 0)
+		return false;
+
+	len = writev(fd, iov, iov_len);
+	if (len < 0) {
+		close(fd);
+		return false;
+	}
+
+	len = read(fd, res, 16);
+	if (len < 0) {
+		close(fd);
+		return false;
+	}
+
+	close(fd);
+
+	return true;
+}
+
 bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 				const uint8_t *m, uint16_t m_len,
 				uint32_t sign_cnt,
 				uint8_t signature[ATT_SIGN_LEN])
 {
-	int fd;
-	int len;
 	uint8_t tmp[16], out[16];
 	uint16_t msg_len = m_len + sizeof(uint32_t);
 	uint8_t msg[msg_len];
 	uint8_t msg_s[msg_len];
+	struct iovec iov;
 
 	if (!crypto)
 		return false;
@@ -283,26 +365,14 @@ bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 	/* The most significant octet of key corresponds to key[0] */
 	swap_buf(key, tmp, 16);
 
-	fd = alg_new(crypto->cmac_aes, tmp, 16);
-	if (fd < 0)
-		return false;
-
 	/* Swap msg before signing */
 	swap_buf(msg, msg_s, msg_len);
 
-	len = send(fd, msg_s, msg_len, 0);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
+	iov.iov_base = msg_s;
+	iov.iov_len = msg_len;
 
-	len = read(fd, out, 16);
-	if (len < 0) {
-		close(fd);
+	if (!crypto_cmac(crypto, tmp, &iov, 1, out))
 		return false;
-	}
-
-	close(fd);
 
 	/*
 	 * As to BT spec. 4.1 Vol[3], Part C, chapter 10.4.1 sign counter should
@@ -358,7 +428,6 @@ bool bt_crypto_e(struct bt_crypto *crypto, const uint8_t key[16],
 			const uint8_t plaintext[16], uint8_t encrypted[16])
 {
 	uint8_t tmp[16], in[16], out[16];
-	int fd;
 
 	if (!crypto)
 		return false;
@@ -366,24 +435,15 @@ bool bt_crypto_e(struct bt_crypto *crypto, const uint8_t key[16],
 	/* The most significant octet of key corresponds to key[0] */
 	swap_buf(key, tmp, 16);
 
-	fd = alg_new(crypto->ecb_aes, tmp, 16);
-	if (fd < 0)
-		return false;
-
-
 	/* Most significant octet of plaintextData corresponds to in[0] */
 	swap_buf(plaintext, in, 16);
 
-	if (!alg_encrypt(fd, in, 16, out, 16)) {
-		close(fd);
+	if (!crypto_ecb(crypto, tmp, in, out))
 		return false;
-	}
 
 	/* Most significant octet of encryptedData corresponds to out[0] */
 	swap_buf(out, encrypted, 16);
 
-	close(fd);
-
 	return true;
 }
 
@@ -442,6 +502,318 @@ bool bt_crypto_ah(struct bt_crypto *crypto, const uint8_t k[16],
 	return true;
 }
 
+/* Number of IRKs evaluated per bt_aes_encrypt_multi() call */
+#define RESOLVE_BATCH	32
+
+struct rpa_irk {
+	uint8_t irk[16];
+	void *user_data;
+};
+
+struct rpa_cache_entry {
+	uint8_t rpa[6];
+	bool valid;
+	int irk;		/* Index into irks, -1 if it did not resolve */
+	time_t expire;
+};
+
+/*
+ * Resolves a private address against a table of IRKs. The IRKs are kept
+ * pre-expanded in a contiguous array so a lookup is just a batch of AES
+ * block encryptions, several keys at a time, and results (including
+ * misses) are remembered in a direct mapped cache keyed by the address.
+ * The cache is flushed whenever the IRK table changes.
+ */
+struct bt_crypto_resolver {
+	struct bt_crypto *crypto;
+	struct bt_aes_key *keys;
+	struct rpa_irk *irks;
+	unsigned int num_irks;
+	unsigned int max_irks;
+	struct rpa_cache_entry *cache;
+	unsigned int cache_mask;
+	unsigned int cache_timeout;
+	unsigned int hits;
+	unsigned int misses;
+};
+
+struct bt_crypto_resolver *bt_crypto_resolver_new(struct bt_crypto *crypto,
+						unsigned int cache_size,
+						unsigned int cache_timeout)
+{
+	struct bt_crypto_resolver *resolver;
+	unsigned int size = 1;
+
+	if (!crypto)
+		return NULL;
+
+	while (size < cache_size)
+		size <<= 1;
+
+	resolver = new0(struct bt_crypto_resolver, 1);
+	resolver->crypto = bt_crypto_ref(crypto);
+	resolver->cache = new0(struct rpa_cache_entry, size);
+	resolver->cache_mask = size - 1;
+	resolver->cache_timeout = cache_timeout;
+
+	return resolver;
+}
+
+void bt_crypto_resolver_free(struct bt_crypto_resolver *resolver)
+{
+	if (!resolver)
+		return;
+
+	explicit_bzero(resolver->keys, resolver->max_irks *
+						sizeof(*resolver->keys));
+	explicit_bzero(resolver->irks, resolver->max_irks *
+						sizeof(*resolver->irks));
+	free(resolver->keys);
+	free(resolver->irks);
+	free(resolver->cache);
+	bt_crypto_unref(resolver->crypto);
+	free(resolver);
+}
+
+static void resolver_flush(struct bt_crypto_resolver *resolver)
+{
+	memset(resolver->cache, 0, (resolver->cache_mask + 1) *
+						sizeof(*resolver->cache));
+}
+
+/*
+ * Grows the key and IRK tables together. The old tables are wiped rather
+ * than handed to realloc() so no copy of the keys is left in freed memory.
+ */
+static bool resolver_grow(struct bt_crypto_resolver *resolver)
+{
+	struct bt_aes_key *keys;
+	struct rpa_irk *irks;
+	unsigned int max;
+
+	max = resolver->max_irks ? resolver->max_irks * 2 : 8;
+
+	keys = malloc(max * sizeof(*keys));
+	irks = malloc(max * sizeof(*irks));
+	if (!keys || !irks) {
+		free(keys);
+		free(irks);
+		return false;
+	}
+
+	if (resolver->num_irks) {
+		memcpy(keys, resolver->keys, resolver->num_irks *
+							sizeof(*keys));
+		memcpy(irks, resolver->irks, resolver->num_irks *
+							sizeof(*irks));
+	}
+
+	explicit_bzero(resolver->keys, resolver->max_irks * sizeof(*keys));
+	explicit_bzero(resolver->irks, resolver->max_irks * sizeof(*irks));
+	free(resolver->keys);
+	free(resolver->irks);
+
+	resolver->keys = keys;
+	resolver->irks = irks;
+	resolver->max_irks = max;
+
+	return true;
+}
+
+bool bt_crypto_resolver_add(struct bt_crypto_resolver *resolver,
+				const uint8_t irk[16], void *user_data)
+{
+	uint8_t key[16];
+	unsigned int i;
+
+	if (!resolver || !irk)
+		return false;
+
+	for (i = 0; i < resolver->num_irks; i++) {
+		if (!memcmp(resolver->irks[i].irk, irk, 16)) {
+			resolver->irks[i].user_data = user_data;
+			return true;
+		}
+	}
+
+	if (resolver->num_irks == resolver->max_irks &&
+						!resolver_grow(resolver))
+		return false;
+
+	/* The most significant octet of key corresponds to key[0] */
+	swap_buf(irk, key, 16);
+	bt_aes_set_key(&resolver->keys[resolver->num_irks], key);
+	explicit_bzero(key, sizeof(key));
+
+	memcpy(resolver->irks[resolver->num_irks].irk, irk, 16);
+	resolver->irks[resolver->num_irks].user_data = user_data;
+	resolver->num_irks++;
+
+	resolver_flush(resolver);
+
+	return true;
+}
+
+bool bt_crypto_resolver_remove(struct bt_crypto_resolver *resolver,
+						const uint8_t irk[16])
+{
+	unsigned int i;
+
+	if (!resolver || !irk)
+		return false;
+
+	for (i = 0; i < resolver->num_irks; i++) {
+		if (memcmp(resolver->irks[i].irk, irk, 16))
+			continue;
+
+		resolver->num_irks--;
+
+		/* Order does not matter, move the last entry into the gap */
+		resolver->keys[i] = resolver->keys[resolver->num_irks];
+		resolver->irks[i] = resolver->irks[resolver->num_irks];
+
+		explicit_bzero(&resolver->keys[resolver->num_irks],
+						sizeof(*resolver->keys));
+		explicit_bzero(&resolver->irks[resolver->num_irks],
+						sizeof(*resolver->irks));
+
+		resolver_flush(resolver);
+
+		return true;
+	}
+
+	return false;
+}
+
+void bt_crypto_resolver_clear(struct bt_crypto_resolver *resolver)
+{
+	if (!resolver)
+		return;
+
+	explicit_bzero(resolver->keys, resolver->num_irks *
+						sizeof(*resolver->keys));
+	explicit_bzero(resolver->irks, resolver->num_irks *
+						sizeof(*resolver->irks));
+
+	resolver->num_irks = 0;
+	resolver_flush(resolver);
+}
+
+static int resolver_lookup(struct bt_crypto_resolver *resolver,
+						const uint8_t rpa[6])
+{
+	uint8_t in[16], out[RESOLVE_BATCH][16];
+	unsigned int i, j;
+
+	/*
+	 * ah(k, prand) in standard byte order: prand is the most significant
+	 * half of the address and ends up in the last three plaintext octets,
+	 * the hash must match the last three ciphertext octets.
+	 */
+	memset(in, 0, 13);
+	in[13] = rpa[5];
+	in[14] = rpa[4];
+	in[15] = rpa[3];
+
+	if (resolver->crypto->ecb_aes >= 0) {
+		for (i = 0; i < resolver->num_irks; i++) {
+			uint8_t hash[3];
+
+			if (!bt_crypto_ah(resolver->crypto,
+						resolver->irks[i].irk,
+						rpa + 3, hash))
+				return -1;
+
+			if (!memcmp(hash, rpa, 3))
+				return i;
+		}
+
+		return -1;
+	}
+
+	for (i = 0; i < resolver->num_irks; i += RESOLVE_BATCH) {
+		unsigned int num = resolver->num_irks - i;
+
+		if (num > RESOLVE_BATCH)
+			num = RESOLVE_BATCH;
+
+		bt_aes_encrypt_multi(&resolver->keys[i], num, in, out);
+
+		for (j = 0; j < num; j++) {
+			if (out[j][15] == rpa[0] && out[j][14] == rpa[1] &&
+							out[j][13] == rpa[2])
+				return i + j;
+		}
+	}
+
+	return -1;
+}
+
+static unsigned int rpa_hash(const uint8_t rpa[6])
+{
+	uint32_t hash = 2166136261u;
+	int i;
+
+	for (i = 0; i < 6; i++)
+		hash = (hash ^ rpa[i]) * 16777619u;
+
+	return hash;
+}
+
+bool bt_crypto_resolver_resolve(struct bt_crypto_resolver *resolver,
+				const uint8_t rpa[6], void **user_data)
+{
+	struct rpa_cache_entry *entry;
+	struct timespec now;
+	int irk;
+
+	if (!resolver || !rpa)
+		return false;
+
+	/* Only resolvable private addresses carry a hash */
+	if ((rpa[5] & 0xc0) != 0x40)
+		return false;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	entry = &resolver->cache[rpa_hash(rpa) & resolver->cache_mask];
+
+	if (entry->valid && !memcmp(entry->rpa, rpa, 6) &&
+						now.tv_sec < entry->expire) {
+		resolver->hits++;
+		irk = entry->irk;
+	} else {
+		resolver->misses++;
+		irk = resolver_lookup(resolver, rpa);
+
+		memcpy(entry->rpa, rpa, 6);
+		entry->valid = true;
+		entry->irk = irk;
+		entry->expire = now.tv_sec + resolver->cache_timeout;
+	}
+
+	if (irk < 0)
+		return false;
+
+	if (user_data)
+		*user_data = resolver->irks[irk].user_data;
+
+	return true;
+}
+
+void bt_crypto_resolver_get_stats(struct bt_crypto_resolver *resolver,
+				unsigned int *hits, unsigned int *misses)
+{
+	if (!resolver)
+		return;
+
+	if (hits)
+		*hits = resolver->hits;
+
+	if (misses)
+		*misses = resolver->misses;
+}
+
 typedef struct {
 	uint64_t a, b;
 } u128;
@@ -589,31 +961,15 @@ bool bt_crypto_s1(struct bt_crypto *crypto, const uint8_t k[16],
 static bool aes_cmac_be(struct bt_crypto *crypto, const uint8_t key[16],
 			const uint8_t *msg, size_t msg_len, uint8_t res[16])
 {
-	ssize_t len;
-	int fd;
+	struct iovec iov;
 
 	if (msg_len > CMAC_MSG_MAX)
 		return false;
 
-	fd = alg_new(crypto->cmac_aes, key, 16);
-	if (fd < 0)
-		return false;
-
-	len = send(fd, msg, msg_len, 0);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
-
-	len = read(fd, res, 16);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
-
-	close(fd);
+	iov.iov_base = (void *) msg;
+	iov.iov_len = msg_len;
 
-	return true;
+	return crypto_cmac(crypto, key, &iov, 1, res);
 }
 
 static bool aes_cmac(struct bt_crypto *crypto, const uint8_t key[16],
@@ -725,31 +1081,11 @@ bool bt_crypto_gatt_hash(struct bt_crypto *crypto, struct iovec *iov,
 				size_t iov_len, uint8_t res[16])
 {
 	const uint8_t key[16] = {};
-	ssize_t len;
-	int fd;
 
 	if (!crypto)
 		return false;
 
-	fd = alg_new(crypto->cmac_aes, key, 16);
-	if (fd < 0)
-		return false;
-
-	len = writev(fd, iov, iov_len);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
-
-	len = read(fd, res, 16);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
-
-	close(fd);
-
-	return true;
+	return crypto_cmac(crypto, key, iov, iov_len, res);
 }
 
 /*
@@ -26,6 +26,23 @@ bool bt_crypto_e(struct bt_crypto *crypto, const uint8_t key[16],
 			const uint8_t plaintext[16], uint8_t encrypted[16]);
 bool bt_crypto_ah(struct bt_crypto *crypto, const uint8_t k[16],
 					const uint8_t r[3], uint8_t hash[3]);
+
+struct bt_crypto_resolver;
+
+struct bt_crypto_resolver *bt_crypto_resolver_new(struct bt_crypto *crypto,
+						unsigned int cache_size,
+						unsigned int cache_timeout);
+void bt_crypto_resolver_free(struct bt_crypto_resolver *resolver);
+bool bt_crypto_resolver_add(struct bt_crypto_resolver *resolver,
+				const uint8_t irk[16], void *user_data);
+bool bt_crypto_resolver_remove(struct bt_crypto_resolver *resolver,
+						const uint8_t irk[16]);
+void bt_crypto_resolver_clear(struct bt_crypto_resolver *resolver);
+bool bt_crypto_resolver_resolve(struct bt_crypto_resolver *resolver,
+				const uint8_t rpa[6], void **user_data);
+void bt_crypto_resolver_get_stats(struct bt_crypto_resolver *resolver,
+				unsigned int *hits, unsigned int *misses);
+
 bool bt_crypto_c1(struct bt_crypto *crypto, const uint8_t k[16],
 			const uint8_t r[16], const uint8_t pres[7],
 			const uint8_t preq[7], uint8_t iat,
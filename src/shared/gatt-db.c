@@ -61,6 +61,11 @@ struct gatt_db {
 	uint16_t last_handle;
 	struct queue *services;
 
+	/* Services sorted by start handle, for binary search by handle */
+	struct gatt_db_service **svc_index;
+	unsigned int svc_index_len;
+	unsigned int svc_index_size;
+
 	struct queue *notify_list;
 	unsigned int next_notify_id;
 
@@ -133,6 +138,92 @@ struct gatt_db_service {
 	struct gatt_db_attribute **attributes;
 };
 
+static inline uint16_t service_start(const struct gatt_db_service *service)
+{
+	return service->attributes[0]->handle;
+}
+
+static inline uint16_t service_end(const struct gatt_db_service *service)
+{
+	return service->attributes[0]->handle + service->num_handles - 1;
+}
+
+/* Returns the position of the first service ending at or after handle */
+static unsigned int svc_index_lower_bound(struct gatt_db *db, uint16_t handle)
+{
+	unsigned int lo = 0, hi = db->svc_index_len;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (service_end(db->svc_index[mid]) < handle)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static struct gatt_db_service *svc_index_find(struct gatt_db *db,
+							uint16_t handle)
+{
+	struct gatt_db_service *service;
+	unsigned int pos;
+
+	pos = svc_index_lower_bound(db, handle);
+	if (pos >= db->svc_index_len)
+		return NULL;
+
+	service = db->svc_index[pos];
+	if (service_start(service) > handle)
+		return NULL;
+
+	return service;
+}
+
+static bool svc_index_insert(struct gatt_db *db,
+					struct gatt_db_service *service)
+{
+	struct gatt_db_service **index;
+	unsigned int pos, size;
+
+	if (db->svc_index_len == db->svc_index_size) {
+		size = db->svc_index_size ? db->svc_index_size * 2 : 8;
+		index = realloc(db->svc_index, size * sizeof(*index));
+		if (!index)
+			return false;
+
+		db->svc_index = index;
+		db->svc_index_size = size;
+	}
+
+	pos = svc_index_lower_bound(db, service_start(service));
+
+	memmove(&db->svc_index[pos + 1], &db->svc_index[pos],
+			(db->svc_index_len - pos) * sizeof(*db->svc_index));
+
+	db->svc_index[pos] = service;
+	db->svc_index_len++;
+
+	return true;
+}
+
+static void svc_index_remove(struct gatt_db *db,
+					struct gatt_db_service *service)
+{
+	unsigned int pos;
+
+	pos = svc_index_lower_bound(db, service_start(service));
+	if (pos >= db->svc_index_len || db->svc_index[pos] != service)
+		return;
+
+	db->svc_index_len--;
+
+	memmove(&db->svc_index[pos], &db->svc_index[pos + 1],
+			(db->svc_index_len - pos) * sizeof(*db->svc_index));
+}
+
 static void set_attribute_data(struct gatt_db_attribute *attribute,
 						gatt_db_read_t read_func,
 						gatt_db_write_t write_func,
@@ -315,6 +406,15 @@ static void service_clone(void *data, void *user_data)
 		}
 	}
 
+	if (!svc_index_insert(db, clone)) {
+		for (i = 0; i < clone->num_handles; i++)
+			attribute_destroy(clone->attributes[i]);
+
+		free(clone->attributes);
+		free(clone);
+		return;
+	}
+
 	queue_push_tail(db->services, clone);
 }
 
@@ -506,6 +606,9 @@ static void gatt_db_service_destroy(void *data)
 	struct gatt_db_service *service = data;
 	int i;
 
+	if (service->db && service->attributes[0])
+		svc_index_remove(service->db, service);
+
 	if (service->active)
 		notify_service_changed(service->db, service, false);
 
@@ -533,6 +636,11 @@ static void gatt_db_destroy(struct gatt_db *db)
 	if (db->hash_id)
 		timeout_remove(db->hash_id);
 
+	/* No lookups are possible anymore so skip index maintenance */
+	free(db->svc_index);
+	db->svc_index = NULL;
+	db->svc_index_len = 0;
+
 	queue_destroy(db->services, gatt_db_service_destroy);
 	free(db->ccc);
 	free(db);
@@ -735,16 +843,17 @@ static struct gatt_db_service *find_insert_loc(struct gatt_db *db,
 						uint16_t start, uint16_t end,
 						struct gatt_db_service **after)
 {
-	const struct queue_entry *services_entry;
 	struct gatt_db_service *service;
 	uint16_t cur_start, cur_end;
+	unsigned int pos;
 
-	*after = NULL;
+	/* Skip over every service that ends before the new one starts */
+	pos = svc_index_lower_bound(db, start);
 
-	services_entry = queue_get_entries(db->services);
+	*after = pos ? db->svc_index[pos - 1] : NULL;
 
-	while (services_entry) {
-		service = services_entry->data;
+	for (; pos < db->svc_index_len; pos++) {
+		service = db->svc_index[pos];
 
 		gatt_db_service_get_handles(service, &cur_start, &cur_end);
 
@@ -758,7 +867,6 @@ static struct gatt_db_service *find_insert_loc(struct gatt_db *db,
 			return NULL;
 
 		*after = service;
-		services_entry = services_entry->next;
 	}
 
 	return NULL;
@@ -825,6 +933,11 @@ struct gatt_db_attribute *gatt_db_insert_service(struct gatt_db *db,
 	service->attributes[0]->handle = handle;
 	service->num_handles = num_handles;
 
+	if (!svc_index_insert(db, service)) {
+		queue_remove(db->services, service);
+		goto fail;
+	}
+
 	/* Fast-forward last_handle if the new service was added to the end */
 	db->last_handle = MAX(handle + num_handles - 1, db->last_handle);
 
@@ -1528,7 +1641,7 @@ static void foreach_in_range(void *data, void *user_data)
 	struct gatt_db_service *service = data;
 	struct foreach_data *foreach_data = user_data;
 	uint16_t svc_start, svc_end;
-	int i;
+	int i = 0;
 
 	if (!service->active)
 		return;
@@ -1546,7 +1659,11 @@ static void foreach_in_range(void *data, void *user_data)
 		return foreach_service_in_range(data, user_data);
 	}
 
-	for (i = 0; i < service->num_handles; i++) {
+	/* Attribute handles are allocated by their position in the service */
+	if (svc_start < foreach_data->start)
+		i = foreach_data->start - svc_start;
+
+	for (; i < service->num_handles; i++) {
 		struct gatt_db_attribute *attribute = service->attributes[i];
 
 		if (!attribute)
@@ -1566,6 +1683,39 @@ static void foreach_in_range(void *data, void *user_data)
 	}
 }
 
+static void foreach_index_in_range(struct gatt_db *db,
+					struct foreach_data *foreach_data)
+{
+	uint16_t handle = foreach_data->start;
+
+	/*
+	 * Look the next service up by handle after every callback rather
+	 * than walking positions, since callbacks may add or remove services.
+	 */
+	while (1) {
+		struct gatt_db_service *service;
+		unsigned int pos;
+		uint16_t end;
+
+		pos = svc_index_lower_bound(db, handle);
+		if (pos >= db->svc_index_len)
+			return;
+
+		service = db->svc_index[pos];
+		if (service_start(service) > foreach_data->end)
+			return;
+
+		end = service_end(service);
+
+		foreach_in_range(service, foreach_data);
+
+		if (end >= foreach_data->end)
+			return;
+
+		handle = end + 1;
+	}
+}
+
 void gatt_db_foreach_service_in_range(struct gatt_db *db,
 						const bt_uuid_t *uuid,
 						gatt_db_attribute_cb_t func,
@@ -1585,7 +1735,7 @@ void gatt_db_foreach_service_in_range(struct gatt_db *db,
 	data.end = end_handle;
 	data.attr = false;
 
-	queue_foreach(db->services, foreach_in_range, &data);
+	foreach_index_in_range(db, &data);
 }
 
 void gatt_db_foreach_in_range(struct gatt_db *db, const bt_uuid_t *uuid,
@@ -1606,7 +1756,7 @@ void gatt_db_foreach_in_range(struct gatt_db *db, const bt_uuid_t *uuid,
 	data.end = end_handle;
 	data.attr = true;
 
-	queue_foreach(db->services, foreach_in_range, &data);
+	foreach_index_in_range(db, &data);
 }
 
 void gatt_db_service_foreach(struct gatt_db_attribute *attrib,
@@ -1730,17 +1880,6 @@ void gatt_db_service_foreach_incl(struct gatt_db_attribute *attrib,
 								user_data);
 }
 
-static bool find_service_for_handle(const void *data, const void *user_data)
-{
-	const struct gatt_db_service *service = data;
-	uint16_t handle = PTR_TO_UINT(user_data);
-	uint16_t start, end;
-
-	gatt_db_service_get_handles(service, &start, &end);
-
-	return (start <= handle) && (handle <= end);
-}
-
 struct gatt_db_attribute *gatt_db_get_service(struct gatt_db *db,
 							uint16_t handle)
 {
@@ -1749,8 +1888,7 @@ struct gatt_db_attribute *gatt_db_get_service(struct gatt_db *db,
 	if (!db || !handle)
 		return NULL;
 
-	service = queue_find(db->services, find_service_for_handle,
-						UINT_TO_PTR(handle));
+	service = svc_index_find(db, handle);
 	if (!service)
 		return NULL;
 
@@ -1762,23 +1900,20 @@ struct gatt_db_attribute *gatt_db_get_attribute(struct gatt_db *db,
 {
 	struct gatt_db_attribute *attrib;
 	struct gatt_db_service *service;
-	int i;
 
-	attrib = gatt_db_get_service(db, handle);
-	if (!attrib)
+	if (!db || !handle)
 		return NULL;
 
-	service = attrib->service;
-
-	for (i = 0; i < service->num_handles; i++) {
-		if (!service->attributes[i])
-			continue;
+	service = svc_index_find(db, handle);
+	if (!service)
+		return NULL;
 
-		if (service->attributes[i]->handle == handle)
-			return service->attributes[i];
-	}
+	/* Attribute handles are allocated by their position in the service */
+	attrib = service->attributes[handle - service_start(service)];
+	if (!attrib || attrib->handle != handle)
+		return NULL;
 
-	return NULL;
+	return attrib;
 }
 
 static bool find_service_with_uuid(const void *data, const void *user_data)
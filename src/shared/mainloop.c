@@ -16,6 +16,9 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <time.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stddef.h>
@@ -30,39 +33,143 @@
 #include "mainloop.h"
 #include "mainloop-notify.h"
 
-#define MAX_EPOLL_EVENTS 10
+#define MIN_EPOLL_EVENTS 10
+#define MAX_EPOLL_EVENTS 1024
 
 static int epoll_fd;
 static int epoll_terminate;
 static int exit_status = EXIT_SUCCESS;
 
+static struct epoll_event *epoll_events;
+static unsigned int epoll_events_size;
+
 struct mainloop_data {
 	int fd;
 	uint32_t events;
 	mainloop_event_func callback;
 	mainloop_destroy_func destroy;
 	void *user_data;
+	struct mainloop_data *next_removed;
 };
 
-#define MAX_MAINLOOP_ENTRIES 128
+#define MIN_MAINLOOP_ENTRIES 128
+
+/*
+ * Handlers are indexed directly by file descriptor. The table starts out
+ * with MIN_MAINLOOP_ENTRIES slots and is doubled whenever a descriptor
+ * beyond its current end gets added, so the only limit is RLIMIT_NOFILE.
+ */
+static struct mainloop_data **mainloop_list;
+static unsigned int mainloop_list_size;
+
+/*
+ * Events carry the handler pointer. Handlers removed while a batch is
+ * being dispatched are only freed once the batch is done, so pending
+ * events for them can be recognized and skipped.
+ */
+static bool mainloop_dispatching;
+static struct mainloop_data *mainloop_removed;
+
+#define MIN_TIMEOUT_ENTRIES 64
+#define TIMEOUT_DISARMED UINT_MAX
 
-static struct mainloop_data *mainloop_list[MAX_MAINLOOP_ENTRIES];
+#define NSEC_PER_MSEC 1000000ULL
+#define NSEC_PER_SEC 1000000000ULL
 
 struct timeout_data {
-	int fd;
+	int id;
+	unsigned int index;
+	uint64_t expire;
 	mainloop_timeout_func callback;
 	mainloop_destroy_func destroy;
 	void *user_data;
 };
 
-void mainloop_init(void)
+/*
+ * All timeouts share a single timerfd. Pending ones are kept in a binary
+ * min-heap ordered by absolute expiry (each entry tracks its own heap
+ * index so cancel does not need to search) and the timerfd is armed for
+ * the heap head. Timeout ids index timeout_list directly.
+ */
+static int timeout_fd = -1;
+static uint64_t timeout_armed;
+static bool timeout_dispatching;
+
+static struct timeout_data **timeout_heap;
+static unsigned int timeout_heap_len;
+static unsigned int timeout_heap_size;
+
+static struct timeout_data **timeout_list;
+static unsigned int timeout_list_size;
+static unsigned int timeout_next_id = 1;
+
+static int mainloop_list_grow(int fd)
 {
-	unsigned int i;
+	struct mainloop_data **list;
+	unsigned int size;
+
+	if ((unsigned int) fd < mainloop_list_size)
+		return 0;
+
+	size = mainloop_list_size ? mainloop_list_size : MIN_MAINLOOP_ENTRIES;
+
+	while (size <= (unsigned int) fd)
+		size <<= 1;
+
+	list = realloc(mainloop_list, size * sizeof(*list));
+	if (!list)
+		return -ENOMEM;
+
+	memset(list + mainloop_list_size, 0,
+			(size - mainloop_list_size) * sizeof(*list));
+
+	mainloop_list = list;
+	mainloop_list_size = size;
+
+	return 0;
+}
+
+static struct mainloop_data *mainloop_list_lookup(int fd)
+{
+	if (fd < 0 || (unsigned int) fd >= mainloop_list_size)
+		return NULL;
+
+	return mainloop_list[fd];
+}
+
+static void epoll_events_grow(void)
+{
+	struct epoll_event *events;
+	unsigned int size;
+
+	if (epoll_events_size >= MAX_EPOLL_EVENTS)
+		return;
 
+	size = epoll_events_size ? epoll_events_size << 1 : MIN_EPOLL_EVENTS;
+	if (size > MAX_EPOLL_EVENTS)
+		size = MAX_EPOLL_EVENTS;
+
+	events = realloc(epoll_events, size * sizeof(*events));
+	if (!events)
+		return;
+
+	epoll_events = events;
+	epoll_events_size = size;
+}
+
+void mainloop_init(void)
+{
 	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 
-	for (i = 0; i < MAX_MAINLOOP_ENTRIES; i++)
-		mainloop_list[i] = NULL;
+	if (mainloop_list)
+		memset(mainloop_list, 0,
+				mainloop_list_size * sizeof(*mainloop_list));
+
+	/* Without an event batch mainloop_run() fails right away */
+	if (mainloop_list_grow(MIN_MAINLOOP_ENTRIES - 1) < 0)
+		return;
+
+	epoll_events_grow();
 
 	epoll_terminate = 0;
 }
@@ -90,23 +197,44 @@ int mainloop_run(void)
 {
 	unsigned int i;
 
+	if (!epoll_events)
+		return EXIT_FAILURE;
+
 	while (!epoll_terminate) {
-		struct epoll_event events[MAX_EPOLL_EVENTS];
 		int n, nfds;
 
-		nfds = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+		nfds = epoll_wait(epoll_fd, epoll_events, epoll_events_size, -1);
 		if (nfds < 0)
 			continue;
 
+		mainloop_dispatching = true;
+
 		for (n = 0; n < nfds; n++) {
-			struct mainloop_data *data = events[n].data.ptr;
+			struct mainloop_data *data = epoll_events[n].data.ptr;
+
+			/* Removed by an earlier callback in this batch */
+			if (!data->callback)
+				continue;
 
-			data->callback(data->fd, events[n].events,
+			data->callback(data->fd, epoll_events[n].events,
 							data->user_data);
 		}
+
+		mainloop_dispatching = false;
+
+		while (mainloop_removed) {
+			struct mainloop_data *data = mainloop_removed;
+
+			mainloop_removed = data->next_removed;
+			free(data);
+		}
+
+		/* Harvest more events per wakeup while under load */
+		if ((unsigned int) nfds == epoll_events_size)
+			epoll_events_grow();
 	}
 
-	for (i = 0; i < MAX_MAINLOOP_ENTRIES; i++) {
+	for (i = 0; i < mainloop_list_size; i++) {
 		struct mainloop_data *data = mainloop_list[i];
 
 		mainloop_list[i] = NULL;
@@ -121,6 +249,14 @@ int mainloop_run(void)
 		}
 	}
 
+	free(mainloop_list);
+	mainloop_list = NULL;
+	mainloop_list_size = 0;
+
+	free(epoll_events);
+	epoll_events = NULL;
+	epoll_events_size = 0;
+
 	close(epoll_fd);
 	epoll_fd = 0;
 
@@ -136,9 +272,12 @@ int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
 	struct epoll_event ev;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1 || !callback)
+	if (fd < 0 || !callback)
 		return -EINVAL;
 
+	if (mainloop_list_grow(fd) < 0)
+		return -ENOMEM;
+
 	data = malloc(sizeof(*data));
 	if (!data)
 		return -ENOMEM;
@@ -171,10 +310,10 @@ int mainloop_modify_fd(int fd, uint32_t events)
 	struct epoll_event ev;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1)
+	if (fd < 0)
 		return -EINVAL;
 
-	data = mainloop_list[fd];
+	data = mainloop_list_lookup(fd);
 	if (!data)
 		return -ENXIO;
 
@@ -196,10 +335,10 @@ int mainloop_remove_fd(int fd)
 	struct mainloop_data *data;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1)
+	if (fd < 0)
 		return -EINVAL;
 
-	data = mainloop_list[fd];
+	data = mainloop_list_lookup(fd);
 	if (!data)
 		return -ENXIO;
 
@@ -210,110 +349,374 @@ int mainloop_remove_fd(int fd)
 	if (data->destroy)
 		data->destroy(data->user_data);
 
-	free(data);
+	if (mainloop_dispatching) {
+		data->callback = NULL;
+		data->next_removed = mainloop_removed;
+		mainloop_removed = data;
+	} else
+		free(data);
 
 	return err;
 }
 
-static void timeout_destroy(void *user_data)
+static uint64_t timeout_now(void)
 {
-	struct timeout_data *data = user_data;
+	struct timespec ts;
 
-	close(data->fd);
-	data->fd = -1;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	if (data->destroy)
-		data->destroy(data->user_data);
+	return (uint64_t) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
 
-	free(data);
+static void timeout_swap(unsigned int a, unsigned int b)
+{
+	struct timeout_data *tmp = timeout_heap[a];
+
+	timeout_heap[a] = timeout_heap[b];
+	timeout_heap[b] = tmp;
+
+	timeout_heap[a]->index = a;
+	timeout_heap[b]->index = b;
+}
+
+static bool timeout_before(unsigned int a, unsigned int b)
+{
+	return timeout_heap[a]->expire < timeout_heap[b]->expire;
+}
+
+static void timeout_sift_up(unsigned int index)
+{
+	while (index > 0) {
+		unsigned int parent = (index - 1) / 2;
+
+		if (!timeout_before(index, parent))
+			break;
+
+		timeout_swap(index, parent);
+		index = parent;
+	}
+}
+
+static void timeout_sift_down(unsigned int index)
+{
+	while (1) {
+		unsigned int child = index * 2 + 1;
+
+		if (child >= timeout_heap_len)
+			break;
+
+		if (child + 1 < timeout_heap_len &&
+					timeout_before(child + 1, child))
+			child++;
+
+		if (!timeout_before(child, index))
+			break;
+
+		timeout_swap(index, child);
+		index = child;
+	}
+}
+
+static void timeout_heap_remove(struct timeout_data *data)
+{
+	unsigned int index = data->index;
+
+	if (index == TIMEOUT_DISARMED)
+		return;
+
+	data->index = TIMEOUT_DISARMED;
+
+	if (index == --timeout_heap_len)
+		return;
+
+	timeout_heap[index] = timeout_heap[timeout_heap_len];
+	timeout_heap[index]->index = index;
+
+	timeout_sift_up(index);
+	timeout_sift_down(timeout_heap[index]->index);
+}
+
+static int timeout_heap_insert(struct timeout_data *data)
+{
+	if (timeout_heap_len == timeout_heap_size) {
+		struct timeout_data **heap;
+		unsigned int size;
+
+		size = timeout_heap_size ? timeout_heap_size << 1 :
+							MIN_TIMEOUT_ENTRIES;
+
+		heap = realloc(timeout_heap, size * sizeof(*heap));
+		if (!heap)
+			return -ENOMEM;
+
+		timeout_heap = heap;
+		timeout_heap_size = size;
+	}
+
+	data->index = timeout_heap_len++;
+	timeout_heap[data->index] = data;
+
+	timeout_sift_up(data->index);
+
+	return 0;
+}
+
+/*
+ * Program the shared timerfd for the earliest pending timeout. The timer
+ * is only ever moved earlier here; cancelling the head leaves it armed and
+ * the resulting early wakeup simply re-arms it, which saves a syscall per
+ * cancel for the common arm-then-cancel request timeout pattern.
+ */
+static void timeout_rearm(bool force)
+{
+	struct itimerspec itimer;
+	uint64_t expire;
+
+	if (timeout_dispatching)
+		return;
+
+	expire = timeout_heap_len ? timeout_heap[0]->expire : 0;
+
+	if (!force && (!expire || (timeout_armed && timeout_armed <= expire)))
+		return;
+
+	if (expire == timeout_armed)
+		return;
+
+	memset(&itimer, 0, sizeof(itimer));
+	itimer.it_value.tv_sec = expire / NSEC_PER_SEC;
+	itimer.it_value.tv_nsec = expire % NSEC_PER_SEC;
+
+	if (timerfd_settime(timeout_fd, TFD_TIMER_ABSTIME, &itimer, NULL) < 0)
+		return;
+
+	timeout_armed = expire;
 }
 
 static void timeout_callback(int fd, uint32_t events, void *user_data)
 {
-	struct timeout_data *data = user_data;
-	uint64_t expired;
+	uint64_t expired, now;
 	ssize_t result;
 
 	if (events & (EPOLLERR | EPOLLHUP))
 		return;
 
-	result = read(data->fd, &expired, sizeof(expired));
+	result = read(timeout_fd, &expired, sizeof(expired));
 	if (result != sizeof(expired))
 		return;
 
-	if (data->callback)
-		data->callback(data->fd, data->user_data);
+	timeout_armed = 0;
+	timeout_dispatching = true;
+
+	now = timeout_now();
+
+	/*
+	 * Anything armed from within a callback expires strictly after now,
+	 * so this terminates even if callbacks keep re-arming themselves.
+	 */
+	while (timeout_heap_len && timeout_heap[0]->expire <= now) {
+		struct timeout_data *data = timeout_heap[0];
+
+		timeout_heap_remove(data);
+
+		/* The callback is free to modify or remove the timeout */
+		data->callback(data->id, data->user_data);
+	}
+
+	timeout_dispatching = false;
+
+	timeout_rearm(true);
 }
 
-static inline int timeout_set(int fd, unsigned int msec)
+static struct timeout_data *timeout_lookup(int id)
 {
-	struct itimerspec itimer;
-	unsigned int sec = msec / 1000;
+	if (id <= 0 || (unsigned int) id >= timeout_list_size)
+		return NULL;
 
-	memset(&itimer, 0, sizeof(itimer));
-	itimer.it_interval.tv_sec = 0;
-	itimer.it_interval.tv_nsec = 0;
-	itimer.it_value.tv_sec = sec;
-	itimer.it_value.tv_nsec = (msec - (sec * 1000)) * 1000 * 1000;
+	return timeout_list[id];
+}
+
+static int timeout_alloc_id(void)
+{
+	struct timeout_data **list;
+	unsigned int i, size;
+
+	for (i = timeout_next_id; i < timeout_list_size; i++) {
+		if (!timeout_list[i])
+			goto done;
+	}
+
+	for (i = 1; i < timeout_next_id && i < timeout_list_size; i++) {
+		if (!timeout_list[i])
+			goto done;
+	}
+
+	size = timeout_list_size ? timeout_list_size << 1 :
+							MIN_TIMEOUT_ENTRIES;
+	if (size > INT_MAX)
+		return -ENOMEM;
 
-	return timerfd_settime(fd, 0, &itimer, NULL);
+	list = realloc(timeout_list, size * sizeof(*list));
+	if (!list)
+		return -ENOMEM;
+
+	memset(list + timeout_list_size, 0,
+			(size - timeout_list_size) * sizeof(*list));
+
+	i = timeout_list_size ? timeout_list_size : 1;
+
+	timeout_list = list;
+	timeout_list_size = size;
+
+done:
+	timeout_next_id = i + 1;
+
+	return i;
+}
+
+static void timeout_destroy(void *user_data)
+{
+	struct timeout_data **list = timeout_list;
+	unsigned int i, size = timeout_list_size;
+
+	/* Detach everything first since destroy callbacks may call back in */
+	timeout_list = NULL;
+	timeout_list_size = 0;
+	timeout_next_id = 1;
+
+	free(timeout_heap);
+	timeout_heap = NULL;
+	timeout_heap_len = 0;
+	timeout_heap_size = 0;
+
+	close(timeout_fd);
+	timeout_fd = -1;
+	timeout_armed = 0;
+	timeout_dispatching = false;
+
+	for (i = 0; i < size; i++) {
+		struct timeout_data *data = list[i];
+
+		if (!data)
+			continue;
+
+		if (data->destroy)
+			data->destroy(data->user_data);
+
+		free(data);
+	}
+
+	free(list);
+}
+
+static int timeout_setup(void)
+{
+	if (timeout_fd >= 0)
+		return 0;
+
+	timeout_fd = timerfd_create(CLOCK_MONOTONIC,
+						TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timeout_fd < 0)
+		return -EIO;
+
+	if (mainloop_add_fd(timeout_fd, EPOLLIN, timeout_callback,
+						NULL, timeout_destroy) < 0) {
+		close(timeout_fd);
+		timeout_fd = -1;
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int timeout_set(struct timeout_data *data, unsigned int msec)
+{
+	int err;
+
+	timeout_heap_remove(data);
+
+	data->expire = timeout_now() + (uint64_t) msec * NSEC_PER_MSEC;
+
+	err = timeout_heap_insert(data);
+	if (err < 0)
+		return err;
+
+	timeout_rearm(false);
+
+	return 0;
 }
 
 int mainloop_add_timeout(unsigned int msec, mainloop_timeout_func callback,
 				void *user_data, mainloop_destroy_func destroy)
 {
 	struct timeout_data *data;
+	int id;
 
 	if (!callback)
 		return -EINVAL;
 
+	if (timeout_setup() < 0)
+		return -EIO;
+
+	id = timeout_alloc_id();
+	if (id < 0)
+		return -ENOMEM;
+
 	data = malloc(sizeof(*data));
 	if (!data)
 		return -ENOMEM;
 
 	memset(data, 0, sizeof(*data));
+	data->id = id;
+	data->index = TIMEOUT_DISARMED;
 	data->callback = callback;
 	data->destroy = destroy;
 	data->user_data = user_data;
 
-	data->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
-	if (data->fd < 0) {
-		free(data);
-		return -EIO;
-	}
-
+	/* A zero timeout stays idle until mainloop_modify_timeout() */
 	if (msec > 0) {
-		if (timeout_set(data->fd, msec) < 0) {
-			close(data->fd);
+		if (timeout_set(data, msec) < 0) {
 			free(data);
 			return -EIO;
 		}
 	}
 
-	if (mainloop_add_fd(data->fd, EPOLLIN | EPOLLONESHOT,
-				timeout_callback, data, timeout_destroy) < 0) {
-		close(data->fd);
-		free(data);
-		return -EIO;
-	}
+	timeout_list[id] = data;
 
-	return data->fd;
+	return id;
 }
 
 int mainloop_modify_timeout(int id, unsigned int msec)
 {
+	struct timeout_data *data;
+
+	data = timeout_lookup(id);
+	if (!data)
+		return -EIO;
+
 	if (msec > 0) {
-		if (timeout_set(id, msec) < 0)
+		if (timeout_set(data, msec) < 0)
 			return -EIO;
 	}
 
-	if (mainloop_modify_fd(id, EPOLLIN | EPOLLONESHOT) < 0)
-		return -EIO;
-
 	return 0;
 }
 
 int mainloop_remove_timeout(int id)
 {
-	return mainloop_remove_fd(id);
+	struct timeout_data *data;
+
+	data = timeout_lookup(id);
+	if (!data)
+		return -ENXIO;
+
+	timeout_list[id] = NULL;
+	timeout_heap_remove(data);
+
+	if (data->destroy)
+		data->destroy(data->user_data);
+
+	free(data);
+
+	return 0;
 }
@@ -14,6 +14,7 @@
 
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
@@ -344,20 +345,21 @@ bool bt_uhid_unregister_all(struct bt_uhid *uhid)
 	return true;
 }
 
-static int uhid_send(struct bt_uhid *uhid, const struct uhid_event *ev)
+static int uhid_send(struct bt_uhid *uhid, const struct uhid_event *ev,
+								size_t size)
 {
 	ssize_t len;
 	struct iovec iov;
 
 	iov.iov_base = (void *) ev;
-	iov.iov_len = sizeof(*ev);
+	iov.iov_len = size;
 
 	len = io_send(uhid->io, &iov, 1);
 	if (len < 0)
 		return -errno;
 
 	/* uHID kernel driver does not handle partial writes */
-	return len != sizeof(*ev) ? -EIO : 0;
+	return len != (ssize_t) size ? -EIO : 0;
 }
 
 int bt_uhid_send(struct bt_uhid *uhid, const struct uhid_event *ev)
@@ -368,7 +370,7 @@ int bt_uhid_send(struct bt_uhid *uhid, const struct uhid_event *ev)
 	if (!uhid->io)
 		return -ENOTCONN;
 
-	return uhid_send(uhid, ev);
+	return uhid_send(uhid, ev, sizeof(*ev));
 }
 
 static bool input_dequeue(const void *data, const void *match_data)
@@ -483,16 +485,32 @@ int bt_uhid_input(struct bt_uhid *uhid, uint8_t number, const void *data,
 	if (data && size)
 		memcpy(&req->data[len], data, req->size - len);
 
+	return bt_uhid_send_input(uhid, &ev);
+}
+
+/* Send an UHID_INPUT2 event prepared by the caller, e.g. in a preallocated
+ * buffer, writing only the part of the data in use.
+ */
+int bt_uhid_send_input(struct bt_uhid *uhid, const struct uhid_event *ev)
+{
+	if (!uhid || !ev || ev->type != UHID_INPUT2)
+		return -EINVAL;
+
 	/* Queue events if UHID_START has not been received yet */
 	if (!uhid->started) {
 		if (!uhid->input)
 			uhid->input = queue_new();
 
-		queue_push_tail(uhid->input, util_memdup(&ev, sizeof(ev)));
+		queue_push_tail(uhid->input, util_memdup(ev, sizeof(*ev)));
 		return 0;
 	}
 
-	return bt_uhid_send(uhid, &ev);
+	if (!uhid->io)
+		return -ENOTCONN;
+
+	/* The kernel zeroes whatever is past the end of a short event */
+	return uhid_send(uhid, ev, offsetof(struct uhid_event, u.input2.data) +
+							ev->u.input2.size);
 }
 
 int bt_uhid_set_report_reply(struct bt_uhid *uhid, uint8_t id, uint8_t status)
@@ -44,7 +44,19 @@ struct monitor_hdr {
 	uint16_t len;
 } __attribute__ ((packed));
 
+/* Upper bound for how long logged packets stay in the write buffer */
+#define FLUSH_INTERVAL 1000
+
 static struct btsnoop *btsnoop_file = NULL;
+static int flush_id = 0;
+
+static void flush_callback(int id, void *user_data)
+{
+	mainloop_remove_timeout(id);
+	flush_id = 0;
+
+	btsnoop_flush(btsnoop_file);
+}
 
 static void data_callback(int fd, uint32_t events, void *user_data)
 {
@@ -101,6 +113,10 @@ static void data_callback(int fd, uint32_t events, void *user_data)
 
 		btsnoop_write_hci(btsnoop_file, tv, index, opcode, 0, buf,
 									pktlen);
+
+		if (!flush_id)
+			flush_id = mainloop_add_timeout(FLUSH_INTERVAL,
+						flush_callback, NULL, NULL);
 	}
 }
 
@@ -26,6 +26,7 @@
 #include <stdio.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
 
 #include <ell/ell.h>
@@ -42,6 +43,11 @@
 #define RMT_PROV_CLI_MODEL 0x0005
 #define PVT_BEACON_SRV_MODEL 0x0008
 #define DEFAULT_IV_INDEX 0x0000
+#define THROUGHPUT_MSGS	50
+#define SUB_GROUP_ADDR	0xc000
+#define CONFIG_WRITE_MSGS	100
+#define CONFIG_WRITE_POLLS	50
+#define SRV_ATTACH_TRIES	50
 
 #define IS_CONFIG_MODEL(x) (((x) == (CFG_SRV_MODEL)) ||		\
 				((x) == (CFG_CLI_MODEL)) ||		\
@@ -61,7 +67,7 @@ struct meshcfg_app {
 	const char *agent_path;
 	struct meshcfg_node *node;
 	uint8_t num_ele;
-	struct meshcfg_el ele[2];
+	struct meshcfg_el ele[3];
 	uint16_t cid;
 	uint16_t pid;
 	uint16_t vid;
@@ -123,6 +129,11 @@ static struct l_queue *startup_chain;
 static struct l_dbus *dbus;
 struct l_dbus_client *client;
 
+static struct l_dbus *srv_dbus;
+static void (*srv_attached)(bool success);
+static unsigned int srv_attach_tries;
+static struct l_timeout *srv_retry;
+
 static struct l_queue *node_proxies;
 static struct l_dbus_proxy *net_proxy;
 static char *test_dir;
@@ -139,6 +150,7 @@ static const char *const srv_app_path = "/mesh/cfgtest/server";
 static const char *const srv_agent_path = "/mesh/cfgtest/server/agent";
 static const char *const srv_ele_path_00 = "/mesh/cfgtest/server/ele0";
 static const char *const srv_ele_path_01 = "/mesh/cfgtest/server/ele1";
+static const char *const srv_ele_path_02 = "/mesh/cfgtest/server/ele2";
 
 static struct meshcfg_app client_app = {
 	.path = cli_app_path,
@@ -183,6 +195,14 @@ static struct meshcfg_app server_app = {
 			.location = 0x0002,
 			.mods = {0x1000, 0xffff, 0xffff, 0xffff},
 			.vmods = {0x5F10001, 0xffffffff}
+		},
+		/* Only exposed once the composition is changed */
+		{
+			.path = srv_ele_path_02,
+			.index = PRIMARY_ELE_IDX + 2,
+			.location = 0x0003,
+			.mods = {0x1002, 0xffff, 0xffff, 0xffff},
+			.vmods = {0xffffffff, 0xffffffff}
 		}
 	}
 };
@@ -207,7 +227,7 @@ static struct startup_entry init_import_server = {
 static void attach_node(const void *data);
 static struct startup_entry init_attach_client = {
 	.func = attach_node,
-	.data = NULL,
+	.data = &client_app,
 };
 
 static void import_subnet(const void *data);
@@ -365,6 +385,142 @@ static struct msg_data test_dev_comp_req = {
 	.data = {0x80, 0x08, 0x00}
 };
 
+struct app_msg {
+	uint16_t dst;
+	struct msg_data *msg;
+};
+
+/*
+ * Back to back maximum length messages from the client to the server's
+ * second element, each one sent in 32 segments
+ */
+static struct exp_rsp test_throughput_expected = {
+	.test_id = 6,
+	.rsp = NULL
+};
+
+static struct msg_data throughput_msg = {
+	.len = MAX_MSG_LEN,
+	.data = { 0xC1, 0xF1, 0x05 }
+};
+
+static struct app_msg throughput_send = {
+	.dst = 0x0BCE,
+	.msg = &throughput_msg
+};
+
+static bool throughput_rcvd[THROUGHPUT_MSGS];
+static unsigned int throughput_count;
+static uint64_t throughput_start;
+
+static struct msg_data test_sub_add_req = {
+	.len = 8,
+	.data = { 0x80, 0x1B, 0xCE, 0x0B, 0x00, 0xC0, 0x00, 0x10}
+};
+
+static struct msg_data test_sub_del_req = {
+	.len = 8,
+	.data = { 0x80, 0x1C, 0xCE, 0x0B, 0x00, 0xC0, 0x00, 0x10}
+};
+
+static struct msg_data test_sub_rsp = {
+	.len = 9,
+	.data = { 0x80, 0x1F, 0x00, 0xCE, 0x0B, 0x00, 0xC0, 0x00, 0x10}
+};
+
+/* Generic OnOff Get */
+static struct msg_data test_group_msg = {
+	.len = 2,
+	.data = { 0x82, 0x01}
+};
+
+static struct app_msg test_group_send = {
+	.dst = SUB_GROUP_ADDR,
+	.msg = &test_group_msg
+};
+
+struct sub_step {
+	struct msg_data *req;
+	struct msg_data *rsp;
+	bool group;
+	bool delivered;
+	bool reattach;
+};
+
+struct sub_test {
+	const struct sub_step *steps;
+	unsigned int num_steps;
+};
+
+/*
+ * Subscribe the server's Generic OnOff Server to a group, send to the
+ * group, unsubscribe and send again, which must not be delivered anymore
+ */
+static const struct sub_step sub_steps[] = {
+	{ .req = &test_bind_req, .rsp = &test_bind_rsp },
+	{ .req = &test_sub_add_req, .rsp = &test_sub_rsp },
+	{ .req = &test_group_msg, .group = true, .delivered = true },
+	{ .req = &test_sub_del_req, .rsp = &test_sub_rsp },
+	{ .req = &test_group_msg, .group = true, .delivered = false },
+};
+
+static const struct sub_test test_sub_dispatch = {
+	.steps = sub_steps,
+	.num_steps = L_ARRAY_SIZE(sub_steps)
+};
+
+/*
+ * Deliver to the group, then re-attach the server with an extra element,
+ * which replaces its secondary element and drops the subscription. The
+ * group must no longer be delivered until the new model subscribes.
+ */
+static const struct sub_step comp_change_steps[] = {
+	{ .req = &test_bind_req, .rsp = &test_bind_rsp },
+	{ .req = &test_sub_add_req, .rsp = &test_sub_rsp },
+	{ .req = &test_group_msg, .group = true, .delivered = true },
+	{ .reattach = true },
+	{ .req = &test_group_msg, .group = true, .delivered = false },
+	{ .req = &test_bind_req, .rsp = &test_bind_rsp },
+	{ .req = &test_sub_add_req, .rsp = &test_sub_rsp },
+	{ .req = &test_group_msg, .group = true, .delivered = true },
+	{ .req = &test_sub_del_req, .rsp = &test_sub_rsp },
+};
+
+static const struct sub_test test_comp_change = {
+	.steps = comp_change_steps,
+	.num_steps = L_ARRAY_SIZE(comp_change_steps)
+};
+
+static struct exp_rsp test_sub_dispatch_expected = {
+	.test_id = 7,
+	.rsp = NULL
+};
+
+static const struct sub_test *sub_test;
+static unsigned int sub_step;
+static struct l_timeout *sub_timeout;
+
+/*
+ * Back to back Default TTL Sets, each one changing the server's stored
+ * configuration, which must be written out a lot less often than that
+ */
+static struct exp_rsp test_config_write_expected = {
+	.test_id = 8,
+	.rsp = NULL
+};
+
+static struct msg_data config_write_req = {
+	.len = 3,
+	.data = { 0x80, 0x0D, 0x00}
+};
+
+static unsigned int config_write_rcvd;
+static unsigned int config_write_polls;
+static unsigned int config_writes;
+static struct l_io *config_write_io;
+static uint64_t config_write_start;
+static uint8_t config_write_ttl;
+
 static void append_byte_array(struct l_dbus_message_builder *builder,
 					unsigned char *data, unsigned int len)
 {
@@ -484,6 +640,371 @@ static void send_cfg_msg(const void *data)
 							(void *) data, NULL);
 }
 
+static void send_app_msg_setup(struct l_dbus_message *msg, void *user_data)
+{
+	struct app_msg *req = user_data;
+	struct l_dbus_message_builder *builder;
+
+	builder = l_dbus_message_builder_new(msg);
+
+	l_dbus_message_builder_append_basic(builder, 'o',
+							common_route.ele_path);
+	l_dbus_message_builder_append_basic(builder, 'q', &req->dst);
+	l_dbus_message_builder_append_basic(builder, 'q',
+						&init_add_appkey_req.idx);
+
+	/* Options */
+	l_dbus_message_builder_enter_array(builder, "{sv}");
+	l_dbus_message_builder_enter_dict(builder, "sv");
+	l_dbus_message_builder_leave_dict(builder);
+	l_dbus_message_builder_leave_array(builder);
+
+	/* Data */
+	append_byte_array(builder, req->msg->data, req->msg->len);
+	l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+}
+
+static void send_app_msg(const struct app_msg *data)
+{
+	struct meshcfg_node *node = client_app.node;
+
+	l_dbus_proxy_method_call(node->proxy, "Send", send_app_msg_setup,
+					generic_reply, (void *) data, NULL);
+}
+
+static void sub_not_delivered(struct l_timeout *timeout, void *user_data);
+static void reattach_server(void);
+
+static void run_sub_step(void *user_data)
+{
+	const struct sub_step *step = &sub_test->steps[sub_step];
+
+	if (step->reattach) {
+		reattach_server();
+		return;
+	}
+
+	if (!step->group) {
+		send_cfg_msg(step->req);
+		return;
+	}
+
+	send_app_msg(&test_group_send);
+
+	if (!step->delivered)
+		sub_timeout = l_timeout_create(1, sub_not_delivered, NULL,
+									NULL);
+}
+
+static void next_sub_step(void)
+{
+	if (++sub_step < sub_test->num_steps)
+		l_idle_oneshot(run_sub_step, NULL, NULL);
+	else
+		l_idle_oneshot(test_success, NULL, NULL);
+}
+
+static void sub_not_delivered(struct l_timeout *timeout, void *user_data)
+{
+	l_timeout_remove(sub_timeout);
+	sub_timeout = NULL;
+
+	next_sub_step();
+}
+
+static void start_sub_dispatch(const void *data)
+{
+	sub_test = data;
+	sub_step = 0;
+	run_sub_step(NULL);
+}
+
+static void sub_dispatch_rsp(uint32_t len, uint8_t *data)
+{
+	const struct sub_step *step = &sub_test->steps[sub_step];
+
+	if (!step->rsp || len != step->rsp->len ||
+					memcmp(data, step->rsp->data, len)) {
+		l_idle_oneshot(test_fail, NULL, NULL);
+		return;
+	}
+
+	next_sub_step();
+}
+
+static void sub_dispatch_rcvd(uint16_t dst, uint32_t len, uint8_t *data)
+{
+	const struct sub_step *step = &sub_test->steps[sub_step];
+
+	if (!step->group || !step->delivered || dst != SUB_GROUP_ADDR ||
+			len != step->req->len ||
+			memcmp(data, step->req->data, len)) {
+		l_timeout_remove(sub_timeout);
+		sub_timeout = NULL;
+		l_idle_oneshot(test_fail, NULL, NULL);
+		return;
+	}
+
+	next_sub_step();
+}
+
+static char *node_config_dir(const uint8_t uuid[16])
+{
+	char *hex, *dir;
+
+	hex = l_util_hexstring(uuid, 16);
+	dir = l_strdup_printf("%s/%s", test_dir, hex);
+	l_free(hex);
+
+	return dir;
+}
+
+/* Each write of node.json ends with a tmp file being renamed over it */
+static void count_config_writes(void)
+{
+	char buf[4096]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *event;
+	ssize_t len;
+	char *ptr;
+
+	while ((len = read(l_io_get_fd(config_write_io), buf,
+							sizeof(buf))) > 0) {
+		for (ptr = buf; ptr < buf + len;
+				ptr += sizeof(*event) + event->len) {
+			event = (const struct inotify_event *) ptr;
+
+			if (event->len && !strcmp(event->name, "node.json"))
+				config_writes++;
+		}
+	}
+}
+
+static bool config_write_event(struct l_io *io, void *user_data)
+{
+	count_config_writes();
+
+	return true;
+}
+
+static bool watch_config_writes(void)
+{
+	char *dir;
+	int fd, wd;
+
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	dir = node_config_dir(server_app.uuid);
+	wd = inotify_add_watch(fd, dir, IN_MOVED_TO);
+	l_free(dir);
+
+	if (wd < 0) {
+		close(fd);
+		return false;
+	}
+
+	config_writes = 0;
+	config_write_io = l_io_new(fd);
+	l_io_set_close_on_destroy(config_write_io, true);
+	l_io_set_read_handler(config_write_io, config_write_event, NULL,
+									NULL);
+
+	return true;
+}
+
+static void start_config_write(const void *data)
+{
+	unsigned int i;
+
+	if (!watch_config_writes()) {
+		l_error("Failed to watch the server configuration");
+		l_idle_oneshot(test_fail, NULL, NULL);
+		return;
+	}
+
+	config_write_rcvd = 0;
+	config_write_polls = 0;
+	config_write_start = l_time_now();
+
+	/* Valid TTLs are 0 and 2 to 127 */
+	for (i = 0; i < CONFIG_WRITE_MSGS; i++) {
+		config_write_ttl = 2 + i % 126;
+		config_write_req.data[2] = config_write_ttl;
+		send_cfg_msg(&config_write_req);
+	}
+}
+
+static char *read_node_config(const uint8_t uuid[16])
+{
+	char *dir, *fname, *str = NULL;
+	FILE *fp;
+	long len;
+
+	dir = node_config_dir(uuid);
+	fname = l_strdup_printf("%s/node.json", dir);
+	l_free(dir);
+
+	fp = fopen(fname, "r");
+	l_free(fname);
+
+	if (!fp)
+		return NULL;
+
+	if (fseek(fp, 0, SEEK_END) || (len = ftell(fp)) < 0 ||
+						fseek(fp, 0, SEEK_SET))
+		goto done;
+
+	str = l_malloc(len + 1);
+
+	if (fread(str, 1, len, fp) != (size_t) len) {
+		l_free(str);
+		str = NULL;
+		goto done;
+	}
+
+	str[len] = '\0';
+
+done:
+	fclose(fp);
+	return str;
+}
+
+/* The last change reaches node.json once the pending write has run */
+static void check_config_written(struct l_timeout *timeout, void *user_data)
+{
+	char *str, *expected;
+	uint64_t ms;
+	bool found;
+
+	str = read_node_config(server_app.uuid);
+	expected = l_strdup_printf("\"defaultTTL\":%u", config_write_ttl);
+	found = str && strstr(str, expected);
+	l_free(expected);
+	l_free(str);
+
+	if (!found && ++config_write_polls < CONFIG_WRITE_POLLS) {
+		l_timeout_modify_ms(timeout, 100);
+		return;
+	}
+
+	l_timeout_remove(timeout);
+
+	count_config_writes();
+	l_io_destroy(config_write_io);
+	config_write_io = NULL;
+
+	if (!found) {
+		l_error("Default TTL %u not stored", config_write_ttl);
+		l_idle_oneshot(test_fail, NULL, NULL);
+		return;
+	}
+
+	ms = (l_time_now() - config_write_start) / 1000;
+	l_info("%u configuration changes stored in %u ms with %u writes",
+				config_write_rcvd, (unsigned int) ms,
+				config_writes);
+
+	if (config_writes >= CONFIG_WRITE_MSGS / 2) {
+		l_error("Configuration changes not coalesced");
+		l_idle_oneshot(test_fail, NULL, NULL);
+		return;
+	}
+
+	l_idle_oneshot(test_success, NULL, NULL);
+}
+
+static void config_write_rsp(uint32_t len, uint8_t *data)
+{
+	/* Default TTL Status */
+	if (len != 3 || data[0] != 0x80 || data[1] != 0x0E) {
+		l_io_destroy(config_write_io);
+		config_write_io = NULL;
+		l_idle_oneshot(test_fail, NULL, NULL);
+		return;
+	}
+
+	if (++config_write_rcvd < CONFIG_WRITE_MSGS)
+		return;
+
+	l_timeout_create_ms(0, check_config_written, NULL, NULL);
+}
+
+static void send_throughput_msgs(void *user_data)
+{
+	unsigned int i, j;
+
+	memset(throughput_rcvd, 0, sizeof(throughput_rcvd));
+	throughput_count = 0;
+	throughput_start = l_time_now();
+
+	/* The message is built right away, so the buffer can be reused */
+	for (i = 0; i < THROUGHPUT_MSGS; i++) {
+		throughput_msg.data[3] = i;
+
+		for (j = 4; j < throughput_msg.len; j++)
+			throughput_msg.data[j] = i + j;
+
+		send_app_msg(&throughput_send);
+	}
+}
+
+/* Bind the receiving model first, then send everything at once */
+static void start_throughput(const void *data)
+{
+	send_cfg_msg(&test_bind_req);
+}
+
+static void throughput_bind_rsp(uint32_t len, uint8_t *data)
+{
+	if (len != test_bind_rsp.len ||
+				memcmp(data, test_bind_rsp.data, len)) {
+		l_idle_oneshot(test_fail, NULL, NULL);
+		return;
+	}
+
+	l_idle_oneshot(send_throughput_msgs, NULL, NULL);
+}
+
+static void throughput_msg_rcvd(uint16_t dst, uint32_t len, uint8_t *data)
+{
+	uint64_t ms;
+	uint32_t i;
+	uint8_t seq;
+
+	if (dst != throughput_send.dst || len != throughput_msg.len ||
+			memcmp(data, throughput_msg.data, 3))
+		goto fail;
+
+	seq = data[3];
+
+	if (seq >= THROUGHPUT_MSGS || throughput_rcvd[seq])
+		goto fail;
+
+	for (i = 4; i < len; i++) {
+		if (data[i] != (uint8_t) (seq + i))
+			goto fail;
+	}
+
+	throughput_rcvd[seq] = true;
+
+	if (++throughput_count < THROUGHPUT_MSGS)
+		return;
+
+	ms = (l_time_now() - throughput_start) / 1000;
+	l_info("%u segmented messages of %u bytes in %u ms",
+				throughput_count, len, (unsigned int) ms);
+
+	l_idle_oneshot(test_success, NULL, NULL);
+	return;
+
+fail:
+	l_error("Unexpected message (len %u) to %4.4x", len, dst);
+	l_idle_oneshot(test_fail, NULL, NULL);
+}
+
 static void add_key_setup(struct l_dbus_message *msg, void *user_data)
 {
 	struct test_data *tst = user_data;
@@ -725,16 +1246,152 @@ static void attach_node_setup(struct l_dbus_message *msg, void *user_data)
 
 static void attach_node(const void *data)
 {
-	struct meshcfg_node *node = client_app.node;
+	struct meshcfg_app *app = (struct meshcfg_app *) data;
 
-	if (!node) {
+	if (!app->node) {
 		l_tester_test_abort(tester);
 		return;
 	}
 
 	l_dbus_proxy_method_call(net_proxy, "Attach",
 					attach_node_setup, attach_node_reply,
-					&client_app, NULL);
+					app, NULL);
+}
+
+static bool register_app_iface(struct l_dbus *bus);
+static bool register_app(struct l_dbus *bus, struct meshcfg_app *app);
+
+static void srv_attach(void);
+
+static void srv_attach_retry(struct l_timeout *timeout, void *user_data)
+{
+	l_timeout_remove(srv_retry);
+	srv_retry = NULL;
+
+	srv_attach();
+}
+
+static void srv_attach_reply(struct l_dbus_message *msg, void *user_data)
+{
+	struct l_dbus_message_iter iter_cfg;
+	const char *path;
+
+	if (l_dbus_message_is_error(msg)) {
+		const char *name;
+
+		l_dbus_message_get_error(msg, &name, NULL);
+
+		/* The daemon may not have seen the old connection go yet */
+		if ((!strcmp(name, ERROR_INTERFACE ".AlreadyExists") ||
+				!strcmp(name, ERROR_INTERFACE ".Busy")) &&
+					++srv_attach_tries < SRV_ATTACH_TRIES) {
+			srv_retry = l_timeout_create_ms(100, srv_attach_retry,
+								NULL, NULL);
+			return;
+		}
+
+		l_error("Failed to attach server: %s", name);
+		srv_attached(false);
+		return;
+	}
+
+	if (!l_dbus_message_get_arguments(msg, "oa(ya(qa{sv}))", &path,
+								&iter_cfg)) {
+		srv_attached(false);
+		return;
+	}
+
+	l_info("Attached server with path %s", path);
+	srv_attached(true);
+}
+
+static void srv_attach_setup(struct l_dbus_message *msg, void *user_data)
+{
+	l_dbus_message_set_arguments(msg, "ot", server_app.path,
+				l_get_be64(server_app.node->token.u8));
+}
+
+static void srv_attach(void)
+{
+	l_dbus_method_call(srv_dbus, BLUEZ_MESH_NAME, "/org/bluez/mesh",
+				MESH_NETWORK_INTERFACE, "Attach",
+				srv_attach_setup, srv_attach_reply,
+				NULL, NULL);
+}
+
+static void srv_ready(void *user_data)
+{
+	if (!l_dbus_object_manager_enable(srv_dbus, "/") ||
+					!register_app_iface(srv_dbus) ||
+					!register_app(srv_dbus, &server_app)) {
+		srv_attached(false);
+		return;
+	}
+
+	srv_attach();
+}
+
+/*
+ * The server application has its own D-Bus connection, so that dropping
+ * it detaches the node and the server can attach again as a different
+ * application.
+ */
+static void connect_server(void (*attached)(bool success))
+{
+	srv_attached = attached;
+	srv_attach_tries = 0;
+
+	srv_dbus = l_dbus_new_default(L_DBUS_SESSION_BUS);
+	l_dbus_set_ready_handler(srv_dbus, srv_ready, NULL, NULL);
+}
+
+static void disconnect_server(void)
+{
+	l_timeout_remove(srv_retry);
+	srv_retry = NULL;
+
+	l_dbus_destroy(srv_dbus);
+	srv_dbus = NULL;
+}
+
+static void attach_server_done(bool success)
+{
+	if (success)
+		l_tester_setup_complete(tester);
+	else
+		l_tester_setup_failed(tester);
+}
+
+static void attach_server(const void *data)
+{
+	if (srv_dbus) {
+		l_tester_setup_complete(tester);
+		return;
+	}
+
+	if (!server_app.node) {
+		l_tester_setup_failed(tester);
+		return;
+	}
+
+	connect_server(attach_server_done);
+}
+
+static void reattach_server_done(bool success)
+{
+	if (success)
+		next_sub_step();
+	else
+		l_idle_oneshot(test_fail, NULL, NULL);
+}
+
+/* Attach the server again, exposing one more element than before */
+static void reattach_server(void)
+{
+	disconnect_server();
+
+	server_app.num_ele = L_ARRAY_SIZE(server_app.ele);
+	connect_server(reattach_server_done);
 }
 
 static struct l_dbus_message *join_complete(struct l_dbus *dbus,
@@ -1134,6 +1791,21 @@ static struct l_dbus_message *dev_msg_recv_call(struct l_dbus *dbus,
 		struct exp_rsp *exp = l_tester_get_data(tester);
 		bool res = false;
 
+		if (exp && exp->test_id == 6) {
+			throughput_bind_rsp(n, data);
+			return l_dbus_message_new_method_return(msg);
+		}
+
+		if (exp && exp->test_id == 7) {
+			sub_dispatch_rsp(n, data);
+			return l_dbus_message_new_method_return(msg);
+		}
+
+		if (exp && exp->test_id == 8) {
+			config_write_rsp(n, data);
+			return l_dbus_message_new_method_return(msg);
+		}
+
 		if (exp && exp->rsp) {
 			if (exp->test_id == 5)
 				/* Check device composition */
@@ -1157,6 +1829,40 @@ static struct l_dbus_message *dev_msg_recv_call(struct l_dbus *dbus,
 	return l_dbus_message_new_method_return(msg);
 }
 
+static struct l_dbus_message *msg_recv_call(struct l_dbus *dbus,
+						struct l_dbus_message *msg,
+						void *user_data)
+{
+	struct l_dbus_message_iter iter, var;
+	struct exp_rsp *exp;
+	uint16_t src, idx, dst;
+	uint8_t *data;
+	uint32_t n;
+
+	if (!l_dbus_message_get_arguments(msg, "qqvay", &src, &idx, &var,
+								&iter)) {
+		l_error("Cannot parse received message");
+		return l_dbus_message_new_error(msg, dbus_err_args, NULL);
+	}
+
+	if (!l_dbus_message_iter_get_fixed_array(&iter, &data, &n)) {
+		l_error("Cannot parse received message: data");
+		return l_dbus_message_new_error(msg, dbus_err_args, NULL);
+	}
+
+	/* Virtual destinations come as a label */
+	if (!l_dbus_message_iter_get_variant(&var, "q", &dst))
+		dst = UNASSIGNED_ADDRESS;
+
+	exp = l_tester_get_data(tester);
+	if (exp && exp->test_id == 6)
+		throughput_msg_rcvd(dst, n, data);
+	else if (exp && exp->test_id == 7)
+		sub_dispatch_rcvd(dst, n, data);
+
+	return l_dbus_message_new_method_return(msg);
+}
+
 static void setup_ele_iface(struct l_dbus_interface *iface)
 {
 	/* Properties */
@@ -1172,6 +1878,9 @@ static void setup_ele_iface(struct l_dbus_interface *iface)
 	l_dbus_interface_method(iface, "DevKeyMessageReceived", 0,
 				dev_msg_recv_call, "", "qbqay", "source",
 				"remote", "net_index", "data");
+	l_dbus_interface_method(iface, "MessageReceived", 0, msg_recv_call,
+				"", "qqvay", "source", "key_index",
+				"destination", "data");
 
 	/* TODO: Other methods? */
 }
@@ -1265,16 +1974,16 @@ static void setup_app_iface(struct l_dbus_interface *iface)
 	/* TODO: Other methods? */
 }
 
-static bool register_app_iface(void)
+static bool register_app_iface(struct l_dbus *bus)
 {
-	if (!l_dbus_register_interface(dbus, MESH_APPLICATION_INTERFACE,
+	if (!l_dbus_register_interface(bus, MESH_APPLICATION_INTERFACE,
 						setup_app_iface, NULL, false)) {
 		l_error("Failed to register interface %s",
 						MESH_APPLICATION_INTERFACE);
 		return false;
 	}
 
-	if (!l_dbus_register_interface(dbus, MESH_ELEMENT_INTERFACE,
+	if (!l_dbus_register_interface(bus, MESH_ELEMENT_INTERFACE,
 						setup_ele_iface, NULL, false)) {
 		l_error("Failed to register interface %s",
 						MESH_ELEMENT_INTERFACE);
@@ -1284,11 +1993,11 @@ static bool register_app_iface(void)
 	return true;
 }
 
-static bool register_app(struct meshcfg_app *app)
+static bool register_app(struct l_dbus *bus, struct meshcfg_app *app)
 {
 	uint32_t i;
 
-	if (!l_dbus_register_object(dbus, app->path, NULL, NULL,
+	if (!l_dbus_register_object(bus, app->path, NULL, NULL,
 					MESH_APPLICATION_INTERFACE, app,
 									NULL)) {
 		l_error("Failed to register object %s", app->path);
@@ -1296,16 +2005,16 @@ static bool register_app(struct meshcfg_app *app)
 	}
 
 	for (i = 0; i < L_ARRAY_SIZE(app->ele) && i < app->num_ele; i++) {
-		if (!l_dbus_register_object(dbus, app->ele[i].path, NULL, NULL,
+		if (!l_dbus_register_object(bus, app->ele[i].path, NULL, NULL,
 				MESH_ELEMENT_INTERFACE, &app->ele[i], NULL)) {
 			l_error("Failed to register obj %s", app->ele[i].path);
-			l_dbus_unregister_interface(dbus,
+			l_dbus_unregister_interface(bus,
 							MESH_ELEMENT_INTERFACE);
 			return false;
 		}
 	}
 
-	if (!l_dbus_object_add_interface(dbus, app->path,
+	if (!l_dbus_object_add_interface(bus, app->path,
 				L_DBUS_INTERFACE_OBJECT_MANAGER, NULL)) {
 		l_error("Failed to add interface %s",
 					L_DBUS_INTERFACE_OBJECT_MANAGER);
@@ -1321,8 +2030,8 @@ static void client_ready(struct l_dbus_client *client, void *user_data)
 
 	printf("D-Bus client ready\n");
 
-	if (!register_app_iface() || !register_app(&client_app) ||
-					!register_app(&server_app))
+	if (!register_app_iface(dbus) || !register_app(dbus, &client_app) ||
+					!register_app(dbus, &server_app))
 		return;
 
 	if (stage == L_TESTER_STAGE_PRE_SETUP)
@@ -1569,6 +2278,11 @@ int main(int argc, char *argv[])
 					&test_dev_comp_req, send_cfg_msg,
 						&test_dev_comp_expected);
 
+	l_tester_add_full(tester, "Segmented Send: Throughput", NULL,
+				init_test, attach_server, start_throughput,
+				NULL, NULL, 30, &test_throughput_expected,
+				NULL);
+
 	tester_add_with_response("Config Bind: Success",
 					&test_bind_req, send_cfg_msg,
 						&test_bind_expected);
@@ -1577,6 +2291,22 @@ int main(int argc, char *argv[])
 					&test_bind_inv_mod_req, send_cfg_msg,
 						&test_bind_inv_mod_expected);
 
+	l_tester_add_full(tester, "Config Model Subscription: Group Dispatch",
+				&test_sub_dispatch, init_test, attach_server,
+				start_sub_dispatch, NULL, NULL, 10,
+				&test_sub_dispatch_expected, NULL);
+
+	l_tester_add_full(tester, "Config Default TTL Set: Coalesced Writes",
+				NULL, init_test, NULL, start_config_write,
+				NULL, NULL, 30, &test_config_write_expected,
+				NULL);
+
+	l_tester_add_full(tester,
+			"Config Model Subscription: Composition Change",
+				&test_comp_change, init_test, attach_server,
+				start_sub_dispatch, NULL, NULL, 20,
+				&test_sub_dispatch_expected, NULL);
+
 	l_tester_start(tester, done_callback);
 
 	if (!option_list && !terminated) {
@@ -1591,7 +2321,9 @@ int main(int argc, char *argv[])
 
 	l_free(client_app.node);
 	l_free(server_app.node);
+	l_io_destroy(config_write_io);
 	l_dbus_client_destroy(client);
+	disconnect_server();
 	l_dbus_destroy(dbus);
 
 	l_tester_destroy(tester);
@@ -0,0 +1,355 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <glib.h>
+
+#include "src/shared/ad.h"
+#include "src/shared/queue.h"
+#include "src/shared/util.h"
+#include "src/shared/tester.h"
+
+#define BENCH_MONITORS	64
+#define BENCH_ROUNDS	2000
+
+struct test_adv {
+	const char *name;
+	uint8_t len;
+	uint8_t data[BT_AD_MAX_DATA_LEN];
+};
+
+/* Advertising data as seen over the air from common devices */
+static const struct test_adv recorded[] = {
+	{ "ibeacon", 30, {
+		0x02, 0x01, 0x06,
+		0x1a, 0xff, 0x4c, 0x00, 0x02, 0x15,
+		0xe2, 0xc5, 0x6d, 0xb5, 0xdf, 0xfb, 0x48, 0xd2,
+		0xb0, 0x60, 0xd0, 0xf5, 0xa7, 0x10, 0x96, 0xe0,
+		0x00, 0x01, 0x00, 0x02, 0xc5 } },
+	{ "eddystone-uid", 31, {
+		0x02, 0x01, 0x06,
+		0x03, 0x03, 0xaa, 0xfe,
+		0x17, 0x16, 0xaa, 0xfe, 0x00, 0xe7,
+		0x8b, 0x6e, 0x0f, 0x8a, 0x12, 0xd4, 0xc2, 0x3b,
+		0x3a, 0x7f, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+		0x00, 0x00 } },
+	{ "eddystone-url", 20, {
+		0x02, 0x01, 0x06,
+		0x03, 0x03, 0xaa, 0xfe,
+		0x0c, 0x16, 0xaa, 0xfe, 0x10, 0xeb, 0x03, 'b',
+		'l', 'u', 'e', 'z', 0x07 } },
+	{ "exposure-notification", 28, {
+		0x02, 0x01, 0x1a,
+		0x03, 0x03, 0x6f, 0xfd,
+		0x17, 0x16, 0x6f, 0xfd, 0x5d, 0x1a, 0x0e, 0xa4,
+		0x48, 0x72, 0x36, 0xe1, 0x2b, 0x5c, 0x7f, 0x26,
+		0x9a, 0x4c, 0xf0, 0x08, 0x40, 0x00, 0x00, 0x00 } },
+	{ "swift-pair", 14, {
+		0x02, 0x01, 0x06,
+		0x0a, 0xff, 0x06, 0x00, 0x03, 0x00, 0x80, 'M',
+		'o', 'u', 's' } },
+	{ "hid-keyboard", 20, {
+		0x02, 0x01, 0x05,
+		0x03, 0x19, 0xc1, 0x03,
+		0x03, 0x03, 0x12, 0x18,
+		0x08, 0x09, 'K', 'e', 'y', 'b', 'o', 'a',
+		'r' } },
+	{ "tile", 18, {
+		0x02, 0x01, 0x06,
+		0x03, 0x02, 0xed, 0xfe,
+		0x0a, 0x16, 0xed, 0xfe, 0x02, 0x00, 0x8a, 0x31,
+		0x9c, 0x5e, 0x21 } },
+	{ "tx-power-only", 3, {
+		0x02, 0x0a, 0x08 } },
+	{ "service-data-128", 23, {
+		0x02, 0x01, 0x06,
+		0x13, 0x21, 0xfb, 0x34, 0x9b, 0x5f, 0x80, 0x00,
+		0x00, 0x80, 0x00, 0x10, 0x00, 0x00, 0x00, 0x18,
+		0x00, 0x00, 0x10, 0x00 } },
+};
+
+struct test_monitor {
+	const char *name;
+	struct bt_ad_pattern patterns[3];
+	unsigned int num_patterns;
+};
+
+static const struct test_monitor monitors[] = {
+	{ "apple-ibeacon", {
+		{ BT_AD_MANUFACTURER_DATA, 0, 4, { 0x4c, 0x00, 0x02, 0x15 } },
+		}, 1 },
+	{ "eddystone-uid", {
+		{ BT_AD_SERVICE_DATA16, 0, 1, { 0x00 } },
+		}, 1 },
+	{ "eddystone-url-or-tlm", {
+		{ BT_AD_SERVICE_DATA16, 0, 1, { 0x10 } },
+		{ BT_AD_SERVICE_DATA16, 0, 1, { 0x20 } },
+		}, 2 },
+	{ "le-only-general", {
+		{ BT_AD_FLAGS, 0, 1, { 0x06 } },
+		}, 1 },
+	{ "microsoft", {
+		{ BT_AD_MANUFACTURER_DATA, 0, 2, { 0x06, 0x00 } },
+		{ BT_AD_MANUFACTURER_DATA, 2, 2, { 0x03, 0x00 } },
+		}, 2 },
+	{ "keyboard-appearance", {
+		{ BT_AD_GAP_APPEARANCE, 0, 2, { 0xc1, 0x03 } },
+		}, 1 },
+	{ "ibeacon-major", {
+		{ BT_AD_MANUFACTURER_DATA, 20, 2, { 0x00, 0x01 } },
+		{ BT_AD_TX_POWER, 0, 1, { 0x08 } },
+		}, 2 },
+	{ "tile-any-uuid-size", {
+		{ BT_AD_SERVICE_DATA128, 0, 2, { 0x02, 0x00 } },
+		}, 1 },
+	{ "nothing", {
+		{ BT_AD_MANUFACTURER_DATA, 0, 2, { 0xff, 0xff } },
+		{ BT_AD_MESH_BEACON, 0, 1, { 0x00 } },
+		}, 2 },
+};
+
+struct match_result {
+	const void *matched[64];
+	unsigned int count;
+};
+
+static uint64_t elapsed_ns(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t) (now.tv_sec - start->tv_sec) * 1000000000ULL +
+						now.tv_nsec - start->tv_nsec;
+}
+
+static struct queue *monitor_patterns(const struct test_monitor *monitor)
+{
+	struct queue *patterns = queue_new();
+	unsigned int i;
+
+	for (i = 0; i < monitor->num_patterns; i++) {
+		const struct bt_ad_pattern *p = &monitor->patterns[i];
+
+		queue_push_tail(patterns, bt_ad_pattern_new(p->type, p->offset,
+								p->len,
+								p->data));
+	}
+
+	return patterns;
+}
+
+static void collect_match(void *data, void *user_data)
+{
+	struct match_result *result = user_data;
+
+	result->matched[result->count++] = data;
+}
+
+static void test_matcher(gconstpointer data)
+{
+	struct queue *patterns[ARRAY_SIZE(monitors)];
+	struct bt_ad_matcher *matcher;
+	unsigned int i, j;
+
+	matcher = bt_ad_matcher_new();
+	g_assert(matcher);
+
+	for (i = 0; i < ARRAY_SIZE(monitors); i++) {
+		patterns[i] = monitor_patterns(&monitors[i]);
+		g_assert(bt_ad_matcher_add(matcher, patterns[i],
+							(void *) &monitors[i]));
+	}
+
+	/* Must agree with matching each monitor against a parsed bt_ad */
+	for (i = 0; i < ARRAY_SIZE(recorded); i++) {
+		const struct test_adv *adv = &recorded[i];
+		struct match_result result = { .count = 0 };
+		unsigned int count = 0;
+		struct bt_ad *ad;
+
+		ad = bt_ad_new_with_data(adv->len, adv->data);
+		g_assert(ad);
+
+		g_assert_cmpint(bt_ad_matcher_match(matcher, adv->data,
+						adv->len, collect_match,
+						&result), ==, result.count);
+
+		for (j = 0; j < ARRAY_SIZE(monitors); j++) {
+			if (!bt_ad_pattern_match(ad, patterns[j]))
+				continue;
+
+			g_assert(count < result.count);
+			g_assert(result.matched[count] == &monitors[j]);
+			count++;
+		}
+
+		g_assert_cmpuint(count, ==, result.count);
+
+		tester_debug("%s: %u monitor(s) matched", adv->name, count);
+
+		bt_ad_unref(ad);
+	}
+
+	bt_ad_matcher_free(matcher);
+
+	for (i = 0; i < ARRAY_SIZE(monitors); i++)
+		queue_destroy(patterns[i], free);
+
+	tester_test_passed();
+}
+
+static void test_matcher_raw(gconstpointer data)
+{
+	const struct bt_ad_pattern name = { BT_AD_NAME_COMPLETE, 0, 3,
+							{ 'K', 'e', 'y' } };
+	const struct bt_ad_pattern uuid = { BT_AD_UUID16_ALL, 0, 2,
+							{ 0x12, 0x18 } };
+	const struct bt_ad_pattern svc = { BT_AD_SERVICE_DATA32, 0, 1,
+							{ 0x10 } };
+	const uint8_t invalid[] = { 0x02, 0x01, 0x06, 0x02, 0x40, 0x00 };
+	const uint8_t truncated[] = { 0x02, 0x01, 0x06, 0x08, 0x09, 'K' };
+	const struct test_adv *keyboard = &recorded[5];
+	const struct test_adv *url = &recorded[2];
+	const struct test_adv *svc128 = &recorded[8];
+	const struct bt_ad_pattern *raw[] = { &name, &uuid, &svc };
+	struct bt_ad_matcher *matcher;
+	struct queue *patterns[ARRAY_SIZE(raw)];
+	unsigned int i;
+
+	matcher = bt_ad_matcher_new();
+
+	for (i = 0; i < ARRAY_SIZE(raw); i++) {
+		patterns[i] = queue_new();
+		queue_push_tail(patterns[i],
+				util_memdup(raw[i], sizeof(*raw[i])));
+		bt_ad_matcher_add(matcher, patterns[i], patterns[i]);
+	}
+
+	/* Names and UUID lists are matched on the raw element data */
+	g_assert_cmpint(bt_ad_matcher_match(matcher, keyboard->data,
+					keyboard->len, NULL, NULL), ==, 2);
+
+	/*
+	 * Service data patterns match service data of any UUID size, as
+	 * bt_ad_pattern_match() does.
+	 */
+	g_assert_cmpint(bt_ad_matcher_match(matcher, url->data,
+					url->len, NULL, NULL), ==, 1);
+	g_assert_cmpint(bt_ad_matcher_match(matcher, svc128->data,
+					svc128->len, NULL, NULL), ==, 1);
+
+	/* Invalid AD types reject the whole advertisement */
+	g_assert(!bt_ad_new_with_data(sizeof(invalid), invalid));
+	g_assert_cmpint(bt_ad_matcher_match(matcher, invalid,
+				sizeof(invalid), NULL, NULL), ==, -EINVAL);
+
+	/* An element overflowing the data ends it */
+	g_assert_cmpint(bt_ad_matcher_match(matcher, truncated,
+					sizeof(truncated), NULL, NULL), ==, 0);
+
+	bt_ad_matcher_free(matcher);
+
+	for (i = 0; i < ARRAY_SIZE(raw); i++)
+		queue_destroy(patterns[i], free);
+
+	tester_test_passed();
+}
+
+static void test_matcher_bench(gconstpointer data)
+{
+	struct queue *patterns[BENCH_MONITORS];
+	struct bt_ad_matcher *matcher;
+	struct timespec start;
+	uint64_t parsed, compiled;
+	unsigned int i, j, parsed_hits = 0, compiled_hits = 0;
+
+	matcher = bt_ad_matcher_new();
+
+	/*
+	 * Spread the monitors over a handful of company identifiers and
+	 * service data prefixes, with one in eight being the real ones.
+	 */
+	for (i = 0; i < BENCH_MONITORS; i++) {
+		struct test_monitor monitor;
+
+		monitor = monitors[i % ARRAY_SIZE(monitors)];
+
+		if (i >= ARRAY_SIZE(monitors))
+			monitor.patterns[0].data[0] ^= i;
+
+		patterns[i] = monitor_patterns(&monitor);
+		bt_ad_matcher_add(matcher, patterns[i], patterns[i]);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		const struct test_adv *adv;
+		struct bt_ad *ad;
+
+		adv = &recorded[i % ARRAY_SIZE(recorded)];
+
+		ad = bt_ad_new_with_data(adv->len, adv->data);
+
+		for (j = 0; j < BENCH_MONITORS; j++) {
+			if (bt_ad_pattern_match(ad, patterns[j]))
+				parsed_hits++;
+		}
+
+		bt_ad_unref(ad);
+	}
+
+	parsed = elapsed_ns(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		const struct test_adv *adv;
+
+		adv = &recorded[i % ARRAY_SIZE(recorded)];
+
+		compiled_hits += bt_ad_matcher_match(matcher, adv->data,
+							adv->len, NULL, NULL);
+	}
+
+	compiled = elapsed_ns(&start);
+
+	g_assert_cmpuint(parsed_hits, ==, compiled_hits);
+
+	tester_debug("%u monitors: bt_ad %" PRIu64 " ns/adv, "
+			"matcher %" PRIu64 " ns/adv", BENCH_MONITORS,
+			parsed / BENCH_ROUNDS, compiled / BENCH_ROUNDS);
+
+	bt_ad_matcher_free(matcher);
+
+	for (i = 0; i < BENCH_MONITORS; i++)
+		queue_destroy(patterns[i], free);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/ad/matcher", NULL, NULL, test_matcher, NULL);
+	tester_add("/ad/matcher/raw", NULL, NULL, test_matcher_raw, NULL);
+	tester_add("/ad/matcher/bench", NULL, NULL, test_matcher_bench, NULL);
+
+	return tester_run();
+}
@@ -17,6 +17,8 @@
 #include "src/shared/tester.h"
 
 #include <string.h>
+#include <inttypes.h>
+#include <time.h>
 #include <glib.h>
 
 static struct bt_crypto *crypto;
@@ -383,6 +385,127 @@ static void test_sih(const void *data)
 	tester_test_passed();
 }
 
+#define THROUGHPUT_ROUNDS 10000
+
+static uint64_t elapsed_ns(const struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start->tv_sec) * 1000000000ULL +
+					end.tv_nsec - start->tv_nsec;
+}
+
+static void test_throughput(gconstpointer data)
+{
+	const uint8_t k[16] = {
+			0x9b, 0x7d, 0x39, 0x0a, 0xa6, 0x10, 0x10, 0x34,
+			0x05, 0xad, 0xc8, 0x57, 0xa3, 0x34, 0x02, 0xec };
+	const uint8_t r[3] = { 0x94, 0x81, 0x70 };
+	uint8_t m[64] = {}, block[16] = {}, hash[3], first[3];
+	uint8_t sign[12];
+	struct timespec start;
+	unsigned int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < THROUGHPUT_ROUNDS; i++) {
+		if (!bt_crypto_e(crypto, k, block, block)) {
+			tester_test_failed();
+			return;
+		}
+	}
+
+	tester_debug("e: %" PRIu64 " ns/op",
+				elapsed_ns(&start) / THROUGHPUT_ROUNDS);
+
+	bt_crypto_ah(crypto, k, r, first);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < THROUGHPUT_ROUNDS; i++) {
+		if (!bt_crypto_ah(crypto, k, r, hash) ||
+						memcmp(hash, first, 3)) {
+			tester_test_failed();
+			return;
+		}
+	}
+
+	tester_debug("ah: %" PRIu64 " ns/op",
+				elapsed_ns(&start) / THROUGHPUT_ROUNDS);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < THROUGHPUT_ROUNDS; i++) {
+		if (!bt_crypto_sign_att(crypto, k, m, sizeof(m), i, sign)) {
+			tester_test_failed();
+			return;
+		}
+	}
+
+	tester_debug("sign_att (%zu bytes): %" PRIu64 " ns/op", sizeof(m),
+				elapsed_ns(&start) / THROUGHPUT_ROUNDS);
+
+	tester_test_passed();
+}
+
+#define RESOLVER_IRKS 500
+
+static void test_resolver(gconstpointer data)
+{
+	struct bt_crypto_resolver *resolver;
+	uint8_t irks[RESOLVER_IRKS][16];
+	uint8_t rpa[6] = { 0x00, 0x00, 0x00, 0x12, 0x34, 0x56 };
+	uint8_t unknown[6] = { 0x00, 0x00, 0x00, 0x65, 0x43, 0x61 };
+	struct timespec start;
+	uint64_t lookup, cached;
+	unsigned int i, hits, misses;
+	void *user_data;
+
+	resolver = bt_crypto_resolver_new(crypto, 64, 60);
+	g_assert(resolver);
+
+	for (i = 0; i < RESOLVER_IRKS; i++) {
+		memset(irks[i], i & 0xff, 16);
+		put_le16(i, irks[i]);
+		g_assert(bt_crypto_resolver_add(resolver, irks[i],
+							UINT_TO_PTR(i + 1)));
+	}
+
+	/* Make rpa resolve with the second to last IRK */
+	bt_crypto_ah(crypto, irks[RESOLVER_IRKS - 2], rpa + 3, rpa);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	g_assert(bt_crypto_resolver_resolve(resolver, rpa, &user_data));
+	lookup = elapsed_ns(&start);
+
+	g_assert(PTR_TO_UINT(user_data) == RESOLVER_IRKS - 1);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	g_assert(bt_crypto_resolver_resolve(resolver, rpa, &user_data));
+	cached = elapsed_ns(&start);
+
+	g_assert(PTR_TO_UINT(user_data) == RESOLVER_IRKS - 1);
+
+	tester_debug("%u IRKs: lookup %" PRIu64 " ns, cached %" PRIu64 " ns",
+					RESOLVER_IRKS, lookup, cached);
+
+	g_assert(!bt_crypto_resolver_resolve(resolver, unknown, NULL));
+	g_assert(!bt_crypto_resolver_resolve(resolver, unknown, NULL));
+
+	bt_crypto_resolver_get_stats(resolver, &hits, &misses);
+	g_assert_cmpint(hits, ==, 2);
+	g_assert_cmpint(misses, ==, 2);
+
+	g_assert(bt_crypto_resolver_remove(resolver, irks[RESOLVER_IRKS - 2]));
+	g_assert(!bt_crypto_resolver_resolve(resolver, rpa, NULL));
+
+	bt_crypto_resolver_free(resolver);
+
+	tester_test_passed();
+}
+
 int main(int argc, char *argv[])
 {
 	int exit_status;
@@ -411,6 +534,8 @@ int main(int argc, char *argv[])
 						NULL, test_verify_sign, NULL);
 	tester_add("/crypto/sef", NULL, NULL, test_sef, NULL);
 	tester_add("/crypto/sih", NULL, NULL, test_sih, NULL);
+	tester_add("/crypto/throughput", NULL, NULL, test_throughput, NULL);
+	tester_add("/crypto/resolver", NULL, NULL, test_resolver, NULL);
 
 	exit_status = tester_run();
 
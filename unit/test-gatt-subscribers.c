@@ -0,0 +1,234 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/tester.h"
+#include "src/gatt-subscribers.h"
+
+#define NUM_CCCS		20
+#define FIRST_CCC		0x0010
+#define NOTIFY_ROUNDS		100
+
+/* Stand-ins for the device and CCC states of src/gatt-database.c */
+struct central {
+	struct queue *ccc_states;
+};
+
+struct ccc_state {
+	struct central *central;
+	uint16_t handle;
+	uint16_t value;
+};
+
+struct fanout_test {
+	struct queue *centrals;
+	struct gatt_subscribers *subs;
+	unsigned int subscribed;
+	unsigned int delivered;
+	uint16_t handle;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void test_basic(const void *data)
+{
+	struct gatt_subscribers *subs;
+	int a, b, c;
+
+	subs = gatt_subscribers_new();
+	g_assert(subs != NULL);
+
+	g_assert(gatt_subscribers_count(subs, 0x0003) == 0);
+
+	gatt_subscribers_add(subs, 0x0003, &a);
+	gatt_subscribers_add(subs, 0x0003, &b);
+	gatt_subscribers_add(subs, 0x0010, &c);
+	gatt_subscribers_add(subs, 0x0020, &a);
+
+	g_assert(gatt_subscribers_count(subs, 0x0003) == 2);
+	g_assert(gatt_subscribers_count(subs, 0x0010) == 1);
+	g_assert(gatt_subscribers_count(subs, 0x0020) == 1);
+
+	gatt_subscribers_remove(subs, 0x0003, &a);
+	g_assert(gatt_subscribers_count(subs, 0x0003) == 1);
+
+	/* Removing what is not there leaves the sets alone */
+	gatt_subscribers_remove(subs, 0x0003, &c);
+	gatt_subscribers_remove(subs, 0x0004, &c);
+	g_assert(gatt_subscribers_count(subs, 0x0003) == 1);
+
+	/* A service spanning 0x0010-0x001f goes away */
+	gatt_subscribers_remove_range(subs, 0x0010, 0x001f);
+	g_assert(gatt_subscribers_count(subs, 0x0003) == 1);
+	g_assert(gatt_subscribers_count(subs, 0x0010) == 0);
+	g_assert(gatt_subscribers_count(subs, 0x0020) == 1);
+
+	gatt_subscribers_free(subs);
+	tester_test_passed();
+}
+
+static void notify_ccc(struct ccc_state *ccc, struct fanout_test *test)
+{
+	g_assert(ccc->handle == test->handle);
+	g_assert(ccc->value & 0x0003);
+
+	test->delivered++;
+}
+
+static bool ccc_state_match(const void *a, const void *b)
+{
+	const struct ccc_state *ccc = a;
+	uint16_t handle = PTR_TO_UINT(b);
+
+	return ccc->handle == handle;
+}
+
+/* What notifying all devices cost before there was a subscriber index */
+static void notify_central(void *data, void *user_data)
+{
+	struct central *central = data;
+	struct fanout_test *test = user_data;
+	struct ccc_state *ccc;
+
+	ccc = queue_find(central->ccc_states, ccc_state_match,
+						UINT_TO_PTR(test->handle));
+	if (!ccc || !(ccc->value & 0x0003))
+		return;
+
+	notify_ccc(ccc, test);
+}
+
+static void notify_subscriber(void *data, void *user_data)
+{
+	notify_ccc(data, user_data);
+}
+
+static void central_free(void *data)
+{
+	struct central *central = data;
+
+	queue_destroy(central->ccc_states, g_free);
+	g_free(central);
+}
+
+static uint64_t fanout_run(struct fanout_test *test, bool indexed)
+{
+	uint64_t start;
+	unsigned int round, i;
+
+	test->delivered = 0;
+
+	start = now_ns();
+
+	for (round = 0; round < NOTIFY_ROUNDS; round++) {
+		for (i = 0; i < NUM_CCCS; i++) {
+			test->handle = FIRST_CCC + i * 3;
+
+			if (indexed)
+				gatt_subscribers_foreach(test->subs,
+						test->handle,
+						notify_subscriber, test);
+			else
+				queue_foreach(test->centrals, notify_central,
+									test);
+		}
+	}
+
+	return now_ns() - start;
+}
+
+/*
+ * Hundreds of connected centrals each have a CCC state for every CCC of
+ * the database, and about one in four has notifications enabled on it.
+ * Each value change is delivered to exactly the subscribed centrals, with
+ * and without going through the index.
+ */
+static void test_fanout(const void *data)
+{
+	unsigned int num_centrals = PTR_TO_UINT(data);
+	struct fanout_test test = {};
+	uint64_t scan_ns, index_ns;
+	uint32_t seed = 1;
+	unsigned int i, j;
+
+	test.centrals = queue_new();
+	test.subs = gatt_subscribers_new();
+
+	for (i = 0; i < num_centrals; i++) {
+		struct central *central = g_new0(struct central, 1);
+
+		central->ccc_states = queue_new();
+		queue_push_tail(test.centrals, central);
+
+		for (j = 0; j < NUM_CCCS; j++) {
+			struct ccc_state *ccc = g_new0(struct ccc_state, 1);
+
+			ccc->central = central;
+			ccc->handle = FIRST_CCC + j * 3;
+			queue_push_tail(central->ccc_states, ccc);
+
+			seed = seed * 1103515245 + 12345;
+			if ((seed >> 16) % 4)
+				continue;
+
+			ccc->value = (seed >> 8) & 1 ? 0x0001 : 0x0002;
+			gatt_subscribers_add(test.subs, ccc->handle, ccc);
+			test.subscribed++;
+		}
+	}
+
+	scan_ns = fanout_run(&test, false);
+	g_assert(test.delivered == test.subscribed * NOTIFY_ROUNDS);
+
+	index_ns = fanout_run(&test, true);
+	g_assert(test.delivered == test.subscribed * NOTIFY_ROUNDS);
+
+	tester_debug("%u centrals, %u CCCs, %u subscribed: %u notifications "
+			"scanning %" PRIu64 " us, indexed %" PRIu64 " us",
+			num_centrals, NUM_CCCS, test.subscribed,
+			test.delivered, scan_ns / 1000, index_ns / 1000);
+
+	gatt_subscribers_free(test.subs);
+	queue_destroy(test.centrals, central_free);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/gatt-subscribers/basic", NULL, NULL, test_basic, NULL);
+	tester_add("/gatt-subscribers/fan-out/100", UINT_TO_PTR(100), NULL,
+							test_fanout, NULL);
+	tester_add("/gatt-subscribers/fan-out/500", UINT_TO_PTR(500), NULL,
+							test_fanout, NULL);
+
+	return tester_run();
+}
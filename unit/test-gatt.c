@@ -18,6 +18,7 @@
 #include <inttypes.h>
 #include <string.h>
 #include <fcntl.h>
+#include <time.h>
 #include <sys/socket.h>
 
 #include <glib.h>
@@ -25,6 +26,8 @@
 #include "lib/bluetooth.h"
 #include "lib/uuid.h"
 #include "src/shared/util.h"
+#include "src/shared/io.h"
+#include "src/shared/timeout.h"
 #include "src/shared/att.h"
 #include "src/shared/gatt-helpers.h"
 #include "src/shared/queue.h"
@@ -2412,6 +2415,346 @@ static void test_hash_db(gconstpointer data)
 	context_quit(context);
 }
 
+static void count_attr(struct gatt_db_attribute *attrib, void *user_data)
+{
+	unsigned int *count = user_data;
+
+	(*count)++;
+}
+
+static void test_large_db_lookup(gconstpointer data)
+{
+	struct gatt_db *db;
+	struct timespec start, end;
+	unsigned int handle, found = 0, count = 0;
+	uint64_t elapsed;
+	bt_uuid_t uuid;
+
+	db = gatt_db_new();
+
+	/* Fill the whole handle space with 16 handle services */
+	while (1) {
+		struct gatt_db_attribute *attrib;
+		int i;
+
+		bt_uuid16_create(&uuid, 0x1800 + (count++ % 64));
+
+		attrib = gatt_db_add_service(db, &uuid, true, 16);
+		if (!attrib)
+			break;
+
+		bt_uuid16_create(&uuid, 0x2a00);
+
+		for (i = 0; i < 7; i++)
+			gatt_db_service_add_characteristic(attrib, &uuid,
+							BT_ATT_PERM_READ,
+							BT_GATT_CHRC_PROP_READ,
+							NULL, NULL, NULL);
+
+		gatt_db_service_set_active(attrib, true);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (handle = 1; handle <= UINT16_MAX; handle++) {
+		struct gatt_db_attribute *attrib;
+
+		attrib = gatt_db_get_attribute(db, handle);
+		if (!attrib)
+			continue;
+
+		g_assert_cmpint(gatt_db_attribute_get_handle(attrib), ==,
+								handle);
+		found++;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	elapsed = (end.tv_sec - start.tv_sec) * 1000000000ULL +
+					end.tv_nsec - start.tv_nsec;
+
+	tester_debug("%u services, %u attributes: %" PRIu64 " ns/lookup",
+				count - 1, found, elapsed / UINT16_MAX);
+
+	/* Service declaration, 7 declarations and 7 values per service */
+	g_assert_cmpint(found, ==, (count - 1) * 15);
+
+	count = 0;
+	bt_uuid16_create(&uuid, 0x2a00);
+	gatt_db_foreach_in_range(db, &uuid, count_attr, &count, 0x8000,
+								0x80ff);
+	g_assert_cmpint(count, ==, 16 * 7);
+
+	gatt_db_clear_range(db, 0x8000, 0x80ff);
+	g_assert(!gatt_db_get_attribute(db, 0x8001));
+	g_assert(gatt_db_get_attribute(db, 0x8101));
+
+	gatt_db_unref(db);
+
+	tester_test_passed();
+}
+
+#define EATT_MAX_CHANS	4
+#define EATT_READS	64
+
+struct eatt_test;
+
+struct eatt_peer {
+	struct eatt_test *test;
+	struct io *io;
+	bool busy;
+	unsigned int reqs;
+};
+
+struct eatt_test {
+	struct bt_att *att;
+	struct eatt_peer peers[EATT_MAX_CHANS + 1];
+	unsigned int num_chans;
+	unsigned int completed;
+	struct eatt_peer *first;
+	struct timespec start;
+};
+
+static bool eatt_peer_respond(void *user_data)
+{
+	struct eatt_peer *peer = user_data;
+	const uint8_t rsp[] = { BT_ATT_OP_READ_RSP, 0x01, 0x02 };
+	ssize_t len;
+
+	len = write(io_get_fd(peer->io), rsp, sizeof(rsp));
+	g_assert_cmpint(len, ==, sizeof(rsp));
+
+	peer->busy = false;
+
+	return false;
+}
+
+static bool eatt_peer_read(struct io *io, void *user_data)
+{
+	struct eatt_peer *peer = user_data;
+	uint8_t buf[64];
+	ssize_t len;
+
+	len = read(io_get_fd(io), buf, sizeof(buf));
+	if (len <= 0)
+		return false;
+
+	g_assert_cmpint(len, ==, 3);
+	g_assert_cmpint(buf[0], ==, BT_ATT_OP_READ_REQ);
+
+	/* A channel must never have more than one request outstanding */
+	g_assert(!peer->busy);
+	peer->busy = true;
+	peer->reqs++;
+
+	if (!peer->test->first)
+		peer->test->first = peer;
+
+	/* Give each response some latency, as a remote would */
+	timeout_add(1, eatt_peer_respond, peer, NULL);
+
+	return true;
+}
+
+static bool eatt_test_complete(void *user_data)
+{
+	struct eatt_test *test = user_data;
+	struct bt_att_chan_stats stats;
+	struct timespec end;
+	uint64_t elapsed, total = 0;
+	unsigned int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	elapsed = (end.tv_sec - test->start.tv_sec) * 1000000000ULL +
+				end.tv_nsec - test->start.tv_nsec;
+
+	tester_debug("%u channel(s): %u reads in %" PRIu64 " us",
+				test->num_chans, EATT_READS, elapsed / 1000);
+
+	g_assert_cmpint(bt_att_get_channels(test->att), ==, test->num_chans);
+
+	/* Channels are reported with the last attached one first */
+	for (i = 0; i < test->num_chans; i++) {
+		struct eatt_peer *peer = &test->peers[test->num_chans - i - 1];
+
+		g_assert(bt_att_get_chan_stats(test->att, i, &stats));
+
+		tester_debug("chan %u: type %u mtu %u tx %" PRIu64 "/%"
+				PRIu64 " rx %" PRIu64 "/%" PRIu64, i,
+				stats.type, stats.mtu, stats.tx_pdus,
+				stats.tx_bytes, stats.rx_pdus, stats.rx_bytes);
+
+		g_assert_cmpint(stats.tx_pdus, ==, peer->reqs);
+		g_assert_cmpint(stats.rx_pdus, ==, peer->reqs);
+		g_assert_cmpint(stats.tx_bytes, ==, peer->reqs * 3);
+		g_assert_cmpint(stats.queued, ==, 0);
+		g_assert_cmpint(stats.in_flight, ==, 0);
+
+		/* Requests are spread evenly over the channels */
+		g_assert_cmpint(peer->reqs, >=,
+					EATT_READS / test->num_chans / 2);
+
+		total += stats.tx_pdus;
+	}
+
+	g_assert_cmpint(total, ==, EATT_READS);
+	g_assert(!bt_att_get_chan_stats(test->att, i, &stats));
+
+	/* Idle channels with the bigger MTU are preferred */
+	g_assert(test->first == &test->peers[0]);
+
+	bt_att_unref(test->att);
+
+	for (i = 0; i < test->num_chans; i++)
+		io_destroy(test->peers[i].io);
+
+	g_free(test);
+
+	tester_test_passed();
+
+	return false;
+}
+
+static void eatt_read_cb(uint8_t opcode, const void *pdu, uint16_t length,
+							void *user_data)
+{
+	struct eatt_test *test = user_data;
+
+	g_assert_cmpint(opcode, ==, BT_ATT_OP_READ_RSP);
+	g_assert_cmpint(length, ==, 2);
+
+	if (++test->completed == EATT_READS)
+		timeout_add(1, eatt_test_complete, test, NULL);
+}
+
+static void test_eatt_scheduler(gconstpointer data)
+{
+	struct eatt_test *test = g_new0(struct eatt_test, 1);
+	unsigned int i;
+	int sv[2];
+
+	test->num_chans = PTR_TO_UINT(data);
+
+	for (i = 0; i < test->num_chans; i++) {
+		struct eatt_peer *peer = &test->peers[i];
+		int err;
+
+		err = socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0,
+									sv);
+		g_assert(err == 0);
+
+		if (!i) {
+			test->att = bt_att_new(sv[0], false);
+			g_assert(test->att);
+			bt_att_set_close_on_unref(test->att, true);
+		} else {
+			g_assert(bt_att_attach_fd(test->att, sv[0]) == 0);
+		}
+
+		peer->test = test;
+		peer->io = io_new(sv[1]);
+		g_assert(peer->io);
+
+		io_set_close_on_destroy(peer->io, true);
+		io_set_read_handler(peer->io, eatt_peer_read, peer, NULL);
+	}
+
+	/* Bump the fixed channel MTU over the EATT default */
+	g_assert(bt_att_set_mtu(test->att, 64));
+
+	clock_gettime(CLOCK_MONOTONIC, &test->start);
+
+	for (i = 0; i < EATT_READS; i++) {
+		uint8_t pdu[2];
+
+		put_le16(0x0003 + i, pdu);
+
+		g_assert(bt_att_send(test->att, BT_ATT_OP_READ_REQ, pdu,
+						sizeof(pdu), eatt_read_cb,
+						test, NULL));
+	}
+}
+
+#define BATCH_NOTIFICATIONS	32
+#define BATCH_BUDGET		8
+
+struct batch_test {
+	struct bt_att *att;
+	struct io *peer;
+	unsigned int received;
+};
+
+static bool batch_peer_read(struct io *io, void *user_data)
+{
+	struct batch_test *test = user_data;
+	struct bt_att_chan_stats stats;
+	uint8_t buf[32];
+	ssize_t len;
+
+	len = read(io_get_fd(io), buf, sizeof(buf));
+	if (len <= 0)
+		return false;
+
+	/* Batched PDUs must still arrive one per packet, in order */
+	g_assert_cmpint(len, ==, 5);
+	g_assert_cmpint(buf[0], ==, BT_ATT_OP_HANDLE_NFY);
+	g_assert_cmpint(get_le16(buf + 3), ==, test->received);
+
+	if (++test->received < BATCH_NOTIFICATIONS)
+		return true;
+
+	g_assert(bt_att_get_chan_stats(test->att, 0, &stats));
+
+	tester_debug("%" PRIu64 " PDUs in %" PRIu64 " wakeups, max %u",
+				stats.tx_pdus, stats.tx_wakeups,
+				stats.tx_batch_max);
+
+	g_assert_cmpint(stats.tx_pdus, ==, BATCH_NOTIFICATIONS);
+	g_assert_cmpint(stats.tx_wakeups, ==,
+					BATCH_NOTIFICATIONS / BATCH_BUDGET);
+	g_assert_cmpint(stats.tx_batch_max, ==, BATCH_BUDGET);
+
+	bt_att_unref(test->att);
+	io_destroy(test->peer);
+	g_free(test);
+
+	tester_test_passed();
+
+	return false;
+}
+
+static void test_att_write_batch(gconstpointer data)
+{
+	struct batch_test *test = g_new0(struct batch_test, 1);
+	unsigned int i;
+	int sv[2];
+
+	g_assert(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0,
+								sv) == 0);
+
+	test->att = bt_att_new(sv[0], false);
+	g_assert(test->att);
+	bt_att_set_close_on_unref(test->att, true);
+
+	g_assert(!bt_att_set_write_budget(test->att, 0));
+	g_assert(bt_att_set_write_budget(test->att, BATCH_BUDGET));
+
+	test->peer = io_new(sv[1]);
+	io_set_close_on_destroy(test->peer, true);
+	io_set_read_handler(test->peer, batch_peer_read, test, NULL);
+
+	for (i = 0; i < BATCH_NOTIFICATIONS; i++) {
+		uint8_t pdu[4];
+
+		put_le16(0x0003, pdu);
+		put_le16(i, pdu + 2);
+
+		g_assert(bt_att_send(test->att, BT_ATT_OP_HANDLE_NFY, pdu,
+						sizeof(pdu), NULL, NULL, NULL));
+	}
+}
+
 int main(int argc, char *argv[])
 {
 	struct gatt_db *service_db_1, *service_db_2, *service_db_3;
@@ -4559,5 +4902,14 @@ int main(int argc, char *argv[])
 			test_hash_db, ts_tail_db, NULL,
 			{});
 
+	tester_add("/robustness/large-db-lookup", NULL, NULL,
+						test_large_db_lookup, NULL);
+	tester_add("/robustness/eatt-scheduler/1", UINT_TO_PTR(1), NULL,
+						test_eatt_scheduler, NULL);
+	tester_add("/robustness/eatt-scheduler/4", UINT_TO_PTR(EATT_MAX_CHANS),
+					NULL, test_eatt_scheduler, NULL);
+	tester_add("/robustness/att-write-batch", NULL, NULL,
+						test_att_write_batch, NULL);
+
 	return tester_run();
 }
@@ -0,0 +1,408 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+
+#include <glib.h>
+
+#include "src/shared/tester.h"
+
+/*
+ * The tester itself runs on the GLib mainloop, so the epoll mainloop under
+ * test is built into this file with its entry points renamed. Each test
+ * case runs it to completion before reporting its result.
+ */
+#define mainloop_init		epoll_mainloop_init
+#define mainloop_quit		epoll_mainloop_quit
+#define mainloop_exit_success	epoll_mainloop_exit_success
+#define mainloop_exit_failure	epoll_mainloop_exit_failure
+#define mainloop_run		epoll_mainloop_run
+#define mainloop_add_fd		epoll_mainloop_add_fd
+#define mainloop_modify_fd	epoll_mainloop_modify_fd
+#define mainloop_remove_fd	epoll_mainloop_remove_fd
+#define mainloop_add_timeout	epoll_mainloop_add_timeout
+#define mainloop_modify_timeout	epoll_mainloop_modify_timeout
+#define mainloop_remove_timeout	epoll_mainloop_remove_timeout
+
+#include "src/shared/mainloop.c"
+
+#define MAX_FDS		4096
+#define ROUNDS		16
+
+#define MAX_TIMEOUTS	10000
+#define FIRE_TIMEOUTS	100
+#define REARM_COUNT	3
+
+struct test_data {
+	int fds[MAX_FDS];
+	unsigned int num_fds;
+	unsigned int pending;
+	unsigned int round;
+	unsigned long long dispatched;
+	int max_fd;
+	unsigned int fired;
+	unsigned int last_msec;
+	unsigned int rearmed;
+};
+
+static struct test_data test;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void trigger_all(void)
+{
+	uint64_t val = 1;
+	unsigned int i;
+
+	for (i = 0; i < test.num_fds; i++) {
+		if (write(test.fds[i], &val, sizeof(val)) != sizeof(val)) {
+			tester_warn("Failed to trigger fd %d",
+								test.fds[i]);
+			mainloop_exit_failure();
+			return;
+		}
+	}
+
+	test.pending = test.num_fds;
+}
+
+static void event_callback(int fd, uint32_t events, void *user_data)
+{
+	uint64_t val;
+
+	if (read(fd, &val, sizeof(val)) != sizeof(val)) {
+		tester_warn("Failed to read fd %d", fd);
+		mainloop_exit_failure();
+		return;
+	}
+
+	test.dispatched++;
+
+	if (--test.pending)
+		return;
+
+	if (++test.round < ROUNDS) {
+		trigger_all();
+		return;
+	}
+
+	mainloop_exit_success();
+}
+
+static unsigned int max_test_fds(void)
+{
+	struct rlimit rlim;
+
+	if (getrlimit(RLIMIT_NOFILE, &rlim) < 0)
+		return 256;
+
+	/* Leave some room for stdio and the epoll descriptor itself */
+	if (rlim.rlim_cur < 64 + MAX_FDS)
+		return rlim.rlim_cur > 320 ? rlim.rlim_cur - 64 : 256;
+
+	return MAX_FDS;
+}
+
+static void test_fds(const void *data)
+{
+	unsigned int i, count;
+	uint64_t start, end;
+
+	memset(&test, 0, sizeof(test));
+
+	count = max_test_fds();
+
+	mainloop_init();
+
+	for (i = 0; i < count; i++) {
+		int fd;
+
+		fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fd < 0)
+			break;
+
+		if (mainloop_add_fd(fd, EPOLLIN, event_callback,
+							NULL, NULL) < 0) {
+			tester_warn("Failed to add fd %d", fd);
+			close(fd);
+			goto failed;
+		}
+
+		test.fds[test.num_fds++] = fd;
+
+		if (fd > test.max_fd)
+			test.max_fd = fd;
+	}
+
+	/* The handler table used to be limited to 128 descriptors */
+	if (test.max_fd < 128) {
+		tester_warn("Only reached fd %d", test.max_fd);
+		goto failed;
+	}
+
+	trigger_all();
+
+	start = now_ns();
+
+	if (mainloop_run() != EXIT_SUCCESS)
+		goto failed;
+
+	end = now_ns();
+
+	if (test.dispatched != (unsigned long long) test.num_fds * ROUNDS) {
+		tester_warn("Dispatched %llu of %u events",
+				test.dispatched, test.num_fds * ROUNDS);
+		goto failed;
+	}
+
+	tester_debug("%u fds (max %d), %llu events in %llu us (%llu ns/event)",
+			test.num_fds, test.max_fd, test.dispatched,
+			(unsigned long long) (end - start) / 1000,
+			(unsigned long long) (end - start) / test.dispatched);
+
+	for (i = 0; i < test.num_fds; i++)
+		close(test.fds[i]);
+
+	tester_test_passed();
+	return;
+
+failed:
+	for (i = 0; i < test.num_fds; i++)
+		close(test.fds[i]);
+
+	tester_test_failed();
+}
+
+static void unused_timeout(int id, void *user_data)
+{
+	tester_warn("Cancelled timeout %d fired", id);
+	mainloop_exit_failure();
+}
+
+static void order_timeout(int id, void *user_data)
+{
+	unsigned int msec = (uintptr_t) user_data;
+
+	if (msec < test.last_msec) {
+		tester_warn("Timeout %u ms fired after %u ms",
+						msec, test.last_msec);
+		mainloop_exit_failure();
+		return;
+	}
+
+	test.last_msec = msec;
+	mainloop_remove_timeout(id);
+
+	if (++test.fired == FIRE_TIMEOUTS && test.rearmed == REARM_COUNT)
+		mainloop_exit_success();
+}
+
+static void rearm_timeout(int id, void *user_data)
+{
+	if (++test.rearmed < REARM_COUNT) {
+		mainloop_modify_timeout(id, 1);
+		return;
+	}
+
+	mainloop_remove_timeout(id);
+
+	if (test.fired == FIRE_TIMEOUTS)
+		mainloop_exit_success();
+}
+
+/*
+ * Approximates what every timeout used to cost: a timerfd of its own that
+ * is armed, registered with epoll, unregistered and closed again.
+ */
+static uint64_t legacy_arm_cancel(unsigned int count)
+{
+	struct itimerspec itimer;
+	uint64_t start;
+	unsigned int i;
+	int efd;
+
+	efd = epoll_create1(EPOLL_CLOEXEC);
+	if (efd < 0)
+		return 0;
+
+	memset(&itimer, 0, sizeof(itimer));
+	itimer.it_value.tv_sec = 60;
+
+	start = now_ns();
+
+	for (i = 0; i < count; i++) {
+		struct epoll_event ev = { .events = EPOLLIN | EPOLLONESHOT };
+		int fd;
+
+		fd = timerfd_create(CLOCK_MONOTONIC,
+						TFD_NONBLOCK | TFD_CLOEXEC);
+		if (fd < 0)
+			break;
+
+		timerfd_settime(fd, 0, &itimer, NULL);
+		epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev);
+		epoll_ctl(efd, EPOLL_CTL_DEL, fd, NULL);
+		close(fd);
+	}
+
+	close(efd);
+
+	return now_ns() - start;
+}
+
+static void test_timeouts(const void *data)
+{
+	static int ids[MAX_TIMEOUTS];
+	uint64_t start, end, legacy;
+	unsigned int i;
+
+	memset(&test, 0, sizeof(test));
+
+	mainloop_init();
+
+	start = now_ns();
+
+	for (i = 0; i < MAX_TIMEOUTS; i++) {
+		ids[i] = mainloop_add_timeout(60000 + i, unused_timeout,
+								NULL, NULL);
+		if (ids[i] <= 0) {
+			tester_warn("Failed to add timeout %u", i);
+			tester_test_failed();
+			return;
+		}
+	}
+
+	for (i = 0; i < MAX_TIMEOUTS; i++)
+		mainloop_remove_timeout(ids[MAX_TIMEOUTS - i - 1]);
+
+	end = now_ns();
+
+	legacy = legacy_arm_cancel(MAX_TIMEOUTS);
+
+	tester_debug("%u timeouts armed and cancelled in %llu us "
+			"(%llu ns/timeout, timerfd per timeout %llu ns)",
+			MAX_TIMEOUTS, (unsigned long long) (end - start) / 1000,
+			(unsigned long long) (end - start) / MAX_TIMEOUTS,
+			(unsigned long long) legacy / MAX_TIMEOUTS);
+
+	/* Cancelled timeouts must never fire, pending ones fire in order */
+	ids[0] = mainloop_add_timeout(1, unused_timeout, NULL, NULL);
+
+	for (i = 0; i < FIRE_TIMEOUTS; i++) {
+		unsigned int msec = 1 + (i * 37) % 50;
+
+		mainloop_add_timeout(msec, order_timeout,
+					(void *) (uintptr_t) msec, NULL);
+	}
+
+	mainloop_add_timeout(1, rearm_timeout, NULL, NULL);
+
+	mainloop_remove_timeout(ids[0]);
+
+	if (mainloop_run() != EXIT_SUCCESS) {
+		tester_test_failed();
+		return;
+	}
+
+	tester_test_passed();
+}
+
+static int reuse_fds[2];
+
+static void reused_callback(int fd, uint32_t events, void *user_data)
+{
+	tester_warn("Stale event delivered to reused fd %d", fd);
+	mainloop_exit_failure();
+}
+
+static void reuse_callback(int fd, uint32_t events, void *user_data)
+{
+	int other = reuse_fds[reuse_fds[0] == fd];
+	int new_fd;
+
+	if (other < 0)
+		return;
+
+	/* Recycle the other descriptor before its pending event is seen */
+	mainloop_remove_fd(other);
+	close(other);
+
+	new_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (new_fd != other) {
+		tester_warn("Got fd %d instead of %d", new_fd, other);
+		mainloop_exit_failure();
+		return;
+	}
+
+	reuse_fds[reuse_fds[0] != fd] = -1;
+	mainloop_add_fd(new_fd, EPOLLIN, reused_callback, NULL, NULL);
+}
+
+static void reuse_done(int id, void *user_data)
+{
+	mainloop_exit_success();
+}
+
+static void test_reuse(const void *data)
+{
+	uint64_t val = 1;
+	int i;
+
+	mainloop_init();
+
+	for (i = 0; i < 2; i++) {
+		reuse_fds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		mainloop_add_fd(reuse_fds[i], EPOLLIN, reuse_callback,
+								NULL, NULL);
+
+		g_assert(write(reuse_fds[i], &val, sizeof(val)) ==
+								sizeof(val));
+	}
+
+	mainloop_add_timeout(10, reuse_done, NULL, NULL);
+
+	if (mainloop_run() != EXIT_SUCCESS) {
+		tester_test_failed();
+		return;
+	}
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/mainloop/fds", NULL, NULL, test_fds, NULL);
+	tester_add("/mainloop/reuse", NULL, NULL, test_reuse, NULL);
+	tester_add("/mainloop/timeouts", NULL, NULL, test_timeouts, NULL);
+
+	return tester_run();
+}
@@ -0,0 +1,188 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mesh/mesh-io-mgmt.c"
+
+#define NOW_DUE		0
+#define LATER_DUE	1000
+
+struct sched_test {
+	const char *name;
+	uint8_t num_slots;
+	uint8_t busy;
+	int poll_rsp_due;
+	unsigned int num_general;
+	uint8_t expect_busy;
+	bool expect_poll_rsp_sent;
+};
+
+static unsigned int mesh_sends;
+
+unsigned int mesh_mgmt_send(uint16_t opcode, uint16_t index,
+				uint16_t length, const void *param,
+				mgmt_request_func_t callback,
+				void *user_data, mgmt_destroy_func_t destroy)
+{
+	if (opcode == MGMT_OP_MESH_SEND)
+		mesh_sends++;
+
+	return 1;
+}
+
+unsigned int mesh_mgmt_register(uint16_t event, uint16_t index,
+				mgmt_notify_func_t callback,
+				void *user_data, mgmt_destroy_func_t destroy)
+{
+	return 1;
+}
+
+bool mesh_mgmt_unregister(unsigned int id)
+{
+	return true;
+}
+
+static struct tx_pkt *queue_pkt(uint8_t type, uint32_t due)
+{
+	struct tx_pkt *tx = l_new(struct tx_pkt, 1);
+
+	tx->info.type = type;
+	tx->info.u.gen.cnt = 1;
+	tx->due = due;
+	tx->queued = due;
+	tx->len = 2;
+	tx->pkt[0] = BT_AD_MESH_DATA;
+	l_queue_insert(pvt->tx_pkts, tx, compare_tx_due, NULL);
+
+	return tx;
+}
+
+static void fill_slots(uint8_t busy, uint32_t now)
+{
+	uint8_t i;
+
+	for (i = 0; i < busy; i++) {
+		pvt->slots[i].busy = true;
+		pvt->slots[i].sent = now;
+		pvt->slots[i].handle = i + 1;
+	}
+
+	pvt->busy = busy;
+}
+
+static void check_schedule(const struct sched_test *test)
+{
+	struct tx_pkt *rsp = NULL;
+	uint32_t now = get_instant();
+	unsigned int i;
+	bool rsp_sent;
+
+	pvt = l_new(struct mesh_io_private, 1);
+	pvt->tx_pkts = l_queue_new();
+	pvt->num_slots = test->num_slots;
+	fill_slots(test->busy, now);
+	mesh_sends = 0;
+
+	if (test->poll_rsp_due >= 0)
+		rsp = queue_pkt(MESH_IO_TIMING_TYPE_POLL_RSP,
+						now + test->poll_rsp_due);
+
+	for (i = 0; i < test->num_general; i++)
+		queue_pkt(MESH_IO_TIMING_TYPE_GENERAL, now - 1);
+
+	tx_schedule(pvt);
+
+	rsp_sent = rsp && !l_queue_find(pvt->tx_pkts, NULL, rsp);
+
+	l_info("%s: %u/%u slots busy, Poll response %s", test->name,
+				pvt->busy, pvt->num_slots,
+				rsp ? (rsp_sent ? "sent" : "held") : "none");
+
+	if (pvt->busy != test->expect_busy ||
+			mesh_sends != test->expect_busy - test->busy ||
+			rsp_sent != test->expect_poll_rsp_sent) {
+		l_error("FAILED: expected %u busy, Poll response %s",
+				test->expect_busy,
+				test->expect_poll_rsp_sent ? "sent" : "held");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < TX_SLOTS_MAX; i++) {
+		if (pvt->slots[i].busy)
+			slot_release(pvt, &pvt->slots[i]);
+	}
+
+	l_timeout_remove(pvt->tx_timeout);
+	l_queue_destroy(pvt->tx_pkts, l_free);
+	l_free(pvt);
+	pvt = NULL;
+}
+
+static const struct sched_test sched_tests[] = {
+	{
+		.name = "General packets use every slot",
+		.num_slots = 3,
+		.poll_rsp_due = -1,
+		.num_general = 5,
+		.expect_busy = 3,
+	},
+	{
+		.name = "Pending Poll response keeps the last slot",
+		.num_slots = 3,
+		.poll_rsp_due = LATER_DUE,
+		.num_general = 5,
+		.expect_busy = 2,
+	},
+	{
+		.name = "Pending Poll response with one slot in use",
+		.num_slots = 3,
+		.busy = 1,
+		.poll_rsp_due = LATER_DUE,
+		.num_general = 5,
+		.expect_busy = 2,
+	},
+	{
+		.name = "Due Poll response goes first",
+		.num_slots = 3,
+		.busy = 2,
+		.poll_rsp_due = NOW_DUE,
+		.num_general = 5,
+		.expect_busy = 3,
+		.expect_poll_rsp_sent = true,
+	},
+	{
+		.name = "Single slot waits for the Poll response",
+		.num_slots = 1,
+		.poll_rsp_due = LATER_DUE,
+		.num_general = 1,
+		.expect_busy = 0,
+	},
+};
+
+int main(int argc, char *argv[])
+{
+	unsigned int i;
+
+	l_log_set_stderr();
+	l_main_init();
+
+	for (i = 0; i < L_ARRAY_SIZE(sched_tests); i++)
+		check_schedule(&sched_tests[i]);
+
+	l_main_exit();
+
+	return 0;
+}
@@ -0,0 +1,251 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "src/shared/util.h"
+#include "src/shared/btsnoop.h"
+#include "src/shared/tester.h"
+#include "monitor/display.h"
+#include "monitor/packet.h"
+
+#define REPLAY_ROUNDS	5000
+
+struct test_pkt {
+	uint16_t opcode;
+	uint16_t len;
+	uint8_t data[64];
+};
+
+#define PKT(_opcode, _args...) \
+	{ \
+		.opcode = _opcode, \
+		.len = sizeof((uint8_t []) { _args }), \
+		.data = { _args }, \
+	}
+
+#define CMD(_args...)		PKT(BTSNOOP_OPCODE_COMMAND_PKT, _args)
+#define EVT(_args...)		PKT(BTSNOOP_OPCODE_EVENT_PKT, _args)
+#define ACL_TX(_args...)	PKT(BTSNOOP_OPCODE_ACL_TX_PKT, _args)
+#define ACL_RX(_args...)	PKT(BTSNOOP_OPCODE_ACL_RX_PKT, _args)
+#define MGMT_CMD(_args...) \
+	PKT(BTSNOOP_OPCODE_CTRL_COMMAND, 0x01, 0x00, 0x00, 0x00, _args)
+#define MGMT_EVT(_args...) \
+	PKT(BTSNOOP_OPCODE_CTRL_EVENT, 0x01, 0x00, 0x00, 0x00, _args)
+
+/* Control channel of bluetoothd, opened once ahead of the replay */
+static const struct test_pkt ctrl_open = PKT(BTSNOOP_OPCODE_CTRL_OPEN,
+	0x01, 0x00, 0x00, 0x00,			/* cookie */
+	0x02, 0x00,				/* mgmt */
+	0x01, 0x16, 0x00,			/* version 1.22 */
+	0x00, 0x00, 0x00, 0x00,			/* flags */
+	0x0c, 'b', 'l', 'u', 'e', 't', 'o', 'o', 't', 'h', 'd', 0x00,
+	0x00);
+
+/*
+ * A discovery, LE connection, GATT discovery and disconnection as seen by
+ * btmon, spread over the command, event, LE meta event and management
+ * tables.
+ */
+static const struct test_pkt session[] = {
+	/* Start Discovery */
+	MGMT_CMD(0x23, 0x00, 0x06),
+	/* LE Set Extended Scan Enable */
+	CMD(0x42, 0x20, 0x06, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00),
+	EVT(0x0e, 0x04, 0x01, 0x42, 0x20, 0x00),
+	MGMT_EVT(0x01, 0x00, 0x23, 0x00, 0x00, 0x06),
+	/* LE Extended Advertising Report */
+	EVT(0x3e, 0x1d, 0x0d, 0x01, 0x13, 0x00, 0x00,
+		0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x01, 0x00, 0xff,
+		0x7f, 0xc0, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x02, 0x01, 0x06),
+	/* Device Found */
+	MGMT_EVT(0x12, 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x01,
+		0xc0, 0x00, 0x00, 0x00, 0x00, 0x03, 0x00, 0x02, 0x01, 0x06),
+	/* LE Create Connection */
+	CMD(0x0d, 0x20, 0x19, 0x60, 0x00, 0x60, 0x00, 0x00, 0x00,
+		0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x00,
+		0x18, 0x00, 0x28, 0x00, 0x00, 0x00, 0x2a, 0x00,
+		0x00, 0x00, 0x00, 0x00),
+	EVT(0x0f, 0x04, 0x00, 0x01, 0x0d, 0x20),
+	/* LE Connection Complete */
+	EVT(0x3e, 0x13, 0x01, 0x00, 0x40, 0x00, 0x00, 0x00,
+		0x11, 0x22, 0x33, 0x44, 0x55, 0x66,
+		0x28, 0x00, 0x00, 0x00, 0x2a, 0x00, 0x00),
+	/* Device Connected */
+	MGMT_EVT(0x0b, 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x01,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00),
+	/* ATT Exchange MTU */
+	ACL_TX(0x40, 0x20, 0x07, 0x00, 0x03, 0x00, 0x04, 0x00,
+		0x02, 0x00, 0x02),
+	ACL_RX(0x40, 0x20, 0x07, 0x00, 0x03, 0x00, 0x04, 0x00,
+		0x03, 0x00, 0x02),
+	/* ATT Read By Group Type */
+	ACL_TX(0x40, 0x20, 0x0b, 0x00, 0x07, 0x00, 0x04, 0x00,
+		0x10, 0x01, 0x00, 0xff, 0xff, 0x00, 0x28),
+	ACL_RX(0x40, 0x20, 0x0c, 0x00, 0x08, 0x00, 0x04, 0x00,
+		0x11, 0x06, 0x01, 0x00, 0x05, 0x00, 0x00, 0x18),
+	/* Number of Completed Packets */
+	EVT(0x13, 0x05, 0x01, 0x40, 0x00, 0x02, 0x00),
+	/* Read RSSI */
+	CMD(0x05, 0x14, 0x02, 0x40, 0x00),
+	EVT(0x0e, 0x07, 0x01, 0x05, 0x14, 0x00, 0x40, 0x00, 0xc5),
+	/* Disconnect */
+	CMD(0x06, 0x04, 0x03, 0x40, 0x00, 0x13),
+	EVT(0x0f, 0x04, 0x00, 0x01, 0x06, 0x04),
+	EVT(0x05, 0x04, 0x00, 0x40, 0x00, 0x16),
+	/* Device Disconnected */
+	MGMT_EVT(0x0c, 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x01,
+		0x02),
+};
+
+static uint64_t elapsed_ns(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t) (now.tv_sec - start->tv_sec) * 1000000000ULL +
+						now.tv_nsec - start->tv_nsec;
+}
+
+static void write_pkt(struct btsnoop *snoop, struct timeval *tv,
+						const struct test_pkt *pkt)
+{
+	tv->tv_usec += 250;
+	if (tv->tv_usec >= 1000000) {
+		tv->tv_sec++;
+		tv->tv_usec -= 1000000;
+	}
+
+	g_assert(btsnoop_write_hci(snoop, tv, 0, pkt->opcode, 0, pkt->data,
+								pkt->len));
+}
+
+static void create_capture(const char *path, unsigned int rounds)
+{
+	struct btsnoop_opcode_new_index ni = {
+		.type = 0x00,
+		.bus = 0x01,
+		.bdaddr = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06 },
+		.name = "hci0",
+	};
+	struct timeval tv = { 1700000000, 0 };
+	struct btsnoop *snoop;
+	unsigned int i, j;
+
+	snoop = btsnoop_create(path, 0, 0, BTSNOOP_FORMAT_MONITOR);
+	g_assert(snoop);
+
+	g_assert(btsnoop_write_hci(snoop, &tv, 0, BTSNOOP_OPCODE_NEW_INDEX, 0,
+							&ni, sizeof(ni)));
+	write_pkt(snoop, &tv, &ctrl_open);
+
+	for (i = 0; i < rounds; i++) {
+		for (j = 0; j < ARRAY_SIZE(session); j++)
+			write_pkt(snoop, &tv, &session[j]);
+	}
+
+	btsnoop_unref(snoop);
+}
+
+/*
+ * Replays a capture the way btmon -r does and reports the decoding rate.
+ * The decoded text goes to /dev/null. With quiet set the text is not
+ * even formatted, the same as for the pre-pass of btmon -j, which leaves
+ * mostly the table lookups and the decoding itself.
+ */
+static void test_replay(gconstpointer data)
+{
+	const bool *quiet = data;
+	unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
+	char path[] = "/tmp/test-monitor-XXXXXX";
+	struct btsnoop *snoop;
+	struct timespec start;
+	struct timeval tv;
+	uint16_t index, opcode, pktlen;
+	uint64_t count = 0, ns;
+	int fd, out_fd;
+
+	fd = mkstemp(path);
+	g_assert(fd >= 0);
+	close(fd);
+
+	create_capture(path, REPLAY_ROUNDS);
+
+	snoop = btsnoop_open(path, 0);
+	g_assert(snoop);
+
+	fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	g_assert(fd >= 0);
+
+	fflush(stdout);
+	out_fd = dup(STDOUT_FILENO);
+	dup2(fd, STDOUT_FILENO);
+	close(fd);
+
+	display_quiet = *quiet;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (btsnoop_read_hci(snoop, &tv, &index, &opcode, buf, &pktlen)) {
+		packet_monitor(&tv, NULL, index, opcode, buf, pktlen);
+		count++;
+	}
+
+	fflush(stdout);
+	ns = elapsed_ns(&start);
+
+	display_quiet = false;
+
+	dup2(out_fd, STDOUT_FILENO);
+	close(out_fd);
+
+	btsnoop_unref(snoop);
+	unlink(path);
+
+	g_assert_cmpuint(count, ==, 2 + REPLAY_ROUNDS * ARRAY_SIZE(session));
+
+	tester_debug("%" PRIu64 " packets in %" PRIu64 " ms, "
+				"%" PRIu64 " packets/s", count, ns / 1000000,
+				ns ? count * 1000000000 / ns : 0);
+
+	tester_test_passed();
+}
+
+static const bool verbose = false;
+static const bool quiet = true;
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	packet_set_filter(PACKET_FILTER_SHOW_ACL_DATA |
+					PACKET_FILTER_SHOW_MGMT_SOCKET);
+
+	tester_add("/monitor/replay", &verbose, NULL, test_replay, NULL);
+	tester_add("/monitor/replay/quiet", &quiet, NULL, test_replay, NULL);
+
+	return tester_run();
+}
@@ -0,0 +1,273 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "gobex/gobex.h"
+
+#include "obexd/src/obexd.h"
+#include "obexd/src/plugin.h"
+#include "obexd/src/obex.h"
+#include "obexd/src/server.h"
+#include "obexd/src/service.h"
+
+#include "util.h"
+
+/* Two full buffers of the filesystem driver and a partial one */
+#define PUT_SIZE	(150 * 1024 + 123)
+#define PUT_COUNT	2
+
+extern const struct obex_plugin_desc __obex_builtin_filesystem;
+
+struct put_data {
+	GMainLoop *mainloop;
+	GError *err;
+	GObex *obex;
+	unsigned int num;
+	gsize sent;
+	unsigned int resets;
+	gboolean disconnected;
+	guint timer_id;
+};
+
+static char *root_folder;
+static struct put_data *put_data;
+
+const char *obex_option_root_folder(void)
+{
+	return root_folder;
+}
+
+gboolean obex_option_symlinks(void)
+{
+	return FALSE;
+}
+
+static void *put_connect(struct obex_session *os, int *err)
+{
+	*err = 0;
+
+	return put_data;
+}
+
+static int put_chkput(struct obex_session *os, void *user_data)
+{
+	char *path;
+	int err;
+
+	path = g_build_filename(root_folder, obex_get_name(os), NULL);
+	err = obex_put_stream_start(os, path);
+	g_free(path);
+
+	return err;
+}
+
+static int put_put(struct obex_session *os, void *user_data)
+{
+	return 0;
+}
+
+static void put_reset(struct obex_session *os, void *user_data)
+{
+	struct put_data *d = user_data;
+
+	d->resets++;
+}
+
+static void put_disconnect(struct obex_session *os, void *user_data)
+{
+	struct put_data *d = user_data;
+
+	d->disconnected = TRUE;
+	g_main_loop_quit(d->mainloop);
+}
+
+static const struct obex_service_driver put_driver = {
+	.name = "Test PUT server",
+	.service = OBEX_OPP,
+	.connect = put_connect,
+	.put = put_put,
+	.chkput = put_chkput,
+	.disconnect = put_disconnect,
+	.reset = put_reset,
+};
+
+static uint8_t put_byte(unsigned int num, gsize offset)
+{
+	return (offset * 7 + num) & 0xff;
+}
+
+static gssize provide_put(void *buf, gsize len, gpointer user_data)
+{
+	struct put_data *d = user_data;
+	uint8_t *data = buf;
+	gsize i;
+
+	len = MIN(len, PUT_SIZE - d->sent);
+
+	for (i = 0; i < len; i++)
+		data[i] = put_byte(d->num, d->sent + i);
+
+	d->sent += len;
+
+	return len;
+}
+
+static void check_file(unsigned int num)
+{
+	char name[16], *path, *contents;
+	GError *err = NULL;
+	gsize len, i;
+
+	snprintf(name, sizeof(name), "file%u", num);
+	path = g_build_filename(root_folder, name, NULL);
+
+	g_file_get_contents(path, &contents, &len, &err);
+	g_assert_no_error(err);
+	g_assert_cmpuint(len, ==, PUT_SIZE);
+
+	for (i = 0; i < len; i++)
+		g_assert_cmpuint((uint8_t) contents[i], ==, put_byte(num, i));
+
+	g_free(contents);
+	g_free(path);
+}
+
+static void start_put(struct put_data *d);
+
+static void put_complete(GObex *obex, GError *err, gpointer user_data)
+{
+	struct put_data *d = user_data;
+
+	if (err != NULL) {
+		d->err = g_error_copy(err);
+		g_main_loop_quit(d->mainloop);
+		return;
+	}
+
+	/* The session must be done with the object before answering */
+	g_assert_cmpuint(d->resets, ==, d->num + 1);
+
+	if (++d->num < PUT_COUNT) {
+		start_put(d);
+		return;
+	}
+
+	g_main_loop_quit(d->mainloop);
+}
+
+static void start_put(struct put_data *d)
+{
+	char name[16];
+
+	snprintf(name, sizeof(name), "file%u", d->num);
+	d->sent = 0;
+
+	g_obex_put_req(d->obex, provide_put, put_complete, d, &d->err,
+					G_OBEX_HDR_NAME, name,
+					G_OBEX_HDR_INVALID);
+	g_assert_no_error(d->err);
+}
+
+static gboolean put_timeout(gpointer user_data)
+{
+	struct put_data *d = user_data;
+
+	d->timer_id = 0;
+	g_set_error(&d->err, TEST_ERROR, TEST_ERROR_TIMEOUT, "Timed out");
+	g_main_loop_quit(d->mainloop);
+
+	return FALSE;
+}
+
+static void test_put_back_to_back(void)
+{
+	struct put_data d = {};
+	struct obex_server server = {};
+	GIOChannel *io;
+	GError *err = NULL;
+	unsigned int i;
+
+	root_folder = g_dir_make_tmp("test-obexd-XXXXXX", &err);
+	g_assert_no_error(err);
+
+	g_assert_cmpint(__obex_builtin_filesystem.init(), ==, 0);
+
+	server.drivers = g_slist_append(NULL, (void *) &put_driver);
+	put_data = &d;
+
+	create_endpoints(&d.obex, &io, SOCK_STREAM);
+
+	g_assert_cmpint(obex_session_start(io, 4096, 4096, TRUE, &server),
+									==, 0);
+	g_io_channel_unref(io);
+
+	d.mainloop = g_main_loop_new(NULL, FALSE);
+	d.timer_id = g_timeout_add_seconds(5, put_timeout, &d);
+
+	start_put(&d);
+
+	g_main_loop_run(d.mainloop);
+
+	g_assert_no_error(d.err);
+	g_assert_cmpuint(d.num, ==, PUT_COUNT);
+
+	for (i = 0; i < PUT_COUNT; i++)
+		check_file(i);
+
+	/* Hang up and let the session go away */
+	g_obex_unref(d.obex);
+
+	if (!d.disconnected)
+		g_main_loop_run(d.mainloop);
+
+	g_assert_no_error(d.err);
+
+	if (d.timer_id > 0)
+		g_source_remove(d.timer_id);
+
+	g_main_loop_unref(d.mainloop);
+
+	__obex_builtin_filesystem.exit();
+	g_slist_free(server.drivers);
+	put_data = NULL;
+
+	for (i = 0; i < PUT_COUNT; i++) {
+		char name[16], *path;
+
+		snprintf(name, sizeof(name), "file%u", i);
+		path = g_build_filename(root_folder, name, NULL);
+		g_assert_cmpint(unlink(path), ==, 0);
+		g_free(path);
+	}
+
+	g_assert_cmpint(rmdir(root_folder), ==, 0);
+	g_free(root_folder);
+	root_folder = NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/obexd/put_back_to_back", test_put_back_to_back);
+
+	return g_test_run();
+}